@@ -0,0 +1,229 @@
+/*
+ * bench.cpp
+ */
+
+#include "bench.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+
+namespace fst {
+
+void BenchCounters::Add(const std::string &unit, uint64_t n) {
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    if (counts_[i].first == unit) {
+      counts_[i].second += n;
+      return;
+    }
+  }
+  counts_.push_back(std::make_pair(unit, n));
+}
+
+void BenchCounters::Measure(const std::string &name, uint64_t value) {
+  for (size_t i = 0; i < measures_.size(); ++i) {
+    if (measures_[i].first == name) {
+      measures_[i].second = value;
+      return;
+    }
+  }
+  measures_.push_back(std::make_pair(name, value));
+}
+
+bool BenchRunner::Selected(const std::string &name) const {
+  return name.find(filter_) != std::string::npos;
+}
+
+void BenchRunner::Run(const std::string &name, const BenchBody &body, uint64_t max_iterations) {
+  if (!Selected(name))
+    return;
+  BenchCounters counters;
+  double seconds = 0;
+  uint64_t iterations = 1;
+  for (;;) {
+    counters.Clear();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    body(iterations, &counters);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (seconds >= min_seconds_ || (max_iterations && iterations >= max_iterations))
+      break;
+    // Aim past min_seconds from the time so far, but at most 10x at a time
+    double scale = seconds > 0 ? 1.5 * min_seconds_ / seconds : 10;
+    uint64_t next = iterations * (scale < 2 ? 2 : scale > 10 ? 10 : scale);
+    iterations = max_iterations && next > max_iterations ? max_iterations : next;
+  }
+
+  BenchResult result;
+  result.name = prefix_ + name;
+  result.iterations = iterations;
+  result.ns_per_op = seconds * 1e9 / iterations;
+  for (size_t i = 0; i < counters.Counts().size(); ++i) {
+    const std::pair<std::string, uint64_t> &count = counters.Counts()[i];
+    result.rates.push_back(std::make_pair(count.first, seconds > 0 ? count.second / seconds : 0));
+  }
+  result.measures = counters.Measures();
+  std::cerr << std::left << std::setw(40) << result.name << std::right << std::setw(14)
+            << std::fixed << std::setprecision(1) << result.ns_per_op << " ns/op";
+  for (size_t i = 0; i < result.rates.size(); ++i)
+    std::cerr << "  " << std::setprecision(0) << result.rates[i].second << " " << result.rates[i].first << "/s";
+  for (size_t i = 0; i < result.measures.size(); ++i)
+    std::cerr << "  " << result.measures[i].first << " " << result.measures[i].second;
+  std::cerr << std::endl;
+  results_.push_back(result);
+}
+
+void BenchRunner::Skip(const std::string &name, const std::string &why) {
+  if (!Selected(name))
+    return;
+  BenchResult result;
+  result.name = prefix_ + name;
+  result.skipped = why;
+  std::cerr << std::left << std::setw(40) << result.name << " skipped: " << why << std::endl;
+  results_.push_back(result);
+}
+
+namespace {
+
+// Names are ours, but may hold a file name.
+void WriteString(const std::string &s, std::ostream &strm) {
+  strm << '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\')
+      strm << '\\';
+    strm << (s[i] == '\n' ? ' ' : s[i]);
+  }
+  strm << '"';
+}
+
+// The string value of "key": "..." in line, unescaped; false if absent.
+bool FindString(const std::string &line, const std::string &key, std::string *value) {
+  std::string::size_type pos = line.find("\"" + key + "\": \"");
+  if (pos == std::string::npos)
+    return false;
+  value->clear();
+  for (pos += key.size() + 5; pos < line.size() && line[pos] != '"'; ++pos) {
+    if (line[pos] == '\\' && pos + 1 < line.size())
+      ++pos;
+    *value += line[pos];
+  }
+  return pos < line.size();
+}
+
+bool FindNumber(const std::string &line, const std::string &key, double *value) {
+  std::string::size_type pos = line.find("\"" + key + "\": ");
+  if (pos == std::string::npos)
+    return false;
+  const char *begin = line.c_str() + pos + key.size() + 4;
+  char *end;
+  *value = std::strtod(begin, &end);
+  return end != begin;
+}
+
+}  // namespace
+
+void WriteBenchJson(const std::vector<BenchResult> &results, std::ostream &strm) {
+  strm << "{\"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &result = results[i];
+    strm << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+    WriteString(result.name, strm);
+    if (!result.skipped.empty()) {
+      strm << ", \"skipped\": ";
+      WriteString(result.skipped, strm);
+    } else {
+      strm.unsetf(std::ios::floatfield);
+      strm << ", \"iterations\": " << result.iterations << ", \"ns_per_op\": "
+           << std::setprecision(6) << result.ns_per_op;
+      for (size_t j = 0; j < result.rates.size(); ++j)
+        strm << ", \"" << result.rates[j].first << "_per_second\": " << result.rates[j].second;
+      for (size_t j = 0; j < result.measures.size(); ++j)
+        strm << ", \"" << result.measures[j].first << "\": " << result.measures[j].second;
+    }
+    strm << "}";
+  }
+  strm << "]}\n";
+}
+
+bool ReadBenchBaseline(const std::string &filename,
+                       std::vector<std::pair<std::string, double> > *baseline) {
+  std::ifstream strm(filename.c_str());
+  if (!strm)
+    return false;
+  baseline->clear();
+  std::string line, name;
+  double ns;
+  while (std::getline(strm, line)) {
+    if (FindString(line, "name", &name) && FindNumber(line, "ns_per_op", &ns))
+      baseline->push_back(std::make_pair(name, ns));
+  }
+  return true;
+}
+
+size_t CompareToBaseline(const std::vector<BenchResult> &results,
+                         const std::vector<std::pair<std::string, double> > &baseline,
+                         double tolerance, std::ostream &strm) {
+  size_t regressions = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &result = results[i];
+    if (!result.skipped.empty())
+      continue;
+    for (size_t j = 0; j < baseline.size(); ++j) {
+      if (baseline[j].first != result.name || baseline[j].second <= 0)
+        continue;
+      double change = result.ns_per_op / baseline[j].second - 1;
+      bool regressed = change > tolerance;
+      regressions += regressed;
+      strm << std::left << std::setw(40) << result.name << std::right << std::showpos
+           << std::fixed << std::setprecision(1) << std::setw(8) << change * 100 << "%"
+           << std::noshowpos << (regressed ? "  REGRESSION" : "") << std::endl;
+      break;
+    }
+  }
+  return regressions;
+}
+
+void WriteScaleTable(const std::vector<BenchResult> &results,
+                     const std::vector<std::string> &prefixes, std::ostream &strm) {
+  // Rows in the order first seen, each with a value per prefix, if any
+  std::vector<std::pair<std::string, std::vector<double> > > rows;
+  auto set = [&](const std::string &row, size_t column, double value) {
+    size_t i = 0;
+    while (i < rows.size() && rows[i].first != row)
+      ++i;
+    if (i == rows.size())
+      rows.push_back(std::make_pair(row, std::vector<double>(prefixes.size(), -1)));
+    rows[i].second[column] = value;
+  };
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &result = results[i];
+    for (size_t p = 0; p < prefixes.size(); ++p) {
+      if (!result.skipped.empty() || result.name.compare(0, prefixes[p].size(), prefixes[p]) != 0)
+        continue;
+      std::string name = result.name.substr(prefixes[p].size());
+      set(name + " ns/op", p, result.ns_per_op);
+      for (size_t j = 0; j < result.rates.size(); ++j)
+        set(name + " " + result.rates[j].first + "/s", p, result.rates[j].second);
+      for (size_t j = 0; j < result.measures.size(); ++j)
+        set(name + " " + result.measures[j].first, p, result.measures[j].second);
+      break;
+    }
+  }
+
+  strm << std::left << std::setw(44) << "benchmark" << std::right;
+  for (size_t p = 0; p < prefixes.size(); ++p)
+    strm << std::setw(16) << prefixes[p].substr(0, prefixes[p].find_last_not_of('/') + 1);
+  strm << std::endl << std::fixed << std::setprecision(0);
+  for (size_t i = 0; i < rows.size(); ++i) {
+    strm << std::left << std::setw(44) << rows[i].first << std::right;
+    for (size_t p = 0; p < prefixes.size(); ++p) {
+      if (rows[i].second[p] < 0)
+        strm << std::setw(16) << "-";
+      else
+        strm << std::setw(16) << rows[i].second[p];
+    }
+    strm << std::endl;
+  }
+}
+
+}
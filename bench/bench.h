@@ -0,0 +1,120 @@
+/*
+ * bench.h
+ *
+ * A small benchmark harness: timed loops grown until they run long
+ * enough, results as JSON, and a comparison against a stored baseline.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fst {
+
+// Items a benchmark body processed, by unit ("states", "bytes", ...), so
+// that a rate per second can be reported for each.
+class BenchCounters {
+public:
+  void Add(const std::string &unit, uint64_t n);
+  // A size the body measured, such as the bytes of what it built, reported
+  // as it is rather than per second; the last value set is kept.
+  void Measure(const std::string &name, uint64_t value);
+  const std::vector<std::pair<std::string, uint64_t> > &Counts() const { return counts_; }
+  const std::vector<std::pair<std::string, uint64_t> > &Measures() const { return measures_; }
+  void Clear() {
+    counts_.clear();
+    measures_.clear();
+  }
+
+private:
+  std::vector<std::pair<std::string, uint64_t> > counts_;
+  std::vector<std::pair<std::string, uint64_t> > measures_;
+};
+
+// Runs its operation iterations times, counting what it processed.
+typedef std::function<void(uint64_t iterations, BenchCounters *counters)> BenchBody;
+
+struct BenchResult {
+  std::string name;
+  uint64_t iterations;
+  double ns_per_op;
+  std::vector<std::pair<std::string, double> > rates;  // (unit, per second)
+  std::vector<std::pair<std::string, uint64_t> > measures;
+  std::string skipped;  // why it did not run, if it did not
+
+  BenchResult() : iterations(0), ns_per_op(0) {}
+};
+
+// Keeps the compiler from discarding a value a benchmark computes.
+template <class T>
+inline void KeepValue(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+class BenchRunner {
+public:
+  // Benchmarks whose names do not contain filter are left out; each runs
+  // for at least min_seconds.
+  BenchRunner(const std::string &filter, double min_seconds)
+          : filter_(filter), min_seconds_(min_seconds) {}
+
+  // Prepended to the names of the results from here on, e.g. "x10/" for
+  // the benchmarks of one of several models; the filter still sees the
+  // names without it.
+  void SetPrefix(const std::string &prefix) { prefix_ = prefix; }
+
+  // Runs body, doubling its iterations until one run takes min_seconds,
+  // and reports on that run. max_iterations, unless 0, caps the doubling,
+  // for bodies too slow to repeat much, such as loading a whole model.
+  void Run(const std::string &name, const BenchBody &body, uint64_t max_iterations = 0);
+  // Records that a benchmark could not run, e.g. for want of its inputs.
+  void Skip(const std::string &name, const std::string &why);
+
+  // Whether name passes the filter; setup for a benchmark can be skipped
+  // when none of its names do.
+  bool Selected(const std::string &name) const;
+
+  const std::vector<BenchResult> &Results() const { return results_; }
+
+private:
+  std::string filter_;
+  std::string prefix_;
+  double min_seconds_;
+  std::vector<BenchResult> results_;
+};
+
+// One result per line, so that baselines diff well:
+//
+//   {"benchmarks": [
+//     {"name": n, "iterations": i, "ns_per_op": t, "<unit>_per_second": r, ...,
+//      "<measure>": v, ...},
+//     {"name": n, "skipped": why}]}
+void WriteBenchJson(const std::vector<BenchResult> &results, std::ostream &strm);
+
+// Reads back the (name, ns_per_op) pairs of a file WriteBenchJson wrote;
+// false if it cannot be read.
+bool ReadBenchBaseline(const std::string &filename,
+                       std::vector<std::pair<std::string, double> > *baseline);
+
+// Compares results with baseline, writing a line per benchmark in both to
+// strm, and returns the number slower than the baseline by more than
+// tolerance (0.1 for 10%).
+size_t CompareToBaseline(const std::vector<BenchResult> &results,
+                         const std::vector<std::pair<std::string, double> > &baseline,
+                         double tolerance, std::ostream &strm);
+
+// Tabulates results named "<prefix><benchmark>", one column per prefix
+// and a row for the time, each rate and each measure of every benchmark,
+// so that runs over models of growing size read as a chart.
+void WriteScaleTable(const std::vector<BenchResult> &results,
+                     const std::vector<std::string> &prefixes, std::ostream &strm);
+
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,470 @@
+/*
+ * tripoli-bench.cpp
+ *
+ * Benchmarks of the load, filter and compose hot paths, written as JSON
+ * and optionally compared against a baseline (see the bench target in the
+ * Makefile).
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <sstream>
+#include <sys/stat.h>
+
+#include <fst/arcsort.h>
+#include <fst/util.h>
+
+#include "batch.h"
+#include "bench.h"
+#include "model.h"
+#include "readers.h"
+#include "session.h"
+#include "states.h"
+#include "stats.h"
+#include "tripoli-compile.h"
+
+DEFINE_string(json, "", "Write the results as JSON to this file");
+DEFINE_string(baseline, "", "Compare the results with this JSON file from an earlier run");
+DEFINE_double(tolerance, 0.10, "Slowdown against the baseline reported as a regression");
+DEFINE_string(filter, "", "Run only the benchmarks whose names contain this");
+DEFINE_double(min_time, 0.5, "Seconds each benchmark runs for at least");
+DEFINE_string(data, "data", "Directory of the model's text inputs and input.txt, or several, "
+              "comma-separated, to tabulate side by side (see tripoli-generate)");
+
+using namespace fst;
+
+namespace {
+
+typedef TripoliFilterState<> FilterState;
+typedef ParenMatcher<VectorFst<TripoliArc> > InputMatcher;
+typedef LinearMatcher<LinearFst<TripoliArc> > LinearInputMatcher;
+
+const size_t kQueries = 4096;  // per pass of the query benchmarks
+
+bool Exists(const string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0;
+}
+
+// The comma-separated fields of s.
+vector<string> Split(const string &s) {
+  vector<string> fields;
+  std::istringstream strm(s);
+  string field;
+  while (std::getline(strm, field, ','))
+    fields.push_back(field);
+  return fields;
+}
+
+uint64_t FileSize(const string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// The text inputs of a model under one directory, by the names the
+// Makefile uses.
+struct ModelFiles {
+  explicit ModelFiles(const string &dir)
+          : pdt(dir + "/pdt.txt"), labels(dir + "/arc-labels.txt"),
+            symbols(dir + "/grammar-symbols.txt"), rules(dir + "/rules.txt"),
+            states(dir + "/states.txt"), parens(dir + "/parens.txt"), input(dir + "/input.txt") {}
+
+  // The first of files that is missing, or "" if none is.
+  static string Missing(std::initializer_list<string> files) {
+    for (const string &file : files) {
+      if (!Exists(file))
+        return "no " + file;
+    }
+    return "";
+  }
+
+  string pdt, labels, symbols, rules, states, parens, input;
+};
+
+void BenchGrammar(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("grammar/"))
+    return;
+  string missing = ModelFiles::Missing({files.symbols, files.rules, files.labels});
+  if (!missing.empty()) {
+    runner->Skip("grammar/SymbolCanReach", missing);
+    runner->Skip("grammar/RuleCanReach", missing);
+    return;
+  }
+  std::unique_ptr<Grammar> grammar(ReadGrammar(files.symbols, files.rules, files.labels));
+  std::mt19937 rng(1);
+  vector<pair<Symbol, Symbol> > symbol_queries, rule_queries;
+  std::uniform_int_distribution<Symbol> term(1, grammar->MaxTerm());
+  std::uniform_int_distribution<Symbol> nonterm(grammar->MaxPreterm() + 1, grammar->MaxNonterm());
+  std::uniform_int_distribution<Symbol> rule(1, grammar->RuleReach().Cols() - 1);
+  for (size_t i = 0; i < kQueries; ++i) {
+    symbol_queries.push_back(make_pair(nonterm(rng), term(rng)));
+    rule_queries.push_back(make_pair(rule(rng), term(rng)));
+  }
+
+  runner->Run("grammar/SymbolCanReach", [&](uint64_t n, BenchCounters *counters) {
+    size_t reached = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      const pair<Symbol, Symbol> &q = symbol_queries[i % kQueries];
+      reached += grammar->SymbolCanReach(q.first, q.second);
+    }
+    KeepValue(reached);
+    counters->Add("queries", n);
+  });
+  runner->Run("grammar/RuleCanReach", [&](uint64_t n, BenchCounters *counters) {
+    size_t reached = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      const pair<Symbol, Symbol> &q = rule_queries[i % kQueries];
+      reached += grammar->RuleCanReach(q.first, q.second);
+    }
+    KeepValue(reached);
+    counters->Add("queries", n);
+  });
+}
+
+void BenchFilterState(BenchRunner *runner) {
+  if (!runner->Selected("filter_state/"))
+    return;
+  // States as the filter makes them: up to three backoffs of each kind
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<int> id(0, 1 << 20);
+  vector<FilterState> states;
+  for (size_t i = 0; i < kQueries; ++i) {
+    FilterState f;
+    for (int j = rng() % 4; j > 0; --j)
+      f = f.GenerateAddState(id(rng), id(rng));
+    for (int j = rng() % 4; j > 0; --j)
+      f = f.GenerateAddLabel(id(rng), id(rng));
+    states.push_back(f);
+  }
+  // Every other one is compared with a copy, the rest with a neighbour
+  vector<FilterState> others(states);
+  for (size_t i = 1; i < others.size(); i += 2)
+    others[i] = states[i - 1];
+
+  runner->Run("filter_state/Hash", [&](uint64_t n, BenchCounters *counters) {
+    size_t hash = 0;
+    for (uint64_t i = 0; i < n; ++i)
+      hash ^= FilterStateHash()(states[i % kQueries]);
+    KeepValue(hash);
+    counters->Add("states", n);
+  });
+  runner->Run("filter_state/Equals", [&](uint64_t n, BenchCounters *counters) {
+    size_t equal = 0;
+    for (uint64_t i = 0; i < n; ++i)
+      equal += states[i % kQueries] == others[i % kQueries];
+    KeepValue(equal);
+    counters->Add("states", n);
+  });
+  runner->Run("filter_state/GenerateAddState", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      FilterState f = states[i % kQueries].GenerateAddState(i, i, kNoBackoffChain);
+      KeepValue(f);
+    }
+    counters->Add("states", n);
+  });
+  runner->Run("filter_state/GenerateAddLabel", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      FilterState f = states[i % kQueries].GenerateAddLabel(i, i);
+      KeepValue(f);
+    }
+    counters->Add("states", n);
+  });
+}
+
+// Each reader over its file of the sample model, by bytes read.
+void BenchReaders(const ModelFiles &files, BenchRunner *runner) {
+  struct Reader {
+    const char *name;
+    string file;
+    std::function<void()> read;
+  };
+  const Reader readers[] = {
+    {"readers/ReadNumberedStrings", files.labels, [&files]() {
+      vector<string> labels;
+      ReadNumberedStrings(files.labels, &labels);
+      KeepValue(labels);
+    }},
+    {"readers/ReadSymbolFile", files.symbols, [&files]() {
+      Symbol max_term, max_preterm, max_nonterm;
+      ReadSymbolFile(files.symbols, &max_term, &max_preterm, &max_nonterm);
+      KeepValue(max_nonterm);
+    }},
+    {"readers/ReadIntVectors", files.rules, [&files]() {
+      vector<Rule> rules;
+      ReadIntVectors(files.rules, &rules);
+      KeepValue(rules);
+    }},
+    {"readers/ReadLabelPairs", files.parens, [&files]() {
+      vector<ParenPair> parens;
+      ReadLabelPairs(files.parens, &parens, false);
+      KeepValue(parens);
+    }},
+    {"readers/read_states", files.states, [&files]() {
+      vector<StateInfo> states = read_states(files.states);
+      KeepValue(states);
+    }},
+  };
+  for (const Reader &reader : readers) {
+    if (!Exists(reader.file)) {
+      runner->Skip(reader.name, "no " + reader.file);
+      continue;
+    }
+    uint64_t bytes = FileSize(reader.file);
+    runner->Run(reader.name, [&](uint64_t n, BenchCounters *counters) {
+      for (uint64_t i = 0; i < n; ++i)
+        reader.read();
+      counters->Add("bytes", n * bytes);
+    });
+  }
+}
+
+void BenchPDTInfo(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("pdt_info/"))
+    return;
+  string missing = ModelFiles::Missing({files.pdt, files.symbols, files.rules, files.labels,
+                                        files.states});
+  if (!missing.empty()) {
+    runner->Skip("pdt_info/Build", missing);
+    return;
+  }
+  PdtCompiler<TripoliArc> compiler(files.pdt, 0, 0, 0, true, false, false, false);
+  VectorFst<TripoliArc> sorted(compiler.Pdt());
+  ArcSort(&sorted, ILabelCompare<TripoliArc>());
+  TripoliPdt pdt(sorted);
+  std::unique_ptr<Grammar> grammar(ReadGrammar(files.symbols, files.rules, files.labels));
+  vector<StateInfo> state_info = read_states(files.states);
+  runner->Run("pdt_info/Build", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      PDTInfo<TripoliPdt> info(*grammar, pdt, state_info);
+      KeepValue(info);
+    }
+    counters->Add("states", n * pdt.NumStates());
+  });
+}
+
+// Reading and indexing the text inputs, as src/main does without --model,
+// and the size of what that builds.
+void BenchLoad(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("load/"))
+    return;
+  string missing = ModelFiles::Missing({files.pdt, files.labels, files.symbols, files.rules,
+                                        files.states, files.parens});
+  if (!missing.empty()) {
+    runner->Skip("load/ReadText", missing);
+    return;
+  }
+  runner->Run("load/ReadText", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      std::unique_ptr<TripoliModel> model(TripoliModel::ReadText(
+          files.pdt, files.labels, files.symbols, files.rules, files.states, files.parens));
+      StatsReport report;
+      model->ReportMemory(&report);
+      counters->Add("states", model->GetPdt().NumStates());
+      counters->Measure("model_bytes", report.MemoryBytes());
+    }
+  }, 16);
+}
+
+// Setting input.txt up for composition, from text already in memory: as
+// a VectorFst by the AT&T compiler, and as a LinearFst.
+void BenchInput(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("input/"))
+    return;
+  string missing = ModelFiles::Missing({files.input});
+  if (!missing.empty()) {
+    runner->Skip("input/CompileInputFst", missing);
+    runner->Skip("input/CompileLinearInput", missing);
+    return;
+  }
+  std::ifstream file(files.input.c_str());
+  string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  runner->Run("input/CompileInputFst", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      std::istringstream strm(contents);
+      std::unique_ptr<VectorFst<TripoliArc> > input(CompileInputFst(strm, files.input));
+      counters->Add("states", input ? input->NumStates() : 0);
+    }
+  });
+  runner->Run("input/CompileLinearInput", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      std::unique_ptr<LinearFst<TripoliArc> > input(
+          CompileLinearInput(contents.data(), contents.size(), files.input));
+      counters->Add("states", input ? input->NumStates() : 0);
+    }
+  });
+}
+
+// Expands all of a composition, as writing it out would.
+template <class M>
+void ExpandCompose(const typename M::FST &input, const TripoliModel &model, uint64_t n,
+                   BenchCounters *counters) {
+  for (uint64_t i = 0; i < n; ++i) {
+    const TripoliFilterTables *tables;
+    std::unique_ptr<ComposeFst<TripoliArc> > composed(
+        TripoliCompose<M>(input, model, CacheOptions(), 0, &tables));
+    uint64_t nstates = 0, narcs = 0;
+    for (StateIterator<ComposeFst<TripoliArc> > siter(*composed); !siter.Done(); siter.Next()) {
+      ++nstates;
+      narcs += composed->NumArcs(siter.Value());
+    }
+    counters->Add("states", nstates);
+    counters->Add("arcs", narcs);
+    counters->Measure("table_bytes", GetComposeStats(*tables).table_bytes);
+  }
+}
+
+// Composition of input.txt with the whole model, with the input as a
+// VectorFst and as a LinearFst.
+void BenchCompose(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("compose/"))
+    return;
+  string missing = ModelFiles::Missing({files.pdt, files.labels, files.symbols, files.rules,
+                                        files.states, files.parens, files.input});
+  if (!missing.empty()) {
+    runner->Skip("compose/input", missing);
+    runner->Skip("compose/linear", missing);
+    return;
+  }
+  std::unique_ptr<TripoliModel> model(TripoliModel::ReadText(
+      files.pdt, files.labels, files.symbols, files.rules, files.states, files.parens));
+  std::ifstream strm(files.input.c_str());
+  string contents((std::istreambuf_iterator<char>(strm)), std::istreambuf_iterator<char>());
+  std::istringstream text(contents);
+  std::unique_ptr<VectorFst<TripoliArc> > input(CompileInputFst(text, files.input));
+  if (!input) {
+    runner->Skip("compose/input", "cannot compile " + files.input);
+    runner->Skip("compose/linear", "cannot compile " + files.input);
+    return;
+  }
+  runner->Run("compose/input", [&](uint64_t n, BenchCounters *counters) {
+    ExpandCompose<InputMatcher>(*input, *model, n, counters);
+  }, 64);
+  std::unique_ptr<LinearFst<TripoliArc> > linear(
+      CompileLinearInput(contents.data(), contents.size(), files.input));
+  if (!linear) {
+    runner->Skip("compose/linear", files.input + " is not linear");
+    return;
+  }
+  runner->Run("compose/linear", [&](uint64_t n, BenchCounters *counters) {
+    ExpandCompose<LinearInputMatcher>(*linear, *model, n, counters);
+  }, 64);
+}
+
+// input.txt read one token at a time by a session, as an editor would,
+// with every eighth token taken back and read again.
+void BenchSession(const ModelFiles &files, BenchRunner *runner) {
+  if (!runner->Selected("session/"))
+    return;
+  string missing = ModelFiles::Missing({files.pdt, files.labels, files.symbols, files.rules,
+                                        files.states, files.parens, files.input});
+  if (!missing.empty()) {
+    runner->Skip("session/extend", missing);
+    runner->Skip("session/predict", missing);
+    return;
+  }
+  std::unique_ptr<TripoliModel> model(TripoliModel::ReadText(
+      files.pdt, files.labels, files.symbols, files.rules, files.states, files.parens));
+  std::ifstream strm(files.input.c_str());
+  string contents((std::istreambuf_iterator<char>(strm)), std::istreambuf_iterator<char>());
+  std::unique_ptr<LinearFst<TripoliArc> > input(
+      CompileLinearInput(contents.data(), contents.size(), files.input));
+  if (!input) {
+    runner->Skip("session/extend", files.input + " is not linear");
+    runner->Skip("session/predict", files.input + " is not linear");
+    return;
+  }
+  const FlatArray<Label> &labels = input->Labels();
+  runner->Run("session/extend", [&](uint64_t n, BenchCounters *counters) {
+    for (uint64_t i = 0; i < n; ++i) {
+      TripoliSession session(*model);
+      uint64_t extended = 0, active = 0;
+      for (size_t j = 0; j < labels.size() && session.Extend(labels[j]); ++j) {
+        ++extended;
+        active += session.Frontier().size();
+        if (j % 8 == 7) {
+          session.Rollback(session.Position() - 1);
+          session.Extend(labels[j]);
+          ++extended;
+        }
+      }
+      counters->Add("tokens", extended);
+      counters->Add("active", active);
+    }
+  }, 64);
+
+  // The top ten next tokens after the input, read once
+  TripoliSession session(*model);
+  for (size_t j = 0; j < labels.size() && session.Extend(labels[j]); ++j) {}
+  runner->Run("session/predict", [&](uint64_t n, BenchCounters *counters) {
+    PredictOptions opts;
+    vector<Prediction> predictions;
+    for (uint64_t i = 0; i < n; ++i) {
+      session.Predict(opts, &predictions);
+      counters->Add("predictions", predictions.size());
+      counters->Add("active", session.Frontier().size());
+    }
+  }, 64);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  string usage = "Benchmarks Tripoli's load, filter and compose paths.\n\n  Usage: ";
+  usage += argv[0];
+  usage += " [--data=dir[,dir...]] [--json=out.json] [--baseline=baseline.json]\n";
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+  if (argc != 1) {
+    ShowUsage();
+    return 1;
+  }
+
+  // With several models, each one's results are named after its directory
+  vector<string> dirs = Split(FLAGS_data), prefixes;
+  BenchRunner runner(FLAGS_filter, FLAGS_min_time);
+  try {
+    BenchFilterState(&runner);
+    for (const string &dir : dirs) {
+      if (dirs.size() > 1) {
+        prefixes.push_back(dir.substr(dir.find_last_of('/') + 1) + "/");
+        runner.SetPrefix(prefixes.back());
+      }
+      ModelFiles files(dir);
+      BenchGrammar(files, &runner);
+      BenchReaders(files, &runner);
+      BenchPDTInfo(files, &runner);
+      BenchLoad(files, &runner);
+      BenchInput(files, &runner);
+      BenchCompose(files, &runner);
+      BenchSession(files, &runner);
+    }
+  } catch (const std::invalid_argument &e) {
+    LOG(ERROR) << argv[0] << ": " << e.what();
+    return 1;
+  }
+  if (dirs.size() > 1)
+    WriteScaleTable(runner.Results(), prefixes, cout);
+
+  if (!FLAGS_json.empty()) {
+    std::ofstream out(FLAGS_json.c_str());
+    WriteBenchJson(runner.Results(), out);
+    if (!out) {
+      LOG(ERROR) << "Can't write file: " << FLAGS_json;
+      return 1;
+    }
+  }
+  if (FLAGS_baseline.empty())
+    return 0;
+  vector<pair<string, double> > baseline;
+  if (!ReadBenchBaseline(FLAGS_baseline, &baseline)) {
+    LOG(ERROR) << "Can't read baseline: " << FLAGS_baseline;
+    return 1;
+  }
+  size_t regressions = CompareToBaseline(runner.Results(), baseline, FLAGS_tolerance, cout);
+  if (regressions)
+    cout << regressions << " regressions beyond " << FLAGS_tolerance * 100 << "%" << endl;
+  return regressions ? 2 : 0;
+}
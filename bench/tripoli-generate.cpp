@@ -0,0 +1,104 @@
+/*
+ * tripoli-generate.cpp
+ *
+ * Writes a synthetic model and a linear input for it (see synthetic.h),
+ * named as tripoli-bench --data expects, so that benchmarks can be run on
+ * models of any size (see the bench-scale target in the Makefile).
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include <fst/util.h>
+
+#include "synthetic.h"
+
+DEFINE_int32(terminals, 500, "Terminal symbols");
+DEFINE_int32(nonterminals, 200, "Nonterminal symbols, each with a paren pair");
+DEFINE_int64(rules, 1000, "Grammar rules, at least one per terminal and per nonterminal");
+DEFINE_string(rule_lengths, "4,3,2,1", "Relative frequency of right-hand sides of 1, 2, ... symbols");
+DEFINE_double(bigram_density, 1, "Share of terminals with a bigram context");
+DEFINE_double(trigram_density, 2, "Trigram contexts per bigram context");
+DEFINE_double(dummy_ratio, 0.5, "Share of grammar arcs that pass through a dummy state");
+DEFINE_int32(fanout, 8, "Grammar arcs out of each context and portal state");
+DEFINE_int32(scale, 1, "Multiplies the nonterminals, rules and trigram contexts");
+DEFINE_int32(seed, 1, "Seed of the model's random choices");
+DEFINE_int64(input_length, 100, "Terminals in input.txt, or 0 for none");
+
+using namespace fst;
+
+namespace {
+
+bool ParseLengths(const string &s, vector<double> *lengths) {
+  std::istringstream strm(s);
+  string field;
+  while (std::getline(strm, field, ',')) {
+    char *end;
+    double frequency = std::strtod(field.c_str(), &end);
+    if (field.empty() || *end)
+      return false;
+    lengths->push_back(frequency);
+  }
+  return !lengths->empty();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  string usage = "Writes a synthetic Tripoli model and input.\n\n  Usage: ";
+  usage += argv[0];
+  usage += " [--scale=n] out_dir\n";
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+  if (argc != 2) {
+    ShowUsage();
+    return 1;
+  }
+
+  SyntheticOptions opts;
+  opts.terminals = FLAGS_terminals;
+  opts.nonterminals = FLAGS_nonterminals * FLAGS_scale;
+  opts.rules = FLAGS_rules * FLAGS_scale;
+  opts.rule_lengths.clear();
+  if (!ParseLengths(FLAGS_rule_lengths, &opts.rule_lengths)) {
+    LOG(ERROR) << argv[0] << ": Bad --rule_lengths: " << FLAGS_rule_lengths;
+    return 1;
+  }
+  opts.bigram_density = FLAGS_bigram_density;
+  opts.trigram_density = FLAGS_trigram_density * FLAGS_scale;
+  opts.dummy_ratio = FLAGS_dummy_ratio;
+  opts.fanout = FLAGS_fanout;
+  opts.seed = FLAGS_seed;
+
+  string dir = argv[1];
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+    LOG(ERROR) << argv[0] << ": Can't make directory: " << dir;
+    return 1;
+  }
+  std::unique_ptr<SyntheticModel> model;
+  try {
+    model.reset(new SyntheticModel(opts));
+  } catch (const std::invalid_argument &e) {
+    LOG(ERROR) << argv[0] << ": " << e.what();
+    return 1;
+  }
+  if (!model->Write(dir))
+    return 1;
+  if (FLAGS_input_length > 0) {
+    string input = dir + "/input.txt";
+    std::ofstream strm(input.c_str());
+    model->WriteInput(FLAGS_input_length, FLAGS_seed, strm);
+    if (!strm) {
+      LOG(ERROR) << argv[0] << ": Can't write file: " << input;
+      return 1;
+    }
+  }
+  cout << dir << ": " << model->NumStates() << " states, " << model->NumArcs() << " arcs, "
+       << model->NumRules() << " rules" << endl;
+  return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * a-star.cpp
+ */
+
+#include "a-star.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "future-costs.h"
+#include "paren-stacks.h"
+
+namespace fst {
+
+namespace {
+
+typedef TripoliArc::StateId StateId;
+
+// The best path found to a search state: the arc that reached it and the
+// node before.
+struct Node {
+  StateId state;
+  StackId stack;
+  float cost;
+  int32 prev;  // -1 at the start
+  TripoliArc arc;
+};
+
+// A queued node, or a goal: a node's path completed by its final weight.
+struct Entry {
+  float priority;  // cost plus the bound on what remains
+  int32 node;
+  bool goal;
+
+  // Reversed for a min-heap; ties go to goals, then to older nodes.
+  bool operator<(const Entry &e) const {
+    if (priority != e.priority)
+      return priority > e.priority;
+    if (goal != e.goal)
+      return e.goal;
+    return node > e.node;
+  }
+};
+
+class Search {
+public:
+  Search(const Fst<TripoliArc> &fst, Span<ParenPair> parens, AStarGuide *guide,
+         AStarStats *stats)
+          : fst_(fst), parens_(parens), guide_(guide), stats_(stats) {}
+
+  bool Run(MutableFst<TripoliArc> *path) {
+    path->DeleteStates();
+    StateId start = fst_.Start();
+    if (start == kNoStateId)
+      return false;
+    Node node = {start, 0, 0, -1, TripoliArc()};
+    Push(node);
+    while (!queue_.empty()) {
+      Entry entry = queue_.top();
+      queue_.pop();
+      if (entry.goal) {
+        WritePath(entry.node, path);
+        return true;
+      }
+      if (best_[Key(nodes_[entry.node])] != entry.node)
+        continue;  // a cheaper path to its state came later
+      Expand(entry.node);
+    }
+    return false;
+  }
+
+private:
+  static uint64 Key(const Node &node) {
+    return (uint64(node.state) << 32) | uint32(node.stack);
+  }
+
+  void Expand(int32 n) {
+    const Node node = nodes_[n];
+    ++stats_->expanded;
+    if (node.stack == 0) {
+      TripoliArc::Weight weight = fst_.Final(node.state);
+      if (weight != TripoliArc::Weight::Zero()) {
+        Entry goal = {node.cost + weight.Value(), n, true};
+        queue_.push(goal);
+      }
+    }
+    guide_->SetState(node.state);
+    for (ArcIterator<Fst<TripoliArc> > aiter(fst_, node.state); !aiter.Done(); aiter.Next()) {
+      const TripoliArc &arc = aiter.Value();
+      if (!guide_->Keep(arc)) {
+        ++stats_->pruned;
+        continue;
+      }
+      StackId stack = stacks_.Follow(node.stack, parens_.Paren(arc.olabel));
+      if (stack < 0) {
+        ++stats_->unbalanced;
+        continue;
+      }
+      Node next = {arc.nextstate, stack, node.cost + arc.weight.Value(), n, arc};
+      Push(next);
+    }
+  }
+
+  // Queues node unless its state cannot complete or already has a path
+  // as cheap.
+  void Push(const Node &node) {
+    float future = guide_->FutureCost(node.state);
+    if (future == std::numeric_limits<float>::infinity())
+      return;
+    std::unordered_map<uint64, int32>::iterator it = best_.find(Key(node));
+    if (it != best_.end() && nodes_[it->second].cost <= node.cost)
+      return;
+    int32 n = nodes_.size();
+    nodes_.push_back(node);
+    if (it != best_.end())
+      it->second = n;
+    else
+      best_[Key(node)] = n;
+    Entry entry = {node.cost + future, n, false};
+    queue_.push(entry);
+    ++stats_->pushed;
+  }
+
+  void WritePath(int32 n, MutableFst<TripoliArc> *path) const {
+    vector<TripoliArc> arcs;
+    for (int32 i = n; nodes_[i].prev >= 0; i = nodes_[i].prev)
+      arcs.push_back(nodes_[i].arc);
+    StateId s = path->AddState();
+    path->SetStart(s);
+    for (vector<TripoliArc>::reverse_iterator it = arcs.rbegin(); it != arcs.rend(); ++it) {
+      TripoliArc arc = *it;
+      arc.nextstate = path->AddState();
+      path->AddArc(s, arc);
+      s = arc.nextstate;
+    }
+    path->SetFinal(s, fst_.Final(nodes_[n].state));
+  }
+
+  const Fst<TripoliArc> &fst_;
+  ParenLabels parens_;
+  AStarGuide *guide_;
+  AStarStats *stats_;
+  ParenStacks stacks_;
+  vector<Node> nodes_;
+  std::unordered_map<uint64, int32> best_;  // (state, stack) -> cheapest node
+  std::priority_queue<Entry> queue_;
+};
+
+// Bounds a composition state by the future costs of its input and PDT
+// states, and checks the input-epsilon arcs that start a constituent
+// against the terminals input can read next.
+template <class F>
+class TripoliGuide : public AStarGuide {
+public:
+  TripoliGuide(const F &input, const TripoliModel &model,
+               const TripoliComposeStateTable &state_table)
+          : input_(input), model_(model), state_table_(state_table),
+            pdt_costs_(model.GetFutureCosts()), parens_(model.GetParens()), s1_(kNoStateId),
+            restricted_(false) {
+    FutureCosts(input, &input_costs_);
+  }
+
+  virtual float FutureCost(StateId s) {
+    const TripoliComposeStateTable::StateTuple &tuple = state_table_.Tuple(s);
+    return input_costs_[tuple.state_id1] + pdt_costs_[tuple.state_id2];
+  }
+
+  // Input-epsilon arcs are checked only where input must read a terminal
+  // next: none of its arcs are epsilons and it cannot stop. A close paren
+  // always passes, as the filter lets it: its rule is the constituent it
+  // completes, which need not start with what comes next.
+  virtual void SetState(StateId s) {
+    const TripoliComposeStateTable::StateTuple &tuple = state_table_.Tuple(s);
+    s1_ = tuple.state_id1;
+    restricted_ = false;
+    allowed_.clear();
+    const Grammar &grammar = model_.GetGrammar();
+    if (input_.Final(s1_) != TripoliArc::Weight::Zero())
+      return;
+    mask_.clear();
+    for (ArcIterator<F> aiter(input_, s1_); !aiter.Done(); aiter.Next()) {
+      Label term = aiter.Value().olabel;
+      if (!grammar.IsTerm(term))
+        return;
+      model_.GetPDTInfo().ArcsCanReach(tuple.state_id2, term, &term_mask_);
+      mask_.resize(term_mask_.size(), 0);
+      for (size_t i = 0; i < term_mask_.size(); ++i)
+        mask_[i] |= term_mask_[i];
+    }
+    if (mask_.empty())
+      return;
+    restricted_ = true;
+    const TripoliPdt &pdt = model_.GetPdt();
+    const TripoliArc *arcs = pdt.Arcs(tuple.state_id2);
+    for (size_t i = 0; i < pdt.NumArcs(tuple.state_id2); ++i) {
+      if (((mask_[i / BitMatrix::kWordBits] >> (i % BitMatrix::kWordBits)) & 1) ||
+          parens_.Paren(arcs[i].ilabel) < 0)
+        allowed_.push_back(std::make_pair(arcs[i].olabel, arcs[i].nextstate));
+    }
+    std::sort(allowed_.begin(), allowed_.end());
+  }
+
+  // Composed arcs do not keep the PDT arc's rule, so the arc is found
+  // again by its output label and next PDT state.
+  virtual bool Keep(const TripoliArc &arc) {
+    if (!restricted_)
+      return true;
+    const TripoliComposeStateTable::StateTuple &next = state_table_.Tuple(arc.nextstate);
+    if (next.state_id1 != s1_)
+      return true;
+    return std::binary_search(allowed_.begin(), allowed_.end(),
+                              std::make_pair(arc.olabel, next.state_id2));
+  }
+
+private:
+  const F &input_;
+  const TripoliModel &model_;
+  const TripoliComposeStateTable &state_table_;
+  Span<float> pdt_costs_;
+  ParenLabels parens_;
+  vector<float> input_costs_;
+  StateId s1_;
+  bool restricted_;
+  vector<BitMatrix::Word> mask_, term_mask_;
+  vector<pair<Label, StateId> > allowed_;  // (label, next state) of PDT arcs that pass
+};
+
+template <class M>
+bool ShortestPath(const typename M::FST &input, const TripoliModel &model,
+                  MutableFst<TripoliArc> *path, AStarStats *stats, ComposeStats *compose_stats) {
+  const TripoliComposeStateTable *state_table = 0;
+  const TripoliFilterTables *tables = 0;
+  std::unique_ptr<ComposeFst<TripoliArc> > composed(
+      TripoliCompose<M>(input, model, CacheOptions(), &state_table, &tables));
+  TripoliGuide<typename M::FST> guide(input, model, *state_table);
+  bool found = AStarShortestPath(*composed, model.GetParens(), &guide, path, stats);
+  if (compose_stats)
+    *compose_stats = GetComposeStats(*tables, state_table);
+  return found;
+}
+
+}  // namespace
+
+bool AStarShortestPath(const Fst<TripoliArc> &fst, Span<ParenPair> parens, AStarGuide *guide,
+                       MutableFst<TripoliArc> *path, AStarStats *stats) {
+  AStarStats local_stats;
+  Search search(fst, parens, guide, stats ? stats : &local_stats);
+  return search.Run(path);
+}
+
+bool TripoliShortestPath(const Fst<TripoliArc> &input, const TripoliModel &model,
+                         MutableFst<TripoliArc> *path, AStarStats *stats,
+                         ComposeStats *compose_stats) {
+  if (input.Type() == "linear") {
+    return ShortestPath<LinearMatcher<LinearFst<TripoliArc> > >(
+        static_cast<const LinearFst<TripoliArc> &>(input), model, path, stats, compose_stats);
+  }
+  if (input.Type() == "vector") {
+    return ShortestPath<ParenMatcher<VectorFst<TripoliArc> > >(
+        static_cast<const VectorFst<TripoliArc> &>(input), model, path, stats, compose_stats);
+  }
+  // The guide needs the input's states counted
+  VectorFst<TripoliArc> copy(input);
+  return ShortestPath<ParenMatcher<VectorFst<TripoliArc> > >(copy, model, path, stats,
+                                                             compose_stats);
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * a-star.h
+ *
+ * Single best path through a composition by A* search, expanding only the
+ * states whose cost plus a lower bound on their cost to complete can beat
+ * the best path.
+ */
+
+#ifndef A_STAR_H_
+#define A_STAR_H_
+
+#include "model.h"
+#include "span.h"
+
+namespace fst {
+
+// What the search knows about a composition beyond its arcs. As with a
+// matcher, SetState(s) comes before any Keep() of the arcs out of s.
+class AStarGuide {
+public:
+  virtual ~AStarGuide() {}
+
+  // A lower bound on the cost from s to a final weight; infinity if none
+  // is reachable. It must be consistent (no more than any arc's weight
+  // plus the bound at its next state), or the path found may not be the
+  // best.
+  virtual float FutureCost(TripoliArc::StateId s) = 0;
+
+  virtual void SetState(TripoliArc::StateId s) {}
+
+  // False for an arc out of the current state that cannot be on a
+  // complete path.
+  virtual bool Keep(const TripoliArc &arc) { return true; }
+};
+
+struct AStarStats {
+  size_t expanded;  // search states whose arcs were read
+  size_t pushed;  // search states queued
+  size_t pruned;  // arcs dropped by the guide
+  size_t unbalanced;  // arcs dropped for closing the wrong paren
+
+  AStarStats() : expanded(0), pushed(0), pruned(0), unbalanced(0) {}
+};
+
+// Finds the cheapest complete path through fst on which the parens (the
+// output labels of the pairs in parens) balance, with guide's bound as
+// the A* heuristic; arc weights must not be negative. Writes it to path,
+// which is cleared, and returns false if there is none.
+bool AStarShortestPath(const Fst<TripoliArc> &fst, Span<ParenPair> parens, AStarGuide *guide,
+                       MutableFst<TripoliArc> *path, AStarStats *stats = 0);
+
+// The best derivation of input under model: A* over their Tripoli
+// composition, bounded by the model's PDT future costs plus the future
+// costs of input. An input-epsilon arc that stays at the same input state,
+// such as an open paren or a backoff, is dropped when the rule on its PDT
+// arc cannot reach any terminal that input can read next; close parens
+// are kept. The composition's
+// counters go to compose_stats, if given (see GetComposeStats). A
+// LinearFst input is matched with a LinearMatcher.
+bool TripoliShortestPath(const Fst<TripoliArc> &input, const TripoliModel &model,
+                         MutableFst<TripoliArc> *path, AStarStats *stats = 0,
+                         ComposeStats *compose_stats = 0);
+
+}
+
+#endif /* A_STAR_H_ */
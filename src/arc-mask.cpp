@@ -0,0 +1,112 @@
+/*
+ * arc-mask.cpp
+ */
+
+#include "arc-mask.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TRIPOLI_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+namespace fst {
+
+namespace {
+
+inline bool TestBit(const uint64_t *words, size_t bit) {
+  return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void AcceptScalar(const RuleId *rules, size_t begin, size_t n, const uint64_t *reach,
+                  size_t nreach, const RuleBits &disallowed, uint64_t *mask) {
+  for (size_t i = begin; i < n; ++i) {
+    RuleId r = rules[i];
+    bool accept = true;
+    if (r >= 0) {
+      if (reach && (size_t(r) >= nreach || !TestBit(reach, r)))
+        accept = false;
+      size_t bit = size_t(r) - disallowed.min;
+      if (r >= disallowed.min && bit < disallowed.nbits && TestBit(disallowed.words, bit))
+        accept = false;
+    }
+    mask[i / 64] |= uint64_t(accept) << (i % 64);
+  }
+}
+
+#ifdef TRIPOLI_AVX2_KERNEL
+
+// Eight rules at a time: the words holding their bits are gathered, as
+// 32-bit words since the bitsets are little-endian, with lanes masked off
+// where the index would be out of range. Rule ids fit in an int, and so
+// do nreach and the disallowed set's size.
+__attribute__((target("avx2")))
+void AcceptAvx2(const RuleId *rules, size_t n, const uint64_t *reach, size_t nreach,
+                const RuleBits &disallowed, uint64_t *mask) {
+  const int *reach32 = reinterpret_cast<const int *>(reach);
+  const int *disallowed32 = reinterpret_cast<const int *>(disallowed.words);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i low5 = _mm256_set1_epi32(31);
+  const __m256i rbits = _mm256_set1_epi32(int(nreach));
+  const __m256i dmin = _mm256_set1_epi32(disallowed.min);
+  const __m256i dbits = _mm256_set1_epi32(int(disallowed.nbits));
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rules + i));
+    __m256i tag = _mm256_cmpgt_epi32(zero, r);
+    __m256i pass = _mm256_andnot_si256(tag, ones);
+    if (reach) {
+      pass = _mm256_and_si256(pass, _mm256_cmpgt_epi32(rbits, r));
+      __m256i words = _mm256_mask_i32gather_epi32(zero, reach32, _mm256_srli_epi32(r, 5), pass, 4);
+      __m256i bits = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(r, low5)), one);
+      pass = _mm256_and_si256(pass, _mm256_cmpeq_epi32(bits, one));
+    }
+    if (disallowed.nbits) {
+      __m256i d = _mm256_sub_epi32(r, dmin);
+      __m256i in = _mm256_and_si256(pass, _mm256_and_si256(_mm256_cmpgt_epi32(d, ones),
+                                                           _mm256_cmpgt_epi32(dbits, d)));
+      __m256i words = _mm256_mask_i32gather_epi32(zero, disallowed32, _mm256_srli_epi32(d, 5), in, 4);
+      __m256i bits = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(d, low5)), one);
+      pass = _mm256_andnot_si256(_mm256_and_si256(in, _mm256_cmpeq_epi32(bits, one)), pass);
+    }
+    __m256i accept = _mm256_or_si256(tag, pass);
+    uint64_t m = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(accept)));
+    mask[i / 64] |= m << (i % 64);
+  }
+  AcceptScalar(rules, i, n, reach, nreach, disallowed, mask);
+}
+
+bool CpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+}  // namespace
+
+bool AcceptMaskHasAvx2() {
+#ifdef TRIPOLI_AVX2_KERNEL
+  static const bool has_avx2 = CpuHasAvx2();
+  return has_avx2;
+#else
+  return false;
+#endif
+}
+
+void AcceptMask(const RuleId *rules, size_t n, const uint64_t *reach, size_t nreach,
+                const RuleBits &disallowed, std::vector<uint64_t> *mask, AcceptMaskKernel kernel) {
+  mask->assign((n + 63) / 64, 0);
+  if (kernel == ACCEPT_MASK_AUTO)
+    kernel = AcceptMaskHasAvx2() ? ACCEPT_MASK_AVX2 : ACCEPT_MASK_SCALAR;
+#ifdef TRIPOLI_AVX2_KERNEL
+  if (kernel == ACCEPT_MASK_AVX2) {
+    AcceptAvx2(rules, n, reach, nreach, disallowed, mask->data());
+    return;
+  }
+#endif
+  AcceptScalar(rules, 0, n, reach, nreach, disallowed, mask->data());
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ * arc-mask.h
+ *
+ * The rule checks of the Tripoli filter over a run of PDT arcs at once:
+ * one accept bit per arc from its rule id, the disallowed set and the
+ * reach row of the next input terminal, with an AVX2 kernel where the
+ * CPU has one.
+ */
+
+#ifndef ARC_MASK_H_
+#define ARC_MASK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rule-set.h"
+
+namespace fst {
+
+enum AcceptMaskKernel {
+  ACCEPT_MASK_AUTO,  // the fastest the CPU supports
+  ACCEPT_MASK_SCALAR,
+  ACCEPT_MASK_AVX2  // only if AcceptMaskHasAvx2()
+};
+
+// Sets mask to one bit per rule, bit i % 64 of word i / 64 for rules[i]:
+// set iff rules[i] is an arc tag (negative), or it is not in disallowed
+// and, if reach is given, rules[i] is below nreach (the rules reach has
+// bits for) and bit rules[i] of reach is set.
+void AcceptMask(const RuleId *rules, size_t n, const uint64_t *reach, size_t nreach,
+                const RuleBits &disallowed, std::vector<uint64_t> *mask,
+                AcceptMaskKernel kernel = ACCEPT_MASK_AUTO);
+
+// Whether this build and CPU can run the AVX2 kernel.
+bool AcceptMaskHasAvx2();
+
+}
+
+#endif /* ARC_MASK_H_ */
@@ -0,0 +1,327 @@
+/*
+ * batch.cpp
+ */
+
+#include "batch.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <fst/script/compile-impl.h>
+
+#include "bounded-queue.h"
+#include "readers.h"
+#include "thread-pool.h"
+#include "tokenizer.h"
+
+namespace fst {
+
+namespace {
+
+// Per-result buffer for the text format; results are small next to the
+// default buffer, and many are in flight at once.
+const size_t kResultBufferSize = 1 << 16;
+
+struct BatchResult {
+  size_t index;
+  string text;  // the formatted composition or output file, header included
+  bool ok;
+};
+
+// <dir>/<basename of name>.fst
+string OutputFile(const string &dir, const string &name) {
+  string::size_type slash = name.rfind('/');
+  return dir + "/" + (slash == string::npos ? name : name.substr(slash + 1)) + ".fst";
+}
+
+// Formats fst into result, or writes it to its file in opts.output_dir.
+void Output(const Fst<TripoliArc> &fst, const string &name, const BatchOptions &opts,
+            BatchResult *result) {
+  if (opts.format == OUTPUT_TEXT) {
+    std::ostringstream out;
+    BufferedWriter writer(&out, kResultBufferSize);
+    writer.Write("# ");
+    writer.Write(name.data(), name.size());
+    writer.Put('\n');
+    PrintArcs(fst, &writer);
+    writer.Flush();
+    result->text = out.str();
+    result->ok = true;
+    return;
+  }
+  string filename = OutputFile(opts.output_dir, name);
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!out) {
+    LOG(ERROR) << "RunBatch: Can't open file: " << filename;
+    return;
+  }
+  if (WriteOutput(fst, opts.format, out, filename) && out.flush()) {
+    result->text = "# " + name + ": " + filename + "\n";
+    result->ok = true;
+  }
+}
+
+// Reads, compiles, composes (and searches) and outputs one input; never
+// throws, so the writer always hears back about every input.
+BatchResult Decode(const TripoliModel &model, size_t index, const string &name,
+                   const string &contents, const BatchOptions &opts) {
+  BatchResult result = {index, "", false};
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ComposeStats stats;
+  try {
+    std::unique_ptr<Fst<TripoliArc> > input;
+    if (opts.token_labels) {
+      std::istringstream strm(contents);
+      input.reset(TokensToLinearFst(strm, *opts.token_labels, name));
+    } else {
+      input.reset(CompileInput(contents, name));
+    }
+    if (input && opts.shortest_path) {
+      VectorFst<TripoliArc> path;
+      if (TripoliShortestPath(*input, model, &path, 0, opts.stats ? &stats : 0))
+        Output(path, name, opts, &result);
+      else
+        LOG(ERROR) << "RunBatch: No complete path: " << name;
+    } else if (input) {
+      const TripoliComposeStateTable *state_table = 0;
+      const TripoliFilterTables *tables = 0;
+      std::unique_ptr<ComposeFst<TripoliArc> > composed(
+          TripoliComposeInput(*input, model, CacheOptions(), opts.stats ? &state_table : 0,
+                              &tables));
+      if (!opts.search) {
+        Output(*composed, name, opts, &result);
+      } else {
+        VectorFst<TripoliArc> paths;
+        if (BeamSearch(*composed, model.GetParens(), *opts.search, &paths))
+          Output(paths, name, opts, &result);
+        else
+          LOG(ERROR) << "RunBatch: No complete path: " << name;
+      }
+      if (opts.stats)
+        stats = GetComposeStats(*tables, state_table);
+    }
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "RunBatch: " << name << ": " << e.what();
+  }
+  if (!result.ok)
+    result.text = "# " + name + ": failed\n";
+  if (opts.stats) {
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    opts.stats->AddCompose(name, stats, seconds.count());
+    opts.stats->AddMemory("compose_tables", stats.table_bytes);
+  }
+  return result;
+}
+
+// A weight of the AT&T text format, as a whole field
+bool ParseWeight(const Token &token, TripoliArc::Weight *weight) {
+  string field = token.str();
+  char *end;
+  float value = std::strtof(field.c_str(), &end);
+  if (*end)
+    return false;
+  *weight = value;
+  return true;
+}
+
+}  // namespace
+
+bool ReadBatchInputs(const string &path, vector<string> *inputs) {
+  inputs->clear();
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    LOG(ERROR) << "ReadBatchInputs: Can't open: " << path;
+    return false;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+      LOG(ERROR) << "ReadBatchInputs: Can't read directory: " << path;
+      return false;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      string file = path + "/" + entry->d_name;
+      if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        inputs->push_back(file);
+    }
+    closedir(dir);
+    std::sort(inputs->begin(), inputs->end());
+    return true;
+  }
+
+  std::unique_ptr<TextFile> text(TextFile::Open(path));
+  if (!text)
+    return false;
+  Tokenizer tok(*text, "");
+  Token line;
+  while (tok.NextLine()) {
+    if (tok.NextToken(&line) && line.front() != '#')
+      inputs->push_back(line.str());
+  }
+  return true;
+}
+
+VectorFst<TripoliArc> *CompileInputFst(istream &strm, const string &source) {
+  const SymbolTable *isyms = 0, *osyms = 0, *ssyms = 0;
+  bool accep = true;
+  bool ikeep = false;
+  bool okeep = false;
+  bool allow_negative_labels = false;
+  FstCompiler<TripoliArc> compiler(strm, source, isyms, osyms, ssyms, accep, ikeep, okeep,
+                                   allow_negative_labels);
+  if (compiler.Fst().Properties(kError, false))
+    return 0;
+  return new VectorFst<TripoliArc>(compiler.Fst());
+}
+
+LinearFst<TripoliArc> *CompileLinearInput(const char *data, size_t size, const string &source) {
+  typedef TripoliArc::Weight Weight;
+  Tokenizer tok(data, size, source, " \t\r");
+  vector<Token> cols;
+  vector<Label> labels;
+  vector<Weight> weights;
+  bool weighted = false;
+  bool final = false;
+  Weight final_weight = Weight::Zero();
+  while (tok.NextLine()) {
+    size_t ncols = tok.Split(&cols);
+    if (ncols == 0)
+      continue;
+    int64 src, dst, label;
+    if (final || ncols > 4 ||
+        !ParseInt64(cols[0].data, cols[0].data + cols[0].size, &src) || src != int64(labels.size()))
+      return 0;
+    if (ncols <= 2) {
+      final = true;
+      final_weight = Weight::One();
+      if (ncols == 2 && !ParseWeight(cols[1], &final_weight))
+        return 0;
+      continue;
+    }
+    Weight weight = Weight::One();
+    if (!ParseInt64(cols[1].data, cols[1].data + cols[1].size, &dst) || dst != src + 1 ||
+        !ParseInt64(cols[2].data, cols[2].data + cols[2].size, &label) || label < 0 ||
+        label > std::numeric_limits<Label>::max() || (ncols == 4 && !ParseWeight(cols[3], &weight)))
+      return 0;
+    labels.push_back(label);
+    weights.push_back(weight);
+    weighted |= weight != Weight::One();
+  }
+  if (!final)
+    return 0;
+  if (!weighted)
+    weights.clear();
+  return new LinearFst<TripoliArc>(std::move(labels), std::move(weights), final_weight);
+}
+
+Fst<TripoliArc> *CompileInput(const string &contents, const string &source) {
+  if (LinearFst<TripoliArc> *linear = CompileLinearInput(contents.data(), contents.size(), source))
+    return linear;
+  std::istringstream strm(contents);
+  return CompileInputFst(strm, source);
+}
+
+bool ReadTokenLabels(const string &filename, TokenLabels *labels) {
+  vector<string> names;
+  if (!ReadNumberedStrings(filename, &names)) {
+    LOG(ERROR) << "ReadTokenLabels: Can't read file: " << filename;
+    return false;
+  }
+  labels->clear();
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (!names[i].empty())
+      (*labels)[names[i]] = i;
+  }
+  return true;
+}
+
+LinearFst<TripoliArc> *TokensToLinearFst(istream &strm, const TokenLabels &labels,
+                                         const string &source) {
+  std::unique_ptr<TextFile> text(TextFile::Read(strm, source));
+  Tokenizer tok(*text, " \t\r");
+  vector<Label> input;
+  Token token;
+  while (tok.NextLine()) {
+    while (tok.NextToken(&token)) {
+      TokenLabels::const_iterator it = labels.find(token.str());
+      if (it == labels.end()) {
+        LOG(ERROR) << "TokensToLinearFst: Unknown token = \"" << token.str()
+                   << "\", source = " << source << ", line = " << tok.LineNumber();
+        return 0;
+      }
+      input.push_back(it->second);
+    }
+  }
+  return new LinearFst<TripoliArc>(std::move(input));
+}
+
+// A reader thread reads inputs and hands each one to the work-stealing
+// pool as a task; the calling thread is the writer. Inputs in flight are
+// bounded by window, which the reader pushes to before reading an input
+// and the writer pops from after writing one, so the reader stays at
+// most queue_size inputs ahead of the writer and the reorder buffer never
+// holds more than that. A task is done with the batch once its result is
+// pushed, so a pool passed in need not be drained before returning.
+size_t RunBatch(const TripoliModel &model, const vector<string> &inputs, ostream &strm,
+                const BatchOptions &opts) {
+  BoundedQueue<size_t> window(opts.queue_size);
+  BoundedQueue<BatchResult> results(opts.queue_size);
+  std::unique_ptr<ThreadPool> own_pool;
+  ThreadPool *pool = opts.pool;
+  if (!pool) {
+    own_pool.reset(new ThreadPool(opts.threads));
+    pool = own_pool.get();
+  }
+
+  std::thread reader([&model, &inputs, &opts, &window, &results, pool]() {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      if (!window.Push(i))
+        return;
+      std::ifstream file(inputs[i].c_str(), std::ios::in | std::ios::binary);
+      if (!file) {
+        LOG(ERROR) << "RunBatch: Can't open file: " << inputs[i];
+        BatchResult failed = {i, "# " + inputs[i] + ": failed\n", false};
+        results.Push(failed);
+        continue;
+      }
+      std::shared_ptr<string> contents(new string(std::istreambuf_iterator<char>(file),
+                                                  std::istreambuf_iterator<char>()));
+      const string &name = inputs[i];
+      pool->Async([&model, &opts, &results, i, &name, contents]() {
+        results.Push(Decode(model, i, name, *contents, opts));
+      });
+    }
+  });
+
+  size_t failed = 0;
+  std::map<size_t, BatchResult> pending;
+  for (size_t next = 0; next < inputs.size();) {
+    BatchResult result;
+    results.Pop(&result);
+    pending[result.index] = result;
+    for (std::map<size_t, BatchResult>::iterator it = pending.begin();
+         it != pending.end() && it->first == next; it = pending.begin()) {
+      strm << it->second.text;
+      failed += !it->second.ok;
+      pending.erase(it);
+      size_t done;
+      window.Pop(&done);
+      ++next;
+    }
+  }
+  strm.flush();
+  reader.join();
+  return failed;
+}
+
+}
@@ -0,0 +1,90 @@
+/*
+ * batch.h
+ *
+ * Batch decoding: many input FSTs composed against one loaded model, with
+ * reading, composition and writing overlapped.
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "a-star.h"
+#include "beam-search.h"
+#include "linear-fst.h"
+#include "model.h"
+#include "output.h"
+#include "thread-pool.h"
+
+namespace fst {
+
+// The label of each token, by name, from an arc label file such as
+// arc-labels.txt.
+typedef std::unordered_map<string, TripoliArc::Label> TokenLabels;
+
+struct BatchOptions {
+  // Runs the compositions, e.g. the pool the model was loaded with; if
+  // not set, a pool of threads workers is made for the batch.
+  ThreadPool *pool;
+  size_t threads;  // compose workers without a pool; 0 composes on the reader thread
+  size_t queue_size;  // inputs read ahead of the writer
+  OutputFormat format;
+  string output_dir;  // where binary formats write <input basename>.fst
+  // If set, each input's best paths are written instead of its whole
+  // composition.
+  const BeamSearchOptions *search;
+  bool shortest_path;  // write each input's best path, found by A*
+  StatsReport *stats;  // if set, gets each input's time and counters
+  // If set, inputs are whitespace-separated tokens rather than FSTs (see
+  // TokensToLinearFst).
+  const TokenLabels *token_labels;
+
+  BatchOptions()
+          : pool(0), threads(0), queue_size(64), format(OUTPUT_TEXT), search(0), shortest_path(false),
+            stats(0), token_labels(0) {}
+};
+
+// Input FSTs named by a manifest, one path per line (blank lines and #
+// comments are skipped), or, if path is a directory, its regular files in
+// name order.
+bool ReadBatchInputs(const string &path, vector<string> *inputs);
+
+// Compiles an input FST from the AT&T text format, as fstcompile does for
+// an acceptor; NULL (and logged) on error.
+VectorFst<TripoliArc> *CompileInputFst(istream &strm, const string &source);
+
+// The same input as a LinearFst, if it is one in the form inputs are
+// written in: arcs from states 0, 1, ..., n - 1 in order, each to the
+// next, then state n alone as final. Weights are read as CompileInputFst
+// reads them. NULL, and nothing logged, for any other text, so that the
+// caller can fall back on CompileInputFst.
+LinearFst<TripoliArc> *CompileLinearInput(const char *data, size_t size, const string &source);
+
+// A LinearFst if contents is linear, as above, or else what
+// CompileInputFst compiles; NULL (and logged) on error.
+Fst<TripoliArc> *CompileInput(const string &contents, const string &source);
+
+// Reads labels from an arc label file ("<label> <name>" lines); false (and
+// logged) if it cannot be read.
+bool ReadTokenLabels(const string &filename, TokenLabels *labels);
+
+// A LinearFst over the whitespace-separated tokens of strm, each mapped to
+// its label; NULL (and logged) if a token has none.
+LinearFst<TripoliArc> *TokensToLinearFst(istream &strm, const TokenLabels &labels,
+                                         const string &source);
+
+// Composes every input with model. As text, the results go to strm in
+// input order, each preceded by a "# <input>" line (or "# <input>:
+// failed"); in a binary format each goes to its own file in
+// opts.output_dir, and strm gets "# <input>: <file>" lines instead.
+// Returns the number of inputs that failed.
+size_t RunBatch(const TripoliModel &model, const vector<string> &inputs, ostream &strm,
+                const BatchOptions &opts);
+
+}
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,195 @@
+/*
+ * beam-search.cpp
+ */
+
+#include "beam-search.h"
+#include "paren-stacks.h"
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fst {
+
+namespace {
+
+typedef TripoliArc::StateId StateId;
+
+// A path to a search state: the arc that reached it and the token before.
+struct Token {
+  StateId state;
+  StackId stack;
+  float cost;
+  int32 prev;  // -1 at the start
+  TripoliArc arc;
+  bool dead;  // superseded by nbest cheaper paths into its search state
+};
+
+class Search {
+public:
+  Search(const Fst<TripoliArc> &fst, Span<ParenPair> parens, const BeamSearchOptions &opts,
+         BeamSearchStats *stats)
+          : fst_(fst), opts_(opts), stats_(stats), parens_(parens) {}
+
+  bool Run(MutableFst<TripoliArc> *paths) {
+    paths->DeleteStates();
+    StateId start = fst_.Start();
+    if (start == kNoStateId)
+      return false;
+    Token token = {start, 0, 0, -1, TripoliArc(), false};
+    vector<int32> current(1, Add(&active_, token));
+    while (!current.empty()) {
+      ++stats_->positions;
+      vector<int32> next;
+      ExpandPosition(current, &next);
+      active_.clear();
+      active_.swap(next_active_);
+      current.swap(next);
+    }
+    return WritePaths(paths);
+  }
+
+private:
+  typedef std::unordered_map<uint64, vector<int32> > ActiveMap;  // (state, stack) -> tokens
+
+  struct Cheaper {
+    explicit Cheaper(const vector<Token> *tokens) : tokens(tokens) {}
+    // Reversed for a min-heap; ties go to the older token, for determinism.
+    bool operator()(int32 a, int32 b) const {
+      const Token &ta = (*tokens)[a], &tb = (*tokens)[b];
+      return ta.cost != tb.cost ? ta.cost > tb.cost : a > b;
+    }
+    const vector<Token> *tokens;
+  };
+
+  // Expands the tokens at one position, and what they reach through
+  // epsilons, cheapest first; the tokens they reach at the next position go
+  // to next.
+  void ExpandPosition(const vector<int32> &current, vector<int32> *next) {
+    Cheaper cheaper(&tokens_);
+    std::priority_queue<int32, vector<int32>, Cheaper> agenda(cheaper, current);
+    float best = std::numeric_limits<float>::infinity();
+    size_t expanded = 0;
+    while (!agenda.empty()) {
+      int32 t = agenda.top();
+      agenda.pop();
+      if (tokens_[t].dead)
+        continue;
+      const Token token = tokens_[t];
+      best = std::min(best, token.cost);
+      if (token.cost > best + opts_.beam ||
+          (opts_.max_active && expanded >= opts_.max_active)) {
+        ++stats_->pruned;
+        continue;
+      }
+      ++expanded;
+      ++stats_->expanded;
+
+      if (token.stack == 0) {
+        TripoliArc::Weight weight = fst_.Final(token.state);
+        if (weight != TripoliArc::Weight::Zero())
+          finals_.push_back(std::make_pair(token.cost + weight.Value(), t));
+      }
+      for (ArcIterator<Fst<TripoliArc> > aiter(fst_, token.state); !aiter.Done(); aiter.Next()) {
+        const TripoliArc &arc = aiter.Value();
+        int paren = parens_.Paren(arc.olabel);
+        if (paren > 0 && opts_.max_depth && stacks_.Depth(token.stack) >= opts_.max_depth) {
+          ++stats_->too_deep;
+          continue;
+        }
+        StackId stack = stacks_.Follow(token.stack, paren);
+        if (stack < 0) {
+          ++stats_->unbalanced;
+          continue;
+        }
+        Token reached = {arc.nextstate, stack, token.cost + arc.weight.Value(), t, arc, false};
+        // Composed parens carry the paren on the input side too
+        if (arc.ilabel == 0 || paren != 0) {
+          int32 r = Add(&active_, reached);
+          if (r >= 0)
+            agenda.push(r);
+        } else {
+          int32 r = Add(&next_active_, reached);
+          if (r >= 0)
+            next->push_back(r);
+        }
+      }
+    }
+    stats_->max_active = std::max(stats_->max_active, expanded);
+  }
+
+  // Adds token unless its search state already has nbest cheaper paths,
+  // retiring the most expensive of them if it now has too many; returns
+  // the new token, or -1.
+  int32 Add(ActiveMap *active, const Token &token) {
+    vector<int32> &paths = (*active)[(uint64(token.state) << 32) | uint32(token.stack)];
+    if (paths.size() >= opts_.nbest) {
+      vector<int32>::iterator worst = paths.begin();
+      for (vector<int32>::iterator it = paths.begin(); it != paths.end(); ++it) {
+        if (tokens_[*it].cost > tokens_[*worst].cost)
+          worst = it;
+      }
+      ++stats_->recombined;
+      if (token.cost >= tokens_[*worst].cost)
+        return -1;
+      tokens_[*worst].dead = true;
+      paths.erase(worst);
+    }
+    tokens_.push_back(token);
+    paths.push_back(tokens_.size() - 1);
+    return tokens_.size() - 1;
+  }
+
+  bool WritePaths(MutableFst<TripoliArc> *paths) {
+    std::sort(finals_.begin(), finals_.end());
+    if (finals_.size() > opts_.nbest)
+      finals_.resize(opts_.nbest);
+    if (finals_.empty())
+      return false;
+    StateId start = paths->AddState();
+    paths->SetStart(start);
+    vector<TripoliArc> arcs;
+    for (size_t i = 0; i < finals_.size(); ++i) {
+      arcs.clear();
+      for (int32 t = finals_[i].second; tokens_[t].prev >= 0; t = tokens_[t].prev)
+        arcs.push_back(tokens_[t].arc);
+      const Token &last = tokens_[finals_[i].second];
+      StateId s = start;
+      for (vector<TripoliArc>::reverse_iterator it = arcs.rbegin(); it != arcs.rend(); ++it) {
+        TripoliArc arc = *it;
+        arc.nextstate = paths->AddState();
+        paths->AddArc(s, arc);
+        s = arc.nextstate;
+      }
+      paths->SetFinal(s, Plus(paths->Final(s), fst_.Final(last.state)));
+    }
+    return true;
+  }
+
+  const Fst<TripoliArc> &fst_;
+  const BeamSearchOptions &opts_;
+  BeamSearchStats *stats_;
+  ParenLabels parens_;
+  ParenStacks stacks_;
+  vector<Token> tokens_;  // every path kept, for tracing back
+  ActiveMap active_;  // at the position being expanded
+  ActiveMap next_active_;
+  vector<pair<float, int32> > finals_;  // (cost with final weight, token)
+};
+
+}  // namespace
+
+bool BeamSearch(const Fst<TripoliArc> &fst, Span<ParenPair> parens, const BeamSearchOptions &opts,
+                MutableFst<TripoliArc> *paths, BeamSearchStats *stats) {
+  BeamSearchStats local_stats;
+  if (opts.nbest == 0) {
+    paths->DeleteStates();
+    return false;
+  }
+  Search search(fst, parens, opts, stats ? stats : &local_stats);
+  return search.Run(paths);
+}
+
+}
@@ -0,0 +1,62 @@
+/*
+ * beam-search.h
+ *
+ * Best-path and n-best search over a lazily expanded composition, keeping
+ * paren stacks so only balanced paths survive, and pruning by beam, stack
+ * depth and the number of active states.
+ */
+
+#ifndef BEAM_SEARCH_H_
+#define BEAM_SEARCH_H_
+
+#include <limits>
+
+#include "model.h"
+#include "span.h"
+
+namespace fst {
+
+struct BeamSearchOptions {
+  size_t nbest;  // paths to find
+  float beam;  // costs kept above the best at the same input position
+  size_t max_active;  // states expanded per input position; 0 for no cap
+  size_t max_depth;  // open parens on a path; 0 for no cap
+
+  BeamSearchOptions()
+          : nbest(1), beam(std::numeric_limits<float>::infinity()), max_active(0), max_depth(0) {}
+};
+
+struct BeamSearchStats {
+  size_t expanded;  // search states whose arcs were read
+  size_t positions;  // input positions reached
+  size_t max_active;  // most states expanded at one position
+  size_t pruned;  // search states dropped by the beam or the active cap
+  size_t recombined;  // paths dropped for n better ones into the same state
+  size_t unbalanced;  // arcs dropped for closing the wrong paren
+  size_t too_deep;  // arcs dropped for opening a paren past max_depth
+
+  BeamSearchStats()
+          : expanded(0), positions(0), max_active(0), pruned(0), recombined(0), unbalanced(0),
+            too_deep(0) {}
+};
+
+// Searches fst, typically a ComposeFst from TripoliCompose, for its
+// cheapest complete paths on which the parens (output labels of the
+// (open, close) pairs in parens) balance. Only states the search reaches
+// within the beam are expanded, so an on-the-fly fst is never expanded in
+// full.
+//
+// The search is synchronous in input position, the number of input labels
+// other than epsilons and parens read: the states at one position are
+// expanded cheapest first through their epsilon and paren arcs, and the
+// beam and active cap apply among them. A search state is an fst state and
+// a paren stack; each keeps its opts.nbest cheapest paths.
+//
+// Writes the paths found to paths, which is cleared, as a union from one
+// start state, cheapest first; returns false if there are none.
+bool BeamSearch(const Fst<TripoliArc> &fst, Span<ParenPair> parens, const BeamSearchOptions &opts,
+                MutableFst<TripoliArc> *paths, BeamSearchStats *stats = 0);
+
+}
+
+#endif /* BEAM_SEARCH_H_ */
@@ -0,0 +1,60 @@
+// bit-matrix.h
+//
+// Dense bit matrix with rows packed into 64-bit words, used for the
+// precomputed reachability tables in Grammar.
+
+#ifndef TRIPOLI_BIT_MATRIX_H__
+#define TRIPOLI_BIT_MATRIX_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+
+namespace fst {
+
+class BitMatrix {
+public:
+  typedef uint64_t Word;
+  static const size_t kWordBits = 64;
+
+  BitMatrix() : rows_(0), cols_(0), words_per_row_(0) {}
+  BitMatrix(size_t rows, size_t cols)
+          : rows_(rows), cols_(cols),
+            words_per_row_((cols + kWordBits - 1) / kWordBits),
+            bits_(std::vector<Word>(rows * words_per_row_)) {}
+  // A matrix over rows * WordsPerRow() words owned by someone else.
+  BitMatrix(size_t rows, size_t cols, const Word *bits)
+          : rows_(rows), cols_(cols),
+            words_per_row_((cols + kWordBits - 1) / kWordBits),
+            bits_(bits, rows * words_per_row_) {}
+
+  size_t Rows() const { return rows_; }
+  size_t Cols() const { return cols_; }
+  size_t WordsPerRow() const { return words_per_row_; }
+  size_t SizeInBytes() const { return bits_.SizeInBytes(); }
+  const Word *Data() const { return bits_.data(); }
+
+  bool Test(size_t row, size_t col) const {
+    return (bits_[row * words_per_row_ + col / kWordBits] >> (col % kWordBits)) & 1;
+  }
+
+  // Set and MutableRow only apply to a matrix that owns its bits.
+  void Set(size_t row, size_t col) {
+    bits_.Owned()[row * words_per_row_ + col / kWordBits] |= Word(1) << (col % kWordBits);
+  }
+
+  const Word *Row(size_t row) const { return bits_.data() + row * words_per_row_; }
+  Word *MutableRow(size_t row) { return bits_.Owned().data() + row * words_per_row_; }
+
+private:
+  size_t rows_;
+  size_t cols_;
+  size_t words_per_row_;  // every row is padded to a whole number of words
+  FlatArray<Word> bits_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_BIT_MATRIX_H__
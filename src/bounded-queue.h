@@ -0,0 +1,68 @@
+// bounded-queue.h
+//
+// Blocking FIFO queue of bounded capacity, for connecting the stages of a
+// pipeline so that a fast stage cannot run arbitrarily far ahead.
+
+#ifndef TRIPOLI_BOUNDED_QUEUE_H__
+#define TRIPOLI_BOUNDED_QUEUE_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace fst {
+
+template <class T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1), closed_(false) {}
+
+  // Blocks while the queue is full; false, dropping item, once closed.
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+    if (closed_)
+      return false;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty; false once it is closed and drained.
+  bool Pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty())
+      return false;
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // Wakes every waiter; items already queued can still be popped.
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+private:
+  BoundedQueue(const BoundedQueue &);  // disallow
+  void operator=(const BoundedQueue &);  // disallow
+
+  const size_t capacity_;
+  std::deque<T> items_;
+  bool closed_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_BOUNDED_QUEUE_H__
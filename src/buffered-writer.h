@@ -0,0 +1,87 @@
+// buffered-writer.h
+//
+// Formats text into a large buffer and hands it to a stream in big
+// blocks, instead of going through the stream's formatting and flushing
+// for every field.
+
+#ifndef TRIPOLI_BUFFERED_WRITER_H__
+#define TRIPOLI_BUFFERED_WRITER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+namespace fst {
+
+class BufferedWriter {
+public:
+  static const size_t kDefaultCapacity = 1 << 20;
+
+  explicit BufferedWriter(std::ostream *strm, size_t capacity = kDefaultCapacity)
+          : strm_(strm), buffer_(capacity < 64 ? 64 : capacity), size_(0) {}
+  ~BufferedWriter() { Flush(); }
+
+  void Write(const char *data, size_t n) {
+    if (size_ + n > buffer_.size()) {
+      Flush();
+      if (n > buffer_.size()) {
+        strm_->write(data, n);
+        return;
+      }
+    }
+    memcpy(&buffer_[size_], data, n);
+    size_ += n;
+  }
+
+  void Write(const char *s) { Write(s, strlen(s)); }
+
+  void Put(char c) {
+    if (size_ == buffer_.size())
+      Flush();
+    buffer_[size_++] = c;
+  }
+
+  void WriteInt(int64_t n) {
+    char digits[24];
+    char *end = digits + sizeof(digits), *p = end;
+    uint64_t u = n < 0 ? 0 - uint64_t(n) : uint64_t(n);
+    do {
+      *--p = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    if (n < 0)
+      *--p = '-';
+    Write(p, end - p);
+  }
+
+  // As an ostream prints a float by default: %g, six significant digits.
+  void WriteFloat(float f) {
+    char digits[32];
+    int n = snprintf(digits, sizeof(digits), "%g", f);
+    Write(digits, n);
+  }
+
+  // False if the stream has failed.
+  bool Flush() {
+    if (size_) {
+      strm_->write(&buffer_[0], size_);
+      size_ = 0;
+    }
+    return bool(*strm_);
+  }
+
+private:
+  BufferedWriter(const BufferedWriter &);  // disallow
+  void operator=(const BufferedWriter &);  // disallow
+
+  std::ostream *strm_;
+  std::vector<char> buffer_;
+  size_t size_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_BUFFERED_WRITER_H__
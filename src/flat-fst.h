@@ -0,0 +1,203 @@
+// flat-fst.h
+//
+// Read-only expanded FST whose states, final weights and arcs are kept in
+// flat arrays, like ConstFst, but which can also sit directly on top of the
+// sections of a mapped model file. The arcs of each state are contiguous,
+// so matchers and the rule checks of the Tripoli filter stream through
+// memory, and arcs keep any extra fields (such as RuleArc::rule).
+
+#ifndef TRIPOLI_FLAT_FST_H__
+#define TRIPOLI_FLAT_FST_H__
+
+#include <string>
+#include <vector>
+
+#include <fst/fst.h>
+#include <fst/expanded-fst.h>
+
+#include "span.h"
+
+namespace fst {
+
+template <class A>
+class FlatFstImpl : public FstImpl<A> {
+public:
+  using FstImpl<A>::SetType;
+  using FstImpl<A>::SetProperties;
+  using FstImpl<A>::Properties;
+
+  typedef A Arc;
+  typedef typename A::Weight Weight;
+  typedef typename A::StateId StateId;
+
+  // Copies fst, whose states must be numbered 0 to NumStates() - 1.
+  explicit FlatFstImpl(const ExpandedFst<A> &fst) : start_(fst.Start()) {
+    SetType("flat");
+    StateId nstates = fst.NumStates();
+    std::vector<Weight> &finals = finals_.Owned();
+    std::vector<uint64> &offsets = offsets_.Owned();
+    std::vector<A> &arcs = arcs_.Owned();
+    finals.reserve(nstates);
+    offsets.reserve(nstates + 1);
+    offsets.push_back(0);
+    for (StateId s = 0; s < nstates; ++s) {
+      finals.push_back(fst.Final(s));
+      for (ArcIterator< ExpandedFst<A> > aiter(fst, s); !aiter.Done(); aiter.Next())
+        arcs.push_back(aiter.Value());
+      offsets.push_back(arcs.size());
+    }
+    SetProperties(ComputeProperties());
+  }
+
+  FlatFstImpl(StateId start, uint64 properties, const FlatArray<Weight> &finals,
+              const FlatArray<uint64> &offsets, const FlatArray<A> &arcs)
+          : start_(start), finals_(finals), offsets_(offsets), arcs_(arcs) {
+    SetType("flat");
+    SetProperties(properties);
+  }
+
+  StateId Start() const { return start_; }
+  Weight Final(StateId s) const { return finals_[s]; }
+  StateId NumStates() const { return finals_.size(); }
+  size_t NumArcs(StateId s) const { return offsets_[s + 1] - offsets_[s]; }
+
+  size_t NumInputEpsilons(StateId s) const {
+    size_t n = 0;
+    for (const A *arc = Arcs(s), *end = arc + NumArcs(s); arc != end; ++arc)
+      n += arc->ilabel == 0;
+    return n;
+  }
+
+  size_t NumOutputEpsilons(StateId s) const {
+    size_t n = 0;
+    for (const A *arc = Arcs(s), *end = arc + NumArcs(s); arc != end; ++arc)
+      n += arc->olabel == 0;
+    return n;
+  }
+
+  const A *Arcs(StateId s) const { return arcs_.data() + offsets_[s]; }
+
+  const FlatArray<Weight> &Finals() const { return finals_; }
+  const FlatArray<uint64> &Offsets() const { return offsets_; }
+  const FlatArray<A> &AllArcs() const { return arcs_; }
+
+  void InitStateIterator(StateIteratorData<A> *data) const {
+    data->base = 0;
+    data->nstates = NumStates();
+  }
+
+  void InitArcIterator(StateId s, ArcIteratorData<A> *data) const {
+    data->base = 0;
+    data->arcs = Arcs(s);
+    data->narcs = NumArcs(s);
+    data->ref_count = 0;
+  }
+
+private:
+  uint64 ComputeProperties() const {
+    uint64 props = kExpanded | kAcceptor | kILabelSorted | kOLabelSorted;
+    for (StateId s = 0; s < NumStates(); ++s) {
+      const A *arcs = Arcs(s);
+      for (size_t i = 0; i < NumArcs(s); ++i) {
+        if (arcs[i].ilabel != arcs[i].olabel)
+          props &= ~kAcceptor;
+        if (i > 0 && arcs[i - 1].ilabel > arcs[i].ilabel)
+          props &= ~kILabelSorted;
+        if (i > 0 && arcs[i - 1].olabel > arcs[i].olabel)
+          props &= ~kOLabelSorted;
+      }
+    }
+    return props;
+  }
+
+  StateId start_;
+  FlatArray<Weight> finals_;  // indexed by StateId
+  FlatArray<uint64> offsets_;  // arcs of s are arcs_[offsets_[s], offsets_[s+1])
+  FlatArray<A> arcs_;
+};
+
+template <class A>
+class FlatFst : public ImplToExpandedFst< FlatFstImpl<A> > {
+public:
+  friend class ArcIterator< FlatFst<A> >;
+  friend class StateIterator< FlatFst<A> >;
+
+  typedef A Arc;
+  typedef typename A::Weight Weight;
+  typedef typename A::StateId StateId;
+  typedef FlatFstImpl<A> Impl;
+
+  explicit FlatFst(const ExpandedFst<A> &fst) : ImplToExpandedFst<Impl>(new Impl(fst)) {}
+
+  FlatFst(StateId start, uint64 properties, const FlatArray<Weight> &finals,
+          const FlatArray<uint64> &offsets, const FlatArray<A> &arcs)
+          : ImplToExpandedFst<Impl>(new Impl(start, properties, finals, offsets, arcs)) {}
+
+  FlatFst(const FlatFst<A> &fst, bool safe = false) : ImplToExpandedFst<Impl>(fst) {}
+
+  virtual FlatFst<A> *Copy(bool safe = false) const { return new FlatFst<A>(*this, safe); }
+
+  virtual void InitStateIterator(StateIteratorData<A> *data) const {
+    GetImpl()->InitStateIterator(data);
+  }
+
+  virtual void InitArcIterator(StateId s, ArcIteratorData<A> *data) const {
+    GetImpl()->InitArcIterator(s, data);
+  }
+
+  const A *Arcs(StateId s) const { return GetImpl()->Arcs(s); }
+
+  const FlatArray<Weight> &Finals() const { return GetImpl()->Finals(); }
+  const FlatArray<uint64> &Offsets() const { return GetImpl()->Offsets(); }
+  const FlatArray<A> &AllArcs() const { return GetImpl()->AllArcs(); }
+
+private:
+  Impl *GetImpl() const { return ImplToFst<Impl, ExpandedFst<A> >::GetImpl(); }
+
+  void operator=(const FlatFst<A> &fst);  // disallow
+};
+
+// Specialized for speed, as for ConstFst.
+template <class A>
+class StateIterator< FlatFst<A> > {
+public:
+  typedef typename A::StateId StateId;
+
+  explicit StateIterator(const FlatFst<A> &fst) : nstates_(fst.NumStates()), s_(0) {}
+
+  bool Done() const { return s_ >= nstates_; }
+  StateId Value() const { return s_; }
+  void Next() { ++s_; }
+  void Reset() { s_ = 0; }
+
+private:
+  StateId nstates_;
+  StateId s_;
+};
+
+template <class A>
+class ArcIterator< FlatFst<A> > {
+public:
+  typedef typename A::StateId StateId;
+
+  ArcIterator(const FlatFst<A> &fst, StateId s)
+          : arcs_(fst.Arcs(s)), narcs_(fst.NumArcs(s)), i_(0) {}
+
+  bool Done() const { return i_ >= narcs_; }
+  const A &Value() const { return arcs_[i_]; }
+  void Next() { ++i_; }
+  size_t Position() const { return i_; }
+  void Reset() { i_ = 0; }
+  void Seek(size_t a) { i_ = a; }
+  uint32 Flags() const { return kArcValueFlags; }
+  void SetFlags(uint32 f, uint32 m) {}
+
+private:
+  const A *arcs_;
+  size_t narcs_;
+  size_t i_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_FLAT_FST_H__
@@ -0,0 +1,75 @@
+// future-costs.h
+//
+// The cheapest cost from every state of an FST to a final state, the
+// heuristic tables of the A* search.
+
+#ifndef TRIPOLI_FUTURE_COSTS_H__
+#define TRIPOLI_FUTURE_COSTS_H__
+
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <fst/fst.h>
+#include <fst/expanded-fst.h>
+
+namespace fst {
+
+// (*costs)[s] is the least total tropical weight of a path from s through
+// to a final weight, or infinity if no final state is reachable from s.
+// A Dijkstra search backwards from the final states, over reversed arcs;
+// weights should not be negative, but a negative one only costs extra
+// passes, as an improved state is searched again.
+template <class F>
+void FutureCosts(const F &fst, std::vector<float> *costs) {
+  typedef typename F::Arc Arc;
+  typedef typename Arc::StateId StateId;
+  typedef std::pair<float, StateId> Entry;
+  const float kInfinity = std::numeric_limits<float>::infinity();
+
+  StateId nstates = fst.NumStates();
+  std::vector<size_t> offsets(nstates + 1, 0);  // reversed arcs, by destination
+  for (StateId s = 0; s < nstates; ++s) {
+    for (ArcIterator<F> aiter(fst, s); !aiter.Done(); aiter.Next())
+      ++offsets[aiter.Value().nextstate + 1];
+  }
+  for (StateId s = 0; s < nstates; ++s)
+    offsets[s + 1] += offsets[s];
+  std::vector<std::pair<StateId, float> > reversed(offsets[nstates]);  // (source, weight)
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (StateId s = 0; s < nstates; ++s) {
+    for (ArcIterator<F> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      reversed[fill[arc.nextstate]++] = std::make_pair(s, arc.weight.Value());
+    }
+  }
+
+  costs->assign(nstates, kInfinity);
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+  for (StateId s = 0; s < nstates; ++s) {
+    float weight = fst.Final(s).Value();
+    if (weight != kInfinity) {
+      (*costs)[s] = weight;
+      queue.push(Entry(weight, s));
+    }
+  }
+  while (!queue.empty()) {
+    Entry entry = queue.top();
+    queue.pop();
+    if (entry.first > (*costs)[entry.second])
+      continue;  // stale
+    for (size_t i = offsets[entry.second]; i < offsets[entry.second + 1]; ++i) {
+      float cost = entry.first + reversed[i].second;
+      if (cost < (*costs)[reversed[i].first]) {
+        (*costs)[reversed[i].first] = cost;
+        queue.push(Entry(cost, reversed[i].first));
+      }
+    }
+  }
+}
+
+}  // namespace fst
+
+#endif  // TRIPOLI_FUTURE_COSTS_H__
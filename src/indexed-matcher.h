@@ -0,0 +1,402 @@
+// indexed-matcher.h
+//
+// Matching on a FlatFst, such as the model's PDT, whose unigram and busier
+// context states have thousands of arcs: a LabelIndex maps each label of
+// such a state straight to its run of arcs, and IndexedMatcher uses it in
+// place of a binary search, with the paren handling of ParenMatcher.
+
+#ifndef TRIPOLI_INDEXED_MATCHER_H__
+#define TRIPOLI_INDEXED_MATCHER_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <fst/fst.h>
+#include <fst/matcher.h>
+#include <fst/extensions/pdt/compose.h>
+
+#include "span.h"
+
+namespace fst {
+
+// For each state with at least a minimum number of arcs, a table from
+// input label to the run of the state's arcs with that label. The arcs
+// must be sorted on input labels. A state's table is indexed directly by
+// label when its labels are dense, and is otherwise an open-addressed hash
+// table at most half full. All tables live in one flat array, so an index
+// can be written to and mapped from a compiled model.
+class LabelIndex {
+public:
+  static const size_t kDefaultMinArcs = 64;
+
+  struct Entry {
+    int32_t kind;  // DIRECT or HASHED
+    int32_t base;  // label of slot 0, for DIRECT
+    uint32_t size;  // slots; a power of two for HASHED
+    uint32_t reserved;
+    uint64_t offset;  // of slot 0 in the slot array
+  };
+
+  // Arcs [begin, begin + count) of the state are those labelled label; an
+  // empty slot has count 0 and, in a hash table, label kNoLabel.
+  struct Slot {
+    int32_t label;
+    uint32_t begin;
+    uint32_t count;
+  };
+
+  enum Kind { DIRECT = 0, HASHED = 1 };
+
+  LabelIndex() {}
+
+  // Indexes the states of fst with at least min_arcs arcs; nothing if its
+  // arcs are not sorted on input labels.
+  template <class F>
+  explicit LabelIndex(const F &fst, size_t min_arcs = kDefaultMinArcs) {
+    std::vector<int32_t> &entry_of = entry_of_.Owned();
+    entry_of.resize(fst.NumStates(), -1);
+    if (!fst.Properties(kILabelSorted, false))
+      return;
+    std::vector<Slot> runs;
+    for (typename F::StateId s = 0; s < fst.NumStates(); ++s) {
+      if (fst.NumArcs(s) < min_arcs)
+        continue;
+      runs.clear();
+      const typename F::Arc *arcs = fst.Arcs(s);
+      for (size_t i = 0; i < fst.NumArcs(s); ++i) {
+        if (runs.empty() || runs.back().label != arcs[i].ilabel) {
+          Slot run = {int32_t(arcs[i].ilabel), uint32_t(i), 0};
+          runs.push_back(run);
+        }
+        ++runs.back().count;
+      }
+      entry_of[s] = entries_.Owned().size();
+      Add(runs);
+    }
+  }
+
+  // Views tables written by a model, as from States(), Entries() and Slots().
+  LabelIndex(const FlatArray<int32_t> &entry_of, const FlatArray<Entry> &entries,
+             const FlatArray<Slot> &slots)
+          : entry_of_(entry_of), entries_(entries), slots_(slots) {}
+
+  bool Indexed(int64_t s) const {
+    return s >= 0 && size_t(s) < entry_of_.size() && entry_of_[s] >= 0;
+  }
+
+  // Sets [*begin, *end) to the arcs of s labelled label, counted from the
+  // first arc of s; returns false, leaving them alone, if s is not indexed.
+  bool Find(int64_t s, int64_t label, size_t *begin, size_t *end) const {
+    if (!Indexed(s))
+      return false;
+    const Entry &entry = entries_[entry_of_[s]];
+    const Slot *slots = slots_.data() + entry.offset;
+    const Slot *slot = 0;
+    if (entry.kind == DIRECT) {
+      uint64_t i = uint64_t(label - entry.base);
+      if (label >= entry.base && i < entry.size)
+        slot = slots + i;
+    } else {
+      uint32_t mask = entry.size - 1;
+      for (uint32_t i = Hash(label) & mask; slots[i].label != kNoLabel; i = (i + 1) & mask) {
+        if (slots[i].label == label) {
+          slot = slots + i;
+          break;
+        }
+      }
+    }
+    *begin = slot ? slot->begin : 0;
+    *end = slot ? slot->begin + slot->count : 0;
+    return true;
+  }
+
+  size_t NumIndexed() const { return entries_.size(); }
+
+  // By state: the state's entry, or -1 if it is not indexed.
+  const FlatArray<int32_t> &States() const { return entry_of_; }
+  const FlatArray<Entry> &Entries() const { return entries_; }
+  const FlatArray<Slot> &Slots() const { return slots_; }
+
+private:
+  static uint32_t Hash(int64_t label) {
+    uint32_t h = uint32_t(label) * 0x9E3779B1u;
+    return h ^ (h >> 16);
+  }
+
+  // Adds the table of a state whose label runs, in label order, are runs.
+  void Add(const std::vector<Slot> &runs) {
+    std::vector<Slot> &slots = slots_.Owned();
+    int64_t range = int64_t(runs.back().label) - runs.front().label + 1;
+    Entry entry = {DIRECT, runs.front().label, 0, 0, slots.size()};
+    if (range <= 4 * int64_t(runs.size())) {
+      entry.size = range;
+      Slot empty = {kNoLabel, 0, 0};
+      slots.resize(slots.size() + range, empty);
+      for (size_t i = 0; i < runs.size(); ++i)
+        slots[entry.offset + runs[i].label - entry.base] = runs[i];
+    } else {
+      entry.kind = HASHED;
+      entry.base = 0;
+      entry.size = 1;
+      while (entry.size < 2 * runs.size())
+        entry.size *= 2;
+      Slot empty = {kNoLabel, 0, 0};
+      slots.resize(slots.size() + entry.size, empty);
+      uint32_t mask = entry.size - 1;
+      for (size_t i = 0; i < runs.size(); ++i) {
+        uint32_t j = Hash(runs[i].label) & mask;
+        while (slots[entry.offset + j].label != kNoLabel)
+          j = (j + 1) & mask;
+        slots[entry.offset + j] = runs[i];
+      }
+    }
+    entries_.Owned().push_back(entry);
+  }
+
+  FlatArray<int32_t> entry_of_;
+  FlatArray<Entry> entries_;
+  FlatArray<Slot> slots_;
+};
+
+// Checks a run of arcs an IndexedMatcher has just found, all out of state
+// s with label label (as arcs [begin, end) of s), before any is returned:
+// bit i % 64 of (*mask)[i / 64] is set iff arc begin + i may be returned.
+class ArcPrefilter {
+public:
+  virtual ~ArcPrefilter() {}
+  virtual void AcceptArcs(int64_t s, int64_t label, size_t begin, size_t end,
+                          std::vector<uint64_t> *mask) = 0;
+};
+
+// A matcher on F, a FlatFst or anything else with Arcs(s), that finds
+// labels through a LabelIndex of F where it covers the state and by binary
+// search otherwise; without an index it is a sorted matcher. The index is
+// only used when matching on input labels and must outlive the matcher.
+//
+// Parens behave as in ParenMatcher with the kParenLoop and kParenList
+// flags: finding a paren label finds only an implicit loop, so that a
+// paren on the other side can pass; finding kNoLabel finds the arcs
+// labelled with epsilon and then every arc labelled with a paren.
+//
+// With a prefilter, a run of at least kMinPrefilterRun arcs found for any
+// other label on the input side is passed to it, and only the arcs it
+// accepts are returned. A copy has no prefilter.
+template <class F>
+class IndexedMatcher {
+public:
+  typedef F FST;
+  typedef typename F::Arc Arc;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+
+  static const size_t kMinPrefilterRun = 8;
+
+  IndexedMatcher(const F &fst, MatchType match_type, const LabelIndex *index = 0,
+                 uint32 flags = kParenLoop | kParenList)
+          : fst_(fst.Copy()), index_(match_type == MATCH_INPUT ? index : 0),
+            match_type_(match_type), flags_(flags), min_paren_(kNoLabel), max_paren_(kNoLabel),
+            prefilter_(0), state_(kNoStateId), arcs_(0), narcs_(0) {
+    if (match_type == MATCH_INPUT) {
+      loop_.ilabel = kNoLabel;
+      loop_.olabel = 0;
+    } else {
+      loop_.ilabel = 0;
+      loop_.olabel = kNoLabel;
+    }
+    loop_.weight = Weight::One();
+    loop_.nextstate = kNoStateId;
+    Clear();
+  }
+
+  IndexedMatcher(const IndexedMatcher<F> &matcher, bool safe = false)
+          : fst_(matcher.fst_->Copy(safe)), index_(matcher.index_),
+            match_type_(matcher.match_type_), flags_(matcher.flags_),
+            parens_(matcher.parens_), min_paren_(matcher.min_paren_),
+            max_paren_(matcher.max_paren_), prefilter_(0), state_(kNoStateId), arcs_(0), narcs_(0),
+            loop_(matcher.loop_) {
+    Clear();
+  }
+
+  IndexedMatcher<F> *Copy(bool safe = false) const { return new IndexedMatcher<F>(*this, safe); }
+
+  MatchType Type(bool test) const {
+    if (match_type_ == MATCH_NONE)
+      return MATCH_NONE;
+    uint64 sorted = match_type_ == MATCH_INPUT ? kILabelSorted : kOLabelSorted;
+    return fst_->Properties(sorted, test) ? match_type_ : MATCH_NONE;
+  }
+
+  void SetState(StateId s) {
+    if (state_ == s)
+      return;
+    state_ = s;
+    arcs_ = fst_->Arcs(s);
+    narcs_ = fst_->NumArcs(s);
+    loop_.nextstate = s;
+    Clear();
+  }
+
+  bool Find(Label label) {
+    Clear();
+    if (label == kNoLabel) {
+      Range(0, &pos_, &end_);
+      if ((flags_ & kParenList) && min_paren_ != kNoLabel) {
+        paren_pos_ = LowerBound(min_paren_);
+        paren_end_ = LowerBound(max_paren_ + 1);
+        SkipToParen();
+      }
+    } else if (label == 0) {
+      current_loop_ = true;
+      Range(0, &pos_, &end_);
+    } else if ((flags_ & kParenLoop) && IsParen(label)) {
+      current_loop_ = true;
+    } else {
+      Range(label, &pos_, &end_);
+      if (prefilter_ && match_type_ == MATCH_INPUT && end_ - pos_ >= kMinPrefilterRun) {
+        prefilter_->AcceptArcs(state_, label, pos_, end_, &accepted_);
+        run_begin_ = pos_;
+        filtered_ = true;
+        SkipRejected();
+      }
+    }
+    return !Done();
+  }
+
+  bool Done() const {
+    return !current_loop_ && pos_ == end_ && paren_pos_ == paren_end_;
+  }
+
+  const Arc &Value() const {
+    if (current_loop_)
+      return loop_;
+    return pos_ != end_ ? arcs_[pos_] : arcs_[paren_pos_];
+  }
+
+  void Next() {
+    if (current_loop_) {
+      current_loop_ = false;
+    } else if (pos_ != end_) {
+      ++pos_;
+      if (filtered_)
+        SkipRejected();
+    } else {
+      ++paren_pos_;
+      SkipToParen();
+    }
+  }
+
+  const F &GetFst() const { return *fst_; }
+
+  uint64 Properties(uint64 props) const { return props; }
+
+  uint32 Flags() const { return 0; }
+
+  ssize_t Priority(StateId s) { return fst_->NumArcs(s); }
+
+  // Owned by the caller; it must outlive the matcher, or be replaced.
+  void SetPrefilter(ArcPrefilter *prefilter) { prefilter_ = prefilter; }
+
+  void AddOpenParen(Label label) { AddParen(label); }
+  void AddCloseParen(Label label) { AddParen(label); }
+
+  bool IsParen(Label label) const {
+    return label > 0 && size_t(label) < parens_.size() && parens_[label];
+  }
+
+private:
+  Label ArcLabel(const Arc &arc) const {
+    return match_type_ == MATCH_INPUT ? arc.ilabel : arc.olabel;
+  }
+
+  void Clear() {
+    current_loop_ = false;
+    filtered_ = false;
+    pos_ = end_ = 0;
+    paren_pos_ = paren_end_ = 0;
+  }
+
+  // The first arc of the state whose label is not less than label
+  size_t LowerBound(Label label) const {
+    size_t lo = 0, hi = narcs_;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (ArcLabel(arcs_[mid]) < label)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
+
+  void Range(Label label, size_t *begin, size_t *end) const {
+    if (index_ && index_->Find(state_, label, begin, end))
+      return;
+    *begin = LowerBound(label);
+    *end = *begin;
+    while (*end < narcs_ && ArcLabel(arcs_[*end]) == label)
+      ++*end;
+  }
+
+  void SkipRejected() {
+    while (pos_ != end_) {
+      size_t i = pos_ - run_begin_;
+      if ((accepted_[i / 64] >> (i % 64)) & 1)
+        return;
+      ++pos_;
+    }
+  }
+
+  // Parens are usually a few ranges of labels, so the arcs with labels
+  // between the least and greatest paren are mostly parens themselves.
+  void SkipToParen() {
+    while (paren_pos_ != paren_end_ && !IsParen(ArcLabel(arcs_[paren_pos_])))
+      ++paren_pos_;
+  }
+
+  void AddParen(Label label) {
+    if (label <= 0)
+      return;
+    if (size_t(label) >= parens_.size())
+      parens_.resize(label + 1, false);
+    parens_[label] = true;
+    if (min_paren_ == kNoLabel || label < min_paren_)
+      min_paren_ = label;
+    if (max_paren_ == kNoLabel || label > max_paren_)
+      max_paren_ = label;
+  }
+
+  std::unique_ptr<const F> fst_;
+  const LabelIndex *index_;
+  MatchType match_type_;
+  uint32 flags_;
+  std::vector<bool> parens_;  // by label
+  Label min_paren_, max_paren_;
+  ArcPrefilter *prefilter_;
+  StateId state_;
+  const Arc *arcs_;
+  size_t narcs_;
+  Arc loop_;
+  bool current_loop_;
+  size_t pos_, end_;  // the arcs found with the label
+  bool filtered_;  // whether accepted_ applies to them
+  size_t run_begin_;  // of the arcs accepted_ covers
+  std::vector<uint64_t> accepted_;
+  size_t paren_pos_, paren_end_;  // arcs that may be parens, after kNoLabel
+  void operator=(const IndexedMatcher<F> &);  // disallow
+};
+
+// Sets the prefilter of a matcher that takes one; any other is left alone.
+template <class M>
+inline void AttachPrefilter(M *matcher, ArcPrefilter *prefilter) {}
+
+template <class F>
+inline void AttachPrefilter(IndexedMatcher<F> *matcher, ArcPrefilter *prefilter) {
+  matcher->SetPrefilter(prefilter);
+}
+
+}  // namespace fst
+
+#endif  // TRIPOLI_INDEXED_MATCHER_H__
@@ -0,0 +1,338 @@
+// linear-fst.h
+//
+// Read-only acceptor of a single chain of arcs, such as an input sentence:
+// state i has one arc, labelled with token i, to state i + 1, and the last
+// state is final. Only the labels are stored (and the weights, if any is
+// not One), so an input costs 4 bytes per token, and the labels can be a
+// view of a caller's token buffer. LinearMatcher finds a label by
+// comparing it with the one arc of the state.
+
+#ifndef TRIPOLI_LINEAR_FST_H__
+#define TRIPOLI_LINEAR_FST_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fst/fst.h>
+#include <fst/expanded-fst.h>
+#include <fst/matcher.h>
+#include <fst/extensions/pdt/compose.h>
+
+#include "span.h"
+
+namespace fst {
+
+template <class A>
+class LinearFstImpl : public FstImpl<A> {
+public:
+  using FstImpl<A>::SetType;
+  using FstImpl<A>::SetProperties;
+  using FstImpl<A>::Properties;
+
+  typedef A Arc;
+  typedef typename A::Label Label;
+  typedef typename A::Weight Weight;
+  typedef typename A::StateId StateId;
+
+  // weights is empty, for arcs weighing One, or has a weight per label.
+  LinearFstImpl(const FlatArray<Label> &labels, const FlatArray<Weight> &weights,
+                const Weight &final_weight)
+          : labels_(labels), weights_(weights), final_(final_weight) {
+    SetType("linear");
+    SetProperties(ComputeProperties());
+  }
+
+  StateId Start() const { return 0; }
+  Weight Final(StateId s) const { return size_t(s) == labels_.size() ? final_ : Weight::Zero(); }
+  StateId NumStates() const { return labels_.size() + 1; }
+  size_t NumArcs(StateId s) const { return size_t(s) < labels_.size(); }
+  size_t NumInputEpsilons(StateId s) const { return NumArcs(s) && labels_[s] == 0; }
+  size_t NumOutputEpsilons(StateId s) const { return NumInputEpsilons(s); }
+
+  // The label and weight of the arc out of s < NumStates() - 1
+  Label ArcLabel(StateId s) const { return labels_[s]; }
+  Weight ArcWeight(StateId s) const { return weights_.empty() ? Weight::One() : weights_[s]; }
+  A MakeArc(StateId s) const { return A(labels_[s], labels_[s], ArcWeight(s), s + 1); }
+
+  const FlatArray<Label> &Labels() const { return labels_; }
+  size_t SizeInBytes() const { return labels_.SizeInBytes() + weights_.SizeInBytes(); }
+
+  void InitStateIterator(StateIteratorData<A> *data) const {
+    data->base = 0;
+    data->nstates = NumStates();
+  }
+
+  void InitArcIterator(StateId s, ArcIteratorData<A> *data) const;
+
+private:
+  uint64 ComputeProperties() const {
+    uint64 props = kExpanded | kAcceptor | kIDeterministic | kODeterministic | kILabelSorted |
+                   kOLabelSorted | kAcyclic | kInitialAcyclic | kTopSorted | kAccessible;
+    bool epsilons = false;
+    for (size_t i = 0; i < labels_.size() && !epsilons; ++i)
+      epsilons = labels_[i] == 0;
+    props |= epsilons ? kEpsilons | kIEpsilons | kOEpsilons
+                      : kNoEpsilons | kNoIEpsilons | kNoOEpsilons;
+    bool weighted = final_ != Weight::One();
+    for (size_t i = 0; i < weights_.size() && !weighted; ++i)
+      weighted = weights_[i] != Weight::One();
+    props |= weighted ? kWeighted : kUnweighted;
+    props |= final_ != Weight::Zero() ? kCoAccessible | kString : kNotCoAccessible | kNotString;
+    return props;
+  }
+
+  FlatArray<Label> labels_;
+  FlatArray<Weight> weights_;  // empty if every arc weighs One
+  Weight final_;
+};
+
+// For the generic ArcIterator, which has no room for an arc that is not
+// stored anywhere.
+template <class A>
+class LinearArcIteratorBase : public ArcIteratorBase<A> {
+public:
+  LinearArcIteratorBase(const LinearFstImpl<A> &impl, typename A::StateId s)
+          : narcs_(impl.NumArcs(s)), i_(0) {
+    if (narcs_)
+      arc_ = impl.MakeArc(s);
+  }
+
+private:
+  bool Done_() const { return i_ >= narcs_; }
+  const A &Value_() const { return arc_; }
+  void Next_() { ++i_; }
+  size_t Position_() const { return i_; }
+  void Reset_() { i_ = 0; }
+  void Seek_(size_t a) { i_ = a; }
+  uint32 Flags_() const { return kArcValueFlags; }
+  void SetFlags_(uint32 f, uint32 m) {}
+
+  A arc_;
+  size_t narcs_;
+  size_t i_;
+};
+
+template <class A>
+void LinearFstImpl<A>::InitArcIterator(StateId s, ArcIteratorData<A> *data) const {
+  data->base = new LinearArcIteratorBase<A>(*this, s);
+}
+
+template <class A>
+class LinearFst : public ImplToExpandedFst< LinearFstImpl<A> > {
+public:
+  friend class ArcIterator< LinearFst<A> >;
+  friend class StateIterator< LinearFst<A> >;
+
+  typedef A Arc;
+  typedef typename A::Label Label;
+  typedef typename A::Weight Weight;
+  typedef typename A::StateId StateId;
+  typedef LinearFstImpl<A> Impl;
+
+  // Over labels, copied or, as FlatArray<Label>(data, size), a view of
+  // the caller's buffer, which must then outlive the FST and its copies.
+  explicit LinearFst(const FlatArray<Label> &labels,
+                     const FlatArray<Weight> &weights = FlatArray<Weight>(),
+                     const Weight &final_weight = Weight::One())
+          : ImplToExpandedFst<Impl>(new Impl(labels, weights, final_weight)) {}
+
+  explicit LinearFst(std::vector<Label> &&labels, std::vector<Weight> &&weights = std::vector<Weight>(),
+                     const Weight &final_weight = Weight::One())
+          : ImplToExpandedFst<Impl>(new Impl(FlatArray<Label>(std::move(labels)),
+                                             FlatArray<Weight>(std::move(weights)), final_weight)) {}
+
+  LinearFst(const LinearFst<A> &fst, bool safe = false) : ImplToExpandedFst<Impl>(fst) {}
+
+  virtual LinearFst<A> *Copy(bool safe = false) const { return new LinearFst<A>(*this, safe); }
+
+  virtual void InitStateIterator(StateIteratorData<A> *data) const {
+    GetImpl()->InitStateIterator(data);
+  }
+
+  virtual void InitArcIterator(StateId s, ArcIteratorData<A> *data) const {
+    GetImpl()->InitArcIterator(s, data);
+  }
+
+  Label ArcLabel(StateId s) const { return GetImpl()->ArcLabel(s); }
+  Weight ArcWeight(StateId s) const { return GetImpl()->ArcWeight(s); }
+  A MakeArc(StateId s) const { return GetImpl()->MakeArc(s); }
+  const FlatArray<Label> &Labels() const { return GetImpl()->Labels(); }
+
+  // The labels' bytes, and the weights' if any arc is weighted
+  size_t SizeInBytes() const { return GetImpl()->SizeInBytes(); }
+
+private:
+  Impl *GetImpl() const { return ImplToFst<Impl, ExpandedFst<A> >::GetImpl(); }
+
+  void operator=(const LinearFst<A> &fst);  // disallow
+};
+
+// Specialized for speed, as for ConstFst.
+template <class A>
+class StateIterator< LinearFst<A> > {
+public:
+  typedef typename A::StateId StateId;
+
+  explicit StateIterator(const LinearFst<A> &fst) : nstates_(fst.NumStates()), s_(0) {}
+
+  bool Done() const { return s_ >= nstates_; }
+  StateId Value() const { return s_; }
+  void Next() { ++s_; }
+  void Reset() { s_ = 0; }
+
+private:
+  StateId nstates_;
+  StateId s_;
+};
+
+template <class A>
+class ArcIterator< LinearFst<A> > {
+public:
+  typedef typename A::StateId StateId;
+
+  ArcIterator(const LinearFst<A> &fst, StateId s) : narcs_(fst.NumArcs(s)), i_(0) {
+    if (narcs_)
+      arc_ = fst.MakeArc(s);
+  }
+
+  bool Done() const { return i_ >= narcs_; }
+  const A &Value() const { return arc_; }
+  void Next() { ++i_; }
+  size_t Position() const { return i_; }
+  void Reset() { i_ = 0; }
+  void Seek(size_t a) { i_ = a; }
+  uint32 Flags() const { return kArcValueFlags; }
+  void SetFlags(uint32 f, uint32 m) {}
+
+private:
+  A arc_;
+  size_t narcs_;
+  size_t i_;
+};
+
+// A matcher on a LinearFst: each state has at most one arc, so Find is a
+// comparison with its label. Parens behave as in IndexedMatcher (and
+// ParenMatcher with kParenLoop and kParenList): finding a paren label
+// finds only an implicit loop, and finding kNoLabel finds the arc if it is
+// an epsilon or a paren.
+template <class F>
+class LinearMatcher {
+public:
+  typedef F FST;
+  typedef typename F::Arc Arc;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+
+  LinearMatcher(const F &fst, MatchType match_type, uint32 flags = kParenLoop | kParenList)
+          : fst_(fst.Copy()), match_type_(match_type), flags_(flags), state_(kNoStateId),
+            has_arc_(false) {
+    if (match_type == MATCH_INPUT) {
+      loop_.ilabel = kNoLabel;
+      loop_.olabel = 0;
+    } else {
+      loop_.ilabel = 0;
+      loop_.olabel = kNoLabel;
+    }
+    loop_.weight = Weight::One();
+    loop_.nextstate = kNoStateId;
+    Clear();
+  }
+
+  LinearMatcher(const LinearMatcher<F> &matcher, bool safe = false)
+          : fst_(matcher.fst_->Copy(safe)), match_type_(matcher.match_type_),
+            flags_(matcher.flags_), parens_(matcher.parens_), state_(kNoStateId),
+            has_arc_(false), loop_(matcher.loop_) {
+    Clear();
+  }
+
+  LinearMatcher<F> *Copy(bool safe = false) const { return new LinearMatcher<F>(*this, safe); }
+
+  // A chain is sorted either way.
+  MatchType Type(bool test) const { return match_type_; }
+
+  void SetState(StateId s) {
+    if (state_ == s)
+      return;
+    state_ = s;
+    has_arc_ = fst_->NumArcs(s) > 0;
+    if (has_arc_)
+      arc_ = fst_->MakeArc(s);
+    loop_.nextstate = s;
+    Clear();
+  }
+
+  bool Find(Label label) {
+    Clear();
+    if (!has_arc_) {
+      current_loop_ = label == 0 || ((flags_ & kParenLoop) && IsParen(label));
+    } else if (label == kNoLabel) {
+      current_arc_ = arc_.ilabel == 0 || ((flags_ & kParenList) && IsParen(arc_.ilabel));
+    } else if (label == 0) {
+      current_loop_ = true;
+      current_arc_ = arc_.ilabel == 0;
+    } else if ((flags_ & kParenLoop) && IsParen(label)) {
+      current_loop_ = true;
+    } else {
+      current_arc_ = arc_.ilabel == label;
+    }
+    return !Done();
+  }
+
+  bool Done() const { return !current_loop_ && !current_arc_; }
+
+  const Arc &Value() const { return current_loop_ ? loop_ : arc_; }
+
+  void Next() {
+    if (current_loop_)
+      current_loop_ = false;
+    else
+      current_arc_ = false;
+  }
+
+  const F &GetFst() const { return *fst_; }
+
+  uint64 Properties(uint64 props) const { return props; }
+
+  uint32 Flags() const { return 0; }
+
+  ssize_t Priority(StateId s) { return fst_->NumArcs(s); }
+
+  void AddOpenParen(Label label) { AddParen(label); }
+  void AddCloseParen(Label label) { AddParen(label); }
+
+  bool IsParen(Label label) const {
+    return label > 0 && size_t(label) < parens_.size() && parens_[label];
+  }
+
+private:
+  void Clear() {
+    current_loop_ = false;
+    current_arc_ = false;
+  }
+
+  void AddParen(Label label) {
+    if (label <= 0)
+      return;
+    if (size_t(label) >= parens_.size())
+      parens_.resize(label + 1, false);
+    parens_[label] = true;
+  }
+
+  std::unique_ptr<const F> fst_;
+  MatchType match_type_;
+  uint32 flags_;
+  std::vector<bool> parens_;  // by label
+  StateId state_;
+  bool has_arc_;
+  Arc arc_;  // out of state_, if has_arc_
+  Arc loop_;
+  bool current_loop_;
+  bool current_arc_;
+  void operator=(const LinearMatcher<F> &);  // disallow
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_LINEAR_FST_H__
@@ -32,13 +32,23 @@
 
 #include "tripoli-compile.h"
 #include "tripoli.h"
-#include "states.h"
-#include "readers.h"
+#include "model.h"
+#include "thread-pool.h"
+#include "a-star.h"
+#include "batch.h"
+#include "beam-search.h"
+#include "output.h"
+#include "stats.h"
+#include <future>
+#include <iterator>
 #include <fst/script/fst-class.h>
 #include <fst/script/compile-impl.h>
 #include <fst/extensions/pdt/compose.h>
 #include <fst/extensions/pdt/pdtscript.h>
 
+using namespace std;
+using namespace fst;
+
 DEFINE_bool(acceptor, false, "Input in acceptor format");
 DEFINE_string(arc_type, "standard", "Output arc type");
 DEFINE_string(fst_type, "vector", "Output FST type");
@@ -49,80 +59,184 @@ DEFINE_bool(keep_isymbols, false, "Store input label symbol table with FST");
 DEFINE_bool(keep_osymbols, false, "Store output label symbol table with FST");
 DEFINE_bool(keep_state_numbering, false, "Do not renumber input states");
 DEFINE_bool(allow_negative_labels, false, "Allow negative labels (not recommended; may cause conflicts)");
-
-typedef typename fst::RuleArc<fst::StdArc> Arc;
-typedef typename fst::VectorFst<Arc> StdVectorPdt;
-typedef fst::ParenMatcher< VectorFst<Arc> > FstMatcher;
-typedef fst::ParenMatcher< StdVectorPdt > PdtMatcher;
+DEFINE_string(model, "", "Compiled model from tripoli-build; replaces the PDT and grammar arguments");
+DEFINE_bool(bypass_pass_through, true, "Remove the PDT's dummy and portal states that only pass paths on");
+
+DEFINE_int32(threads, -1, "Threads for loading the model and composing batches; -1 for one per core, 0 for none");
+DEFINE_string(batch, "", "Manifest or directory of input FSTs to compose against one model load; replaces the input argument");
+DEFINE_int32(batch_queue, 64, "Inputs a batch reads ahead of its output");
+DEFINE_int32(nbest, 0, "Write the n best balanced paths a beam search finds instead of the whole composition; 0 for the whole composition");
+DEFINE_bool(shortest_path, false, "Write the best balanced path, found by A*, instead of the whole composition");
+DEFINE_double(beam, 0, "Search beam: costs kept above the best at the same input position; 0 for none");
+DEFINE_int32(max_active, 0, "Search states expanded per input position; 0 for no cap");
+DEFINE_int32(max_depth, 0, "Open parens on a searched path; 0 for no cap");
+DEFINE_string(output_format, "const", "Composed FST as a binary const or compact FST, or as text: const|compact|text");
+DEFINE_string(token_labels, "", "Arc label file (as arc-labels.txt) to read inputs as whitespace-separated tokens instead of FSTs");
+DEFINE_string(stats, "", "Write a JSON report of load times, composition counters and structure sizes to this file on exit");
+
+typedef fst::TripoliArc Arc;
+
+// Writes the --stats report, if there is one, however main returns.
+struct StatsWriter {
+  std::unique_ptr<fst::StatsReport> report;
+
+  ~StatsWriter() {
+    if (report)
+      report->WriteJson(FLAGS_stats);
+  }
+};
 
 int main(int argc, char **argv) {
-  using fst::istream;
-  using fst::ifstream;
-  using fst::SymbolTable;
-
-  const char *inputFilename = argv[1];
-  const char *pdtFilename = argv[2];
-  const char *labels = argv[3];
-  const char *symbols = argv[4];
-  const char *rules = argv[5];
-  const char *states = argv[6];
-  const char *parens = argv[7];
-  const char *out_name = argv[8];
-
-  istream *fstIstrm = new ifstream(inputFilename);
-  istream *pdtIstrm = new ifstream(pdtFilename);
-  const SymbolTable *isyms = 0, *osyms = 0, *ssyms = 0;
-
-  fst::SymbolTableTextOptions opts;
-  opts.allow_negative = false;
-
-//  isyms = SymbolTable::ReadText(labels, opts);
-//  osyms = isyms;
-
-  bool accep = true;
-  bool ikeep = false;
-  bool okeep = false;
-  bool allow_negative_labels = false;
-
-  fst::FstCompiler<Arc> fstCompiler(*fstIstrm, inputFilename, isyms, osyms, ssyms, accep, ikeep, okeep, allow_negative_labels);
-  fst::PdtCompiler<Arc> pdtCompiler(*pdtIstrm, pdtFilename, isyms, osyms, ssyms, accep, ikeep, okeep, allow_negative_labels);
-
-  const VectorFst<Arc> fst = fstCompiler.Fst();
-  cout << "input FST compile..." << endl;
-
-  StdVectorPdt pdt = pdtCompiler.Pdt();
-  cout << "PDT compiled..." << endl;
-
-  // Read the state file
-  ifstream stateFile(states);
-  vector<fst::StateInfo> stateInfo = read_states(stateFile);
-  cout << "States read..." << endl;
-
-  // Read the grammar file
-  fst::Grammar *grammar = fst::ReadGrammar(symbols, rules, labels);
-
-  // Read the parentheses file
-  vector<pair<int64, int64> > parentheses;
-  fst::ReadLabelPairs(parens, &parentheses, false);
-  cout << "Parentheses read..." << endl;
+  string usage = "Composes an input FST with a Tripoli model.\n\n  Usage: ";
+  usage += argv[0];
+  usage += " input.txt pdt.txt arc-labels.txt grammar-symbols.txt rules.txt states.txt parens.txt out\n";
+  usage += "     or: ";
+  usage += argv[0];
+  usage += " --model=model.tpm input.txt out\n";
+  usage += "  With --batch=inputs, the input argument is left out, and out is a directory\n";
+  usage += "  for the binary formats; out - writes text to stdout.\n";
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+  int ninputs = FLAGS_batch.empty() ? 1 : 0;
+  if (argc != 2 + ninputs + (FLAGS_model.empty() ? 6 : 0)) {
+    ShowUsage();
+    return 1;
+  }
+
+  const string out_name = argv[argc - 1];
+  fst::OutputFormat output_format;
+  if (!fst::ParseOutputFormat(FLAGS_output_format, &output_format)) {
+    LOG(ERROR) << "Unknown output format: " << FLAGS_output_format;
+    return 1;
+  }
+  fst::BeamSearchOptions search_opts;
+  search_opts.nbest = FLAGS_nbest;
+  if (FLAGS_beam > 0)
+    search_opts.beam = FLAGS_beam;
+  search_opts.max_active = FLAGS_max_active;
+  search_opts.max_depth = FLAGS_max_depth;
+  char **model_args = argv + 1 + ninputs;
+  StatsWriter stats_writer;  // outlives the pool, whose tasks may time themselves
+  if (!FLAGS_stats.empty())
+    stats_writer.report.reset(new fst::StatsReport);
+  fst::StatsReport *stats = stats_writer.report.get();
+  fst::TokenLabels token_labels;  // outlives the pool, as the input task reads it
+  if (!FLAGS_token_labels.empty() && !fst::ReadTokenLabels(FLAGS_token_labels, &token_labels))
+    return 1;
+  size_t nthreads = FLAGS_threads >= 0 ? FLAGS_threads : fst::ThreadPool::DefaultThreads();
+  fst::ThreadPool pool(nthreads);
+
+  // The input FST is compiled while the model loads; a linear one is
+  // read straight into a LinearFst. Returning early leaves the pool to
+  // finish the task, and the FST is freed with its future.
+  std::future<std::unique_ptr<Fst<Arc> > > input;
+  if (FLAGS_batch.empty()) {
+    std::string input_name = argv[1];
+    input = pool.Async([input_name, stats, &token_labels]() {
+      fst::ScopedTimer timer(stats, "read_input");
+      ifstream fstIstrm(input_name.c_str());
+      if (!FLAGS_token_labels.empty())
+        return std::unique_ptr<Fst<Arc> >(
+            fst::TokensToLinearFst(fstIstrm, token_labels, input_name));
+      string contents((istreambuf_iterator<char>(fstIstrm)), istreambuf_iterator<char>());
+      return std::unique_ptr<Fst<Arc> >(fst::CompileInput(contents, input_name));
+    });
+  }
+
+  std::unique_ptr<fst::TripoliModel> model;
+  if (!FLAGS_model.empty()) {
+    fst::ScopedTimer timer(stats, "map_model");
+    model.reset(fst::TripoliModel::Open(FLAGS_model));
+    if (!model)
+      return 1;
+    cerr << "Model mapped..." << endl;
+  } else {
+    // PDT, arc labels, grammar symbols, rules, states and parentheses
+    model.reset(fst::TripoliModel::ReadText(model_args[0], model_args[1], model_args[2], model_args[3],
+                                            model_args[4], model_args[5], &pool,
+                                            FLAGS_bypass_pass_through, stats));
+  }
+  if (stats)
+    model->ReportMemory(stats);
   // TODO check parenthesis order matches what we need
 
-  fst::PDTInfo<StdVectorPdt> pdtInfo(*grammar, pdt, stateInfo);
-
-  CacheOptions cacheOpts;
-  FstMatcher matcher1(fst, MATCH_OUTPUT);
-  PdtMatcher matcher2(pdt, MATCH_INPUT);
-  TripoliComposeFilter<FstMatcher, PdtMatcher> tripoliFilter(fst, pdt, &pdtInfo, &matcher1, &matcher2);
-  ComposeFstImplOptions<FstMatcher, PdtMatcher, TripoliComposeFilter<FstMatcher, PdtMatcher> > composeOpts(cacheOpts, &matcher1, &matcher2, &tripoliFilter);
-
-    ComposeFst<Arc> cfst(fst, pdt, composeOpts);
-    for (StateIterator<ComposeFst<Arc>> siter(cfst); !siter.Done(); siter.Next()) {
-  	  Arc::StateId state_id = siter.Value();
-  	  for (ArcIterator<ComposeFst<Arc>> aiter(cfst, state_id); !aiter.Done(); aiter.Next()) {
-  		  Arc edge = aiter.Value();
-  	  	  cout << state_id << " " << edge.nextstate << " " << edge.ilabel << " " << edge.olabel << " " << edge.weight << endl;
-  	  }
+  if (!FLAGS_batch.empty()) {
+    vector<string> inputs;
+    if (!fst::ReadBatchInputs(FLAGS_batch, &inputs))
+      return 1;
+    fst::BatchOptions opts;
+    opts.pool = &pool;
+    opts.queue_size = FLAGS_batch_queue;
+    opts.format = output_format;
+    opts.search = FLAGS_nbest > 0 ? &search_opts : 0;
+    opts.shortest_path = FLAGS_shortest_path;
+    opts.stats = stats;
+    opts.token_labels = FLAGS_token_labels.empty() ? 0 : &token_labels;
+    size_t failed;
+    if (output_format != fst::OUTPUT_TEXT) {
+      opts.output_dir = out_name;
+      failed = fst::RunBatch(*model, inputs, cout, opts);
+    } else if (out_name == "-") {
+      failed = fst::RunBatch(*model, inputs, cout, opts);
+    } else {
+      ofstream out(out_name.c_str());
+      failed = fst::RunBatch(*model, inputs, out, opts);
     }
-
-  delete grammar;
+    cerr << inputs.size() - failed << " of " << inputs.size() << " inputs composed" << endl;
+    return failed ? 1 : 0;
+  }
+
+  std::unique_ptr<Fst<Arc> > fst = input.get();
+  if (!fst)
+    return 1;
+  cerr << "input FST compile..." << endl;
+
+  // The compose FST owns its matchers and filter
+  std::unique_ptr<ComposeFst<Arc> > composed;
+  const fst::TripoliComposeStateTable *state_table = 0;
+  const fst::TripoliFilterTables *tables = 0;
+  fst::ComposeStats compose_stats;
+  fst::ScopedTimer compose_timer(stats, "compose");
+  const Fst<Arc> *output = 0;
+  VectorFst<Arc> paths;
+  if (FLAGS_shortest_path) {
+    fst::AStarStats search_stats;
+    if (!fst::TripoliShortestPath(*fst, *model, &paths, &search_stats, &compose_stats)) {
+      LOG(ERROR) << "No complete path";
+      return 1;
+    }
+    cerr << "Search expanded " << search_stats.expanded << " states..." << endl;
+    output = &paths;
+  } else if (FLAGS_nbest > 0) {
+    composed.reset(fst::TripoliComposeInput(*fst, *model, CacheOptions(), &state_table, &tables));
+    // Expands only what the search reaches
+    fst::BeamSearchStats search_stats;
+    if (!fst::BeamSearch(*composed, model->GetParens(), search_opts, &paths, &search_stats)) {
+      LOG(ERROR) << "No complete path within the beam";
+      return 1;
+    }
+    cerr << "Search expanded " << search_stats.expanded << " states..." << endl;
+    output = &paths;
+  } else {
+    composed.reset(fst::TripoliComposeInput(*fst, *model, CacheOptions(), &state_table, &tables));
+    output = composed.get();
+  }
+  bool written;
+  if (output_format == fst::OUTPUT_TEXT && out_name == "-") {
+    written = fst::WriteOutput(*output, output_format, cout, "standard output");
+  } else {
+    ofstream out(out_name.c_str(), ios::out | ios::binary);
+    if (!out) {
+      LOG(ERROR) << "Can't open file: " << out_name;
+      return 1;
+    }
+    written = fst::WriteOutput(*output, output_format, out, out_name);
+  }
+  // A lazy composition is only expanded once written out
+  if (stats) {
+    if (tables)
+      compose_stats = fst::GetComposeStats(*tables, state_table);
+    stats->AddCompose(argv[1], compose_stats, compose_timer.Seconds());
+    stats->AddMemory("compose_tables", compose_stats.table_bytes);
+  }
+  return written ? 0 : 1;
 }
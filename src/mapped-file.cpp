@@ -0,0 +1,49 @@
+/*
+ * mapped-file.cpp
+ */
+
+#include "mapped-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <fst/fst.h>
+
+namespace fst {
+
+MappedFile *MappedFile::Map(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "MappedFile: Can't open file: " << filename << ": " << strerror(errno);
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << "MappedFile: Can't stat file: " << filename << ": " << strerror(errno);
+    close(fd);
+    return 0;
+  }
+  size_t size = st.st_size;
+  void *data = 0;
+  if (size > 0) {
+    data = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      LOG(ERROR) << "MappedFile: Can't map file: " << filename << ": " << strerror(errno);
+      close(fd);
+      return 0;
+    }
+  }
+  close(fd);
+  return new MappedFile(filename, static_cast<const char *>(data), size);
+}
+
+MappedFile::~MappedFile() {
+  if (size_ > 0)
+    munmap(const_cast<char *>(data_), size_);
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ * mapped-file.h
+ *
+ * Read-only memory mapping of a whole file.
+ */
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace fst {
+
+// The mapping is shared, so processes that map the same file share its
+// pages.
+class MappedFile {
+public:
+  // Returns NULL (and logs why) if the file cannot be mapped.
+  static MappedFile *Map(const std::string &filename);
+  ~MappedFile();
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  const std::string &filename() const { return filename_; }
+
+private:
+  MappedFile(const std::string &filename, const char *data, size_t size)
+          : filename_(filename), data_(data), size_(size) {}
+  MappedFile(const MappedFile &);  // disallow
+  void operator=(const MappedFile &);  // disallow
+
+  std::string filename_;
+  const char *data_;
+  size_t size_;
+};
+
+}
+
+#endif /* MAPPED_FILE_H_ */
@@ -0,0 +1,484 @@
+/*
+ * model.cpp
+ */
+
+#include "model.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+#include <fst/arcsort.h>
+#include <fst/util.h>
+
+#include "future-costs.h"
+#include "pass-through.h"
+#include "readers.h"
+#include "states.h"
+#include "tripoli-compile.h"
+
+namespace fst {
+
+namespace {
+
+size_t Align(size_t n) {
+  return (n + kModelAlignment - 1) / kModelAlignment * kModelAlignment;
+}
+
+class ModelWriter {
+public:
+  template <class T>
+  void Add(ModelSection id, const T *data, size_t n) {
+    Section section = {id, reinterpret_cast<const char *>(data), n * sizeof(T)};
+    sections_.push_back(section);
+  }
+
+  template <class T>
+  void Add(ModelSection id, const FlatArray<T> &array) {
+    Add(id, array.data(), array.size());
+  }
+
+  bool Write(const string &filename) const {
+    ofstream strm(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!strm) {
+      LOG(ERROR) << "ModelWriter: Can't open file: " << filename;
+      return false;
+    }
+
+    ModelHeader header;
+    memcpy(header.magic, kModelMagic, sizeof(header.magic));
+    header.version = kModelVersion;
+    header.nsections = sections_.size();
+    header.arc_size = sizeof(TripoliArc);
+    header.reserved = 0;
+
+    vector<ModelSectionEntry> table;
+    size_t offset = Align(sizeof(header) + sections_.size() * sizeof(ModelSectionEntry));
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      ModelSectionEntry entry = {uint32(sections_[i].id), 0, offset, sections_[i].size};
+      table.push_back(entry);
+      offset = Align(offset + sections_[i].size);
+    }
+
+    strm.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    strm.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(ModelSectionEntry));
+    size_t pos = sizeof(header) + table.size() * sizeof(ModelSectionEntry);
+    const char zeros[kModelAlignment] = {0};
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      strm.write(zeros, table[i].offset - pos);
+      strm.write(sections_[i].data, sections_[i].size);
+      pos = table[i].offset + sections_[i].size;
+    }
+    if (!strm) {
+      LOG(ERROR) << "ModelWriter: Write failed: " << filename;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  struct Section {
+    ModelSection id;
+    const char *data;
+    size_t size;
+  };
+  vector<Section> sections_;
+};
+
+class ModelReader {
+public:
+  explicit ModelReader(const MappedFile &file) : file_(file), header_(0), table_(0) {}
+
+  bool ReadHeader() {
+    if (file_.size() < sizeof(ModelHeader))
+      return Error("file too short for a model header");
+    header_ = reinterpret_cast<const ModelHeader *>(file_.data());
+    if (memcmp(header_->magic, kModelMagic, sizeof(kModelMagic)) != 0)
+      return Error("not a Tripoli model");
+    if (header_->version != kModelVersion)
+      return Error("model version " + std::to_string(header_->version) +
+                   ", expected " + std::to_string(kModelVersion));
+    if (header_->arc_size != sizeof(TripoliArc))
+      return Error("model was built with a different arc layout");
+    if (file_.size() < sizeof(ModelHeader) + header_->nsections * sizeof(ModelSectionEntry))
+      return Error("truncated section table");
+    table_ = reinterpret_cast<const ModelSectionEntry *>(file_.data() + sizeof(ModelHeader));
+    return true;
+  }
+
+  template <class T>
+  bool Get(ModelSection id, FlatArray<T> *array) {
+    for (uint32 i = 0; i < header_->nsections; ++i) {
+      const ModelSectionEntry &entry = table_[i];
+      if (entry.id != uint32(id))
+        continue;
+      if (entry.offset % kModelAlignment != 0 || entry.size % sizeof(T) != 0 ||
+          entry.offset > file_.size() || entry.size > file_.size() - entry.offset)
+        return Error("bad section " + std::to_string(id));
+      *array = FlatArray<T>(reinterpret_cast<const T *>(file_.data() + entry.offset),
+                            entry.size / sizeof(T));
+      return true;
+    }
+    return Error("missing section " + std::to_string(id));
+  }
+
+  bool Error(const string &message) const {
+    LOG(ERROR) << "TripoliModel: " << file_.filename() << ": " << message;
+    return false;
+  }
+
+private:
+  const MappedFile &file_;
+  const ModelHeader *header_;
+  const ModelSectionEntry *table_;
+};
+
+// Whether the chain tables of a mapped index are the right sizes and every
+// chain id in them is in range.
+bool BackoffChainsAgree(const PDTIndex &index, size_t nstates) {
+  size_t nchains = index.chain_next.size();
+  if (index.state_chains.size() != nstates || index.chain_targets.size() != nchains ||
+      index.chain_offsets.size() != nchains + 1 || nchains == 0 ||
+      index.chain_offsets[nchains] != index.chain_rules.size())
+    return false;
+  for (size_t i = 0; i < nchains; ++i) {
+    if (index.chain_offsets[i] > index.chain_offsets[i + 1])
+      return false;
+  }
+  for (size_t s = 0; s < nstates; ++s) {
+    if (index.state_chains[s] != kNoBackoffChain && size_t(index.state_chains[s]) >= nchains)
+      return false;
+  }
+  for (size_t i = 0; i < nchains; ++i) {
+    if (index.chain_next[i] != kNoBackoffChain && size_t(index.chain_next[i]) >= nchains)
+      return false;
+  }
+  return true;
+}
+
+// Whether the PDT's arcs and the rule tables of a mapped index stay within
+// the states, arcs, labels and rule ids they index, so a bad file cannot
+// send a lookup past its section.
+bool PdtIndexAgrees(const PDTIndex &index, const FlatArray<uint64> &offsets,
+                    const FlatArray<TripoliArc> &arcs, size_t nstates, size_t nlabels,
+                    int64 num_rule_ids) {
+  if (index.state_info.size() != nstates || index.context_offsets.size() != nstates + 1 ||
+      index.context_offsets[nstates] != index.context_rules.size() ||
+      index.unigram_offsets.empty() || index.unigram_offsets.size() > nlabels + 1 ||
+      index.unigram_offsets[index.unigram_offsets.size() - 1] != index.unigram_rules.size() ||
+      offsets[0] != 0)
+    return false;
+  for (size_t s = 0; s < nstates; ++s) {
+    if (offsets[s] > offsets[s + 1] || index.arc_rule_offsets[s] != offsets[s] ||
+        index.context_offsets[s] > index.context_offsets[s + 1])
+      return false;
+  }
+  for (size_t l = 1; l < index.unigram_offsets.size(); ++l) {
+    if (index.unigram_offsets[l - 1] > index.unigram_offsets[l])
+      return false;
+  }
+  for (size_t i = 0; i < arcs.size(); ++i) {
+    if (arcs[i].nextstate < 0 || size_t(arcs[i].nextstate) >= nstates ||
+        index.arc_rules[i] < SYNTACTIC_BACKOFF_ARC || index.arc_rules[i] >= num_rule_ids)
+      return false;
+  }
+  return true;
+}
+
+// Whether every table of a mapped label index stays within the slots and
+// every run within its state's arcs, so a bad file cannot send a matcher
+// out of bounds.
+bool LabelIndexAgrees(const FlatArray<int32_t> &states, const FlatArray<LabelIndex::Entry> &entries,
+                      const FlatArray<LabelIndex::Slot> &slots, const FlatArray<uint64> &offsets) {
+  if (states.size() + 1 != offsets.size())
+    return false;
+  for (size_t s = 0; s < states.size(); ++s) {
+    if (states[s] < 0)
+      continue;
+    if (size_t(states[s]) >= entries.size())
+      return false;
+    const LabelIndex::Entry &entry = entries[states[s]];
+    if (entry.size == 0 || entry.offset > slots.size() || entry.size > slots.size() - entry.offset)
+      return false;
+    if (entry.kind == LabelIndex::HASHED && (entry.size & (entry.size - 1)) != 0)
+      return false;
+    bool empty = false;  // a hash table needs one to stop probing
+    for (size_t i = entry.offset; i < entry.offset + entry.size; ++i) {
+      if (slots[i].begin + uint64(slots[i].count) > offsets[s + 1] - offsets[s])
+        return false;
+      empty |= slots[i].label == kNoLabel;
+    }
+    if (entry.kind == LabelIndex::HASHED && !empty)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TripoliModel *TripoliModel::ReadText(const string &pdt_file, const string &label_file,
+                                     const string &symbol_file, const string &rule_file,
+                                     const string &state_file, const string &paren_file,
+                                     ThreadPool *pool, bool bypass_pass_through,
+                                     StatsReport *stats) {
+  ThreadPool inline_pool(0);
+  if (!pool)
+    pool = &inline_pool;
+
+  // The files are independent, so they are all read at once. Tasks only
+  // capture copies, as they may outlive an exception thrown by another.
+  std::future<std::unique_ptr<VectorFst<TripoliArc> > > pdt_result = pool->Async([pdt_file, stats]() {
+    ScopedTimer timer(stats, "read_pdt");
+    PdtCompiler<TripoliArc> pdt_compiler(pdt_file, 0, 0, 0, true, false, false, false);
+    if (pdt_compiler.Pdt().Properties(kError, false))
+      throw invalid_argument("cannot read PDT file");
+    return std::unique_ptr<VectorFst<TripoliArc> >(new VectorFst<TripoliArc>(pdt_compiler.Pdt()));
+  });
+  std::future<vector<StateInfo> > state_result = pool->Async([state_file, stats]() {
+    ScopedTimer timer(stats, "read_states");
+    return read_states(state_file);
+  });
+  std::future<std::unique_ptr<Grammar> > grammar_result =
+      pool->Async([symbol_file, rule_file, label_file, stats]() {
+        ScopedTimer timer(stats, "read_grammar");
+        return std::unique_ptr<Grammar>(ReadGrammar(symbol_file, rule_file, label_file));
+      });
+  std::future<vector<ParenPair> > paren_result = pool->Async([paren_file, stats]() {
+    ScopedTimer timer(stats, "read_parens");
+    vector<ParenPair> parens;
+    if (!ReadLabelPairs(paren_file, &parens, false))
+      throw invalid_argument("cannot read parentheses file");
+    return parens;
+  });
+
+  std::unique_ptr<TripoliModel> model(new TripoliModel);
+  std::unique_ptr<VectorFst<TripoliArc> > pdt = pdt_result.get();
+  cerr << "PDT compiled..." << endl;
+  vector<StateInfo> state_info = state_result.get();
+  cerr << "States read..." << endl;
+  if (bypass_pass_through) {
+    ScopedTimer timer(stats, "bypass_pass_through");
+    PassThroughStats bypassed;
+    BypassPassThroughStates(pdt.get(), &state_info, PassThroughOptions(), &bypassed);
+    cerr << "Pass-through states bypassed: " << bypassed.states << " states, "
+         << bypassed.arcs << " arcs removed..." << endl;
+  }
+  {
+    ScopedTimer timer(stats, "flatten_pdt");
+    // Matching on the PDT side needs its arcs sorted on input labels
+    ArcSort(pdt.get(), ILabelCompare<TripoliArc>());
+    model->pdt_.reset(new TripoliPdt(*pdt));
+    pdt.reset();
+  }
+  std::unique_ptr<Grammar> grammar = grammar_result.get();
+  model->parens_ = FlatArray<ParenPair>(paren_result.get());
+  cerr << "Parentheses read..." << endl;
+
+  {
+    ScopedTimer timer(stats, "pdt_info");
+    model->pdt_info_.reset(new PDTInfo<TripoliPdt>(*grammar, *model->pdt_, state_info, pool));
+  }
+  {
+    ScopedTimer timer(stats, "future_costs");
+    FutureCosts(*model->pdt_, &model->future_costs_.Owned());
+  }
+  {
+    ScopedTimer timer(stats, "label_index");
+    model->label_index_ = LabelIndex(*model->pdt_);
+  }
+  return model.release();
+}
+
+TripoliModel *TripoliModel::Open(const string &filename) {
+  std::unique_ptr<MappedFile> file(MappedFile::Map(filename));
+  if (!file)
+    return 0;
+  ModelReader reader(*file);
+  if (!reader.ReadHeader())
+    return 0;
+
+  FlatArray<ModelScalars> scalars;
+  FlatArray<Symbol> labels_to_symbols;
+  FlatArray<BitMatrix::Word> symbol_reach, rule_reach;
+  FlatArray<TripoliArc::Weight> finals;
+  FlatArray<uint64> offsets;
+  FlatArray<TripoliArc> arcs;
+  FlatArray<ParenPair> parens;
+  FlatArray<float> future_costs;
+  FlatArray<int32_t> label_states;
+  FlatArray<LabelIndex::Entry> label_entries;
+  FlatArray<LabelIndex::Slot> label_slots;
+  PDTIndex index;
+  if (!reader.Get(MODEL_SCALARS, &scalars) ||
+      !reader.Get(MODEL_LABELS_TO_SYMBOLS, &labels_to_symbols) ||
+      !reader.Get(MODEL_SYMBOL_REACH, &symbol_reach) ||
+      !reader.Get(MODEL_RULE_REACH, &rule_reach) ||
+      !reader.Get(MODEL_PDT_FINALS, &finals) ||
+      !reader.Get(MODEL_PDT_OFFSETS, &offsets) ||
+      !reader.Get(MODEL_PDT_ARCS, &arcs) ||
+      !reader.Get(MODEL_STATE_INFO, &index.state_info) ||
+      !reader.Get(MODEL_PARENS, &parens) ||
+      !reader.Get(MODEL_PDT_FUTURE_COSTS, &future_costs) ||
+      !reader.Get(MODEL_LABEL_INDEX_STATES, &label_states) ||
+      !reader.Get(MODEL_LABEL_INDEX_ENTRIES, &label_entries) ||
+      !reader.Get(MODEL_LABEL_INDEX_SLOTS, &label_slots) ||
+      !reader.Get(MODEL_CONTEXT_RULES, &index.context_rules) ||
+      !reader.Get(MODEL_CONTEXT_OFFSETS, &index.context_offsets) ||
+      !reader.Get(MODEL_UNIGRAM_RULES, &index.unigram_rules) ||
+      !reader.Get(MODEL_UNIGRAM_OFFSETS, &index.unigram_offsets) ||
+      !reader.Get(MODEL_ARC_RULES, &index.arc_rules) ||
+      !reader.Get(MODEL_ARC_RULE_OFFSETS, &index.arc_rule_offsets) ||
+      !reader.Get(MODEL_STATE_CHAINS, &index.state_chains) ||
+      !reader.Get(MODEL_CHAIN_TARGETS, &index.chain_targets) ||
+      !reader.Get(MODEL_CHAIN_NEXT, &index.chain_next) ||
+      !reader.Get(MODEL_CHAIN_RULES, &index.chain_rules) ||
+      !reader.Get(MODEL_CHAIN_OFFSETS, &index.chain_offsets))
+    return 0;
+  if (scalars.size() != 1)
+    return reader.Error("bad scalars section"), (TripoliModel *)0;
+
+  const ModelScalars &sc = scalars[0];
+  BitMatrix symbol_matrix(sc.max_nonterm + 1, sc.max_term + 1, symbol_reach.data());
+  BitMatrix rule_matrix(sc.max_term + 1, sc.num_rule_ids, rule_reach.data());
+  if (symbol_matrix.Rows() * symbol_matrix.WordsPerRow() != symbol_reach.size() ||
+      rule_matrix.Rows() * rule_matrix.WordsPerRow() != rule_reach.size())
+    return reader.Error("reach matrices do not match the grammar"), (TripoliModel *)0;
+  if (offsets.size() != finals.size() + 1 || offsets[finals.size()] != arcs.size() ||
+      index.arc_rule_offsets.size() != offsets.size() ||
+      index.arc_rules.size() != arcs.size() || future_costs.size() != finals.size())
+    return reader.Error("PDT sections do not agree"), (TripoliModel *)0;
+  if (!PdtIndexAgrees(index, offsets, arcs, finals.size(), labels_to_symbols.size(),
+                      sc.num_rule_ids))
+    return reader.Error("PDT index does not match the PDT"), (TripoliModel *)0;
+  if (!BackoffChainsAgree(index, finals.size()))
+    return reader.Error("backoff chains do not match the PDT"), (TripoliModel *)0;
+  if (!LabelIndexAgrees(label_states, label_entries, label_slots, offsets))
+    return reader.Error("label index does not match the PDT"), (TripoliModel *)0;
+
+  Grammar grammar(sc.max_term, sc.max_preterm, sc.max_nonterm,
+                  labels_to_symbols, symbol_matrix, rule_matrix);
+  TripoliModel *model = new TripoliModel;
+  model->file_ = std::move(file);
+  model->pdt_.reset(new TripoliPdt(sc.pdt_start, sc.pdt_properties, finals, offsets, arcs));
+  model->parens_ = parens;
+  model->future_costs_ = future_costs;
+  model->label_index_ = LabelIndex(label_states, label_entries, label_slots);
+  model->pdt_info_.reset(new PDTInfo<TripoliPdt>(grammar, index));
+  return model;
+}
+
+TripoliPdt *TripoliModel::NewPdtView() const {
+  return new TripoliPdt(pdt_->Start(), pdt_->Properties(kFstProperties, false),
+                        FlatArray<TripoliArc::Weight>(pdt_->Finals().data(), pdt_->Finals().size()),
+                        FlatArray<uint64>(pdt_->Offsets().data(), pdt_->Offsets().size()),
+                        FlatArray<TripoliArc>(pdt_->AllArcs().data(), pdt_->AllArcs().size()));
+}
+
+void TripoliModel::ReportMemory(StatsReport *stats) const {
+  const Grammar &grammar = GetGrammar();
+  const PDTIndex &index = pdt_info_->GetIndex();
+  stats->AddMemory("pdt_arcs", pdt_->AllArcs().SizeInBytes());
+  stats->AddMemory("pdt_states", pdt_->Finals().SizeInBytes() + pdt_->Offsets().SizeInBytes());
+  stats->AddMemory("state_info", index.state_info.SizeInBytes());
+  stats->AddMemory("symbol_reach", grammar.SymbolReach().SizeInBytes());
+  stats->AddMemory("rule_reach", grammar.RuleReach().SizeInBytes());
+  stats->AddMemory("context_rules", index.context_rules.SizeInBytes() +
+                                    index.context_offsets.SizeInBytes());
+  stats->AddMemory("unigram_rules", index.unigram_rules.SizeInBytes() +
+                                    index.unigram_offsets.SizeInBytes());
+  stats->AddMemory("arc_rules", index.arc_rules.SizeInBytes() + index.arc_rule_offsets.SizeInBytes());
+  stats->AddMemory("backoff_chains", index.state_chains.SizeInBytes() +
+                                     index.chain_targets.SizeInBytes() +
+                                     index.chain_next.SizeInBytes() +
+                                     index.chain_rules.SizeInBytes() +
+                                     index.chain_offsets.SizeInBytes());
+  stats->AddMemory("label_index", label_index_.States().SizeInBytes() +
+                                  label_index_.Entries().SizeInBytes() +
+                                  label_index_.Slots().SizeInBytes());
+  stats->AddMemory("future_costs", future_costs_.SizeInBytes());
+}
+
+ComposeFst<TripoliArc> *TripoliComposeInput(const Fst<TripoliArc> &input, const TripoliModel &model,
+                                            const CacheOptions &opts,
+                                            const TripoliComposeStateTable **state_table,
+                                            const TripoliFilterTables **tables) {
+  if (input.Type() == "linear") {
+    return TripoliCompose<LinearMatcher<LinearFst<TripoliArc> > >(
+        static_cast<const LinearFst<TripoliArc> &>(input), model, opts, state_table, tables);
+  }
+  if (input.Type() == "vector") {
+    return TripoliCompose<ParenMatcher<VectorFst<TripoliArc> > >(
+        static_cast<const VectorFst<TripoliArc> &>(input), model, opts, state_table, tables);
+  }
+  return TripoliCompose<ParenMatcher<Fst<TripoliArc> > >(input, model, opts, state_table, tables);
+}
+
+ComposeStats GetComposeStats(const TripoliFilterTables &tables,
+                             const TripoliComposeStateTable *state_table) {
+  ComposeStats stats = tables.stats;
+  stats.union_lookups = tables.pool.UnionLookups();
+  stats.union_hits = tables.pool.UnionHits();
+  stats.rule_sets = tables.pool.NumSets();
+  // Hash nodes hold a key, a value and a next pointer, plus a bucket each
+  size_t node = sizeof(StateId) + sizeof(RuleSetId) + 2 * sizeof(void *);
+  stats.table_bytes = tables.pool.MemoryBytes() +
+                      (tables.context_sets.size() + tables.unigram_sets.size()) * node +
+                      tables.chain_sets.capacity() * sizeof(RuleSetId);
+  if (state_table) {
+    std::unordered_set<TripoliFilterState<>, FilterStateHash> filter_states;
+    for (TripoliArc::StateId s = 0; s < TripoliArc::StateId(state_table->Size()); ++s)
+      filter_states.insert(state_table->Tuple(s).filter_state.GetState1());
+    stats.composed_states = state_table->Size();
+    stats.filter_states = filter_states.size();
+  }
+  return stats;
+}
+
+bool TripoliModel::Write(const string &filename) const {
+  const Grammar &grammar = GetGrammar();
+  const PDTIndex &index = pdt_info_->GetIndex();
+  ModelScalars scalars;
+  scalars.max_term = grammar.MaxTerm();
+  scalars.max_preterm = grammar.MaxPreterm();
+  scalars.max_nonterm = grammar.MaxNonterm();
+  scalars.num_rule_ids = grammar.RuleReach().Cols();
+  scalars.pdt_start = pdt_->Start();
+  scalars.pdt_properties = pdt_->Properties(kFstProperties, false);
+
+  ModelWriter writer;
+  writer.Add(MODEL_SCALARS, &scalars, 1);
+  writer.Add(MODEL_LABELS_TO_SYMBOLS, grammar.LabelsToSymbols());
+  writer.Add(MODEL_SYMBOL_REACH, grammar.SymbolReach().Data(),
+             grammar.SymbolReach().Rows() * grammar.SymbolReach().WordsPerRow());
+  writer.Add(MODEL_RULE_REACH, grammar.RuleReach().Data(),
+             grammar.RuleReach().Rows() * grammar.RuleReach().WordsPerRow());
+  writer.Add(MODEL_PDT_FINALS, pdt_->Finals());
+  writer.Add(MODEL_PDT_OFFSETS, pdt_->Offsets());
+  writer.Add(MODEL_PDT_ARCS, pdt_->AllArcs());
+  // Open wants an entry per PDT state; any past them are never looked up
+  size_t nstates = std::min<size_t>(pdt_->NumStates(), index.state_info.size());
+  writer.Add(MODEL_STATE_INFO, index.state_info.data(), nstates);
+  writer.Add(MODEL_PARENS, parens_);
+  writer.Add(MODEL_PDT_FUTURE_COSTS, future_costs_);
+  writer.Add(MODEL_LABEL_INDEX_STATES, label_index_.States());
+  writer.Add(MODEL_LABEL_INDEX_ENTRIES, label_index_.Entries());
+  writer.Add(MODEL_LABEL_INDEX_SLOTS, label_index_.Slots());
+  writer.Add(MODEL_CONTEXT_RULES, index.context_rules);
+  writer.Add(MODEL_CONTEXT_OFFSETS, index.context_offsets.data(), nstates + 1);
+  writer.Add(MODEL_UNIGRAM_RULES, index.unigram_rules);
+  writer.Add(MODEL_UNIGRAM_OFFSETS, index.unigram_offsets);
+  writer.Add(MODEL_ARC_RULES, index.arc_rules);
+  writer.Add(MODEL_ARC_RULE_OFFSETS, index.arc_rule_offsets);
+  writer.Add(MODEL_STATE_CHAINS, index.state_chains);
+  writer.Add(MODEL_CHAIN_TARGETS, index.chain_targets);
+  writer.Add(MODEL_CHAIN_NEXT, index.chain_next);
+  writer.Add(MODEL_CHAIN_RULES, index.chain_rules);
+  writer.Add(MODEL_CHAIN_OFFSETS, index.chain_offsets);
+  return writer.Write(filename);
+}
+
+}
@@ -0,0 +1,197 @@
+/*
+ * model.h
+ *
+ * A loaded Tripoli model: grammar, PDT, state info, parentheses and the
+ * PDTInfo indexes, either read from the text inputs or opened from a single
+ * compiled model file written by tripoli-build.
+ */
+
+#ifndef MODEL_H_
+#define MODEL_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "tripoli.h"
+#include "flat-fst.h"
+#include "indexed-matcher.h"
+#include "linear-fst.h"
+#include "mapped-file.h"
+#include "span.h"
+#include "stats.h"
+#include "thread-pool.h"
+
+namespace fst {
+
+typedef RuleArc<StdArc> TripoliArc;
+typedef FlatFst<TripoliArc> TripoliPdt;
+typedef pair<int64, int64> ParenPair;  // (open, close) paren labels
+
+// A compiled model is a header, a table of sections and then the sections,
+// each aligned to kModelAlignment bytes. Sections are raw arrays in the
+// native layout of the build that wrote them, so a mapped model is used in
+// place; the header records the arc size to catch mismatched builds.
+// kModelVersion must be bumped whenever a section changes layout or
+// meaning.
+const char kModelMagic[8] = {'T', 'R', 'I', 'P', 'O', 'L', 'I', '\0'};
+const uint32 kModelVersion = 4;
+const size_t kModelAlignment = 64;
+
+enum ModelSection {
+  MODEL_SCALARS = 1,
+  MODEL_LABELS_TO_SYMBOLS = 2,
+  MODEL_SYMBOL_REACH = 3,
+  MODEL_RULE_REACH = 4,
+  MODEL_PDT_FINALS = 5,
+  MODEL_PDT_OFFSETS = 6,
+  MODEL_PDT_ARCS = 7,
+  MODEL_STATE_INFO = 8,
+  MODEL_PARENS = 9,
+  MODEL_CONTEXT_RULES = 10,
+  MODEL_CONTEXT_OFFSETS = 11,
+  MODEL_UNIGRAM_RULES = 12,
+  MODEL_UNIGRAM_OFFSETS = 13,
+  MODEL_ARC_RULES = 14,
+  MODEL_ARC_RULE_OFFSETS = 15,
+  MODEL_PDT_FUTURE_COSTS = 16,  // since version 2
+  MODEL_LABEL_INDEX_STATES = 17,  // since version 3
+  MODEL_LABEL_INDEX_ENTRIES = 18,
+  MODEL_LABEL_INDEX_SLOTS = 19,
+  MODEL_STATE_CHAINS = 20,  // since version 4
+  MODEL_CHAIN_TARGETS = 21,
+  MODEL_CHAIN_NEXT = 22,
+  MODEL_CHAIN_RULES = 23,
+  MODEL_CHAIN_OFFSETS = 24
+};
+
+struct ModelHeader {
+  char magic[8];
+  uint32 version;
+  uint32 nsections;
+  uint32 arc_size;
+  uint32 reserved;
+};
+
+struct ModelSectionEntry {
+  uint32 id;  // a ModelSection
+  uint32 reserved;
+  uint64 offset;  // from the start of the file
+  uint64 size;  // in bytes
+};
+
+// Everything that is not an array, in the MODEL_SCALARS section.
+struct ModelScalars {
+  int64 max_term;
+  int64 max_preterm;
+  int64 max_nonterm;
+  int64 num_rule_ids;  // columns of the rule reach matrix
+  int64 pdt_start;
+  uint64 pdt_properties;
+};
+
+// Immutable once loaded: every accessor is const and nothing is computed
+// lazily, so one model can serve compositions in many threads without
+// locking. Whatever a composition mutates or reference-counts belongs to
+// that composition (see TripoliCompose below).
+class TripoliModel {
+public:
+  // Reads and indexes the text inputs, on pool if given; throws
+  // invalid_argument if they cannot be read. With bypass_pass_through, the
+  // PDT's dummy and portal states that only pass paths on are removed
+  // first (see pass-through.h). Each reader and index build is timed into
+  // stats, if given.
+  static TripoliModel *ReadText(const string &pdt_file, const string &label_file,
+                                const string &symbol_file, const string &rule_file,
+                                const string &state_file, const string &paren_file,
+                                ThreadPool *pool = 0, bool bypass_pass_through = false,
+                                StatsReport *stats = 0);
+
+  // Maps a model written by Write(); returns NULL (and logs why) if the
+  // file is missing, truncated or from an incompatible build.
+  static TripoliModel *Open(const string &filename);
+
+  bool Write(const string &filename) const;
+
+  const Grammar &GetGrammar() const { return pdt_info_->grammar; }
+  const TripoliPdt &GetPdt() const { return *pdt_; }
+  const PDTInfo<TripoliPdt> &GetPDTInfo() const { return *pdt_info_; }
+  Span<ParenPair> GetParens() const { return parens_.Slice(0, parens_.size()); }
+  // Cheapest cost from each PDT state to a final state (see FutureCosts),
+  // the PDT half of the A* heuristic.
+  Span<float> GetFutureCosts() const { return future_costs_.Slice(0, future_costs_.size()); }
+  // Label tables for the PDT states with the most arcs, for TripoliPdtMatcher.
+  const LabelIndex &GetLabelIndex() const { return label_index_; }
+
+  // A new FST over the PDT's arrays, with an impl and reference count of
+  // its own, for one composition. It must not outlive the model.
+  TripoliPdt *NewPdtView() const;
+
+  // Adds the size of each of the model's structures to stats.
+  void ReportMemory(StatsReport *stats) const;
+
+private:
+  TripoliModel() {}
+  TripoliModel(const TripoliModel &);  // disallow
+  void operator=(const TripoliModel &);  // disallow
+
+  std::unique_ptr<MappedFile> file_;  // must outlive the views into it
+  std::unique_ptr<TripoliPdt> pdt_;
+  FlatArray<ParenPair> parens_;
+  FlatArray<float> future_costs_;  // by PDT state
+  LabelIndex label_index_;
+  std::unique_ptr<PDTInfo<TripoliPdt> > pdt_info_;
+};
+
+typedef IndexedMatcher<TripoliPdt> TripoliPdtMatcher;
+typedef PairFilterState<TripoliFilterState<>, IntegerFilterState<StackId> > TripoliComposeFilterState;
+typedef GenericComposeStateTable<TripoliArc, TripoliComposeFilterState> TripoliComposeStateTable;
+
+// Composes fst with the model's PDT under the Tripoli filter, sequenced
+// after a filter on the model's parens (see TripoliParenFilter); M1 is a
+// ParenMatcher on fst. The PDT view, the matchers, the filter and its
+// tables are all made for this composition and owned by the returned
+// ComposeFst, so calls from different threads share only the read-only
+// model. The result is a PDT over the model's parens.
+//
+// If state_table is given, it is set to the composition's state table,
+// which maps each state to its (input state, PDT state, filter state) and
+// lives as long as the ComposeFst does; so, if tables is given, are the
+// filter's tables, with its counters.
+template <class M1>
+ComposeFst<TripoliArc> *TripoliCompose(const typename M1::FST &fst, const TripoliModel &model,
+                                       const CacheOptions &opts = CacheOptions(),
+                                       const TripoliComposeStateTable **state_table = 0,
+                                       const TripoliFilterTables **tables = 0) {
+  typedef TripoliParenFilter<M1, TripoliPdtMatcher> Filter;
+  std::unique_ptr<TripoliPdt> pdt(model.NewPdtView());
+  M1 *matcher1 = new M1(fst, MATCH_OUTPUT);
+  TripoliPdtMatcher *matcher2 = new TripoliPdtMatcher(*pdt, MATCH_INPUT, &model.GetLabelIndex());
+  Filter *filter = new Filter(fst, *pdt, &model.GetPDTInfo(), model.GetParens(), matcher1, matcher2);
+  ComposeFstImplOptions<M1, TripoliPdtMatcher, Filter, TripoliComposeStateTable> compose_opts(
+      opts, matcher1, matcher2, filter);
+  if (state_table) {
+    compose_opts.state_table = new TripoliComposeStateTable(fst, *pdt);
+    *state_table = compose_opts.state_table;
+  }
+  if (tables)
+    *tables = &filter->GetTables();
+  return new ComposeFst<TripoliArc>(fst, *pdt, compose_opts);
+}
+
+// TripoliCompose with the matcher that suits input's type: a
+// LinearMatcher for a LinearFst, whose lookups are a single compare, and a
+// ParenMatcher otherwise.
+ComposeFst<TripoliArc> *TripoliComposeInput(const Fst<TripoliArc> &input, const TripoliModel &model,
+                                            const CacheOptions &opts = CacheOptions(),
+                                            const TripoliComposeStateTable **state_table = 0,
+                                            const TripoliFilterTables **tables = 0);
+
+// The counters of a composition from TripoliCompose, with the sizes of its
+// tables and, if state_table is given, of its states so far.
+ComposeStats GetComposeStats(const TripoliFilterTables &tables,
+                             const TripoliComposeStateTable *state_table = 0);
+
+}
+
+#endif /* MODEL_H_ */
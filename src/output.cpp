@@ -0,0 +1,79 @@
+/*
+ * output.cpp
+ */
+
+#include "output.h"
+
+#include <cmath>
+
+namespace fst {
+
+// So that Fst<TripoliArc>::Read can read back what WriteOutput writes.
+REGISTER_FST(VectorFst, TripoliArc);
+REGISTER_FST(ConstFst, TripoliArc);
+static FstRegisterer<TripoliCompactFst> TripoliCompactFst_registerer;
+
+bool ParseOutputFormat(const string &name, OutputFormat *format) {
+  if (name == "const")
+    *format = OUTPUT_CONST;
+  else if (name == "compact")
+    *format = OUTPUT_COMPACT;
+  else if (name == "text")
+    *format = OUTPUT_TEXT;
+  else
+    return false;
+  return true;
+}
+
+namespace {
+
+// As operator<< prints a tropical weight.
+void WriteWeight(const TropicalWeight &w, BufferedWriter *writer) {
+  float f = w.Value();
+  if (f != f)
+    writer->Write("BadNumber");
+  else if (std::isinf(f))
+    writer->Write(f > 0 ? "Infinity" : "-Infinity");
+  else
+    writer->WriteFloat(f);
+}
+
+}  // namespace
+
+void PrintArcs(const Fst<TripoliArc> &fst, BufferedWriter *writer) {
+  for (StateIterator<Fst<TripoliArc> > siter(fst); !siter.Done(); siter.Next()) {
+    TripoliArc::StateId state_id = siter.Value();
+    for (ArcIterator<Fst<TripoliArc> > aiter(fst, state_id); !aiter.Done(); aiter.Next()) {
+      const TripoliArc &edge = aiter.Value();
+      writer->WriteInt(state_id);
+      writer->Put(' ');
+      writer->WriteInt(edge.nextstate);
+      writer->Put(' ');
+      writer->WriteInt(edge.ilabel);
+      writer->Put(' ');
+      writer->WriteInt(edge.olabel);
+      writer->Put(' ');
+      WriteWeight(edge.weight, writer);
+      writer->Put('\n');
+    }
+  }
+}
+
+bool WriteOutput(const Fst<TripoliArc> &fst, OutputFormat format, ostream &strm,
+                 const string &source) {
+  FstWriteOptions opts(source);
+  switch (format) {
+    case OUTPUT_CONST:
+      return TripoliConstFst(fst).Write(strm, opts);
+    case OUTPUT_COMPACT:
+      return TripoliCompactFst(fst).Write(strm, opts);
+    case OUTPUT_TEXT: {
+      BufferedWriter writer(&strm);
+      PrintArcs(fst, &writer);
+      return writer.Flush();
+    }
+  }
+  return false;
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ * output.h
+ *
+ * Writing a composed machine: an OpenFst binary in const or compact
+ * layout, or the text dump of its arcs.
+ */
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <iostream>
+#include <string>
+
+#include <fst/compact-fst.h>
+#include <fst/const-fst.h>
+
+#include "buffered-writer.h"
+#include "model.h"
+
+namespace fst {
+
+enum OutputFormat {
+  OUTPUT_CONST,
+  OUTPUT_COMPACT,
+  OUTPUT_TEXT
+};
+
+// "const", "compact" or "text".
+bool ParseOutputFormat(const string &name, OutputFormat *format);
+
+// Compacts a RuleArc to its five fields, rule included, which the stock
+// compactors would drop. Composed arcs are not acceptor arcs (parens come
+// out with an epsilon input label), so both labels are kept; what the
+// compact layout saves over the const one is its per-state table, an
+// offset per state rather than a full state record.
+template <class A>
+class RuleArcCompactor {
+public:
+  typedef A Arc;
+  typedef typename A::Label Label;
+  typedef typename A::StateId StateId;
+  typedef typename A::Weight Weight;
+
+  struct Element {
+    Label ilabel;
+    Label olabel;
+    Weight weight;
+    StateId nextstate;
+    RuleId rule;
+  };
+
+  Element Compact(StateId s, const A &arc) const {
+    Element e = {arc.ilabel, arc.olabel, arc.weight, arc.nextstate, arc.rule};
+    return e;
+  }
+
+  A Expand(StateId s, const Element &e, uint32 f = kArcValueFlags) const {
+    return A(e.ilabel, e.olabel, e.weight, e.nextstate, e.rule);
+  }
+
+  ssize_t Size() const { return -1; }
+  uint64 Properties() const { return 0ULL; }
+  bool Compatible(const Fst<A> &fst) const { return true; }
+
+  static const string &Type() {
+    static const string type = "rule";
+    return type;
+  }
+
+  bool Write(ostream &strm) const { return true; }
+  static RuleArcCompactor *Read(istream &strm) { return new RuleArcCompactor; }
+};
+
+typedef ConstFst<TripoliArc> TripoliConstFst;
+typedef CompactFst<TripoliArc, RuleArcCompactor<TripoliArc> > TripoliCompactFst;
+
+// Writes one line per arc of fst: state, next state, input and output
+// label, weight.
+void PrintArcs(const Fst<TripoliArc> &fst, BufferedWriter *writer);
+
+// Expands fst and writes it to strm in format; source names strm in
+// errors.
+bool WriteOutput(const Fst<TripoliArc> &fst, OutputFormat format, ostream &strm,
+                 const string &source);
+
+}
+
+#endif /* OUTPUT_H_ */
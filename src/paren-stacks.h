@@ -0,0 +1,95 @@
+// paren-stacks.h
+//
+// Paren stacks for searches over a composition with the PDT: which labels
+// open and close which paren, and the stacks themselves, shared as a tree.
+
+#ifndef TRIPOLI_PAREN_STACKS_H__
+#define TRIPOLI_PAREN_STACKS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "span.h"
+
+namespace fst {
+
+typedef int32_t StackId;  // 0 is the empty stack
+
+// Open paren k of a list of (open, close) label pairs as k, close paren k
+// as -k, counting from 1, and any other label as 0.
+class ParenLabels {
+public:
+  // P is a pair of labels, as ParenPair.
+  template <class P>
+  explicit ParenLabels(Span<P> parens) {
+    for (size_t i = 0; i < parens.size(); ++i) {
+      Set(parens[i].first, int(i) + 1);
+      Set(parens[i].second, -(int(i) + 1));
+    }
+  }
+
+  int Paren(int64_t label) const {
+    return label >= 0 && size_t(label) < parens_.size() ? parens_[label] : 0;
+  }
+
+private:
+  void Set(int64_t label, int paren) {
+    if (label < 0)
+      return;
+    if (size_t(label) >= parens_.size())
+      parens_.resize(label + 1, 0);
+    parens_[label] = paren;
+  }
+
+  std::vector<int> parens_;  // by label
+};
+
+// A stack is a node: pushing finds or adds a child, popping returns the
+// parent. Equal stacks are the same node, so search states compare stacks
+// by id.
+class ParenStacks {
+public:
+  ParenStacks() : nodes_(1, Node(0, 0, 0)) {}
+
+  StackId Push(StackId stack, int paren) {
+    uint64_t key = (uint64_t(stack) << 32) | uint32_t(paren);
+    std::unordered_map<uint64_t, StackId>::const_iterator it = children_.find(key);
+    if (it != children_.end())
+      return it->second;
+    StackId child = nodes_.size();
+    nodes_.push_back(Node(stack, paren, nodes_[stack].depth + 1));
+    children_[key] = child;
+    return child;
+  }
+
+  StackId Pop(StackId stack) const { return nodes_[stack].parent; }
+  int Top(StackId stack) const { return nodes_[stack].paren; }
+  size_t Depth(StackId stack) const { return nodes_[stack].depth; }
+
+  // The stack after an arc with paren (from ParenLabels) out of stack, or
+  // -1 if the arc closes the wrong paren.
+  StackId Follow(StackId stack, int paren) {
+    if (paren > 0)
+      return Push(stack, paren);
+    if (paren < 0)
+      return Depth(stack) && Top(stack) == -paren ? Pop(stack) : -1;
+    return stack;
+  }
+
+private:
+  struct Node {
+    Node(StackId p, int pa, size_t d) : parent(p), paren(pa), depth(d) {}
+    StackId parent;
+    int paren;  // the paren on top
+    size_t depth;
+  };
+
+  std::vector<Node> nodes_;
+  std::unordered_map<uint64_t, StackId> children_;  // keyed by (parent, paren)
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_PAREN_STACKS_H__
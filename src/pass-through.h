@@ -0,0 +1,180 @@
+// pass-through.h
+//
+// Removes the states of a PDT that only pass a path on: dummy and portal
+// states whose arcs are all epsilon arcs the compose filter lets through
+// unchanged.
+
+#ifndef TRIPOLI_PASS_THROUGH_H__
+#define TRIPOLI_PASS_THROUGH_H__
+
+#include <utility>
+#include <vector>
+
+#include <fst/mutable-fst.h>
+
+#include "tripoli.h"
+
+namespace fst {
+
+struct PassThroughOptions {
+  size_t max_fanout;  // targets a removed state may lead to; 1 never adds arcs
+
+  PassThroughOptions() : max_fanout(1) {}
+};
+
+struct PassThroughStats {
+  size_t states;  // states removed
+  size_t arcs;  // arcs removed, less those added
+
+  PassThroughStats() : states(0), arcs(0) {}
+};
+
+// Whether the compose filter passes arc through without a look at it:
+// FilterArc returns the filter state unchanged for dummy and portal arcs,
+// and one reading no label cannot touch a paren stack either.
+template <class A>
+bool IsPassThroughArc(const A &arc) {
+  return (arc.rule == DUMMY_ARC || arc.rule == PORTAL_ARC) && arc.ilabel == 0 && arc.olabel == 0;
+}
+
+// Bypasses every state of pdt other than the start whose arcs are all
+// pass-through arcs and which is not final: an arc into one is replaced by
+// an arc to each state its pass-through arcs lead to in the end, with the
+// arc's own labels and rule and its weight times theirs. Chains of such
+// states are followed through; a state on a cycle of them is kept, as is
+// one leading to more than opts.max_fanout states. The states bypassed are
+// deleted, and the rest renumbered in order, with state_info to match;
+// entries of state_info past pdt's states are kept at its end.
+//
+// Paths keep their labels, rules, parens and weights, so compositions with
+// pdt find the same paths with fewer states. Arcs should be sorted again
+// afterwards.
+template <class A>
+void BypassPassThroughStates(MutableFst<A> *pdt, vector<StateInfo> *state_info,
+                             const PassThroughOptions &opts = PassThroughOptions(),
+                             PassThroughStats *stats = 0) {
+  typedef typename A::StateId StateId;
+  typedef typename A::Weight Weight;
+  typedef vector<pair<StateId, Weight> > Targets;
+  enum { UNSEEN, OPEN, DONE };
+
+  StateId nstates = pdt->NumStates();
+  vector<bool> through(nstates, false);
+  for (StateId s = 0; s < nstates; ++s) {
+    if (s == pdt->Start() || pdt->Final(s) != Weight::Zero() || pdt->NumArcs(s) == 0)
+      continue;
+    bool all = true;
+    for (ArcIterator<MutableFst<A> > aiter(*pdt, s); all && !aiter.Done(); aiter.Next())
+      all = IsPassThroughArc(aiter.Value()) && aiter.Value().nextstate != s;
+    through[s] = all;
+  }
+
+  // targets[s] is where the pass-through arcs of a bypassed state lead in
+  // the end, found depth first without recursion; a state found open again
+  // is on a cycle, so is kept and becomes a target itself.
+  vector<Targets> targets(nstates);
+  vector<char> status(nstates, UNSEEN);
+  vector<pair<StateId, size_t> > stack;  // (state, arcs visited)
+  for (StateId root = 0; root < nstates; ++root) {
+    if (!through[root] || status[root] != UNSEEN)
+      continue;
+    stack.push_back(make_pair(root, 0));
+    status[root] = OPEN;
+    while (!stack.empty()) {
+      StateId u = stack.back().first;
+      size_t i = stack.back().second;
+      if (i < pdt->NumArcs(u)) {
+        ++stack.back().second;
+        ArcIterator<MutableFst<A> > aiter(*pdt, u);
+        aiter.Seek(i);
+        const A &arc = aiter.Value();
+        StateId t = arc.nextstate;
+        if (through[t] && status[t] == UNSEEN) {
+          stack.push_back(make_pair(t, 0));
+          status[t] = OPEN;
+          continue;
+        }
+        if (through[t] && status[t] == OPEN)
+          through[t] = false;
+        if (through[t]) {
+          for (size_t j = 0; j < targets[t].size(); ++j)
+            targets[u].push_back(make_pair(targets[t][j].first, Times(arc.weight, targets[t][j].second)));
+        } else {
+          targets[u].push_back(make_pair(t, arc.weight));
+        }
+        continue;
+      }
+      stack.pop_back();
+      status[u] = DONE;
+      if (targets[u].size() > opts.max_fanout)
+        through[u] = false;
+      if (stack.empty())
+        break;
+      // The parent's last arc visited led here
+      StateId p = stack.back().first;
+      ArcIterator<MutableFst<A> > aiter(*pdt, p);
+      aiter.Seek(stack.back().second - 1);
+      Weight w = aiter.Value().weight;
+      if (through[u]) {
+        for (size_t j = 0; j < targets[u].size(); ++j)
+          targets[p].push_back(make_pair(targets[u][j].first, Times(w, targets[u][j].second)));
+      } else {
+        targets[p].push_back(make_pair(u, w));
+      }
+    }
+  }
+
+  size_t narcs = 0, added = 0;
+  vector<A> arcs;
+  vector<StateId> deleted;
+  for (StateId s = 0; s < nstates; ++s) {
+    if (through[s]) {
+      deleted.push_back(s);
+      narcs += pdt->NumArcs(s);
+      continue;
+    }
+    arcs.clear();
+    bool changed = false;
+    for (ArcIterator<MutableFst<A> > aiter(*pdt, s); !aiter.Done(); aiter.Next()) {
+      const A &arc = aiter.Value();
+      if (!through[arc.nextstate]) {
+        arcs.push_back(arc);
+        continue;
+      }
+      changed = true;
+      const Targets &ts = targets[arc.nextstate];
+      for (size_t j = 0; j < ts.size(); ++j) {
+        A bypass = arc;
+        bypass.nextstate = ts[j].first;
+        bypass.weight = Times(arc.weight, ts[j].second);
+        arcs.push_back(bypass);
+      }
+    }
+    if (!changed)
+      continue;
+    narcs += pdt->NumArcs(s);
+    added += arcs.size();
+    pdt->DeleteArcs(s);
+    for (size_t j = 0; j < arcs.size(); ++j)
+      pdt->AddArc(s, arcs[j]);
+  }
+
+  // DeleteStates keeps the rest in order, which state_info follows
+  pdt->DeleteStates(deleted);
+  vector<StateInfo> &info = *state_info;
+  size_t kept = 0;
+  for (size_t s = 0; s < info.size(); ++s) {
+    if (s >= size_t(nstates) || !through[s])
+      info[kept++] = info[s];
+  }
+  info.resize(kept);
+
+  if (stats) {
+    stats->states += deleted.size();
+    stats->arcs += narcs - added;
+  }
+}
+
+}  // namespace fst
+
+#endif  // TRIPOLI_PASS_THROUGH_H__
@@ -8,6 +8,8 @@
 #include <fst/fst.h>
 #include "readers.h"
 #include "tripoli.h"
+#include "tokenizer.h"
+#include <memory>
 
 using namespace std;
 using namespace fst;
@@ -16,30 +18,26 @@ namespace fst {
 
 template <typename T>
 bool ReadIntVectors(const string& filename, vector<vector<T>> *vectors) {
-  ifstream strm(filename.c_str());
-  if (!strm) {
+  unique_ptr<TextFile> text(TextFile::Open(filename));
+  if (!text) {
     LOG(ERROR) << "ReadIntVectors: Can't open file: " << filename;
     return false;
   }
-  const int kLineLen = 8096;
-  char line[kLineLen];
-  size_t nline = 0;
+  Tokenizer tok(*text);
   vectors->clear();
-  while (strm.getline(line, kLineLen)) {
-    ++nline;
-    vector<char *> col;
-    SplitToVector(line, "\n\t ", &col, true);
+  Token col;
+  while (tok.NextLine()) {
     // empty line or comment?
-    if (col.size() == 0 || col[0][0] == '\0' || col[0][0] == '#')
+    if (!tok.NextToken(&col) || col.front() == '#')
       continue;
 
     bool err;
     vector<T> vec;
-    for (size_t i = 0; i < col.size(); ++i) {
-      T n = StrToInt64(col[i], filename, nline, false, &err);
+    do {
+      T n = tok.ToInt64(col, false, &err);
       if (err) return false;
       vec.push_back(n);
-    }
+    } while (tok.NextToken(&col));
     vectors->push_back(vec);
   }
   return true;
@@ -47,30 +45,27 @@ bool ReadIntVectors(const string& filename, vector<vector<T>> *vectors) {
 template bool ReadIntVectors(const string&, vector<Rule>*);
 
 bool ReadNumberedStrings(const string& filename, vector<string> *strings) {
-  ifstream strm(filename.c_str());
-  if (!strm) {
+  unique_ptr<TextFile> text(TextFile::Open(filename));
+  if (!text) {
     LOG(ERROR) << "ReadNumberedStrings: Can't open file: " << filename;
     return false;
   }
-  string input;
-  size_t nline = 0;
+  Tokenizer tok(*text);
   strings->clear();
   int prevn = -1;
-  while (getline(strm, input)) {
-    ++nline;
-    stringstream ss(input);
-    int64 n;
-    ss >> n;
-    if (n <= prevn) return false;
+  Token col;
+  while (tok.NextLine()) {
+    if (!tok.NextToken(&col))
+      continue;
+    bool err;
+    int64 n = tok.ToInt64(col, false, &err, "ReadNumberedStrings");
+    if (err || n <= prevn) return false;
     prevn++;
     for (; prevn < n; ++prevn) {
       strings->push_back("");
     }
-    string s;
-    ss >> s;
-    strings->push_back(s);
+    strings->push_back(tok.NextToken(&col) ? col.str() : "");
   }
-  strm.close();
   return true;
 }
 
@@ -107,7 +102,7 @@ bool ReadSymbolFile(const string& filename, Symbol *max_term,
 }
 
 inline bool ReadLabelFile(const string& filename, vector<Symbol> *labels_to_symbols, const Symbol max_term) {
-  cout << "Reading labels..\n";
+  cerr << "Reading labels..\n";
   vector<string> labels;
   ReadNumberedStrings(filename, &labels);
   labels_to_symbols->push_back(-1);
@@ -0,0 +1,149 @@
+/*
+ * rule-set.cpp
+ */
+
+#include "rule-set.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "stats.h"
+
+namespace fst {
+
+const RuleSetId RuleSetPool::kEmpty;
+
+RuleSetPool::RuleSetPool() : union_lookups_(0), union_hits_(0) {
+  Entry empty = {0, 0, 0, -1, false, HashRules(0, 0)};
+  sets_.push_back(empty);
+  by_hash_.insert(std::make_pair(empty.hash, kEmpty));
+}
+
+uint64_t RuleSetPool::HashRules(const RuleId *begin, const RuleId *end) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ (end - begin);
+  for (; begin != end; ++begin) {
+    h ^= uint32_t(*begin);
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+  }
+  return h;
+}
+
+bool RuleSetPool::Equals(const Entry &e, const RuleId *begin, const RuleId *end) const {
+  if (e.size != size_t(end - begin))
+    return false;
+  if (!e.dense)
+    return std::equal(begin, end, sparse_.begin() + e.offset);
+  for (; begin != end; ++begin) {
+    if (!Contains(&e - &sets_[0], *begin))
+      return false;
+  }
+  return true;
+}
+
+RuleSetId RuleSetPool::Intern(const RuleId *begin, const RuleId *end) {
+  if (begin == end)
+    return kEmpty;
+  uint64_t hash = HashRules(begin, end);
+  auto range = by_hash_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (Equals(sets_[it->second], begin, end))
+      return it->second;
+  }
+
+  Entry e;
+  e.size = end - begin;
+  e.min = begin[0];
+  e.max = end[-1];
+  e.hash = hash;
+  size_t words = (size_t(e.max) - e.min) / 64 + 1;
+  e.dense = words * sizeof(uint64_t) < e.size * sizeof(RuleId);
+  if (e.dense) {
+    e.offset = dense_.size();
+    dense_.resize(dense_.size() + words, 0);
+    for (; begin != end; ++begin) {
+      size_t bit = *begin - e.min;
+      dense_[e.offset + bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  } else {
+    e.offset = sparse_.size();
+    sparse_.insert(sparse_.end(), begin, end);
+  }
+
+  RuleSetId id = sets_.size();
+  sets_.push_back(e);
+  by_hash_.insert(std::make_pair(hash, id));
+  return id;
+}
+
+RuleSetId RuleSetPool::Union(RuleSetId a, RuleSetId b) {
+  if (a == b || b == kEmpty)
+    return a;
+  if (a == kEmpty)
+    return b;
+  if (a > b)
+    std::swap(a, b);
+  uint64_t key = uint64_t(a) << 32 | b;
+  TRIPOLI_COUNT(union_lookups_, 1);
+  auto it = unions_.find(key);
+  if (it != unions_.end()) {
+    TRIPOLI_COUNT(union_hits_, 1);
+    return it->second;
+  }
+
+  Elements(a, &scratch_a_);
+  Elements(b, &scratch_b_);
+  scratch_union_.clear();
+  std::set_union(scratch_a_.begin(), scratch_a_.end(),
+                 scratch_b_.begin(), scratch_b_.end(),
+                 std::back_inserter(scratch_union_));
+  RuleSetId id = Intern(scratch_union_);
+  unions_[key] = id;
+  return id;
+}
+
+RuleBits RuleSetPool::Bits(RuleSetId set) {
+  const Entry &e = sets_[set];
+  if (e.size == 0)
+    return RuleBits();
+  size_t words = (size_t(e.max) - e.min) / 64 + 1;
+  if (e.dense)
+    return RuleBits(&dense_[e.offset], e.min, words * 64);
+  std::vector<uint64_t> &bits = sparse_bits_[set];
+  if (bits.empty()) {
+    bits.resize(words, 0);
+    for (uint32_t i = 0; i < e.size; ++i) {
+      size_t bit = sparse_[e.offset + i] - e.min;
+      bits[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  }
+  return RuleBits(bits.data(), e.min, words * 64);
+}
+
+size_t RuleSetPool::MemoryBytes() const {
+  // Hash nodes hold a key, a value and a next pointer, plus a bucket each
+  size_t node = 2 * sizeof(uint64_t) + 2 * sizeof(void *);
+  size_t bytes = sets_.capacity() * sizeof(Entry) + sparse_.capacity() * sizeof(RuleId) +
+                 dense_.capacity() * sizeof(uint64_t) +
+                 (by_hash_.size() + unions_.size() + sparse_bits_.size()) * node;
+  for (auto it = sparse_bits_.begin(); it != sparse_bits_.end(); ++it)
+    bytes += it->second.capacity() * sizeof(uint64_t);
+  return bytes;
+}
+
+void RuleSetPool::Elements(RuleSetId set, std::vector<RuleId> *rules) const {
+  const Entry &e = sets_[set];
+  rules->clear();
+  if (!e.dense) {
+    rules->assign(sparse_.begin() + e.offset, sparse_.begin() + e.offset + e.size);
+    return;
+  }
+  rules->reserve(e.size);
+  size_t words = (size_t(e.max) - e.min) / 64 + 1;
+  for (size_t w = 0; w < words; ++w) {
+    for (uint64_t bits = dense_[e.offset + w]; bits; bits &= bits - 1)
+      rules->push_back(e.min + RuleId(w * 64 + __builtin_ctzll(bits)));
+  }
+}
+
+}  // namespace fst
@@ -0,0 +1,113 @@
+// rule-set.h
+//
+// Intern table for the immutable sets of rule ids that the Tripoli filter
+// disallows after backing off.
+
+#ifndef TRIPOLI_RULE_SET_H__
+#define TRIPOLI_RULE_SET_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace fst {
+
+typedef int RuleId;  // as in tripoli.h
+typedef uint32_t RuleSetId;
+
+// A rule set as a bitset: rule r is in the set iff bit r - min of words is
+// set, for r in [min, min + nbits). nbits is 0 for the empty set.
+struct RuleBits {
+  const uint64_t *words;
+  RuleId min;
+  size_t nbits;
+
+  RuleBits() : words(0), min(0), nbits(0) {}
+  RuleBits(const uint64_t *words, RuleId min, size_t nbits) : words(words), min(min), nbits(nbits) {}
+};
+
+// Every distinct set is stored once and referred to by a 32-bit handle, so
+// equal sets share a handle and copying one is free. A set is stored as a
+// sorted array of ids, or as a bitset over its id range when that is the
+// smaller of the two. Unions are memoized by their pair of handles.
+class RuleSetPool {
+public:
+  static const RuleSetId kEmpty = 0;
+
+  RuleSetPool();
+
+  // [begin, end) must be sorted and free of duplicates.
+  RuleSetId Intern(const RuleId *begin, const RuleId *end);
+  RuleSetId Intern(const std::vector<RuleId> &rules) {
+    return Intern(rules.data(), rules.data() + rules.size());
+  }
+
+  RuleSetId Union(RuleSetId a, RuleSetId b);
+
+  bool Contains(RuleSetId set, RuleId r) const {
+    const Entry &e = sets_[set];
+    if (e.dense) {
+      if (r < e.min || r > e.max)
+        return false;
+      size_t bit = r - e.min;
+      return (dense_[e.offset + bit / 64] >> (bit % 64)) & 1;
+    }
+    const RuleId *first = sparse_.data() + e.offset;
+    const RuleId *last = first + e.size;
+    // short sets are cheaper to scan than to bisect
+    if (e.size <= 8) {
+      for (; first != last; ++first) {
+        if (*first >= r)
+          return *first == r;
+      }
+      return false;
+    }
+    const RuleId *it = std::lower_bound(first, last, r);
+    return it != last && *it == r;
+  }
+
+  // The set as a bitset; a sparse set is expanded once and kept. The
+  // words are only valid until the next Intern() or Union().
+  RuleBits Bits(RuleSetId set);
+
+  size_t Size(RuleSetId set) const { return sets_[set].size; }
+  void Elements(RuleSetId set, std::vector<RuleId> *rules) const;
+
+  size_t NumSets() const { return sets_.size(); }
+  size_t NumUnions() const { return unions_.size(); }
+  // Union() calls on two distinct non-empty sets, and those answered from
+  // the memo; counted unless built with TRIPOLI_STATS=0.
+  uint64_t UnionLookups() const { return union_lookups_; }
+  uint64_t UnionHits() const { return union_hits_; }
+  // Approximate heap bytes of the sets, the memos and their indexes.
+  size_t MemoryBytes() const;
+
+private:
+  struct Entry {
+    uint32_t offset;  // into sparse_ (ids) or dense_ (words)
+    uint32_t size;    // number of ids in the set
+    RuleId min;
+    RuleId max;
+    bool dense;
+    uint64_t hash;
+  };
+
+  static uint64_t HashRules(const RuleId *begin, const RuleId *end);
+  bool Equals(const Entry &e, const RuleId *begin, const RuleId *end) const;
+
+  std::vector<Entry> sets_;
+  std::vector<RuleId> sparse_;
+  std::vector<uint64_t> dense_;
+  std::unordered_multimap<uint64_t, RuleSetId> by_hash_;
+  std::unordered_map<uint64_t, RuleSetId> unions_;  // keyed by (smaller, larger) handle
+  std::unordered_map<RuleSetId, std::vector<uint64_t> > sparse_bits_;  // sparse sets, by Bits()
+  std::vector<RuleId> scratch_a_, scratch_b_, scratch_union_;
+  uint64_t union_lookups_;
+  uint64_t union_hits_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_RULE_SET_H__
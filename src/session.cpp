@@ -0,0 +1,229 @@
+/*
+ * session.cpp
+ */
+
+#include "session.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace fst {
+
+namespace {
+
+const size_t kNoEntry = ~size_t(0);
+
+bool CheaperEntry(const FrontierEntry &a, const FrontierEntry &b) {
+  return a.cost < b.cost;
+}
+
+bool CheaperPrediction(const Prediction &a, const Prediction &b) {
+  return a.cost != b.cost ? a.cost < b.cost : a.label < b.label;
+}
+
+// Plus in the log semiring, over costs
+float LogPlus(float a, float b) {
+  float lo = std::min(a, b), hi = std::max(a, b);
+  return lo - std::log1p(std::exp(lo - hi));
+}
+
+}  // namespace
+
+TripoliSession::TripoliSession(const TripoliModel &model, const SessionOptions &opts)
+        : model_(model), opts_(opts), pdt_(model.NewPdtView()),
+          input_(new LinearFst<TripoliArc>(vector<Label>())), frontiers_(1) {
+  // The filter owns its matchers, as in TripoliCompose
+  InputMatcher *matcher1 = new InputMatcher(*input_, MATCH_OUTPUT);
+  TripoliPdtMatcher *matcher2 = new TripoliPdtMatcher(*pdt_, MATCH_INPUT, &model.GetLabelIndex());
+  filter_.reset(new Filter(*input_, *pdt_, &model.GetPDTInfo(), model.GetParens(), matcher1,
+                           matcher2));
+  if (pdt_->Start() == kNoStateId)
+    return;
+  index_.clear();
+  Add(pdt_->Start(), filter_->Start(), 0, &frontiers_[0]);
+  Close(&frontiers_[0]);
+}
+
+TripoliSession::~TripoliSession() {}
+
+bool TripoliSession::Extend(Label label) {
+  // Epsilons and parens are the closure's, not the input's
+  if (label <= 0)
+    return false;
+  const vector<FrontierEntry> &current = frontiers_.back();
+  vector<FrontierEntry> next;
+  index_.clear();
+  TripoliArc arc1(label, label, TripoliArc::Weight::One(), 0);
+  for (size_t i = 0; i < current.size(); ++i)
+    Follow(current[i], label, arc1, &next, 0);
+  if (next.empty())
+    return false;
+  Close(&next);
+  frontiers_.push_back(std::move(next));
+  return true;
+}
+
+bool TripoliSession::Rollback(size_t position) {
+  if (position > Position())
+    return false;
+  frontiers_.resize(position + 1);
+  return true;
+}
+
+float TripoliSession::FinalCost() const {
+  float best = std::numeric_limits<float>::infinity();
+  const vector<FrontierEntry> &frontier = Frontier();
+  for (size_t i = 0; i < frontier.size(); ++i) {
+    if (frontier[i].filter.GetState2().GetState() != 0)
+      continue;
+    best = std::min(best, frontier[i].cost + pdt_->Final(frontier[i].state).Value());
+  }
+  return best;
+}
+
+void TripoliSession::Predict(const PredictOptions &opts, vector<Prediction> *predictions) {
+  const float kInfinity = std::numeric_limits<float>::infinity();
+  predictions->clear();
+  if (opts.k == 0)
+    return;
+  const Grammar &grammar = model_.GetGrammar();
+  scores_.resize(grammar.MaxTerm() + 1, kInfinity);
+  scored_.clear();
+  const vector<FrontierEntry> &frontier = Frontier();
+  float margin = opts.sum ? opts.margin : 0;
+  // Costs only fall as entries are swept, so a stale k-th cost still
+  // bounds the true one; it is refreshed after 1, 2, 4, ... entries.
+  float kth = kInfinity;
+  for (size_t i = 0, refresh = 1; i < frontier.size(); ++i) {
+    const FrontierEntry &entry = frontier[i];
+    if (entry.cost >= kth + margin)
+      break;
+    // The filter judges each arc as Follow would, syntactic backoffs
+    // included
+    filter_->SetState(0, entry.state, entry.filter);
+    const TripoliArc *arcs = pdt_->Arcs(entry.state);
+    for (size_t a = 0; a < pdt_->NumArcs(entry.state); ++a) {
+      const TripoliArc &arc = arcs[a];
+      if (!grammar.IsTerm(arc.ilabel))
+        continue;
+      TripoliArc input_arc(arc.ilabel, arc.ilabel, TripoliArc::Weight::One(), 0);
+      TripoliArc pdt_arc = arc;
+      if (filter_->FilterArc(&input_arc, &pdt_arc) == TripoliComposeFilterState::NoState())
+        continue;
+      float cost = entry.cost + arc.weight.Value();
+      float &score = scores_[arc.ilabel];
+      if (score == kInfinity)
+        scored_.push_back(arc.ilabel);
+      score = opts.sum ? LogPlus(score, cost) : std::min(score, cost);
+    }
+    if (i + 1 == refresh) {
+      kth = KthCost(opts.k);
+      refresh *= 2;
+    }
+  }
+
+  for (size_t i = 0; i < scored_.size(); ++i) {
+    Prediction prediction = {scored_[i], scores_[scored_[i]]};
+    predictions->push_back(prediction);
+    scores_[scored_[i]] = kInfinity;
+  }
+  size_t k = std::min(opts.k, predictions->size());
+  std::partial_sort(predictions->begin(), predictions->begin() + k, predictions->end(),
+                    CheaperPrediction);
+  predictions->resize(k);
+}
+
+float TripoliSession::KthCost(size_t k) {
+  if (scored_.size() < k)
+    return std::numeric_limits<float>::infinity();
+  costs_.clear();
+  for (size_t i = 0; i < scored_.size(); ++i)
+    costs_.push_back(scores_[scored_[i]]);
+  std::nth_element(costs_.begin(), costs_.begin() + (k - 1), costs_.end());
+  return costs_[k - 1];
+}
+
+size_t TripoliSession::Add(TripoliArc::StateId state, const TripoliComposeFilterState &filter,
+                           float cost, vector<FrontierEntry> *next) {
+  EntryKey key = {state, filter};
+  std::pair<std::unordered_map<EntryKey, size_t, EntryKeyHash>::iterator, bool> inserted =
+      index_.insert(std::make_pair(key, next->size()));
+  if (inserted.second) {
+    FrontierEntry entry = {state, filter, cost};
+    next->push_back(entry);
+    return next->size() - 1;
+  }
+  FrontierEntry &entry = (*next)[inserted.first->second];
+  if (cost >= entry.cost)
+    return kNoEntry;
+  entry.cost = cost;
+  return inserted.first->second;
+}
+
+void TripoliSession::Follow(const FrontierEntry &entry, Label label, const TripoliArc &arc1,
+                            vector<FrontierEntry> *next, vector<size_t> *reached) {
+  // The filter's state comes first: the matcher's prefilter reads it
+  filter_->SetState(0, entry.state, entry.filter);
+  TripoliPdtMatcher *matcher = filter_->GetMatcher2();
+  matcher->SetState(entry.state);
+  if (!matcher->Find(label))
+    return;
+  for (; !matcher->Done(); matcher->Next()) {
+    TripoliArc input_arc = arc1;
+    TripoliArc pdt_arc = matcher->Value();
+    TripoliComposeFilterState f = filter_->FilterArc(&input_arc, &pdt_arc);
+    if (f == TripoliComposeFilterState::NoState())
+      continue;
+    size_t e = Add(pdt_arc.nextstate, f,
+                   entry.cost + input_arc.weight.Value() + pdt_arc.weight.Value(), next);
+    if (e != kNoEntry && reached)
+      reached->push_back(e);
+  }
+}
+
+void TripoliSession::Close(vector<FrontierEntry> *next) {
+  typedef std::pair<float, size_t> Item;  // (cost when queued, entry)
+  std::priority_queue<Item, vector<Item>, std::greater<Item> > agenda;
+  for (size_t i = 0; i < next->size(); ++i)
+    agenda.push(Item((*next)[i].cost, i));
+  // What the composition matches an epsilon or paren PDT arc with: the
+  // input's loop, which stays at the same position
+  TripoliArc loop(0, kNoLabel, TripoliArc::Weight::One(), 0);
+  vector<bool> kept;
+  vector<size_t> reached;
+  float best = std::numeric_limits<float>::infinity();
+  size_t nkept = 0;
+  while (!agenda.empty()) {
+    Item item = agenda.top();
+    agenda.pop();
+    // Made cheaper, and queued again, since
+    if (item.first != (*next)[item.second].cost)
+      continue;
+    best = std::min(best, item.first);
+    kept.resize(next->size(), false);
+    if (!kept[item.second]) {
+      if (item.first > best + opts_.beam || (opts_.max_active && nkept >= opts_.max_active))
+        continue;
+      kept[item.second] = true;
+      ++nkept;
+    }
+    FrontierEntry entry = (*next)[item.second];  // next may grow
+    reached.clear();
+    Follow(entry, kNoLabel, loop, next, &reached);
+    for (size_t i = 0; i < reached.size(); ++i)
+      agenda.push(Item((*next)[reached[i]].cost, reached[i]));
+  }
+  kept.resize(next->size(), false);
+  size_t n = 0;
+  for (size_t i = 0; i < next->size(); ++i) {
+    if (kept[i])
+      (*next)[n++] = (*next)[i];
+  }
+  next->resize(n);
+  std::stable_sort(next->begin(), next->end(), CheaperEntry);
+}
+
+}
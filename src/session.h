@@ -0,0 +1,162 @@
+/*
+ * session.h
+ *
+ * Online decoding: a composition with an input that arrives one token at
+ * a time, kept as the frontier of states reached by the prefix so far
+ * rather than recomposed from the start on every token.
+ */
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "linear-fst.h"
+#include "model.h"
+
+namespace fst {
+
+struct SessionOptions {
+  float beam;  // costs kept above the best in a frontier
+  size_t max_active;  // states kept in a frontier; 0 for no cap
+
+  SessionOptions() : beam(std::numeric_limits<float>::infinity()), max_active(0) {}
+};
+
+struct PredictOptions {
+  size_t k;  // tokens to predict
+  // If set, a token's cost sums (in the log semiring) the frontier's paths
+  // that read it next; if not, it is the cheapest of them.
+  bool sum;
+  // With sum, frontier entries costlier than the k-th token by more than
+  // this are left out of the sweep; without, the sweep stops at the k-th
+  // token's cost, which is exact.
+  float margin;
+
+  PredictOptions() : k(10), sum(true), margin(10) {}
+};
+
+// A token that can be read next, with the cost of reading it after the
+// prefix.
+struct Prediction {
+  Label label;
+  float cost;
+};
+
+// A state of the composition at the current input position: a PDT state
+// and the filter state of the paths that reach it (backoffs and paren
+// stack), with the cheapest cost of those paths.
+struct FrontierEntry {
+  TripoliArc::StateId state;
+  TripoliComposeFilterState filter;
+  float cost;
+};
+
+// The composition of a model with a prefix, as TripoliCompose would expand
+// it with the prefix as a LinearFst, held only at the prefix's end: the
+// frontier is every state the prefix reaches, closed under the PDT's
+// epsilon and paren arcs. Extending it by a token follows the frontier's
+// arcs on that token and closes the result, through the same filter and
+// PDT matcher as the composition, so it costs the same whatever the
+// prefix length. Each position's frontier is kept, so going back to an
+// earlier position is a pop.
+//
+// Paths are recombined by the cheapest cost into each entry, as a best
+// path search would; the filter's tables are shared by every position, so
+// the model must outlive the session.
+class TripoliSession {
+public:
+  explicit TripoliSession(const TripoliModel &model, const SessionOptions &opts = SessionOptions());
+  ~TripoliSession();
+
+  // Reads label next; if no path reads it, returns false and leaves the
+  // session as it was.
+  bool Extend(Label label);
+
+  // Tokens read so far, the position a Rollback can return to.
+  size_t Position() const { return frontiers_.size() - 1; }
+
+  // Goes back to an earlier position, as if the tokens after it were
+  // never read; false if position is past the current one.
+  bool Rollback(size_t position);
+
+  // Goes back to the empty prefix.
+  void Reset() { Rollback(0); }
+
+  // The current frontier, cheapest first.
+  const vector<FrontierEntry> &Frontier() const { return frontiers_.back(); }
+
+  // The cheapest complete path ending with the prefix (its final weight
+  // included, its parens closed), or infinity if the prefix cannot end
+  // there.
+  float FinalCost() const;
+
+  // The opts.k terminals cheapest to read next, cheapest first (ties by
+  // label), to predictions. A terminal arc out of a frontier entry's PDT
+  // state counts if the filter would let the entry read it, as Extend
+  // does: a rule not disallowed there that can reach the terminal, or a
+  // syntactic backoff while the entry has a backoff label to spare. The
+  // entries are swept cheapest first and the sweep ends once no entry left
+  // can change the k best (see PredictOptions), so arc weights must not be
+  // negative. As each entry holds only its cheapest path, a sum is over
+  // entries rather than every path.
+  void Predict(const PredictOptions &opts, vector<Prediction> *predictions);
+
+  const TripoliModel &GetModel() const { return model_; }
+
+private:
+  typedef LinearMatcher<LinearFst<TripoliArc> > InputMatcher;
+  typedef TripoliParenFilter<InputMatcher, TripoliPdtMatcher> Filter;
+
+  struct EntryKey {
+    TripoliArc::StateId state;
+    TripoliComposeFilterState filter;
+
+    bool operator==(const EntryKey &key) const {
+      return state == key.state && filter == key.filter;
+    }
+  };
+
+  struct EntryKeyHash {
+    size_t operator()(const EntryKey &key) const {
+      return key.filter.Hash() * 7853 ^ size_t(key.state);
+    }
+  };
+
+  // Adds an entry to next, unless next has it as cheaply already; returns
+  // its index if it was added or made cheaper, and ~0 if not.
+  size_t Add(TripoliArc::StateId state, const TripoliComposeFilterState &filter, float cost,
+             vector<FrontierEntry> *next);
+
+  // Follows the PDT arcs on label out of entry into next, matched with the
+  // input arc arc1 as the composition would; the entries added or made
+  // cheaper go to reached, if given.
+  void Follow(const FrontierEntry &entry, Label label, const TripoliArc &arc1,
+              vector<FrontierEntry> *next, vector<size_t> *reached);
+
+  // Closes next under epsilon and paren arcs, cheapest first, then prunes
+  // it to the beam and active cap and sorts it.
+  void Close(vector<FrontierEntry> *next);
+
+  // The k-th lowest cost of the tokens Predict has scored, or infinity if
+  // there are fewer than k.
+  float KthCost(size_t k);
+
+  const TripoliModel &model_;
+  SessionOptions opts_;
+  std::unique_ptr<TripoliPdt> pdt_;
+  std::unique_ptr<LinearFst<TripoliArc> > input_;  // an empty stand-in for the filter
+  std::unique_ptr<Filter> filter_;
+  vector<vector<FrontierEntry> > frontiers_;  // by position
+  std::unordered_map<EntryKey, size_t, EntryKeyHash> index_;  // into the frontier being built
+  vector<float> scores_;  // Predict's cost of each terminal, infinity if unscored
+  vector<Label> scored_;  // the terminals with a cost
+  vector<float> costs_;  // scratch for KthCost
+};
+
+}
+
+#endif /* SESSION_H_ */
@@ -0,0 +1,65 @@
+// span.h
+//
+// Read-only views of contiguous ranges: Span hands out slices of one flat
+// array, and FlatArray holds a table that is either built in memory or
+// mapped straight from a compiled model file.
+
+#ifndef TRIPOLI_SPAN_H__
+#define TRIPOLI_SPAN_H__
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace fst {
+
+template <class T>
+class Span {
+public:
+  typedef const T *const_iterator;
+
+  Span() : data_(0), size_(0) {}
+  Span(const T *data, size_t size) : data_(data), size_(size) {}
+
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+  const T *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T &operator[](size_t i) const { return data_[i]; }
+
+private:
+  const T *data_;
+  size_t size_;
+};
+
+// An array that owns its elements, or views elements owned by someone else
+// (such as a mapped model file) that must outlive it. Only an owning array
+// can be modified, through Owned().
+template <class T>
+class FlatArray {
+public:
+  FlatArray() : view_(0), view_size_(0) {}
+  explicit FlatArray(const std::vector<T> &owned) : owned_(owned), view_(0), view_size_(0) {}
+  explicit FlatArray(std::vector<T> &&owned) : owned_(std::move(owned)), view_(0), view_size_(0) {}
+  FlatArray(const T *data, size_t size) : view_(data), view_size_(size) {}
+
+  const T *data() const { return view_ ? view_ : owned_.data(); }
+  size_t size() const { return view_ ? view_size_ : owned_.size(); }
+  bool empty() const { return size() == 0; }
+  const T &operator[](size_t i) const { return data()[i]; }
+  Span<T> Slice(size_t begin, size_t end) const { return Span<T>(data() + begin, end - begin); }
+
+  bool IsView() const { return view_ != 0; }
+  std::vector<T> &Owned() { return owned_; }
+  size_t SizeInBytes() const { return size() * sizeof(T); }
+
+private:
+  std::vector<T> owned_;
+  const T *view_;
+  size_t view_size_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_SPAN_H__
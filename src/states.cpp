@@ -6,36 +6,48 @@
  */
 
 #include "tripoli.h"
+#include "states.h"
+#include "tokenizer.h"
 #include <iostream>
+#include <memory>
 #include <vector>
 
 using namespace std;
 using namespace fst;
 
-vector<StateInfo> read_states(istream& f) {
-	if (!f) {
-		throw string("Could not open stream");
-	}
-	string line;
+static vector<StateInfo> read_states(Tokenizer *tok) {
 	vector<StateInfo> lines;
-	while (getline(f, line)) {
+	vector<Token> col;
+	while (tok->NextLine()) {
 		StateInfo s;
-		istringstream l(line);
-		// Throw away the first token, which is the id
-		l.ignore(numeric_limits<streamsize>::max(), ' ');
-		int arctag;
-		l >> arctag;
-		s.tag = StateTag(arctag);
+		bool err = false;
+		// The first token is the id, which is implied by the line number
+		if (tok->Split(&col) < 2)
+			throw invalid_argument("read_states: Bad state line, source = " + tok->Source() +
+			                       ", line = " + to_string(tok->LineNumber()));
+		s.tag = StateTag(tok->ToInt64(col[1], false, &err, "read_states"));
+		if (err)
+			throw invalid_argument("read_states: Bad state tag, source = " + tok->Source() +
+			                       ", line = " + to_string(tok->LineNumber()));
 		// Later on, these values are checked in the PDTInfo constructor
 		switch(s.tag) {
 		case StateTag::TRIGRAM_STATE:
 			// URGENT TODO: Check both what the application assumes is
 			// meant by fst and snd and what is given in the input file
-			l >> s.fst;
-			l >> s.snd;
+			if (col.size() < 4)
+				err = true;
+			else {
+				bool snd_err;
+				s.fst = tok->ToInt64(col[2], true, &err, "read_states");
+				s.snd = tok->ToInt64(col[3], true, &snd_err, "read_states");
+				err = err || snd_err;
+			}
 			break;
 		case StateTag::BIGRAM_STATE:
-			l >> s.fst;
+			if (col.size() < 3)
+				err = true;
+			else
+				s.fst = tok->ToInt64(col[2], true, &err, "read_states");
 			s.snd = -1;
 			break;
 		default:
@@ -43,7 +55,27 @@ vector<StateInfo> read_states(istream& f) {
 			s.fst = -1;
 			s.snd = -1;
 		}
+		if (err)
+			throw invalid_argument("read_states: Bad state context, source = " + tok->Source() +
+			                       ", line = " + to_string(tok->LineNumber()));
 		lines.push_back(s);
 	}
 	return lines;
 }
+
+vector<StateInfo> read_states(istream& f) {
+	if (!f) {
+		throw string("Could not open stream");
+	}
+	unique_ptr<TextFile> text(TextFile::Read(f, "stream"));
+	Tokenizer tok(*text);
+	return read_states(&tok);
+}
+
+vector<StateInfo> read_states(const string& filename) {
+	unique_ptr<TextFile> text(TextFile::Open(filename));
+	if (!text)
+		throw invalid_argument("read_states: can't open " + filename);
+	Tokenizer tok(*text);
+	return read_states(&tok);
+}
@@ -14,5 +14,7 @@ using namespace std;
 using namespace fst;
 
 vector<StateInfo> read_states(istream& f);
+// Maps the file rather than reading it through a stream.
+vector<StateInfo> read_states(const string& filename);
 
 #endif /* STATES_H_ */
@@ -0,0 +1,175 @@
+/*
+ * stats.cpp
+ */
+
+#include "stats.h"
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <fstream>
+
+#include <fst/fst.h>
+
+namespace fst {
+
+namespace {
+
+// Each counter with its JSON name, in report order.
+struct Counter {
+  const char *name;
+  uint64_t ComposeStats::*field;
+};
+
+const Counter kCounters[] = {
+  {"filter_arcs", &ComposeStats::filter_arcs},
+  {"rejected_disallowed", &ComposeStats::rejected_disallowed},
+  {"rejected_reach", &ComposeStats::rejected_reach},
+  {"lexical_backoffs", &ComposeStats::lexical_backoffs},
+  {"chain_backoffs", &ComposeStats::chain_backoffs},
+  {"syntactic_backoffs", &ComposeStats::syntactic_backoffs},
+  {"backoff_overflows", &ComposeStats::backoff_overflows},
+  {"prefiltered_arcs", &ComposeStats::prefiltered_arcs},
+  {"prefilter_rejected", &ComposeStats::prefilter_rejected},
+  {"set_lookups", &ComposeStats::set_lookups},
+  {"set_hits", &ComposeStats::set_hits},
+  {"union_lookups", &ComposeStats::union_lookups},
+  {"union_hits", &ComposeStats::union_hits},
+  {"composed_states", &ComposeStats::composed_states},
+  {"filter_states", &ComposeStats::filter_states},
+  {"rule_sets", &ComposeStats::rule_sets},
+  {"table_bytes", &ComposeStats::table_bytes},
+};
+
+// Names are ours or input paths; only quotes, backslashes and control
+// characters need escaping.
+void WriteString(std::ostream &strm, const std::string &s) {
+  strm << '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      strm << '\\' << c;
+    } else if (c < 0x20) {
+      const char *hex = "0123456789abcdef";
+      strm << "\\u00" << hex[c >> 4] << hex[c & 15];
+    } else {
+      strm << c;
+    }
+  }
+  strm << '"';
+}
+
+void WriteCounters(std::ostream &strm, const ComposeStats &stats) {
+  for (size_t i = 0; i < sizeof(kCounters) / sizeof(kCounters[0]); ++i) {
+    if (i > 0)
+      strm << ", ";
+    strm << '"' << kCounters[i].name << "\": " << stats.*kCounters[i].field;
+  }
+}
+
+double Rate(uint64_t hits, uint64_t lookups) {
+  return lookups ? double(hits) / lookups : 0;
+}
+
+}  // namespace
+
+void ComposeStats::Add(const ComposeStats &stats) {
+  for (size_t i = 0; i < sizeof(kCounters) / sizeof(kCounters[0]); ++i)
+    this->*kCounters[i].field += stats.*kCounters[i].field;
+}
+
+void StatsReport::AddTime(const std::string &phase, double seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < times_.size(); ++i) {
+    if (times_[i].first == phase) {
+      times_[i].second += seconds;
+      return;
+    }
+  }
+  times_.push_back(std::make_pair(phase, seconds));
+}
+
+void StatsReport::AddMemory(const std::string &structure, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < memory_.size(); ++i) {
+    if (memory_[i].first == structure) {
+      memory_[i].second = std::max(memory_[i].second, bytes);
+      return;
+    }
+  }
+  memory_.push_back(std::make_pair(structure, bytes));
+}
+
+void StatsReport::AddCompose(const std::string &item, const ComposeStats &stats, double seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Item entry = {item, stats, seconds};
+  items_.push_back(entry);
+  totals_.Add(stats);
+  compose_seconds_ += seconds;
+}
+
+ComposeStats StatsReport::Totals() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return totals_;
+}
+
+size_t StatsReport::NumItems() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return items_.size();
+}
+
+uint64_t StatsReport::MemoryBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < memory_.size(); ++i)
+    bytes += memory_[i].second;
+  return bytes;
+}
+
+void StatsReport::WriteJson(std::ostream &strm) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  strm << "{\"times\": {";
+  for (size_t i = 0; i < times_.size(); ++i) {
+    strm << (i > 0 ? ", " : "");
+    WriteString(strm, times_[i].first);
+    strm << ": " << times_[i].second;
+  }
+  strm << "},\n \"memory\": {";
+  for (size_t i = 0; i < memory_.size(); ++i) {
+    strm << (i > 0 ? ", " : "");
+    WriteString(strm, memory_[i].first);
+    strm << ": " << memory_[i].second;
+  }
+  struct rusage usage;
+  uint64_t peak_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? uint64_t(usage.ru_maxrss) * 1024 : 0;
+  strm << "},\n \"peak_rss_bytes\": " << peak_rss;
+  strm << ",\n \"compose\": {\"items\": " << items_.size() << ", \"seconds\": " << compose_seconds_
+       << ", \"totals\": {";
+  WriteCounters(strm, totals_);
+  strm << "}, \"set_hit_rate\": " << Rate(totals_.set_hits, totals_.set_lookups)
+       << ", \"union_hit_rate\": " << Rate(totals_.union_hits, totals_.union_lookups);
+  strm << "},\n \"items\": [";
+  for (size_t i = 0; i < items_.size(); ++i) {
+    strm << (i > 0 ? ",\n   " : "\n   ") << "{\"name\": ";
+    WriteString(strm, items_[i].name);
+    strm << ", \"seconds\": " << items_[i].seconds << ", ";
+    WriteCounters(strm, items_[i].stats);
+    strm << "}";
+  }
+  strm << "]}\n";
+}
+
+bool StatsReport::WriteJson(const std::string &filename) const {
+  std::ofstream strm(filename.c_str());
+  if (!strm) {
+    LOG(ERROR) << "StatsReport: Can't open file: " << filename;
+    return false;
+  }
+  WriteJson(strm);
+  if (!strm) {
+    LOG(ERROR) << "StatsReport: Write failed: " << filename;
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,132 @@
+/*
+ * stats.h
+ *
+ * Instrumentation: load-phase timers, composition counters and the sizes
+ * of the structures built, gathered into a JSON report.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counters cost an add each where they are kept; building with
+// -DTRIPOLI_STATS=0 compiles them out. Timers and reports cost nothing
+// unless a StatsReport is given, so they are chosen at runtime.
+#ifndef TRIPOLI_STATS
+#define TRIPOLI_STATS 1
+#endif
+
+#if TRIPOLI_STATS
+#define TRIPOLI_COUNT(counter, n) ((counter) += (n))
+#else
+#define TRIPOLI_COUNT(counter, n) ((void)0)
+#endif
+
+namespace fst {
+
+// Counters of one composition, kept by its filter (see
+// TripoliFilterTables), and its sizes once done (see GetComposeStats).
+struct ComposeStats {
+  uint64_t filter_arcs;  // FilterArc calls
+  uint64_t rejected_disallowed;  // grammar arcs whose rule was disallowed
+  uint64_t rejected_reach;  // grammar arcs whose rule cannot reach the next terminal
+  uint64_t lexical_backoffs;
+  uint64_t chain_backoffs;  // lexical backoffs along a precomputed chain
+  uint64_t syntactic_backoffs;
+  uint64_t backoff_overflows;  // backoffs dropped as the filter state was full
+  uint64_t prefiltered_arcs;  // arcs checked in runs by the matcher prefilter
+  uint64_t prefilter_rejected;
+  uint64_t set_lookups;  // context, unigram and chain sets looked up
+  uint64_t set_hits;  // ... and found interned already
+  uint64_t union_lookups;  // unions of two disallowed sets
+  uint64_t union_hits;  // ... found memoized
+  uint64_t composed_states;
+  uint64_t filter_states;  // distinct rule filter states among them
+  uint64_t rule_sets;  // disallowed sets interned
+  uint64_t table_bytes;  // the filter's interned sets and memos
+
+  ComposeStats()
+          : filter_arcs(0), rejected_disallowed(0), rejected_reach(0), lexical_backoffs(0),
+            chain_backoffs(0), syntactic_backoffs(0), backoff_overflows(0), prefiltered_arcs(0),
+            prefilter_rejected(0), set_lookups(0), set_hits(0), union_lookups(0), union_hits(0),
+            composed_states(0), filter_states(0), rule_sets(0), table_bytes(0) {}
+
+  void Add(const ComposeStats &stats);
+};
+
+// Collects timings, structure sizes and composition counters from any
+// thread, and writes them as one JSON object:
+//
+//   {"times": {phase: seconds, ...},
+//    "memory": {structure: peak bytes, ...},
+//    "peak_rss_bytes": n,
+//    "compose": {"items": n, "seconds": s, "totals": {counter: n, ...},
+//                "set_hit_rate": r, "union_hit_rate": r},
+//    "items": [{"name": input, "seconds": s, counter: n, ...}, ...]}
+//
+// Phases timed more than once add up; a structure measured more than once
+// keeps its largest size.
+class StatsReport {
+public:
+  StatsReport() : compose_seconds_(0) {}
+
+  void AddTime(const std::string &phase, double seconds);
+  void AddMemory(const std::string &structure, uint64_t bytes);
+  void AddCompose(const std::string &item, const ComposeStats &stats, double seconds);
+
+  ComposeStats Totals() const;
+  size_t NumItems() const;
+  // The sum of every structure's largest size
+  uint64_t MemoryBytes() const;
+
+  void WriteJson(std::ostream &strm) const;
+  // False (and logged) if filename cannot be written.
+  bool WriteJson(const std::string &filename) const;
+
+private:
+  struct Item {
+    std::string name;
+    ComposeStats stats;
+    double seconds;
+  };
+
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, double> > times_;  // in the order first timed
+  std::vector<std::pair<std::string, uint64_t> > memory_;
+  std::vector<Item> items_;
+  ComposeStats totals_;
+  double compose_seconds_;
+};
+
+// Adds the time from construction to destruction to report, if given,
+// under phase.
+class ScopedTimer {
+public:
+  ScopedTimer(StatsReport *report, const std::string &phase)
+          : report_(report), phase_(phase), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    if (report_)
+      report_->AddTime(phase_, Seconds());
+  }
+
+  double Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+private:
+  StatsReport *report_;
+  std::string phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}
+
+#endif /* STATS_H_ */
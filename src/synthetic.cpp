@@ -0,0 +1,262 @@
+/*
+ * synthetic.cpp
+ */
+
+#include "synthetic.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+
+namespace fst {
+
+namespace {
+
+// Each text input with its file name, in the order ReadText takes them.
+struct InputFile {
+  const char *name;
+  void (SyntheticModel::*write)(std::ostream &) const;
+};
+
+const InputFile kInputFiles[] = {
+  {"pdt.txt", &SyntheticModel::WritePdt},
+  {"arc-labels.txt", &SyntheticModel::WriteLabels},
+  {"grammar-symbols.txt", &SyntheticModel::WriteSymbols},
+  {"rules.txt", &SyntheticModel::WriteRules},
+  {"states.txt", &SyntheticModel::WriteStates},
+  {"parens.txt", &SyntheticModel::WriteParens},
+};
+
+uint64_t ContextKey(Symbol fst, Symbol snd) {
+  return uint64_t(uint32_t(fst)) << 32 | uint32_t(snd);
+}
+
+}  // namespace
+
+SyntheticModel::SyntheticModel(const SyntheticOptions &opts)
+        : terminals_(opts.terminals), nonterminals_(opts.nonterminals) {
+  if (opts.terminals <= 0 || opts.nonterminals <= 0)
+    throw invalid_argument("SyntheticModel: terminals and nonterminals should be > 0");
+  if (opts.rules < size_t(opts.terminals) || opts.rules < size_t(opts.nonterminals))
+    throw invalid_argument("SyntheticModel: rules should be at least terminals and nonterminals");
+  double length_total = 0;
+  for (size_t i = 0; i < opts.rule_lengths.size(); ++i) {
+    if (opts.rule_lengths[i] < 0)
+      throw invalid_argument("SyntheticModel: rule length frequencies should be >= 0");
+    length_total += opts.rule_lengths[i];
+  }
+  if (length_total <= 0)
+    throw invalid_argument("SyntheticModel: no rule length has a frequency");
+  if (opts.bigram_density < 0 || opts.bigram_density > 1 || opts.trigram_density < 0 ||
+      opts.dummy_ratio < 0 || opts.dummy_ratio > 1)
+    throw invalid_argument("SyntheticModel: densities and ratios out of range");
+
+  std::mt19937 rng(opts.seed);
+  std::uniform_int_distribution<Symbol> term(1, terminals_);
+  std::uniform_int_distribution<Symbol> nonterm(0, nonterminals_ - 1);
+  std::discrete_distribution<size_t> length(opts.rule_lengths.begin(), opts.rule_lengths.end());
+  std::bernoulli_distribution preterm_corner(0.5);
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::uniform_real_distribution<float> grammar_weight(0.5, 8);
+  std::uniform_real_distribution<float> backoff_weight(0.1, 2);
+
+  // The grammar
+  auto corner = [&]() {
+    return preterm_corner(rng) ? Preterm(term(rng)) : Nonterm(nonterm(rng));
+  };
+  rules_.reserve(opts.rules);
+  for (size_t i = 0; i < opts.rules; ++i) {
+    Rule rule;
+    rule.push_back(i + 1);
+    rule.push_back(Nonterm(i < size_t(nonterminals_) ? i : nonterm(rng)));
+    rule.push_back(i < size_t(terminals_) ? Preterm(i + 1) : corner());
+    for (size_t n = length(rng); n > 0; --n)
+      rule.push_back(corner());
+    rules_.push_back(rule);
+  }
+  // As ReadSymbolFile counts them
+  Grammar grammar(terminals_, 2 * terminals_, 2 * terminals_ + nonterminals_ + 1, rules_);
+
+  // Context arcs keep off the terminals' own rules, so that backing off to
+  // the unigram state never disallows the rule of its arc. A random rule
+  // mostly reaches a given terminal; 0 if none of a few tries does.
+  RuleId nrules = opts.rules;
+  auto context_rule = [&](Symbol t) -> RuleId {
+    if (nrules <= terminals_)
+      return 0;
+    std::uniform_int_distribution<RuleId> rule(terminals_ + 1, nrules);
+    for (int tries = 0; tries < 16; ++tries) {
+      RuleId r = rule(rng);
+      if (grammar.RuleCanReach(r, t))
+        return r;
+    }
+    return 0;
+  };
+
+  // The context states
+  StateId start = AddState(TRIGRAM_STATE, -2, -2);
+  StateId unigram = AddState(UNIGRAM_STATE);
+  vector<StateId> bigrams(terminals_ + 1, kNoStateId);
+  for (Symbol t = 1; t <= terminals_; ++t) {
+    if (chance(rng) < opts.bigram_density)
+      bigrams[t] = AddState(BIGRAM_STATE, t);
+  }
+  unordered_map<uint64_t, StateId> trigrams;
+  double whole = std::floor(opts.trigram_density);
+  for (Symbol t = 1; t <= terminals_; ++t) {
+    if (bigrams[t] == kNoStateId)
+      continue;
+    for (int n = whole + (chance(rng) < opts.trigram_density - whole); n > 0; --n) {
+      Symbol prev = term(rng);
+      if (!trigrams.count(ContextKey(prev, t)))
+        trigrams[ContextKey(prev, t)] = AddState(TRIGRAM_STATE, prev, t);
+    }
+  }
+  StateId ncontexts = states_.size();
+
+  // The highest-order context after prev then t
+  auto next_context = [&](Symbol prev, Symbol t) {
+    unordered_map<uint64_t, StateId>::const_iterator it = trigrams.find(ContextKey(prev, t));
+    if (it != trigrams.end())
+      return it->second;
+    return bigrams[t] != kNoStateId ? bigrams[t] : unigram;
+  };
+  auto add_grammar_arc = [&](StateId src, StateId dst, Label label, RuleId rule) {
+    if (chance(rng) < opts.dummy_ratio) {
+      StateId dummy = AddState(DUMMY_STATE);
+      AddArc(src, dummy, label, grammar_weight(rng), rule);
+      AddArc(dummy, dst, 0, 0, DUMMY_ARC);
+    } else {
+      AddArc(src, dst, label, grammar_weight(rng), rule);
+    }
+  };
+
+  // Arcs out of the start state come first, as the PDT's text format needs
+  for (StateId s = start; s < ncontexts; ++s) {
+    if (s == unigram)
+      continue;
+    StateInfo context = states_[s];
+    Symbol prev = context.tag == BIGRAM_STATE ? context.fst : context.snd;
+    for (size_t i = 0; i < opts.fanout; ++i) {
+      Symbol t = term(rng);
+      RuleId r = context_rule(t);
+      if (r)
+        add_grammar_arc(s, next_context(prev, t), t, r);
+    }
+    StateId backoff = s != start && context.tag == TRIGRAM_STATE ? bigrams[context.snd] : unigram;
+    AddArc(s, backoff, 0, backoff_weight(rng), LEXICAL_BACKOFF_ARC);
+  }
+  for (Symbol t = 1; t <= terminals_; ++t)
+    add_grammar_arc(unigram, next_context(-1, t), t, t);
+  finals_.push_back(unigram);
+
+  // Parens, each around one terminal and closed on a rule of its
+  // nonterminal
+  for (Symbol i = 0; i < nonterminals_; ++i) {
+    StateId portal = AddState(PORTAL_STATE);
+    StateId close = AddState(DUMMY_STATE);
+    AddArc(unigram, portal, OpenParen(i), 0, PORTAL_ARC);
+    for (size_t j = 0; j < opts.fanout; ++j) {
+      Symbol t = term(rng);
+      RuleId r = context_rule(t);
+      if (r)
+        AddArc(portal, close, t, grammar_weight(rng), r);
+    }
+    AddArc(close, unigram, CloseParen(i), 0, i + 1);
+  }
+}
+
+StateId SyntheticModel::AddState(StateTag tag, Symbol fst, Symbol snd) {
+  StateInfo info;
+  info.tag = tag;
+  info.fst = fst;
+  info.snd = snd;
+  states_.push_back(info);
+  return states_.size() - 1;
+}
+
+bool SyntheticModel::Write(const string &dir) const {
+  for (size_t i = 0; i < sizeof(kInputFiles) / sizeof(kInputFiles[0]); ++i) {
+    string filename = dir + "/" + kInputFiles[i].name;
+    std::ofstream strm(filename.c_str());
+    if (!strm) {
+      LOG(ERROR) << "SyntheticModel: Can't open file: " << filename;
+      return false;
+    }
+    (this->*kInputFiles[i].write)(strm);
+    if (!strm) {
+      LOG(ERROR) << "SyntheticModel: Write failed: " << filename;
+      return false;
+    }
+  }
+  return true;
+}
+
+void SyntheticModel::WritePdt(std::ostream &strm) const {
+  for (size_t i = 0; i < arcs_.size(); ++i) {
+    const SynthArc &arc = arcs_[i];
+    strm << arc.src << ' ' << arc.dst << ' ' << arc.label << ' ' << arc.weight << ' ' << arc.rule
+         << '\n';
+  }
+  for (size_t i = 0; i < finals_.size(); ++i)
+    strm << finals_[i] << '\n';
+}
+
+void SyntheticModel::WriteLabels(std::ostream &strm) const {
+  strm << "0 <epsilon>\n";
+  for (Symbol t = 1; t <= terminals_; ++t)
+    strm << t << " t" << t << '\n';
+  for (Symbol i = 0; i < nonterminals_; ++i)
+    strm << OpenParen(i) << " +P" << Nonterm(i) << '\n';
+  for (Symbol i = 0; i < nonterminals_; ++i)
+    strm << CloseParen(i) << " -P" << Nonterm(i) << '\n';
+}
+
+void SyntheticModel::WriteSymbols(std::ostream &strm) const {
+  for (Symbol t = 1; t <= terminals_; ++t)
+    strm << t << " t" << t << '\n';
+  for (Symbol t = 1; t <= terminals_; ++t)
+    strm << Preterm(t) << " _t" << t << '\n';
+  for (Symbol i = 0; i < nonterminals_; ++i)
+    strm << Nonterm(i) << " N" << i << '\n';
+}
+
+void SyntheticModel::WriteRules(std::ostream &strm) const {
+  for (size_t i = 0; i < rules_.size(); ++i) {
+    const Rule &rule = rules_[i];
+    for (size_t j = 0; j < rule.size(); ++j)
+      strm << (j > 0 ? " " : "") << rule[j];
+    strm << '\n';
+  }
+}
+
+void SyntheticModel::WriteStates(std::ostream &strm) const {
+  for (size_t s = 0; s < states_.size(); ++s) {
+    const StateInfo &info = states_[s];
+    strm << s << ' ' << info.tag;
+    if (info.tag == TRIGRAM_STATE)
+      strm << ' ' << info.fst << ' ' << info.snd;
+    else if (info.tag == BIGRAM_STATE)
+      strm << ' ' << info.fst;
+    strm << '\n';
+  }
+}
+
+void SyntheticModel::WriteParens(std::ostream &strm) const {
+  for (Symbol i = 0; i < nonterminals_; ++i)
+    strm << OpenParen(i) << ' ' << CloseParen(i) << '\n';
+}
+
+void SyntheticModel::WriteInput(size_t length, unsigned seed, std::ostream &strm) const {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<Symbol> term(1, terminals_);
+  for (size_t i = 0; i < length; ++i) {
+    Symbol t = term(rng);
+    strm << i << ' ' << i + 1 << ' ' << t << ' ' << t << '\n';
+  }
+  strm << length << '\n';
+}
+
+}
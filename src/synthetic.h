@@ -0,0 +1,107 @@
+/*
+ * synthetic.h
+ *
+ * Synthetic models for scaling experiments: a random grammar and a PDT over
+ * it, consistent enough to load and compose with, at any size.
+ */
+
+#ifndef SYNTHETIC_H_
+#define SYNTHETIC_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tripoli.h"
+
+namespace fst {
+
+struct SyntheticOptions {
+  Symbol terminals;
+  Symbol nonterminals;  // each with a paren pair
+  size_t rules;  // at least terminals and nonterminals
+  // Relative frequency of right-hand sides of 1, 2, ... symbols
+  vector<double> rule_lengths;
+  double bigram_density;  // share of terminals with a bigram context
+  double trigram_density;  // trigram contexts per bigram context
+  double dummy_ratio;  // share of grammar arcs that pass through a dummy state
+  size_t fanout;  // grammar arcs out of each trigram, bigram and portal state
+  unsigned seed;
+
+  SyntheticOptions()
+          : terminals(500), nonterminals(200), rules(1000), rule_lengths({4, 3, 2, 1}),
+            bigram_density(1), trigram_density(2), dummy_ratio(0.5), fanout(8), seed(1) {}
+};
+
+// Terminal t is symbol and label t, named "t<t>", and its preterminal
+// "_t<t>"; nonterminals "N<i>" follow, and the open and close parens of
+// each, labelled "+P<symbol>" and "-P<symbol>", follow the terminals'
+// labels. Rule t (for each terminal t) has t's preterminal as its left
+// corner, and rule i (for each nonterminal i) has nonterminal i as its
+// left-hand side.
+//
+// The PDT has the start state, the unigram state, a bigram state for
+// bigram_density of the terminals and trigram_density trigram states per
+// bigram state. A context state has fanout grammar arcs on rules other
+// than the terminals' own, each to the context its terminal leads to, and
+// backs off to the next lower order; the unigram state, which is final,
+// has an arc for every terminal on that terminal's rule, so every input
+// over the terminals has a path. Each nonterminal's parens wrap a single
+// terminal: an open paren from the unigram state to a portal state with
+// fanout grammar arcs, each to a dummy state that closes the paren back
+// to the unigram state.
+class SyntheticModel {
+public:
+  // Throws invalid_argument if opts cannot make such a model.
+  explicit SyntheticModel(const SyntheticOptions &opts);
+
+  // The model's text inputs in dir, named as in the Makefile (pdt.txt,
+  // arc-labels.txt, ...); false (and logged) if one cannot be written.
+  bool Write(const string &dir) const;
+
+  void WritePdt(std::ostream &strm) const;
+  void WriteLabels(std::ostream &strm) const;
+  void WriteSymbols(std::ostream &strm) const;
+  void WriteRules(std::ostream &strm) const;
+  void WriteStates(std::ostream &strm) const;
+  void WriteParens(std::ostream &strm) const;
+
+  // A linear input of length terminals drawn with seed, in the AT&T text
+  // format of input.txt.
+  void WriteInput(size_t length, unsigned seed, std::ostream &strm) const;
+
+  size_t NumStates() const { return states_.size(); }
+  size_t NumArcs() const { return arcs_.size(); }
+  size_t NumRules() const { return rules_.size(); }
+
+private:
+  struct SynthArc {
+    StateId src;
+    StateId dst;
+    Label label;
+    float weight;
+    RuleId rule;
+  };
+
+  Symbol Preterm(Symbol t) const { return terminals_ + t; }
+  Symbol Nonterm(Symbol i) const { return 2 * terminals_ + 1 + i; }
+  Label OpenParen(Symbol i) const { return terminals_ + 1 + i; }
+  Label CloseParen(Symbol i) const { return terminals_ + nonterminals_ + 1 + i; }
+
+  StateId AddState(StateTag tag, Symbol fst = -1, Symbol snd = -1);
+  void AddArc(StateId src, StateId dst, Label label, float weight, RuleId rule) {
+    SynthArc arc = {src, dst, label, weight, rule};
+    arcs_.push_back(arc);
+  }
+
+  Symbol terminals_;
+  Symbol nonterminals_;
+  vector<Rule> rules_;
+  vector<StateInfo> states_;
+  vector<SynthArc> arcs_;  // the start state's first
+  vector<StateId> finals_;
+};
+
+}
+
+#endif /* SYNTHETIC_H_ */
@@ -0,0 +1,213 @@
+// thread-pool.h
+//
+// Work-stealing pool of worker threads, for loading and indexing a model
+// and for batch decoding.
+
+#ifndef TRIPOLI_THREAD_POOL_H__
+#define TRIPOLI_THREAD_POOL_H__
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace fst {
+
+// Every worker has its own deque of tasks. A worker runs its own tasks
+// newest first, and when it runs out steals the oldest task of another
+// worker. Tasks scheduled from outside the pool are dealt round-robin;
+// tasks scheduled by a worker go to its own deque, so nested work stays
+// on the thread that made it until someone is idle. A pool of zero threads
+// runs every task inline, which keeps single-threaded runs free of
+// threads.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t nthreads)
+          : queues_(nthreads), done_(false), pending_(0), finished_(0), waiting_(0), next_(0) {
+    for (size_t i = 0; i < nthreads; ++i)
+      queues_[i].reset(new Queue);
+    for (size_t i = 0; i < nthreads; ++i)
+      threads_.push_back(std::thread(&ThreadPool::Run, this, i));
+  }
+
+  // Finishes the queued tasks first.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+      threads_[i].join();
+  }
+
+  // One thread per core, or none if that is unknown.
+  static size_t DefaultThreads() { return std::thread::hardware_concurrency(); }
+
+  size_t NumThreads() const { return threads_.size(); }
+
+  // Runs f on the pool. The future rethrows anything f throws.
+  template <class F>
+  std::future<typename std::result_of<F()>::type> Async(F f) {
+    typedef typename std::result_of<F()>::type R;
+    std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(f));
+    std::future<R> result = task->get_future();
+    Schedule([task]() { (*task)(); });
+    return result;
+  }
+
+  // Calls fn(chunk, begin, end) for nchunks consecutive ranges that
+  // split [0, n), and waits for all of them. Rethrows the exception of the
+  // lowest chunk that threw. A worker that calls this runs queued tasks
+  // while it waits rather than blocking.
+  template <class F>
+  void ParallelFor(size_t n, size_t nchunks, F fn) {
+    nchunks = std::max<size_t>(1, std::min(n, nchunks));
+    std::vector<std::future<void> > results;
+    for (size_t c = 0; c < nchunks; ++c) {
+      size_t begin = n * c / nchunks, end = n * (c + 1) / nchunks;
+      results.push_back(Async([fn, c, begin, end]() { fn(c, begin, end); }));
+    }
+    for (size_t c = 0; c < results.size(); ++c)
+      Wait(results[c]);
+    for (size_t c = 0; c < results.size(); ++c)
+      results[c].get();
+  }
+
+  // Waits for result, running queued tasks meanwhile if called by one of
+  // this pool's workers.
+  template <class R>
+  void Wait(const std::future<R> &result) {
+    if (CurrentPool() != this) {
+      result.wait();
+      return;
+    }
+    while (!Ready(result)) {
+      if (RunOne(CurrentWorker()))
+        continue;
+      // Sleeps until a task is queued or one finishes, which may be the
+      // one result is waiting for
+      std::unique_lock<std::mutex> lock(mutex_);
+      size_t finished = finished_;
+      ++waiting_;
+      wake_.wait(lock, [&]() { return pending_ > 0 || finished_ != finished || Ready(result); });
+      --waiting_;
+    }
+  }
+
+private:
+  ThreadPool(const ThreadPool &);  // disallow
+  void operator=(const ThreadPool &);  // disallow
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  template <class R>
+  static bool Ready(const std::future<R> &result) {
+    return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+
+  static ThreadPool *&CurrentPool() {
+    static thread_local ThreadPool *pool = 0;
+    return pool;
+  }
+
+  static size_t &CurrentWorker() {
+    static thread_local size_t worker = 0;
+    return worker;
+  }
+
+  void Schedule(const std::function<void()> &task) {
+    if (threads_.empty()) {
+      task();
+      return;
+    }
+    size_t i;
+    if (CurrentPool() == this) {
+      i = CurrentWorker();
+    } else {
+      std::lock_guard<std::mutex> lock(mutex_);
+      i = next_++ % queues_.size();
+    }
+    {
+      // Counted before it can be taken, so the count never goes below zero
+      std::lock_guard<std::mutex> queue_lock(queues_[i]->mutex);
+      std::lock_guard<std::mutex> lock(mutex_);
+      queues_[i]->tasks.push_back(task);
+      ++pending_;
+    }
+    wake_.notify_one();
+  }
+
+  // Runs one task, worker i's newest or else another worker's oldest;
+  // false if every deque was empty.
+  bool RunOne(size_t i) {
+    std::function<void()> task;
+    for (size_t k = 0; k < queues_.size() && !task; ++k) {
+      Queue &queue = *queues_[(i + k) % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty())
+        continue;
+      if (k == 0) {
+        task.swap(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task.swap(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+    }
+    if (!task)
+      return false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --pending_;
+    }
+    task();
+    bool waiting;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++finished_;
+      waiting = waiting_ > 0;
+    }
+    if (waiting)
+      wake_.notify_all();
+    return true;
+  }
+
+  void Run(size_t i) {
+    CurrentPool() = this;
+    CurrentWorker() = i;
+    for (;;) {
+      if (RunOne(i))
+        continue;
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return done_ || pending_ > 0; });
+      if (done_ && pending_ == 0)
+        return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue> > queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;  // guards done_, pending_, finished_, waiting_ and next_; taken after a queue's
+  std::condition_variable wake_;
+  bool done_;
+  size_t pending_;  // tasks queued but not yet taken
+  size_t finished_;  // tasks run, for Wait to tell when one ends
+  size_t waiting_;  // workers asleep in Wait
+  size_t next_;
+};
+
+}  // namespace fst
+
+#endif  // TRIPOLI_THREAD_POOL_H__
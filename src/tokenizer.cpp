@@ -0,0 +1,93 @@
+/*
+ * tokenizer.cpp
+ */
+
+#include "tokenizer.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+
+namespace fst {
+
+TextFile *TextFile::Open(const std::string &filename) {
+  MappedFile *file = MappedFile::Map(filename);
+  if (!file)
+    return 0;
+  TextFile *text = new TextFile(filename);
+  text->file_.reset(file);
+  text->data_ = file->data();
+  text->size_ = file->size();
+  return text;
+}
+
+TextFile *TextFile::Read(std::istream &strm, const std::string &source) {
+  TextFile *text = new TextFile(source);
+  text->buffer_.assign(std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>());
+  text->data_ = text->buffer_.data();
+  text->size_ = text->buffer_.size();
+  return text;
+}
+
+Tokenizer::Tokenizer(const TextFile &text, const char *separators)
+        : next_(text.data()), end_(text.data() + text.size()), source_(text.source()) {
+  Init(separators);
+}
+
+Tokenizer::Tokenizer(const char *data, size_t size, const std::string &source,
+                     const char *separators)
+        : next_(data), end_(data + size), source_(source) {
+  Init(separators);
+}
+
+void Tokenizer::Init(const char *separators) {
+  pos_ = line_end_ = next_;
+  nline_ = 0;
+  memset(separator_, 0, sizeof(separator_));
+  for (const char *c = separators; *c; ++c)
+    separator_[uchar(*c)] = true;
+  // DOS line endings
+  separator_[uchar('\r')] = true;
+}
+
+int64 Tokenizer::ToInt64(const Token &token, bool allow_negative, bool *error,
+                         const char *caller) const {
+  int64 n = 0;
+  if (!ParseInt64(token.data, token.data + token.size, &n)) {
+    FSTERROR() << caller << ": Bad integer = \"" << token.str()
+               << "\", source = " << source_ << ", line = " << nline_;
+    *error = true;
+    return 0;
+  }
+  if (!allow_negative && n < 0) {
+    FSTERROR() << caller << ": Negative integer = \"" << token.str()
+               << "\", source = " << source_ << ", line = " << nline_;
+    *error = true;
+    return 0;
+  }
+  *error = false;
+  return n;
+}
+
+float Tokenizer::ToFloat(const Token &token, bool *error, const char *caller) const {
+  // strtof needs a terminated string; fields this short never allocate
+  char buf[64];
+  char *end = 0;
+  float f = 0;
+  if (token.size > 0 && token.size < sizeof(buf)) {
+    memcpy(buf, token.data, token.size);
+    buf[token.size] = '\0';
+    errno = 0;
+    f = strtof(buf, &end);
+  }
+  if (!end || end != buf + token.size || errno == ERANGE) {
+    FSTERROR() << caller << ": Bad weight = \"" << token.str()
+               << "\", source = " << source_ << ", line = " << nline_;
+    *error = true;
+    return 0;
+  }
+  *error = false;
+  return f;
+}
+
+}
@@ -0,0 +1,152 @@
+/*
+ * tokenizer.h
+ *
+ * Line and field tokenizer for the text inputs (states, rules, symbols,
+ * labels and PDTs). Files are mapped rather than read, and tokens point
+ * into the mapping, so nothing is copied on the way to the number parsers.
+ */
+
+#ifndef TOKENIZER_H_
+#define TOKENIZER_H_
+
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fst/fst.h>
+
+#include "mapped-file.h"
+
+namespace fst {
+
+// The contents of a text input, either mapped from a file or, for streams,
+// copied into a buffer.
+class TextFile {
+public:
+  // Returns NULL (and logs why) if the file cannot be mapped.
+  static TextFile *Open(const std::string &filename);
+  static TextFile *Read(std::istream &strm, const std::string &source);
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  const std::string &source() const { return source_; }
+
+private:
+  TextFile(const std::string &source) : data_(0), size_(0), source_(source) {}
+  TextFile(const TextFile &);  // disallow
+  void operator=(const TextFile &);  // disallow
+
+  std::unique_ptr<MappedFile> file_;
+  std::string buffer_;
+  const char *data_;
+  size_t size_;
+  std::string source_;
+};
+
+// A field of the current line. It is not NUL-terminated.
+struct Token {
+  const char *data;
+  size_t size;
+
+  bool empty() const { return size == 0; }
+  char front() const { return *data; }
+  std::string str() const { return std::string(data, size); }
+  bool operator==(const char *s) const { return strlen(s) == size && memcmp(s, data, size) == 0; }
+};
+
+// Walks the lines of a text one at a time and splits each into fields.
+// Line numbers count from 1, as in the error messages of the readers that
+// use it.
+class Tokenizer {
+public:
+  explicit Tokenizer(const TextFile &text, const char *separators = " \t");
+  Tokenizer(const char *data, size_t size, const std::string &source,
+            const char *separators = " \t");
+
+  // Moves to the next line; false at the end of the text.
+  bool NextLine() {
+    if (next_ == end_)
+      return false;
+    const char *nl = static_cast<const char *>(memchr(next_, '\n', end_ - next_));
+    pos_ = next_;
+    line_end_ = nl ? nl : end_;
+    next_ = nl ? nl + 1 : end_;
+    ++nline_;
+    return true;
+  }
+
+  // Moves to the next field of the current line; false if there is none.
+  bool NextToken(Token *token) {
+    while (pos_ != line_end_ && separator_[uchar(*pos_)])
+      ++pos_;
+    if (pos_ == line_end_)
+      return false;
+    const char *begin = pos_;
+    while (pos_ != line_end_ && !separator_[uchar(*pos_)])
+      ++pos_;
+    token->data = begin;
+    token->size = pos_ - begin;
+    return true;
+  }
+
+  // Splits the rest of the current line; returns the number of fields.
+  size_t Split(std::vector<Token> *tokens) {
+    tokens->clear();
+    Token token;
+    while (NextToken(&token))
+      tokens->push_back(token);
+    return tokens->size();
+  }
+
+  // The conversions below log a bad field together with the source and
+  // line number, under the name of the reader given as caller, and set
+  // *error.
+  int64 ToInt64(const Token &token, bool allow_negative, bool *error,
+                const char *caller = "StrToInt64") const;
+  float ToFloat(const Token &token, bool *error, const char *caller = "StrToFloat") const;
+
+  size_t LineNumber() const { return nline_; }
+  const std::string &Source() const { return source_; }
+
+private:
+  typedef unsigned char uchar;
+
+  void Init(const char *separators);
+
+  const char *next_;  // start of the next line
+  const char *end_;
+  const char *pos_;  // position within the current line
+  const char *line_end_;
+  size_t nline_;
+  std::string source_;
+  bool separator_[256];
+};
+
+// Parses all of [begin, end) as a decimal integer; false if it is not one
+// or does not fit in an int64.
+inline bool ParseInt64(const char *begin, const char *end, int64 *n) {
+  bool negative = begin != end && *begin == '-';
+  if (begin != end && (*begin == '-' || *begin == '+'))
+    ++begin;
+  // 19 digits cannot overflow a uint64, so range is checked once at the end
+  if (begin == end || end - begin > 19)
+    return false;
+  uint64 value = 0;
+  for (const char *p = begin; p != end; ++p) {
+    unsigned digit = unsigned(*p) - '0';
+    if (digit > 9)
+      return false;
+    value = value * 10 + digit;
+  }
+  if (value > (uint64(1) << 63) - !negative)
+    return false;
+  *n = negative ? int64(0 - value) : int64(value);
+  return true;
+}
+
+}
+
+#endif /* TOKENIZER_H_ */
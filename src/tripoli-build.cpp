@@ -0,0 +1,42 @@
+/*
+ * tripoli-build.cpp
+ *
+ * Compiles the text inputs of a Tripoli model into a single model file that
+ * src/main maps with --model, skipping the text parsing and index building
+ * done on every run otherwise.
+ */
+
+#include <iostream>
+#include <stdexcept>
+
+#include <fst/util.h>
+
+#include "model.h"
+
+DEFINE_bool(bypass_pass_through, true, "Remove the PDT's dummy and portal states that only pass paths on");
+
+int main(int argc, char **argv) {
+  string usage = "Compiles a Tripoli model.\n\n  Usage: ";
+  usage += argv[0];
+  usage += " pdt.txt arc-labels.txt grammar-symbols.txt rules.txt states.txt parens.txt model.out\n";
+
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+  if (argc != 8) {
+    ShowUsage();
+    return 1;
+  }
+
+  fst::ThreadPool pool(fst::ThreadPool::DefaultThreads());
+  std::unique_ptr<fst::TripoliModel> model;
+  try {
+    model.reset(fst::TripoliModel::ReadText(argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], &pool,
+                                            FLAGS_bypass_pass_through));
+  } catch (const std::invalid_argument &e) {
+    LOG(ERROR) << argv[0] << ": " << e.what();
+    return 1;
+  }
+  if (!model->Write(argv[7]))
+    return 1;
+  cout << "Model written to " << argv[7] << endl;
+  return 0;
+}
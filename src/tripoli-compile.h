@@ -25,6 +25,7 @@
 using std::unordered_map;
 using std::unordered_multimap;
 #include <sstream>
+#include <memory>
 #include <string>
 #include <vector>
 using std::vector;
@@ -36,6 +37,8 @@ using std::vector;
 #include <fst/util.h>
 #include <fst/vector-fst.h>
 
+#include "tokenizer.h"
+
 DECLARE_string(fst_field_separator);
 
 namespace fst {
@@ -60,14 +63,22 @@ template <class A> class PdtCompiler {
               const SymbolTable *isyms, const SymbolTable *osyms,
               const SymbolTable *ssyms, bool accep, bool ikeep,
               bool okeep, bool allow_negative_labels = false) {
-    SymbolTable* misyms = isyms ? isyms->Copy() : NULL;
-    SymbolTable* mosyms = osyms ? osyms->Copy() : NULL;
-    SymbolTable* mssyms = ssyms ? ssyms->Copy() : NULL;
-    Init(istrm, source, misyms, mosyms, mssyms, accep, ikeep, okeep,
-         allow_negative_labels, false);
-    delete mssyms;
-    delete mosyms;
-    delete misyms;
+    std::unique_ptr<TextFile> text(TextFile::Read(istrm, source));
+    InitCopies(*text, isyms, osyms, ssyms, accep, ikeep, okeep, allow_negative_labels);
+  }
+
+  // Maps the file at source instead of reading it through a stream.
+  PdtCompiler(const string &source,
+              const SymbolTable *isyms, const SymbolTable *osyms,
+              const SymbolTable *ssyms, bool accep, bool ikeep,
+              bool okeep, bool allow_negative_labels = false) {
+    std::unique_ptr<TextFile> text(TextFile::Open(source));
+    if (!text) {
+      FSTERROR() << "PdtCompiler: Can't open file: " << source;
+      fst_.SetProperties(kError, kError);
+      return;
+    }
+    InitCopies(*text, isyms, osyms, ssyms, accep, ikeep, okeep, allow_negative_labels);
   }
 
   PdtCompiler(istream &istrm, const string &source,  // NOLINT
@@ -75,16 +86,16 @@ template <class A> class PdtCompiler {
               SymbolTable *ssyms, bool accep, bool ikeep,
               bool okeep, bool allow_negative_labels,
               bool add_symbols) {
-    Init(istrm, source, isyms, osyms, ssyms, accep, ikeep, okeep,
+    std::unique_ptr<TextFile> text(TextFile::Read(istrm, source));
+    Init(*text, isyms, osyms, ssyms, accep, ikeep, okeep,
          allow_negative_labels, add_symbols);
   }
 
-  void Init(istream &istrm, const string &source, SymbolTable *isyms,  // NOLINT
+  void Init(const TextFile &text, SymbolTable *isyms,
             SymbolTable *osyms, SymbolTable *ssyms, bool accep, bool ikeep,
             bool okeep, bool allow_negative_labels,
             bool add_symbols) {
-    nline_ = 0;
-    source_ = source;
+    source_ = text.source();
     isyms_ = isyms;
     osyms_ = osyms;
     ssyms_ = ssyms;
@@ -92,28 +103,27 @@ template <class A> class PdtCompiler {
     keep_state_numbering_ = true;
     allow_negative_labels_ = allow_negative_labels;
     add_symbols_ = add_symbols;
-    char line[kLineLen];
     // Reads pdt.txt
-    while (istrm.getline(line, kLineLen)) {
-      ++nline_;
-      vector<char *> col;
-      string separator = FLAGS_fst_field_separator + "\n";
-      SplitToVector(line, separator.c_str(), &col, true);
-      if (col.size() == 0 || col[0][0] == '\0')  // empty line
+    Tokenizer tok(text, FLAGS_fst_field_separator.c_str());
+    tok_ = &tok;
+    vector<Token> col;
+    while (tok.NextLine()) {
+      tok.Split(&col);
+      if (col.size() == 0)  // empty line
         continue;
       if (col.size() > 6 || col.size() == 3 ||
           (col.size() > 5 && accep) ||
           (col.size() == 4 && !accep)) {
         FSTERROR() << "PdtCompiler: Bad number of columns, source = "
                    << source_
-                   << ", line = " << nline_;
+                   << ", line = " << tok.LineNumber();
         fst_.SetProperties(kError, kError);
-        return;
+        break;
       }
       StateId s = StrToStateId(col[0]);
       while (s >= fst_.NumStates())
         fst_.AddState();
-      if (nline_ == 1)
+      if (tok.LineNumber() == 1)
         fst_.SetStart(s);
 
       Arc arc;
@@ -130,7 +140,7 @@ template <class A> class PdtCompiler {
         arc.ilabel = StrToILabel(col[2]);
         arc.olabel = arc.ilabel;
         arc.weight = Weight::One();
-        arc.rule = std::stoi(col[3]);
+        arc.rule = StrToRule(col[3]);
         fst_.AddArc(s, arc);
         break;
       case 5:
@@ -139,11 +149,11 @@ template <class A> class PdtCompiler {
         if (accep) {
           arc.olabel = arc.ilabel;
           arc.weight = StrToWeight(col[3], true);
-          arc.rule = std::stoi(col[4]);
+          arc.rule = StrToRule(col[4]);
         } else {
           arc.olabel = StrToOLabel(col[3]);
           arc.weight = Weight::One();
-          arc.rule = std::stoi(col[4]);
+          arc.rule = StrToRule(col[4]);
         }
         fst_.AddArc(s, arc);
         break;
@@ -152,12 +162,13 @@ template <class A> class PdtCompiler {
         arc.ilabel = StrToILabel(col[2]);
         arc.olabel = StrToOLabel(col[3]);
         arc.weight = StrToWeight(col[4], true);
-        arc.rule = std::stoi(col[4]);
+        arc.rule = StrToRule(col[5]);
         fst_.AddArc(s, arc);
       }
       while (d >= fst_.NumStates())
         fst_.AddState();
     }
+    tok_ = 0;
     if (ikeep)
       fst_.SetInputSymbols(isyms);
     if (okeep)
@@ -172,35 +183,43 @@ template <class A> class PdtCompiler {
   }
 
  private:
-  // Maximum line length in text file.
-  static const int kLineLen = 8096;
+  void InitCopies(const TextFile &text, const SymbolTable *isyms,
+                  const SymbolTable *osyms, const SymbolTable *ssyms, bool accep,
+                  bool ikeep, bool okeep, bool allow_negative_labels) {
+    SymbolTable* misyms = isyms ? isyms->Copy() : NULL;
+    SymbolTable* mosyms = osyms ? osyms->Copy() : NULL;
+    SymbolTable* mssyms = ssyms ? ssyms->Copy() : NULL;
+    Init(text, misyms, mosyms, mssyms, accep, ikeep, okeep,
+         allow_negative_labels, false);
+    delete mssyms;
+    delete mosyms;
+    delete misyms;
+  }
 
-  int64 StrToId(const char *s, SymbolTable *syms,
+  int64 StrToId(const Token &s, SymbolTable *syms,
                 const char *name, bool allow_negative = false) const {
     int64 n = 0;
 
     if (syms) {
-      n = (add_symbols_) ? syms->AddSymbol(s) : syms->Find(s);
+      n = (add_symbols_) ? syms->AddSymbol(s.str()) : syms->Find(s.str());
       if (n == -1 || (!allow_negative && n < 0)) {
-        FSTERROR() << "PdtCompiler: Symbol \"" << s
+        FSTERROR() << "PdtCompiler: Symbol \"" << s.str()
                    << "\" is not mapped to any integer " << name
                    << ", symbol table = " << syms->Name()
-                   << ", source = " << source_ << ", line = " << nline_;
+                   << ", source = " << source_ << ", line = " << tok_->LineNumber();
         fst_.SetProperties(kError, kError);
       }
     } else {
-      char *p;
-      n = strtoll(s, &p, 10);
-      if (p < s + strlen(s) || (!allow_negative && n < 0)) {
-        FSTERROR() << "PdtCompiler: Bad " << name << " integer = \"" << s
-                   << "\", source = " << source_ << ", line = " << nline_;
+      if (!ParseInt64(s.data, s.data + s.size, &n) || (!allow_negative && n < 0)) {
+        FSTERROR() << "PdtCompiler: Bad " << name << " integer = \"" << s.str()
+                   << "\", source = " << source_ << ", line = " << tok_->LineNumber();
         fst_.SetProperties(kError, kError);
       }
     }
     return n;
   }
 
-  StateId StrToStateId(const char *s) {
+  StateId StrToStateId(const Token &s) {
     StateId n = StrToId(s, ssyms_, "state ID");
 
     if (keep_state_numbering_)
@@ -216,21 +235,28 @@ template <class A> class PdtCompiler {
     }
   }
 
-  StateId StrToILabel(const char *s) const {
+  StateId StrToILabel(const Token &s) const {
     return StrToId(s, isyms_, "arc ilabel", allow_negative_labels_);
   }
 
-  StateId StrToOLabel(const char *s) const {
+  StateId StrToOLabel(const Token &s) const {
     return StrToId(s, osyms_, "arc olabel", allow_negative_labels_);
   }
 
-  Weight StrToWeight(const char *s, bool allow_zero) const {
-    Weight w;
-    istringstream strm(s);
-    strm >> w;
-    if (!strm || (!allow_zero && w == Weight::Zero())) {
-      FSTERROR() << "PdtCompiler: Bad weight = \"" << s
-                 << "\", source = " << source_ << ", line = " << nline_;
+  // Rule ids below zero are ArcTags.
+  int StrToRule(const Token &s) const {
+    return StrToId(s, 0, "arc rule", true);
+  }
+
+  // Weights are parsed as floats, which is what the tropical and log
+  // weights of the arcs the PDT is compiled with hold.
+  Weight StrToWeight(const Token &s, bool allow_zero) const {
+    bool err;
+    Weight w(tok_->ToFloat(s, &err, "PdtCompiler"));
+    if (err || (!allow_zero && w == Weight::Zero())) {
+      if (!err)
+        FSTERROR() << "PdtCompiler: Bad weight = \"" << s.str()
+                   << "\", source = " << source_ << ", line = " << tok_->LineNumber();
       fst_.SetProperties(kError, kError);
       w = Weight::NoWeight();
     }
@@ -238,7 +264,7 @@ template <class A> class PdtCompiler {
   }
 
   mutable VectorFst<A> fst_;
-  size_t nline_;
+  const Tokenizer *tok_;               // while compiling
   string source_;                      // text FST source name
   SymbolTable *isyms_;           // ilabel symbol table (not owned)
   SymbolTable *osyms_;           // olabel symbol table (not owned)
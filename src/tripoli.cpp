@@ -1,14 +0,0 @@
-/*
- * tripoli.cpp
- *
- *  Created on: Nov 15, 2014
- *      Author: ara
- */
-
-#include "tripoli.h"
-
-namespace fst {
-
-TripoliFilterState TripoliFilterState::no_state_;
-
-}
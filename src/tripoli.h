@@ -17,6 +17,7 @@
 #include <vector>
 #include <memory>
 #include <functional>
+#include <iterator>
 
 using std::string;
 using std::invalid_argument;
@@ -38,6 +39,15 @@ using std::hash;
 #include <fst/util.h>
 #include <fst/filter-state.h>
 
+#include "arc-mask.h"
+#include "bit-matrix.h"
+#include "indexed-matcher.h"
+#include "paren-stacks.h"
+#include "rule-set.h"
+#include "span.h"
+#include "stats.h"
+#include "thread-pool.h"
+
 namespace fst {
 
 typedef int Label;  // arc label
@@ -55,13 +65,14 @@ public:
           : Arc(i, o, w, s), rule(r) {}
   RuleArc() {}
 
-  RuleId rule;
-};
+  // Distinct from Arc::Type(), so binary FSTs of rule arcs are never read
+  // back as FSTs of the narrower Arc.
+  static const string &Type() {
+    static const string type = "rule_" + Arc::Type();
+    return type;
+  }
 
-enum ReachType {
-  REACH_UNKNOWN,
-  REACH_YES,
-  REACH_NO = 0
+  RuleId rule;
 };
 
 class Grammar {
@@ -79,56 +90,64 @@ public:
       throw invalid_argument("max_nonterm should be > max_preterm");
 
     SetRules(rules);
-
-    for (Symbol pt = max_term + 1; pt <= max_preterm; ++pt) {
-      Symbol t = ToTerm(pt);
-      if(symbol_reach_.size() <= pt) {
-        symbol_reach_.resize(pt+1);
-        symbol_reach_[pt] = vector<ReachType>(t+1);
-      }
-      symbol_reach_[pt][t] = REACH_YES;
-    }
   }
 
-  bool IsTerm(Symbol s) { return s > 0 && s <= max_term_; }
-  bool IsPreterm(Symbol s) { return s > max_term_ && s <= max_preterm_; }
-  bool IsNonterm(Symbol s) { return s > max_preterm_ && s <= max_nonterm_; }
-  Symbol LabelToSymbol(Label l) { return labels_to_symbols_[l]; }
-
-  Symbol ToPreterm(Symbol t) {
+  // A grammar over reach tables that were built earlier, e.g. loaded from
+  // a compiled model. The rules themselves are not needed any more.
+  Grammar(Symbol max_term, Symbol max_preterm, Symbol max_nonterm,
+          const FlatArray<Symbol> &labels_to_symbols,
+          const BitMatrix &symbol_reach, const BitMatrix &rule_reach)
+          : max_term_(max_term), max_preterm_(max_preterm), max_nonterm_(max_nonterm),
+            labels_to_symbols_(labels_to_symbols),
+            symbol_reach_(symbol_reach), rule_reach_(rule_reach) {}
+
+  Symbol MaxTerm() const { return max_term_; }
+  Symbol MaxPreterm() const { return max_preterm_; }
+  Symbol MaxNonterm() const { return max_nonterm_; }
+  const FlatArray<Symbol> &LabelsToSymbols() const { return labels_to_symbols_; }
+  const BitMatrix &SymbolReach() const { return symbol_reach_; }
+  const BitMatrix &RuleReach() const { return rule_reach_; }
+
+  bool IsTerm(Symbol s) const { return s > 0 && s <= max_term_; }
+  bool IsPreterm(Symbol s) const { return s > max_term_ && s <= max_preterm_; }
+  bool IsNonterm(Symbol s) const { return s > max_preterm_ && s <= max_nonterm_; }
+  Symbol LabelToSymbol(Label l) const { return labels_to_symbols_[l]; }
+
+  Symbol ToPreterm(Symbol t) const {
     if (t <= max_term_)
       return max_term_ + t;
     else return -1;
   }
-  Symbol ToTerm(Symbol pt) {
+  Symbol ToTerm(Symbol pt) const {
     if (pt > max_term_ && pt <= max_preterm_)
       return pt - max_term_;
     else return -1;
   }
 
-  bool SymbolCanReach(Symbol nonterm, Symbol term) {
-    if (IsTerm(nonterm) || !IsTerm(term))
+  bool SymbolCanReach(Symbol nonterm, Symbol term) const {
+    if (!(IsPreterm(nonterm) || IsNonterm(nonterm)) || !IsTerm(term))
       throw invalid_argument("SymbolCanReach: nonterm must not be term, and term must be term");
+    return symbol_reach_.Test(nonterm, term);
+  }
 
-    ReachType cached = symbol_reach_[nonterm][term];
-    if (cached != REACH_UNKNOWN)
-      return cached;
-
-    symbol_reach_[nonterm][term] = REACH_NO;  // prevent infinite loops
-    vector<Symbol> replacements = replacement_symbols_[nonterm];
-    for (vector<Symbol>::const_iterator it = replacements.begin();
-                                        it != replacements.end(); ++it) {
-      if (SymbolCanReach(*it, term)) {
-        symbol_reach_[nonterm][term] = REACH_YES;
-        return true;
-      }
-    }
-    return false;
+  // Rules are looked up by their id (the first column of the rule file),
+  // which is what the PDT arcs carry.
+  bool RuleCanReach(RuleId r, Symbol term) const {
+    if (r < 0 || r >= rule_reach_.Cols() || !IsTerm(term))
+      throw invalid_argument("RuleCanReach: unknown rule id, or term is not a term");
+    return rule_reach_.Test(term, r);
   }
 
-  bool RuleCanReach(RuleId r, Symbol term) {
-    //TODO cache separately for speed-up
-    return SymbolCanReach(rules_[r][1], term);
+  // Batched RuleCanReach over n rule ids, e.g. the arcs of one PDT state:
+  // bit i of mask is set iff rules[i] can reach term. Ids below zero are
+  // ArcTags rather than rules; reach does not constrain them, so their
+  // bits are always set. Unknown rule ids, which RuleCanReach throws on,
+  // are left unset.
+  void RulesCanReach(Symbol term, const RuleId *rules, size_t n,
+                     vector<BitMatrix::Word> *mask) const {
+    if (!IsTerm(term))
+      throw invalid_argument("RulesCanReach: term must be term");
+    AcceptMask(rules, n, rule_reach_.Row(term), rule_reach_.Cols(), RuleBits(), mask);
   }
 
   void ValidateRule(Rule rule) {
@@ -157,28 +176,141 @@ public:
     rules_ = rules;
     replacement_symbols_ = vector<vector<Symbol> >(max_nonterm_+1, vector<Symbol>());
     for (ssize_t i = 0; i < rules.size(); ++i) {
-      Rule rule = rules[i];
+      const Rule &rule = rules[i];
       ValidateRule(rule);
       Symbol lsym = rule[1];
       Symbol rsym = rule[2];
-      vector<Symbol> repls = replacement_symbols_[lsym];
+      vector<Symbol> &repls = replacement_symbols_[lsym];
       // Replacement symbols is a vector of the leftmost righthand
       // side symbols indexed by lefthand side symbol, so if we
       // encounter a new one as we iterate through rules, we add it
       if (std::find(repls.begin(), repls.end(), rsym) == repls.end())
         repls.push_back(rsym);
     }
+    BuildReach();
+    BuildRuleReach();
   }
 
 private:
+  // Transposes the reach rows of each rule's left-hand side into
+  // rule_reach_, so that RuleCanReach is a single bit test and the row for
+  // one terminal covers every rule.
+  void BuildRuleReach() {
+    RuleId max_rule = -1;
+    for (size_t i = 0; i < rules_.size(); ++i)
+      max_rule = std::max(max_rule, rules_[i][0]);
+    rule_reach_ = BitMatrix(max_term_ + 1, max_rule + 1);
+    for (size_t i = 0; i < rules_.size(); ++i) {
+      RuleId r = rules_[i][0];
+      const BitMatrix::Word *row = symbol_reach_.Row(rules_[i][1]);
+      for (size_t w = 0; w < symbol_reach_.WordsPerRow(); ++w) {
+        for (BitMatrix::Word bits = row[w]; bits; bits &= bits - 1)
+          rule_reach_.Set(w * BitMatrix::kWordBits + __builtin_ctzll(bits), r);
+      }
+    }
+  }
+
+  // Computes the full left-corner closure into symbol_reach_. Tarjan's
+  // algorithm condenses the nonterminal graph into strongly connected
+  // components and emits them in reverse topological order, so each
+  // component's row is the union of its own preterminal left corners and
+  // the (already final) rows of the components it points to.
+  void BuildReach() {
+    symbol_reach_ = BitMatrix(max_nonterm_ + 1, max_term_ + 1);
+    for (Symbol pt = max_term_ + 1; pt <= max_preterm_; ++pt)
+      symbol_reach_.Set(pt, ToTerm(pt));
+
+    const Symbol unvisited = -1;
+    vector<Symbol> index(max_nonterm_ + 1, unvisited);
+    vector<Symbol> lowlink(max_nonterm_ + 1, unvisited);
+    vector<Symbol> component(max_nonterm_ + 1, unvisited);
+    vector<bool> on_stack(max_nonterm_ + 1, false);
+    vector<Symbol> stack;
+    vector<pair<Symbol, size_t> > dfs;  // (symbol, next replacement to visit)
+    Symbol next_index = 0;
+    Symbol ncomponents = 0;
+
+    for (Symbol root = max_preterm_ + 1; root <= max_nonterm_; ++root) {
+      if (index[root] != unvisited)
+        continue;
+      index[root] = lowlink[root] = next_index++;
+      stack.push_back(root);
+      on_stack[root] = true;
+      dfs.push_back(make_pair(root, 0));
+
+      while (!dfs.empty()) {
+        Symbol s = dfs.back().first;
+        const vector<Symbol> &repls = replacement_symbols_[s];
+        if (dfs.back().second < repls.size()) {
+          Symbol t = repls[dfs.back().second++];
+          if (!IsNonterm(t))
+            continue;
+          if (index[t] == unvisited) {
+            index[t] = lowlink[t] = next_index++;
+            stack.push_back(t);
+            on_stack[t] = true;
+            dfs.push_back(make_pair(t, 0));
+          } else if (on_stack[t]) {
+            lowlink[s] = std::min(lowlink[s], index[t]);
+          }
+          continue;
+        }
+
+        dfs.pop_back();
+        if (!dfs.empty()) {
+          Symbol parent = dfs.back().first;
+          lowlink[parent] = std::min(lowlink[parent], lowlink[s]);
+        }
+        if (lowlink[s] != index[s])
+          continue;
+
+        // s is the root of a component: pop it, then fill in its row.
+        size_t first = stack.size();
+        do {
+          --first;
+          on_stack[stack[first]] = false;
+          component[stack[first]] = ncomponents;
+        } while (stack[first] != s);
+
+        BitMatrix::Word *row = symbol_reach_.MutableRow(s);
+        for (size_t m = first; m < stack.size(); ++m) {
+          const vector<Symbol> &corners = replacement_symbols_[stack[m]];
+          for (size_t i = 0; i < corners.size(); ++i) {
+            Symbol c = corners[i];
+            if (IsTerm(c)) {
+              symbol_reach_.Set(s, c);
+            } else if (IsPreterm(c)) {
+              symbol_reach_.Set(s, ToTerm(c));
+            } else if (IsNonterm(c) && component[c] != ncomponents) {
+              const BitMatrix::Word *other = symbol_reach_.Row(c);
+              for (size_t w = 0; w < symbol_reach_.WordsPerRow(); ++w)
+                row[w] |= other[w];
+            }
+          }
+        }
+        for (size_t m = first; m < stack.size(); ++m) {
+          if (stack[m] != s)
+            std::copy(row, row + symbol_reach_.WordsPerRow(),
+                      symbol_reach_.MutableRow(stack[m]));
+        }
+        stack.resize(first);
+        ++ncomponents;
+      }
+    }
+  }
+
+
   Symbol max_term_;    // assume first terminal is 1 (0 reserved for epsilon)
   Symbol max_preterm_; // assume min_preterm_ is max_term_ + 1, assume max_preterm_ == max_term_ * 2
   Symbol max_nonterm_; // assume min_nonterm_ is max_preterm_ + 1
-  vector<Symbol> labels_to_symbols_;
+  FlatArray<Symbol> labels_to_symbols_;
   vector<Rule> rules_;
-  // TODO is this a source of trouble? vector is not a sparse
-  // representation, but the symbol count could climb quite high
-  vector<vector<ReachType> > symbol_reach_;
+  // symbol_reach_.Test(s, t) iff terminal t is a left corner of symbol s;
+  // one row per symbol up to max_nonterm_, one column per terminal
+  BitMatrix symbol_reach_;
+  // rule_reach_.Test(t, r) iff rule r's left-hand side can reach terminal t;
+  // one row per terminal, one column per rule id
+  BitMatrix rule_reach_;
   vector<vector<Symbol> > replacement_symbols_;
   // replacement_symbols_[s] is a vector of symbols which appear as the left-most symbol of the RHS of a production from s
 };
@@ -204,82 +336,114 @@ struct StateInfo {
   Symbol snd;
 };
 
+// A backoff chain is a run of lexical backoffs from a context state, each
+// from the state the one before led to (see PDTInfo). Chain 0 is the
+// empty run.
+typedef int32 BackoffChainId;
+const BackoffChainId kNoBackoffChain = -1;
 
+
+// Filter state of the Tripoli compose filter: the context states and labels
+// backed off through since the last grammar arc, and the rules those
+// backoffs disallow. It is a small fixed-size value with a precomputed
+// hash, since the compose state table copies, hashes and compares it
+// constantly. kMaxBackoffs bounds the number of lexical backoffs, and
+// separately of syntactic backoffs, that a state can record.
+template <int kMaxBackoffs = 3>
 class TripoliFilterState {
 public:
-  TripoliFilterState() : no_state_flag_(false) {
-    states_.reserve(3);
-    labels_.reserve(3);
+  TripoliFilterState()
+          : no_state_flag_(false), nstates_(0), nlabels_(0),
+            disallowed_(RuleSetPool::kEmpty), chain_(0) { Rehash(); }
+
+  explicit TripoliFilterState(bool no_state_flag)
+          : no_state_flag_(no_state_flag), nstates_(0), nlabels_(0),
+            disallowed_(RuleSetPool::kEmpty), chain_(0) { Rehash(); }
+
+  // disallowed is the interned union of this state's set and the new one,
+  // and chain the backoff chain of the new states, if PDTInfo has one. A
+  // state that has run out of room becomes NoState.
+  TripoliFilterState GenerateAddState(StateId state, RuleSetId disallowed,
+                                      BackoffChainId chain = kNoBackoffChain) const {
+    if (nstates_ == kMaxBackoffs)
+      return NoState();
+    TripoliFilterState f(*this);
+    f.states_[f.nstates_++] = state;
+    f.disallowed_ = disallowed;
+    f.chain_ = chain;
+    f.Rehash();
+    return f;
+  }
+  TripoliFilterState GenerateAddLabel(Label label, RuleSetId disallowed) const {
+    if (nlabels_ == kMaxBackoffs)
+      return NoState();
+    TripoliFilterState f(*this);
+    f.labels_[f.nlabels_++] = label;
+    f.disallowed_ = disallowed;
+    f.chain_ = kNoBackoffChain;
+    f.Rehash();
+    return f;
   }
-  TripoliFilterState(const vector<StateId> &states, const vector<Label> &labels, const set<RuleId> &disallowed)
-          : no_state_flag_(false), states_(states), labels_(labels), disallowed_(disallowed) {}
-
-  TripoliFilterState(bool no_state_flag) : no_state_flag_(no_state_flag) {}
 
-   TripoliFilterState GenerateAddState(StateId state, const set<RuleId> &disallowed) const {
-     set<RuleId> new_disallowed;
-     set_union(disallowed_.cbegin(), disallowed_.cend(), disallowed.cbegin(), disallowed.cend(),
-             std::inserter(new_disallowed, new_disallowed.end()));
+  RuleSetId Disallowed() const { return disallowed_; }
+  BackoffChainId Chain() const { return chain_; }
 
-     vector<StateId> new_states(states_);
-     new_states.push_back(state);
-     return TripoliFilterState(new_states, labels_, new_disallowed);
-   }
-  TripoliFilterState GenerateAddLabel(Label label, const set<RuleId> &disallowed) const {
-    set<RuleId> new_disallowed;
-    set_union(disallowed_.cbegin(), disallowed_.cend(), disallowed.cbegin(), disallowed.cend(),
-           std::inserter(new_disallowed, new_disallowed.end()));
+  static TripoliFilterState NoState() { return TripoliFilterState(true); }
 
-    vector<Label> new_labels(labels_);
-    new_labels.push_back(label);
-    return TripoliFilterState(states_, new_labels, new_disallowed);
-  }
+  size_t Hash() const { return hash_; }
 
-  bool Contains(RuleId r) const {
-    return disallowed_.find(r) != disallowed_.end();
+  bool operator==(const TripoliFilterState &f) const {
+    if (hash_ != f.hash_ || no_state_flag_ != f.no_state_flag_ ||
+        nstates_ != f.nstates_ || nlabels_ != f.nlabels_)
+      return false;
+    for (int i = 0; i < nstates_; ++i)
+      if (states_[i] != f.states_[i])
+        return false;
+    for (int i = 0; i < nlabels_; ++i)
+      if (labels_[i] != f.labels_[i])
+        return false;
+    return true;
   }
 
-  static const TripoliFilterState &NoState() { return no_state_;}
+  bool operator!=(const TripoliFilterState &f) const { return !(*this == f); }
 
-  template <typename T>
-  static size_t VecHash(vector<T> vec) {
-    size_t h = 0;
-    for (typename vector<T>::const_iterator it = vec.cbegin();
-         it != vec.cend(); ++it) {
-      h ^= h << 1 ^ *it;
-    }
+private:
+  // Final step of MurmurHash3, a cheap mixer with full avalanche.
+  static uint64 Mix(uint64 h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
     return h;
   }
 
-  size_t Hash() const {
-    size_t h1 = VecHash<StateId>(states_);
-    size_t h2 = VecHash<Label>(labels_);
-    const int lshift = 5;
-    const int rshift = CHAR_BIT * sizeof(size_t) - 5;
-    return h1 << lshift ^ h1 >> rshift ^ h2;
-  }
-
-  bool operator==(const TripoliFilterState &f) const {
-    return (f.no_state_flag_ && no_state_flag_) || (f.states_ == states_ && f.labels_ == labels_);
-  }
-
-  bool operator!=(const TripoliFilterState &f) const {
-    return !(f.no_state_flag_ && no_state_flag_) && (f.states_ != states_ || f.labels_ != labels_);
+  void Rehash() {
+    uint64 h = Mix(uint64(no_state_flag_) << 16 | uint64(nstates_) << 8 | nlabels_);
+    for (int i = 0; i < nstates_; ++i)
+      h = Mix(h ^ uint32(states_[i]));
+    for (int i = 0; i < nlabels_; ++i)
+      h = Mix(h + uint32(labels_[i]));
+    hash_ = h;
   }
 
-private:
+  uint64 hash_;
   bool no_state_flag_;
-  vector<StateId> states_;
-  vector<Label> labels_;
-  set<RuleId> disallowed_;
-
-  static TripoliFilterState no_state_;
-
-  template <class M1, class M2> friend class TripoliComposeFilter;
+  uint8 nstates_;
+  uint8 nlabels_;
+  RuleSetId disallowed_;  // handle into the composition's RuleSetPool
+  // Follows from the states and labels, so it is left out of the hash and
+  // of equality.
+  BackoffChainId chain_;
+  StateId states_[kMaxBackoffs];
+  Label labels_[kMaxBackoffs];
+
+  template <class M1, class M2, int N> friend class TripoliComposeFilter;
 };
 
 struct FilterStateHash {
-  size_t operator()(const TripoliFilterState &f) { return f.Hash(); }
+  template <int N>
+  size_t operator()(const TripoliFilterState<N> &f) const { return f.Hash(); }
 };
 
 struct StateInfoHash {
@@ -297,6 +461,26 @@ struct StateInfoEquals {
   }
 };
 
+// PDTInfo's lookup tables as flat arrays, so that a compiled model can
+// store them as they are. Rule sets are in compressed sparse rows: the
+// rules of state s (or label l) are rules[offsets[s], offsets[s+1]).
+struct PDTIndex {
+  FlatArray<StateInfo> state_info;  // maps StateId to state-info
+  FlatArray<RuleId> context_rules;  // rules observed at each context state, sorted
+  FlatArray<uint64> context_offsets;  // indexed by StateId
+  FlatArray<RuleId> unigram_rules;  // rules seen with each arc-Label (pop) from the unigram state, sorted
+  FlatArray<uint64> unigram_offsets;  // indexed by Label
+  FlatArray<RuleId> arc_rules;  // rule of every PDT arc, state by state in arc order
+  FlatArray<uint64> arc_rule_offsets;  // indexed by StateId
+  FlatArray<BackoffChainId> state_chains;  // chain of one backoff from each StateId, or kNoBackoffChain
+  FlatArray<StateId> chain_targets;  // state the last backoff of each chain leads to
+  FlatArray<BackoffChainId> chain_next;  // chain one backoff longer from there, or kNoBackoffChain
+  FlatArray<RuleId> chain_rules;  // rules each chain disallows, sorted
+  FlatArray<uint64> chain_offsets;  // indexed by BackoffChainId
+};
+
+// Read-only once built, and it keeps no reference to the PDT, so one
+// PDTInfo can back compositions in any number of threads.
 template <class F>
 class PDTInfo {
 public:
@@ -304,107 +488,311 @@ public:
   typedef typename F::Arc Arc;
   typedef typename Arc::Weight Weight;
 
-  PDTInfo(Grammar &grammar, PDT &pdt, vector<StateInfo> &state_info)
-          : grammar(grammar),
-            pdt_(pdt),
-            state_info_(state_info) {
+  // With a pool, states are validated and indexed in parallel ranges that
+  // are merged in order, so the indexes and the state named by a
+  // validation error are the same as without one.
+  PDTInfo(const Grammar &grammar, const PDT &pdt, const vector<StateInfo> &state_info,
+          ThreadPool *pool = 0)
+          : grammar(grammar) {
+
+    index_.state_info = FlatArray<StateInfo>(state_info);
+    size_t nchunks = pool ? 4 * pool->NumThreads() : 1;
+    collect_arc_rules(pdt, pool, nchunks);
+
+    vector<IndexChunk> chunks(std::max<size_t>(1, std::min(state_info.size(), nchunks)));
+    if (pool) {
+      pool->ParallelFor(state_info.size(), chunks.size(),
+                        [this, &pdt, &chunks](size_t c, size_t begin, size_t end) {
+                          index_states(pdt, begin, end, &chunks[c]);
+                        });
+    } else {
+      index_states(pdt, 0, state_info.size(), &chunks[0]);
+    }
+
+    vector<uint64> &context_offsets = index_.context_offsets.Owned();
+    vector<RuleId> &context_rules = index_.context_rules.Owned();
+    vector<pair<Label, RuleId> > unigram_rules;
+    context_offsets.reserve(state_info.size() + 1);
+    context_offsets.push_back(0);
+    // We will check that only one state is annotated as the start state
+    bool start_state_found = false;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      IndexChunk &chunk = chunks[c];
+      for (size_t i = 0; i < chunk.start_states.size(); ++i) {
+        if (start_state_found)
+          throw invalid_argument("Duplicate start states found: " + std::to_string(chunk.start_states[i]));
+        start_state_found = true;
+      }
+      if (!chunk.error.empty())
+        throw invalid_argument(chunk.error);
+      uint64 base = context_rules.size();
+      context_rules.insert(context_rules.end(), chunk.context_rules.begin(), chunk.context_rules.end());
+      for (size_t i = 0; i < chunk.context_ends.size(); ++i)
+        context_offsets.push_back(base + chunk.context_ends[i]);
+      unigram_rules.insert(unigram_rules.end(), chunk.unigram_rules.begin(), chunk.unigram_rules.end());
+      IndexChunk().Swap(&chunk);
+    }
+    index_unigram_rules(&unigram_rules);
+    if(!start_state_found) {
+      throw invalid_argument("No start state (trigram) found.");
+    }
+    index_backoff_chains(pdt);
+  }
+
+  // Over tables that were built earlier, e.g. loaded from a compiled model.
+  PDTInfo(const Grammar &grammar, const PDTIndex &index)
+          : index_(index),
+            grammar(grammar) {}
+
+  // Sorted rules seen on the arcs of context state s (empty for any other
+  // state).
+  Span<RuleId> GetContextRuleSet(StateId s) const {
+    if (s < 0 || s + 1 >= index_.context_offsets.size())
+      return Span<RuleId>();
+    return index_.context_rules.Slice(index_.context_offsets[s], index_.context_offsets[s + 1]);
+  }
+
+  // Sorted rules seen with arc label l out of the unigram state.
+  Span<RuleId> GetUnigramRuleSet(Label l) const {
+    if (l < 0 || l + 1 >= index_.unigram_offsets.size())
+      return Span<RuleId>();
+    return index_.unigram_rules.Slice(index_.unigram_offsets[l], index_.unigram_offsets[l + 1]);
+  }
 
-    StateId state = 0;
+  // The chain after a lexical backoff out of state s that follows chain,
+  // or kNoBackoffChain if s is not where chain leads or nothing was
+  // precomputed for it.
+  BackoffChainId NextBackoffChain(BackoffChainId chain, StateId s) const {
+    if (chain == 0)
+      return s >= 0 && size_t(s) < index_.state_chains.size() ? index_.state_chains[s]
+                                                               : kNoBackoffChain;
+    if (chain < 0 || size_t(chain) >= index_.chain_next.size() ||
+        index_.chain_targets[chain] != s)
+      return kNoBackoffChain;
+    return index_.chain_next[chain];
+  }
+
+  // Sorted union of the context rule sets of the states on chain.
+  Span<RuleId> GetBackoffChainRuleSet(BackoffChainId chain) const {
+    return index_.chain_rules.Slice(index_.chain_offsets[chain], index_.chain_offsets[chain + 1]);
+  }
+
+  size_t NumBackoffChains() const { return index_.chain_next.size(); }
+
+  const StateInfo &GetStateInfo(StateId s) const {
+    return index_.state_info[s];
+  }
+
+  // Bit i of mask is set iff the i-th arc of s passes the reach check
+  // when term is the next input terminal.
+  void ArcsCanReach(StateId s, Label term, vector<BitMatrix::Word> *mask) const {
+    Span<RuleId> rules = GetArcRules(s);
+    grammar.RulesCanReach(term, rules.data(), rules.size(), mask);
+  }
+
+  // Rules of the arcs of s, in arc order.
+  Span<RuleId> GetArcRules(StateId s) const {
+    return index_.arc_rules.Slice(index_.arc_rule_offsets[s], index_.arc_rule_offsets[s + 1]);
+  }
+
+  const PDTIndex &GetIndex() const { return index_; }
+
+private:
+  // Indexes of the states [begin, end) of one range, up to the first
+  // invalid one.
+  struct IndexChunk {
+    vector<RuleId> context_rules;
+    vector<uint64> context_ends;  // into context_rules, one per state
+    vector<pair<Label, RuleId> > unigram_rules;
+    vector<StateId> start_states;  // at most two: a second one is an error
+    string error;  // for the first invalid state
+
+    void Swap(IndexChunk *other) {
+      context_rules.swap(other->context_rules);
+      context_ends.swap(other->context_ends);
+      unigram_rules.swap(other->unigram_rules);
+      start_states.swap(other->start_states);
+      error.swap(other->error);
+    }
+  };
+
+  void index_states(const PDT &pdt, StateId begin, StateId end, IndexChunk *chunk) const {
+    StateId nstates = pdt.NumStates();
     // In states.cpp, read_states uses -1 as the absence of a value
     // But no_value was originally 0, probably a bug
     int no_value = -1;
     int start_state = -2;
     // We will use -2 as the special start symbol
-    // And we will check that only one such state is so annotated
-    bool start_state_found = false;
-    for (vector<StateInfo>::const_iterator it = state_info.begin();
-         it != state_info.end();
-         ++it, ++state) {
-      StateInfo si = *it;
+    for (StateId state = begin; state < end; ++state) {
+      const StateInfo &si = index_.state_info[state];
 
       switch (si.tag) {
         case TRIGRAM_STATE:
           if(si.fst == start_state && si.snd == start_state) {
-            if(start_state_found)
-              throw invalid_argument("Duplicate start states found: " + std::to_string(state));
-            else
-              start_state_found = true;
+            chunk->start_states.push_back(state);
+            if (chunk->start_states.size() > 1)
+              return;
           } else if (!((grammar.IsTerm(si.fst) || si.fst == start_state) && grammar.IsTerm(si.snd))) {
-            throw invalid_argument("invalid StateInfo for trigram state: " + std::to_string(state));
+            chunk->error = "invalid StateInfo for trigram state: " + std::to_string(state);
+            return;
           }
-          collect_rules(state);
-          state_index_[si] = state;
+          if (state < nstates)
+            collect_rules(pdt, state, &chunk->context_rules);
           break;
 
         case BIGRAM_STATE:
-          if (!(grammar.IsTerm(si.fst) && si.snd == no_value))
-            throw invalid_argument("invalid StateInfo for bigram state: " + std::to_string(state));
-          collect_rules(state);
-          state_index_[si] = state;
+          if (!(grammar.IsTerm(si.fst) && si.snd == no_value)) {
+            chunk->error = "invalid StateInfo for bigram state: " + std::to_string(state);
+            return;
+          }
+          if (state < nstates)
+            collect_rules(pdt, state, &chunk->context_rules);
           break;
 
         case UNIGRAM_STATE:
-          if (!(si.fst == no_value && si.snd == no_value))
-            throw invalid_argument("invalid StateInfo for unigram state: " + std::to_string(state));
-          collect_unigram_rules(state);
-          state_index_[si] = state;
+          if (!(si.fst == no_value && si.snd == no_value)) {
+            chunk->error = "invalid StateInfo for unigram state: " + std::to_string(state);
+            return;
+          }
+          if (state < nstates)
+            collect_unigram_rules(pdt, state, &chunk->unigram_rules);
           break;
 
         case DUMMY_STATE:
-          if (!(si.fst == no_value && si.snd == no_value))
-            throw invalid_argument("invalid StateInfo for dummy state: " + std::to_string(state));
+          if (!(si.fst == no_value && si.snd == no_value)) {
+            chunk->error = "invalid StateInfo for dummy state: " + std::to_string(state);
+            return;
+          }
           break;
         case PORTAL_STATE:
-          if (!(si.fst == no_value && si.snd == no_value))
-            throw invalid_argument("invalid StateInfo for portal state: " + std::to_string(state));
-      }  
-    }
-    if(!start_state_found) {
-      throw new invalid_argument("No start state (trigram) found.");
+          if (!(si.fst == no_value && si.snd == no_value)) {
+            chunk->error = "invalid StateInfo for portal state: " + std::to_string(state);
+            return;
+          }
+      }
+      chunk->context_ends.push_back(chunk->context_rules.size());
     }
   }
 
-  // TODO Why can't this be const?
-  set<RuleId> &GetContextRuleSet(StateId s) {
-    return seen_rules_[s];
-  }
-
-  // TODO Why can't this be const?
-  set<RuleId> &GetUnigramRuleSet(Label l) {
-    return unigram_rules_[l];
-  }
-
-  StateInfo &GetStateInfo(StateId s) const {
-    return state_info_[s];
+  // Arc counts are summed serially; the rules themselves are copied in
+  // parallel into their final place.
+  void collect_arc_rules(const PDT &pdt, ThreadPool *pool, size_t nchunks) {
+    StateId nstates = pdt.NumStates();
+    vector<RuleId> &arc_rules = index_.arc_rules.Owned();
+    vector<uint64> &offsets = index_.arc_rule_offsets.Owned();
+    offsets.reserve(nstates + 1);
+    offsets.push_back(0);
+    for (StateId s = 0; s < nstates; ++s)
+      offsets.push_back(offsets.back() + pdt.NumArcs(s));
+    arc_rules.resize(offsets.back());
+    auto copy = [&pdt, &arc_rules, &offsets](size_t c, size_t begin, size_t end) {
+      for (StateId s = begin; s < end; ++s) {
+        RuleId *rule = &arc_rules[offsets[s]];
+        for (ArcIterator<PDT> aiter(pdt, s);
+             !aiter.Done();
+             aiter.Next())
+          *rule++ = aiter.Value().rule;
+      }
+    };
+    if (pool)
+      pool->ParallelFor(nstates, nchunks, copy);
+    else
+      copy(0, 0, nstates);
   }
-
-private:
-  void collect_rules(StateId s) {
-    set<RuleId> &rules = seen_rules_[s];
-    for (ArcIterator<PDT> aiter(pdt_, s);
+  // ArcTags are not rules, so they are left out of the rule sets.
+  void collect_rules(const PDT &pdt, StateId s, vector<RuleId> *rules) const {
+    size_t begin = rules->size();
+    for (ArcIterator<PDT> aiter(pdt, s);
          !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
-      rules.insert(arc.rule);
+      if (arc.rule >= 0)
+        rules->push_back(arc.rule);
     }
+    std::sort(rules->begin() + begin, rules->end());
+    rules->erase(std::unique(rules->begin() + begin, rules->end()), rules->end());
   }
-  void collect_unigram_rules(StateId s) {
-    for (ArcIterator<PDT> aiter(pdt_, s);
+  void collect_unigram_rules(const PDT &pdt, StateId s, vector<pair<Label, RuleId> > *rules) const {
+    for (ArcIterator<PDT> aiter(pdt, s);
          !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
       Label label = arc.ilabel;
-      if (label == 0)
+      if (label == 0 || arc.rule < 0)
         continue;
-      unigram_rules_[label].insert(arc.rule);
+      rules->push_back(make_pair(label, arc.rule));
     }
   }
+  void index_unigram_rules(vector<pair<Label, RuleId> > *rules) {
+    std::sort(rules->begin(), rules->end());
+    rules->erase(std::unique(rules->begin(), rules->end()), rules->end());
+    Label max_label = rules->empty() ? -1 : rules->back().first;
+    vector<uint64> &offsets = index_.unigram_offsets.Owned();
+    vector<RuleId> &unigram_rules = index_.unigram_rules.Owned();
+    offsets.assign(max_label + 2, 0);
+    unigram_rules.reserve(rules->size());
+    for (size_t i = 0; i < rules->size(); ++i) {
+      ++offsets[(*rules)[i].first + 1];
+      unigram_rules.push_back((*rules)[i].second);
+    }
+    for (size_t l = 1; l < offsets.size(); ++l)
+      offsets[l] += offsets[l - 1];
+  }
 
-  PDT pdt_;
-  vector<StateInfo> state_info_;  // maps StateId to state-info
-  unordered_map<StateInfo, StateId, StateInfoHash, StateInfoEquals> state_index_; // maps (context) state-info to StateId
-  unordered_map<StateId, set<RuleId>> seen_rules_; // maps stateId (context state) to observed rules
-  unordered_map<Label, set<RuleId>> unigram_rules_; // maps arc-Label (pop) to set of rules seen with that context from unigram state
+  // Backoff topology is fixed (trigram to bigram to unigram), so the
+  // chain of every run of lexical backoffs from each state, and the rules
+  // it disallows, are found once here rather than unioned per arc. A run
+  // that passes through a dummy or portal arc between backoffs is not a
+  // chain, and the filter unions its rules as it goes.
+  void index_backoff_chains(const PDT &pdt) {
+    StateId nstates = pdt.NumStates();
+    vector<StateId> targets(nstates, kNoStateId);
+    for (StateId s = 0; s < nstates; ++s) {
+      for (ArcIterator<PDT> aiter(pdt, s); !aiter.Done(); aiter.Next()) {
+        if (aiter.Value().rule == LEXICAL_BACKOFF_ARC) {
+          targets[s] = aiter.Value().nextstate;
+          break;
+        }
+      }
+    }
+    vector<BackoffChainId> &state_chains = index_.state_chains.Owned();
+    vector<StateId> &chain_targets = index_.chain_targets.Owned();
+    vector<BackoffChainId> &chain_next = index_.chain_next.Owned();
+    vector<RuleId> &chain_rules = index_.chain_rules.Owned();
+    vector<uint64> &chain_offsets = index_.chain_offsets.Owned();
+    state_chains.assign(nstates, kNoBackoffChain);
+    chain_targets.assign(1, kNoStateId);
+    chain_next.assign(1, kNoBackoffChain);
+    chain_offsets.assign(2, 0);
+    vector<RuleId> rules, merged;
+    for (StateId s = 0; s < nstates; ++s) {
+      rules.clear();
+      BackoffChainId prev = 0;
+      // Bounded in case the backoff arcs loop
+      StateId at = s;
+      for (int n = 0; n < kMaxBackoffChain && at >= 0 && at < nstates &&
+                      targets[at] != kNoStateId; ++n, at = targets[at]) {
+        Span<RuleId> own = GetContextRuleSet(at);
+        merged.clear();
+        std::set_union(rules.begin(), rules.end(), own.begin(), own.end(), std::back_inserter(merged));
+        rules.swap(merged);
+        BackoffChainId chain = chain_next.size();
+        if (prev == 0)
+          state_chains[at] = chain;
+        else
+          chain_next[prev] = chain;
+        chain_targets.push_back(targets[at]);
+        chain_next.push_back(kNoBackoffChain);
+        chain_rules.insert(chain_rules.end(), rules.begin(), rules.end());
+        chain_offsets.push_back(chain_rules.size());
+        prev = chain;
+      }
+    }
+  }
+
+  static const int kMaxBackoffChain = 4;
+
+  PDTIndex index_;
 //  unordered_map<FilterState, set<RuleId>, FilterStateHash> cached_filter_sets_;
 
 public:
@@ -412,15 +800,35 @@ public:
 };
 
 
-template <class M1, class M2>
-class TripoliComposeFilter {
+// Mutable state of one composition, shared by a filter and its unsafe
+// copies: the intern table for disallowed sets, the handles of PDTInfo's
+// rule sets once they have been interned, and the filter's counters. A
+// safe copy, as made for another thread, gets a copy of its own.
+struct TripoliFilterTables {
+  static const RuleSetId kUnset = ~RuleSetId(0);
+
+  TripoliFilterTables() : overflow_logged(false) {}
+
+  RuleSetPool pool;
+  unordered_map<StateId, RuleSetId> context_sets;
+  unordered_map<Label, RuleSetId> unigram_sets;
+  vector<RuleSetId> chain_sets;  // by BackoffChainId, kUnset until interned
+  ComposeStats stats;  // the filter's counters; the rest is filled in later
+  bool overflow_logged;  // see TripoliComposeFilter::Overflow
+};
+
+// As the PDT matcher's ArcPrefilter (when M2 is an IndexedMatcher), it
+// runs the rule checks of FilterArc over each run of matched arcs at once
+// (see AcceptMask), so the arcs they reject never reach FilterArc.
+template <class M1, class M2, int kMaxBackoffs = 3>
+class TripoliComposeFilter : public ArcPrefilter {
 public:
   typedef typename M1::FST FST;
   typedef typename M2::FST PDT;
   typedef typename PDT::Arc Arc;
   typedef M1 Matcher1;
   typedef M2 Matcher2;
-  typedef TripoliFilterState FilterState;
+  typedef TripoliFilterState<kMaxBackoffs> FilterState;
   typedef typename Arc::Weight Weight;
 
   /* Nonce-constructor required to satisfy templatization requirements in compose.h. Do NOT use! */
@@ -429,30 +837,37 @@ public:
             matcher2_(matcher2 ? matcher2 : new M2(pdt, MATCH_INPUT)),
             fst_(matcher1_->GetFst()),
             pdt_(matcher2_->GetFst()),
-            pdt_info_((PDTInfo<PDT>*)0),
+            pdt_info_(0),
             s1_(kNoStateId),
             s2_(kNoStateId),
-            f_(kNoStateId) { throw "Do not call this constructor."; }
+            f_(FilterState::NoState()) { throw "Do not call this constructor."; }
 
-  TripoliComposeFilter(const FST &fst, const PDT &pdt, PDTInfo<PDT> *pdt_info, M1 *matcher1 = 0, M2 *matcher2 = 0)
+  TripoliComposeFilter(const FST &fst, const PDT &pdt, const PDTInfo<PDT> *pdt_info, M1 *matcher1 = 0, M2 *matcher2 = 0)
           : matcher1_(matcher1 ? matcher1 : new M1(fst, MATCH_OUTPUT)),
             matcher2_(matcher2 ? matcher2 : new M2(pdt, MATCH_INPUT)),
             fst_(matcher1_->GetFst()),
             pdt_(matcher2_->GetFst()),
             pdt_info_(pdt_info),
+            tables_(new TripoliFilterTables),
             s1_(kNoStateId),
             s2_(kNoStateId),
-            f_(kNoStateId) { TripoliFilterState::no_state_ = FilterState(true); }
+            f_(FilterState::NoState()) {
+    AttachPrefilter(matcher2_, this);
+  }
 
-  TripoliComposeFilter(const TripoliComposeFilter<M1, M2> &filter, bool safe = false)
+  TripoliComposeFilter(const TripoliComposeFilter<M1, M2, kMaxBackoffs> &filter, bool safe = false)
           : matcher1_(filter.matcher1_->Copy(safe)),
             matcher2_(filter.matcher2_->Copy(safe)),
             fst_(matcher1_->GetFst()),
             pdt_(matcher2_->GetFst()),
             pdt_info_(filter.pdt_info_),
+            tables_(safe ? std::make_shared<TripoliFilterTables>(*filter.tables_) : filter.tables_),
             s1_(kNoStateId),
             s2_(kNoStateId),
-            f_(kNoStateId) { TripoliFilterState::no_state_ = FilterState(true); }
+            f_(FilterState::NoState()) {
+    if (pdt_info_)
+      AttachPrefilter(matcher2_, this);
+  }
 
   ~TripoliComposeFilter() {
     delete matcher1_;
@@ -472,47 +887,241 @@ public:
   void FilterFinal(Weight *, Weight *) const {};
 
   const FilterState FilterArc(Arc *arc1, Arc *arc2) const {
+    ComposeStats &stats = tables_->stats;
+    TRIPOLI_COUNT(stats.filter_arcs, 1);
     RuleId r = arc2->rule;
     switch (r) {
       case LEXICAL_BACKOFF_ARC: {
-        set<RuleId> &disallowed = pdt_info_->GetContextRuleSet(s2_);
-        return f_.GenerateAddState(s2_, disallowed);
+        TRIPOLI_COUNT(stats.lexical_backoffs, 1);
+        if (f_.nstates_ == kMaxBackoffs)
+          return Overflow();
+        BackoffChainId chain = pdt_info_->NextBackoffChain(f_.chain_, s2_);
+        if (chain != kNoBackoffChain) {
+          TRIPOLI_COUNT(stats.chain_backoffs, 1);
+          return f_.GenerateAddState(s2_, InternChainRuleSet(chain), chain);
+        }
+        RuleSetId disallowed = InternRuleSet(&tables_->context_sets, s2_,
+                                             pdt_info_->GetContextRuleSet(s2_));
+        return f_.GenerateAddState(s2_, tables_->pool.Union(f_.disallowed_, disallowed));
       }
       case SYNTACTIC_BACKOFF_ARC: {
-        set<RuleId> &disallowed = pdt_info_->GetUnigramRuleSet(arc2->ilabel);
-        return f_.GenerateAddLabel(arc2->ilabel, disallowed);
+        TRIPOLI_COUNT(stats.syntactic_backoffs, 1);
+        if (f_.nlabels_ == kMaxBackoffs)
+          return Overflow();
+        RuleSetId disallowed = InternRuleSet(&tables_->unigram_sets, arc2->ilabel,
+                                             pdt_info_->GetUnigramRuleSet(arc2->ilabel));
+        return f_.GenerateAddLabel(arc2->ilabel, tables_->pool.Union(f_.disallowed_, disallowed));
       }
       case DUMMY_ARC:
       case PORTAL_ARC:
         return f_;
     }
-    if (f_.Contains(r))
-      return TripoliFilterState::NoState();
+    if (tables_->pool.Contains(f_.disallowed_, r)) {
+      TRIPOLI_COUNT(stats.rejected_disallowed, 1);
+      return FilterState::NoState();
+    }
 
-    if (!pdt_info_->grammar.RuleCanReach(r, arc1->olabel))
-      return TripoliFilterState::NoState();
+    // Only a terminal on the input side gives us something to look ahead to
+    if (pdt_info_->grammar.IsTerm(arc1->olabel) &&
+        !pdt_info_->grammar.RuleCanReach(r, arc1->olabel)) {
+      TRIPOLI_COUNT(stats.rejected_reach, 1);
+      return FilterState::NoState();
+    }
 
-    return f_;
+    // A grammar arc moves on to a new context, so the backoffs that led
+    // here no longer constrain what follows it.
+    return Start();
+  }
+
+  // A grammar arc matched on label passes FilterArc iff its rule is not
+  // disallowed and, when label is a terminal, the rule can reach it.
+  virtual void AcceptArcs(int64_t s, int64_t label, size_t begin, size_t end,
+                          vector<uint64_t> *mask) {
+    if (s != s2_ || f_ == FilterState::NoState()) {
+      mask->assign((end - begin + 63) / 64, ~uint64_t(0));
+      return;
+    }
+    const Grammar &grammar = pdt_info_->grammar;
+    const BitMatrix::Word *reach = grammar.IsTerm(label) ? grammar.RuleReach().Row(label) : 0;
+    AcceptMask(pdt_info_->GetArcRules(s).data() + begin, end - begin, reach,
+               grammar.RuleReach().Cols(), tables_->pool.Bits(f_.disallowed_), mask);
+#if TRIPOLI_STATS
+    size_t accepted = 0;
+    for (size_t i = 0; i < mask->size(); ++i)
+      accepted += __builtin_popcountll((*mask)[i]);
+    tables_->stats.prefiltered_arcs += end - begin;
+    tables_->stats.prefilter_rejected += end - begin - accepted;
+#endif
   }
 
 M1 *GetMatcher1() { return matcher1_; }
 M2 *GetMatcher2() { return matcher2_; }
 
+// Shared with every unsafe copy, so it sees the whole composition.
+const TripoliFilterTables &GetTables() const { return *tables_; }
+
 /* TODO Not sure if this is correct */
 uint64 Properties(uint64 props) const { return props; }
 
 private:
+  template <class K>
+  RuleSetId InternRuleSet(unordered_map<K, RuleSetId> *interned, K key,
+                          Span<RuleId> rules) const {
+    TRIPOLI_COUNT(tables_->stats.set_lookups, 1);
+    typename unordered_map<K, RuleSetId>::const_iterator it = interned->find(key);
+    if (it != interned->end()) {
+      TRIPOLI_COUNT(tables_->stats.set_hits, 1);
+      return it->second;
+    }
+    RuleSetId id = tables_->pool.Intern(rules.begin(), rules.end());
+    (*interned)[key] = id;
+    return id;
+  }
+
+  // A backoff past kMaxBackoffs in one context has nowhere to go in the
+  // filter state, so its path is dropped. That means kMaxBackoffs is too
+  // small for the model; it is counted, and logged once per composition.
+  FilterState Overflow() const {
+    TRIPOLI_COUNT(tables_->stats.backoff_overflows, 1);
+    if (!tables_->overflow_logged) {
+      tables_->overflow_logged = true;
+      LOG(WARNING) << "TripoliComposeFilter: more than " << kMaxBackoffs
+                   << " backoffs of a kind in one context; dropping paths past them";
+    }
+    return FilterState::NoState();
+  }
+
+  RuleSetId InternChainRuleSet(BackoffChainId chain) const {
+    vector<RuleSetId> &sets = tables_->chain_sets;
+    if (sets.empty())
+      sets.assign(pdt_info_->NumBackoffChains(), RuleSetId(TripoliFilterTables::kUnset));
+    TRIPOLI_COUNT(tables_->stats.set_lookups, 1);
+    if (sets[chain] == TripoliFilterTables::kUnset) {
+      Span<RuleId> rules = pdt_info_->GetBackoffChainRuleSet(chain);
+      sets[chain] = tables_->pool.Intern(rules.begin(), rules.end());
+    } else {
+      TRIPOLI_COUNT(tables_->stats.set_hits, 1);
+    }
+    return sets[chain];
+  }
+
   Matcher1 *matcher1_;
   Matcher2 *matcher2_;
   const FST &fst_;
   const PDT &pdt_;
-  PDTInfo<PDT> *pdt_info_;
+  const PDTInfo<PDT> *pdt_info_;
+  std::shared_ptr<TripoliFilterTables> tables_;
   StateId s1_;
   StateId s2_;
-  TripoliFilterState f_;
+  FilterState f_;
   vector<set<Label>> fst_state_labels_;
 
-  void operator=(const TripoliComposeFilter<M1, M2> &); // disallow
+  void operator=(const TripoliComposeFilter<M1, M2, kMaxBackoffs> &); // disallow
+};
+
+// Paren state of one composition, shared by a filter and its unsafe
+// copies like TripoliFilterTables: which labels are parens, and the
+// stacks seen so far.
+struct TripoliParenTables {
+  template <class P>
+  explicit TripoliParenTables(Span<P> parens) : labels(parens) {}
+
+  ParenLabels labels;
+  ParenStacks stacks;
+};
+
+// The Tripoli filter sequenced after the paren filter of PDT composition
+// (as ParenFilter in pdt/compose.h, expanding): the filter state adds the
+// paren stack, an arc that pops the wrong paren is rejected before any
+// rule check, and a final state with parens still open is not final.
+// Parens are kept on both sides of the composed arc, so the result is
+// again a PDT over the same parens.
+template <class M1, class M2, int kMaxBackoffs = 3>
+class TripoliParenFilter {
+public:
+  typedef TripoliComposeFilter<M1, M2, kMaxBackoffs> RuleFilter;
+  typedef typename RuleFilter::FST FST;
+  typedef typename RuleFilter::PDT PDT;
+  typedef typename RuleFilter::Arc Arc;
+  typedef typename RuleFilter::Weight Weight;
+  typedef M1 Matcher1;
+  typedef M2 Matcher2;
+  typedef IntegerFilterState<StackId> StackState;
+  typedef PairFilterState<typename RuleFilter::FilterState, StackState> FilterState;
+
+  /* Nonce-constructor required to satisfy templatization requirements in compose.h. Do NOT use! */
+  TripoliParenFilter(const FST &fst, const PDT &pdt, M1 *matcher1 = 0, M2 *matcher2 = 0)
+          : filter_(fst, pdt, matcher1, matcher2) { throw "Do not call this constructor."; }
+
+  // P is a pair of labels, as ParenPair.
+  template <class P>
+  TripoliParenFilter(const FST &fst, const PDT &pdt, const PDTInfo<PDT> *pdt_info,
+                     Span<P> parens, M1 *matcher1 = 0, M2 *matcher2 = 0)
+          : filter_(fst, pdt, pdt_info, matcher1, matcher2),
+            parens_(new TripoliParenTables(parens)),
+            f_(FilterState::NoState()) {
+    // So that the matchers loop on the side without the paren
+    for (size_t i = 0; i < parens.size(); ++i) {
+      GetMatcher1()->AddOpenParen(parens[i].first);
+      GetMatcher1()->AddCloseParen(parens[i].second);
+      GetMatcher2()->AddOpenParen(parens[i].first);
+      GetMatcher2()->AddCloseParen(parens[i].second);
+    }
+  }
+
+  TripoliParenFilter(const TripoliParenFilter<M1, M2, kMaxBackoffs> &filter, bool safe = false)
+          : filter_(filter.filter_, safe),
+            parens_(safe ? std::make_shared<TripoliParenTables>(*filter.parens_) : filter.parens_),
+            f_(FilterState::NoState()) {}
+
+  FilterState Start() const { return FilterState(filter_.Start(), StackState(0)); }
+
+  void SetState(StateId s1, StateId s2, const FilterState &f) {
+    filter_.SetState(s1, s2, f.GetState1());
+    f_ = f;
+  }
+
+  void FilterFinal(Weight *final1, Weight *final2) const {
+    if (f_.GetState2().GetState() != 0)
+      *final1 = Weight::Zero();
+    filter_.FilterFinal(final1, final2);
+  }
+
+  const FilterState FilterArc(Arc *arc1, Arc *arc2) const {
+    StackId stack = f_.GetState2().GetState();
+    // A paren on one side is matched by the other side's paren loop
+    Label paren = kNoLabel;
+    if (arc1->olabel == kNoLabel && arc2->ilabel != 0)
+      paren = arc2->ilabel;
+    else if (arc2->ilabel == kNoLabel && arc1->olabel != 0)
+      paren = arc1->olabel;
+    if (paren != kNoLabel) {
+      stack = parens_->stacks.Follow(stack, parens_->labels.Paren(paren));
+      if (stack < 0)
+        return FilterState::NoState();
+      if (arc1->olabel == kNoLabel)
+        arc1->ilabel = arc2->ilabel;
+      else
+        arc2->olabel = arc1->olabel;
+    }
+    typename RuleFilter::FilterState f1 = filter_.FilterArc(arc1, arc2);
+    if (f1 == RuleFilter::FilterState::NoState())
+      return FilterState::NoState();
+    return FilterState(f1, StackState(stack));
+  }
+
+  M1 *GetMatcher1() { return filter_.GetMatcher1(); }
+  M2 *GetMatcher2() { return filter_.GetMatcher2(); }
+  const TripoliFilterTables &GetTables() const { return filter_.GetTables(); }
+
+  uint64 Properties(uint64 props) const { return filter_.Properties(props); }
+
+private:
+  RuleFilter filter_;
+  std::shared_ptr<TripoliParenTables> parens_;
+  FilterState f_;
+
+  void operator=(const TripoliParenFilter<M1, M2, kMaxBackoffs> &); // disallow
 };
 
 };
@@ -0,0 +1,172 @@
+#include "gtest/gtest.h"
+
+#include "a-star.h"
+#include "future-costs.h"
+#include "linear-fst.h"
+#include "synthetic.h"
+#include "test-models.h"
+#include <fst/vector-fst.h>
+#include <limits>
+#include <memory>
+#include <random>
+
+using namespace std;
+using namespace fst;
+
+typedef VectorFst<TripoliArc> Lattice;
+
+static const float kInfinity = numeric_limits<float>::infinity();
+
+// Bounds by the exact future costs of a plain FST, optionally dropping
+// arcs with one label.
+class ExactGuide : public AStarGuide {
+public:
+	explicit ExactGuide(const Lattice &fst, Label dropped = -1) : dropped_(dropped) {
+		FutureCosts(fst, &costs_);
+	}
+	float FutureCost(TripoliArc::StateId s) { return costs_[s]; }
+	bool Keep(const TripoliArc &arc) { return arc.olabel != dropped_; }
+
+private:
+	vector<float> costs_;
+	Label dropped_;
+};
+
+static Lattice Grid(int nstates) {
+	Lattice fst;
+	for (int i = 0; i < nstates; ++i)
+		fst.AddState();
+	fst.SetStart(0);
+	return fst;
+}
+
+static TripoliArc Word(Label label, float weight, TripoliArc::StateId nextstate) {
+	return TripoliArc(label, label, weight, nextstate, 1);
+}
+
+static vector<Label> Labels(const Lattice &path, float *cost) {
+	vector<Label> labels;
+	*cost = 0;
+	TripoliArc::StateId s = path.Start();
+	while (path.NumArcs(s)) {
+		ArcIterator<Lattice> aiter(path, s);
+		labels.push_back(aiter.Value().olabel);
+		*cost += aiter.Value().weight.Value();
+		s = aiter.Value().nextstate;
+	}
+	*cost += path.Final(s).Value();
+	return labels;
+}
+
+TEST(FutureCostsTest, CheapestCostToAFinalState) {
+	Lattice fst = Grid(5);
+	fst.AddArc(0, Word(1, 1, 1));
+	fst.AddArc(0, Word(2, 5, 2));
+	fst.AddArc(1, Word(3, 7, 3));
+	fst.AddArc(2, Word(4, 0, 3));
+	fst.AddArc(4, Word(5, 0, 0));  // 4 is unreachable, but reaches a final
+	fst.SetFinal(3, 0.5);
+	fst.SetFinal(1, 10);
+	vector<float> costs;
+	FutureCosts(fst, &costs);
+	EXPECT_EQ(vector<float>({5.5, 7.5, 0.5, 0.5, 5.5}), costs);
+
+	fst.AddState();  // a dead end
+	FutureCosts(fst, &costs);
+	EXPECT_EQ(kInfinity, costs[5]);
+}
+
+// From 0, a free chain of n words that ends in a word costing 100, or a
+// word costing 1 then a free one: a blind search walks the whole chain
+// first.
+static Lattice Trap(int n) {
+	Lattice fst = Grid(n + 3);
+	TripoliArc::StateId final = n + 2;
+	for (int i = 0; i < n; ++i)
+		fst.AddArc(i, Word(1, 0, i + 1));
+	fst.AddArc(n, Word(2, 100, final));
+	fst.AddArc(0, Word(3, 1, n + 1));
+	fst.AddArc(n + 1, Word(4, 0, final));
+	fst.SetFinal(final, 0);
+	return fst;
+}
+
+TEST(AStarTest, FindsTheBestPathExpandingLess) {
+	Lattice fst = Trap(10);
+	Lattice path;
+	AStarStats exact, blind;
+	ExactGuide guide(fst);
+	ASSERT_TRUE(AStarShortestPath(fst, Span<ParenPair>(), &guide, &path, &exact));
+	float cost;
+	EXPECT_EQ(vector<Label>({3, 4}), Labels(path, &cost));
+	EXPECT_EQ(1, cost);
+	EXPECT_EQ(3u, exact.expanded);
+
+	ZeroGuide zero;
+	ASSERT_TRUE(AStarShortestPath(fst, Span<ParenPair>(), &zero, &path, &blind));
+	EXPECT_EQ(vector<Label>({3, 4}), Labels(path, &cost));
+	EXPECT_EQ(13u, blind.expanded);
+}
+
+TEST(AStarTest, HonoursTheGuideAndParens) {
+	// 0 -(10-> 1 -)13-> 3 is free but unbalanced; -)11-> 3 costs 4;
+	// 0 -5-> 3 costs 2 unless the guide drops it.
+	Lattice fst = Grid(4);
+	fst.AddArc(0, TripoliArc(0, 10, 0, 1, PORTAL_ARC));
+	fst.AddArc(1, TripoliArc(0, 13, 0, 3, PORTAL_ARC));
+	fst.AddArc(1, TripoliArc(0, 11, 4, 3, PORTAL_ARC));
+	fst.AddArc(0, Word(5, 2, 3));
+	fst.SetFinal(3, 0);
+	vector<ParenPair> parens = {ParenPair(10, 11), ParenPair(12, 13)};
+	Span<ParenPair> span(parens.data(), parens.size());
+
+	Lattice path;
+	float cost;
+	ExactGuide guide(fst);
+	ASSERT_TRUE(AStarShortestPath(fst, span, &guide, &path));
+	EXPECT_EQ(vector<Label>({5}), Labels(path, &cost));
+
+	AStarStats stats;
+	ExactGuide dropping(fst, 5);
+	ASSERT_TRUE(AStarShortestPath(fst, span, &dropping, &path, &stats));
+	EXPECT_EQ(vector<Label>({10, 11}), Labels(path, &cost));
+	EXPECT_EQ(4, cost);
+	EXPECT_EQ(1u, stats.pruned);
+	EXPECT_EQ(1u, stats.unbalanced);
+
+	fst.DeleteArcs(1);
+	EXPECT_FALSE(AStarShortestPath(fst, span, &dropping, &path));
+}
+
+// Each paren of the synthetic model closes on its nonterminal's rule, which
+// need not reach the terminal after it, so a guide that checked close
+// parens against the next terminal would miss the best path.
+TEST(TripoliShortestPathTest, MatchesAnExhaustiveSearch) {
+	SyntheticOptions opts;
+	opts.terminals = 12;
+	opts.nonterminals = 6;
+	opts.rules = 40;
+	opts.fanout = 3;
+	unique_ptr<TripoliModel> model(ReadSyntheticModel(SyntheticModel(opts)));
+	ASSERT_TRUE(model != 0);
+
+	mt19937 rng(3);
+	uniform_int_distribution<Label> term(1, 12);
+	for (int i = 0; i < 20; ++i) {
+		vector<Label> labels;
+		for (int j = 0; j < 1 + i % 5; ++j)
+			labels.push_back(term(rng));
+		LinearFst<TripoliArc> linear((vector<Label>(labels)));
+		VectorFst<TripoliArc> vector_input(linear);
+		float expected = ExhaustiveCost(linear, *model);
+		ASSERT_LT(expected, kInfinity) << "input " << i;
+		for (const Fst<TripoliArc> *input : {(const Fst<TripoliArc> *)&linear,
+				(const Fst<TripoliArc> *)&vector_input}) {
+			Lattice path;
+			ASSERT_TRUE(TripoliShortestPath(*input, *model, &path)) << "input " << i;
+			float cost;
+			Labels(path, &cost);
+			EXPECT_FLOAT_EQ(expected, cost) << "input " << i << ", " << input->Type();
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+
+#include "arc-mask.h"
+
+#include <random>
+
+using namespace std;
+using namespace fst;
+
+static bool Bit(const vector<uint64_t> &mask, size_t i) {
+	return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+TEST(AcceptMaskTest, TagsPassAndRulesNeedReachAndNotDisallowed) {
+	// reach: rules 1, 2 and 5; disallowed: rules 2 and 3, from min 2
+	uint64_t reach[1] = {0x26};
+	uint64_t disallowed[1] = {0x3};
+	vector<RuleId> rules = {-1, 1, 2, 3, 4, 5, -3};
+	vector<uint64_t> mask;
+	AcceptMask(rules.data(), rules.size(), reach, 64, RuleBits(disallowed, 2, 64), &mask,
+			ACCEPT_MASK_SCALAR);
+	ASSERT_EQ(1u, mask.size());
+	EXPECT_EQ(uint64_t(0x63), mask[0]);  // -1, 1, 5 and -3
+
+	// Without reach, only the disallowed set counts
+	AcceptMask(rules.data(), rules.size(), 0, 0, RuleBits(disallowed, 2, 64), &mask);
+	EXPECT_EQ(uint64_t(0x73), mask[0]);
+	AcceptMask(rules.data(), rules.size(), 0, 0, RuleBits(), &mask);
+	EXPECT_EQ(uint64_t(0x7f), mask[0]);
+}
+
+TEST(AcceptMaskTest, RulesPastTheReachRowAreRejected) {
+	// A reach row of rules 0 to 4, all reaching, in a word whose higher
+	// bits belong to another row
+	uint64_t reach[1] = {~uint64_t(0)};
+	vector<RuleId> rules = {-2, 0, 4, 5, 63, 64, 1000};
+	for (AcceptMaskKernel kernel : {ACCEPT_MASK_SCALAR, ACCEPT_MASK_AUTO}) {
+		vector<uint64_t> mask;
+		AcceptMask(rules.data(), rules.size(), reach, 5, RuleBits(), &mask, kernel);
+		ASSERT_EQ(1u, mask.size());
+		EXPECT_EQ(uint64_t(0x7), mask[0]);  // -2, 0 and 4
+	}
+	// As FilterArc checks reach only before a terminal, so does the mask
+	vector<uint64_t> mask;
+	AcceptMask(rules.data(), rules.size(), 0, 0, RuleBits(), &mask);
+	EXPECT_EQ(uint64_t(0x7f), mask[0]);
+}
+
+TEST(AcceptMaskTest, KernelsAgree) {
+	if (!AcceptMaskHasAvx2())
+		return;
+	mt19937 random(7);
+	const size_t kRules = 5000;
+	vector<uint64_t> reach(kRules / 64 + 1), disallowed(40);
+	for (size_t i = 0; i < reach.size(); ++i)
+		reach[i] = uint64_t(random()) << 32 | random();
+	for (size_t i = 0; i < disallowed.size(); ++i)
+		disallowed[i] = uint64_t(random()) << 32 | random();
+	// Runs of every length up to 300, so every tail length is covered,
+	// with some rules past the reach row
+	for (size_t n = 0; n < 300; ++n) {
+		vector<RuleId> rules(n);
+		for (size_t i = 0; i < n; ++i)
+			rules[i] = RuleId(random() % (kRules + 104)) - 4;
+		RuleBits bits(disallowed.data(), 1000, disallowed.size() * 64);
+		vector<uint64_t> scalar, avx2;
+		AcceptMask(rules.data(), n, reach.data(), kRules, bits, &scalar, ACCEPT_MASK_SCALAR);
+		AcceptMask(rules.data(), n, reach.data(), kRules, bits, &avx2, ACCEPT_MASK_AVX2);
+		ASSERT_EQ(scalar, avx2) << "n = " << n;
+		for (size_t i = 0; i < n; ++i) {
+			if (rules[i] >= RuleId(kRules)) {
+				EXPECT_FALSE(Bit(scalar, i));
+			}
+		}
+		AcceptMask(rules.data(), n, 0, 0, bits, &scalar, ACCEPT_MASK_SCALAR);
+		AcceptMask(rules.data(), n, 0, 0, bits, &avx2, ACCEPT_MASK_AVX2);
+		ASSERT_EQ(scalar, avx2) << "n = " << n;
+		for (size_t i = 0; i < n; ++i) {
+			if (rules[i] < 0) {
+				EXPECT_TRUE(Bit(scalar, i));
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+
+#include "batch.h"
+#include "test-models.h"
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace fst;
+
+TEST(BatchTest, ReadsManifestsAndDirectories) {
+	string dir = TempName("inputs");
+	mkdir(dir.c_str(), 0700);
+	WriteFile(dir + "/b.txt", "0 1 1\n1\n");
+	WriteFile(dir + "/a.txt", "0 1 2\n1\n");
+	vector<string> inputs;
+	ASSERT_TRUE(ReadBatchInputs(dir, &inputs));
+	EXPECT_EQ(vector<string>({dir + "/a.txt", dir + "/b.txt"}), inputs);
+
+	string manifest = WriteFile(TempName("manifest"), "# inputs\nx.txt\n\ny.txt\r\n");
+	ASSERT_TRUE(ReadBatchInputs(manifest, &inputs));
+	EXPECT_EQ(vector<string>({"x.txt", "y.txt"}), inputs);
+	EXPECT_FALSE(ReadBatchInputs(TempName("missing"), &inputs));
+	remove((dir + "/a.txt").c_str());
+	remove((dir + "/b.txt").c_str());
+	rmdir(dir.c_str());
+	remove(manifest.c_str());
+}
+
+TEST(BatchTest, KeepsInputOrderAndCountsFailures) {
+	unique_ptr<TripoliModel> model(ReadSmallModel());
+	vector<string> inputs;
+	for (int i = 0; i < 40; ++i) {
+		string name = TempName("input-" + to_string(i));
+		if (i % 7 != 3)
+			WriteFile(name, "0 1 1\n1\n");
+		inputs.push_back(name);
+	}
+	// Each input that reads composes to the same machine
+	unique_ptr<Fst<TripoliArc> > input(CompileInput("0 1 1\n1\n", "input"));
+	unique_ptr<ComposeFst<TripoliArc> > composed(TripoliComposeInput(*input, *model));
+	ostringstream machine;
+	ASSERT_TRUE(WriteOutput(*composed, OUTPUT_TEXT, machine, "machine"));
+	string expected;
+	for (int i = 0; i < 40; ++i)
+		expected += "# " + inputs[i] + (i % 7 != 3 ? "\n" + machine.str() : ": failed\n");
+
+	for (size_t nthreads : {0, 4}) {
+		BatchOptions opts;
+		opts.threads = nthreads;
+		opts.queue_size = 3;
+		ostringstream out;
+		EXPECT_EQ(6u, RunBatch(*model, inputs, out, opts));
+		EXPECT_EQ(expected, out.str());
+	}
+	// On a pool of the caller's, which is still usable after
+	ThreadPool pool(3);
+	BatchOptions opts;
+	opts.pool = &pool;
+	opts.queue_size = 3;
+	ostringstream out;
+	EXPECT_EQ(6u, RunBatch(*model, inputs, out, opts));
+	EXPECT_EQ(expected, out.str());
+	EXPECT_EQ(7, pool.Async([]() { return 7; }).get());
+	for (const string &name : inputs)
+		remove(name.c_str());
+}
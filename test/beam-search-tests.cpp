@@ -0,0 +1,155 @@
+#include "gtest/gtest.h"
+
+#include "beam-search.h"
+#include <fst/vector-fst.h>
+
+using namespace std;
+using namespace fst;
+
+typedef VectorFst<TripoliArc> Lattice;
+
+// (10, 11) and (12, 13) are paren pairs.
+static const vector<ParenPair> kParens = {ParenPair(10, 11), ParenPair(12, 13)};
+
+static TripoliArc Paren(Label paren, float weight, StateId nextstate) {
+	return TripoliArc(0, paren, weight, nextstate, PORTAL_ARC);
+}
+
+static TripoliArc Word(Label label, float weight, StateId nextstate) {
+	return TripoliArc(label, label, weight, nextstate, 1);
+}
+
+static Lattice Chain(int nstates) {
+	Lattice fst;
+	for (int i = 0; i < nstates; ++i)
+		fst.AddState();
+	fst.SetStart(0);
+	return fst;
+}
+
+static vector<Label> PathLabels(const Lattice &paths, StateId s, float *cost) {
+	vector<Label> labels;
+	*cost = 0;
+	while (paths.NumArcs(s)) {
+		ArcIterator<Lattice> aiter(paths, s);
+		labels.push_back(aiter.Value().olabel);
+		*cost += aiter.Value().weight.Value();
+		s = aiter.Value().nextstate;
+	}
+	*cost += paths.Final(s).Value();
+	return labels;
+}
+
+static Span<ParenPair> Parens() {
+	return Span<ParenPair>(kParens.data(), kParens.size());
+}
+
+TEST(BeamSearchTest, KeepsOnlyBalancedPaths) {
+	// 0 -(10-> 1 -a-> 2 -)13-> 3 is cheap but unbalanced; -)11-> 3 is dear
+	Lattice fst = Chain(4);
+	fst.AddArc(0, Paren(10, 0, 1));
+	fst.AddArc(1, Word(1, 1, 2));
+	fst.AddArc(2, Paren(13, 0, 3));
+	fst.AddArc(2, Paren(11, 5, 3));
+	fst.SetFinal(3, 0.5);
+
+	Lattice paths;
+	BeamSearchStats stats;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), BeamSearchOptions(), &paths, &stats));
+	float cost;
+	EXPECT_EQ(vector<Label>({10, 1, 11}), PathLabels(paths, paths.Start(), &cost));
+	EXPECT_EQ(6.5, cost);
+	EXPECT_EQ(1u, stats.unbalanced);
+	EXPECT_EQ(2u, stats.positions);
+
+	// A final state with parens still open does not end a path
+	fst.SetFinal(2, 0);
+	ASSERT_TRUE(BeamSearch(fst, Parens(), BeamSearchOptions(), &paths));
+	EXPECT_EQ(vector<Label>({10, 1, 11}), PathLabels(paths, paths.Start(), &cost));
+}
+
+TEST(BeamSearchTest, CapsStackDepth) {
+	Lattice fst = Chain(5);
+	fst.AddArc(0, Paren(10, 0, 1));
+	fst.AddArc(1, Paren(12, 0, 2));
+	fst.AddArc(2, Paren(13, 0, 3));
+	fst.AddArc(3, Paren(11, 0, 4));
+	fst.SetFinal(4, 0);
+
+	Lattice paths;
+	BeamSearchOptions opts;
+	opts.max_depth = 2;
+	EXPECT_TRUE(BeamSearch(fst, Parens(), opts, &paths));
+	BeamSearchStats stats;
+	opts.max_depth = 1;
+	EXPECT_FALSE(BeamSearch(fst, Parens(), opts, &paths, &stats));
+	EXPECT_EQ(1u, stats.too_deep);
+	EXPECT_EQ(0, paths.NumStates());
+}
+
+// 0 -a/0-> 1 -c/9-> 3 and 0 -b/2-> 2 -c/0-> 3: the path that is best in
+// the end is behind at the first position.
+static Lattice GardenPath() {
+	Lattice fst = Chain(4);
+	fst.AddArc(0, Word(1, 0, 1));
+	fst.AddArc(0, Word(2, 2, 2));
+	fst.AddArc(1, Word(3, 9, 3));
+	fst.AddArc(2, Word(3, 0, 3));
+	fst.SetFinal(3, 0);
+	return fst;
+}
+
+TEST(BeamSearchTest, BeamAndActiveCapPruneByPosition) {
+	Lattice fst = GardenPath();
+	Lattice paths;
+	float cost;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), BeamSearchOptions(), &paths));
+	EXPECT_EQ(vector<Label>({2, 3}), PathLabels(paths, paths.Start(), &cost));
+
+	BeamSearchOptions opts;
+	opts.beam = 1;
+	BeamSearchStats stats;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), opts, &paths, &stats));
+	EXPECT_EQ(vector<Label>({1, 3}), PathLabels(paths, paths.Start(), &cost));
+	EXPECT_EQ(1u, stats.pruned);
+
+	opts = BeamSearchOptions();
+	opts.max_active = 1;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), opts, &paths));
+	EXPECT_EQ(vector<Label>({1, 3}), PathLabels(paths, paths.Start(), &cost));
+}
+
+TEST(BeamSearchTest, FindsNBestCheapestFirst) {
+	Lattice fst = GardenPath();
+	Lattice paths;
+	BeamSearchOptions opts;
+	opts.nbest = 3;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), opts, &paths));
+	ASSERT_EQ(2u, paths.NumArcs(paths.Start()));
+	ArcIterator<Lattice> aiter(paths, paths.Start());
+	float cost;
+	EXPECT_EQ(2, aiter.Value().olabel);
+	EXPECT_EQ(vector<Label>({3}), PathLabels(paths, aiter.Value().nextstate, &cost));
+	EXPECT_EQ(0, cost);
+	aiter.Next();
+	EXPECT_EQ(1, aiter.Value().olabel);
+	EXPECT_EQ(vector<Label>({3}), PathLabels(paths, aiter.Value().nextstate, &cost));
+	EXPECT_EQ(9, cost);
+
+	opts.nbest = 1;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), opts, &paths));
+	EXPECT_EQ(1u, paths.NumArcs(paths.Start()));
+}
+
+TEST(BeamSearchTest, ParensDoNotAdvanceThePosition) {
+	// Composed parens carry the paren on both sides
+	Lattice fst = Chain(4);
+	fst.AddArc(0, TripoliArc(10, 10, 0, 1, PORTAL_ARC));
+	fst.AddArc(1, Word(1, 0, 2));
+	fst.AddArc(2, TripoliArc(11, 11, 0, 3, PORTAL_ARC));
+	fst.SetFinal(3, 0);
+	Lattice paths;
+	BeamSearchStats stats;
+	ASSERT_TRUE(BeamSearch(fst, Parens(), BeamSearchOptions(), &paths, &stats));
+	EXPECT_EQ(2u, stats.positions);
+}
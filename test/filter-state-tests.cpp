@@ -0,0 +1,77 @@
+#include "gtest/gtest.h"
+
+#include "linear-fst.h"
+#include "test-models.h"
+#include "tripoli.h"
+#include <memory>
+
+using namespace std;
+using namespace fst;
+
+typedef TripoliFilterState<2> FilterState;
+
+TEST(FilterStateTest, StartIsNotNoState) {
+	EXPECT_NE(FilterState(), FilterState::NoState());
+	EXPECT_EQ(FilterState::NoState(), FilterState::NoState());
+}
+
+TEST(FilterStateTest, EqualBackoffsHashEqual) {
+	FilterState a = FilterState().GenerateAddState(7, 1).GenerateAddLabel(3, 2);
+	FilterState b = FilterState().GenerateAddState(7, 1).GenerateAddLabel(3, 2);
+	FilterState c = FilterState().GenerateAddLabel(3, 2).GenerateAddState(8, 1);
+	EXPECT_EQ(a, b);
+	EXPECT_EQ(a.Hash(), b.Hash());
+	EXPECT_NE(a, c);
+	EXPECT_EQ(2u, a.Disallowed());
+}
+
+TEST(FilterStateTest, OverflowBecomesNoState) {
+	FilterState f = FilterState().GenerateAddState(1, 0).GenerateAddState(2, 0);
+	EXPECT_NE(FilterState::NoState(), f);
+	EXPECT_EQ(FilterState::NoState(), f.GenerateAddState(3, 0));
+}
+
+// With room for one lexical backoff, the small PDT's second backoff in a
+// row is dropped, and counted.
+TEST(FilterStateTest, OverflowingBackoffsAreDroppedAndCounted) {
+	typedef RuleArc<StdArc> Arc;
+	typedef VectorFst<Arc> Pdt;
+	typedef ParenMatcher<Pdt> Matcher;
+	Pdt pdt, input;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	input.AddState();
+	input.SetStart(0);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	TripoliComposeFilter<Matcher, Matcher, 1> filter(input, pdt, &info);
+
+	filter.SetState(0, 0, filter.Start());
+	Arc loop(0, kNoLabel, 0, 0), backoff(0, 0, 0, 1, LEXICAL_BACKOFF_ARC);
+	TripoliFilterState<1> bigram = filter.FilterArc(&loop, &backoff);
+	ASSERT_NE(TripoliFilterState<1>::NoState(), bigram);
+	filter.SetState(0, 1, bigram);
+	loop = Arc(0, kNoLabel, 0, 0);
+	backoff = Arc(0, 0, 0, 2, LEXICAL_BACKOFF_ARC);
+	EXPECT_EQ(TripoliFilterState<1>::NoState(), filter.FilterArc(&loop, &backoff));
+#if TRIPOLI_STATS
+	EXPECT_EQ(1u, filter.GetTables().stats.backoff_overflows);
+#endif
+	EXPECT_TRUE(filter.GetTables().overflow_logged);
+}
+
+// A grammar arc starts a new context, so the rules a backoff before it
+// disallowed no longer apply after it. In the small PDT, with weights, the
+// cheapest reading of a b backs off from the trigram state, reads a at
+// the bigram state and then b at the unigram state on rule 1, which the
+// trigram state's context disallowed before the a.
+TEST(FilterStateTest, GrammarArcsEndTheBackoffContext) {
+	unique_ptr<TripoliModel> model(ReadSmallGrammarModel(
+			"0 3 1 2 4\n0 3 2 1\n0 3 2 4\n0 1 0 -3\n"
+			"1 3 1 2\n1 2 0 -3\n"
+			"2 3 2 1 3\n2 3 2 1\n2 3 1 2\n"
+			"3 2 0 -1\n3\n"));
+	ASSERT_TRUE(model != 0);
+	// Kept across the a, the backoff's context would leave b only rule 3,
+	// at 1, or the trigram state's a, at 2
+	EXPECT_EQ(0, ExhaustiveCost(LinearFst<TripoliArc>(vector<Label>({1, 2})), *model));
+}
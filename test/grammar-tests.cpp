@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+
+#include "tripoli.h"
+
+using namespace std;
+using namespace fst;
+
+// Terminals 1-2, preterminals 3-4, nonterminals 5-7. 6 and 7 form a
+// left-corner cycle that only escapes through 7 -> _2.
+static Grammar CycleGrammar() {
+	vector<Rule> rules;
+	rules.push_back({1, 5, 3});
+	rules.push_back({2, 6, 7, 4});
+	rules.push_back({3, 7, 6, 3});
+	rules.push_back({4, 7, 4});
+	return Grammar(2, 4, 7, rules);
+}
+
+TEST(GrammarTest, PretermReachesItsTerm) {
+	Grammar g = CycleGrammar();
+	EXPECT_TRUE(g.SymbolCanReach(3, 1));
+	EXPECT_FALSE(g.SymbolCanReach(3, 2));
+}
+
+TEST(GrammarTest, ReachesThroughLeftCornerCycle) {
+	Grammar g = CycleGrammar();
+	EXPECT_TRUE(g.SymbolCanReach(5, 1));
+	EXPECT_FALSE(g.SymbolCanReach(5, 2));
+	EXPECT_TRUE(g.SymbolCanReach(6, 2));
+	EXPECT_TRUE(g.SymbolCanReach(7, 2));
+	EXPECT_FALSE(g.SymbolCanReach(6, 1));
+}
+
+TEST(GrammarTest, RejectsTermAsSource) {
+	Grammar g = CycleGrammar();
+	EXPECT_THROW(g.SymbolCanReach(1, 2), invalid_argument);
+}
+
+TEST(GrammarTest, RuleReachUsesRuleIds) {
+	Grammar g = CycleGrammar();
+	EXPECT_TRUE(g.RuleCanReach(1, 1));
+	EXPECT_FALSE(g.RuleCanReach(1, 2));
+	EXPECT_TRUE(g.RuleCanReach(4, 2));
+	EXPECT_THROW(g.RuleCanReach(5, 1), invalid_argument);
+}
+
+TEST(GrammarTest, BatchedRuleReachMatchesSingleQueries) {
+	Grammar g = CycleGrammar();
+	RuleId rules[] = {1, -3, 2, 3, 4, 1};
+	vector<BitMatrix::Word> mask;
+	g.RulesCanReach(2, rules, 6, &mask);
+	ASSERT_EQ(1u, mask.size());
+	EXPECT_EQ(0x1eu, mask[0]);
+
+	// An unknown rule, which RuleCanReach throws on, is rejected
+	RuleId unknown[] = {5, 2};
+	g.RulesCanReach(2, unknown, 2, &mask);
+	EXPECT_EQ(0x2u, mask[0]);
+}
@@ -0,0 +1,177 @@
+#include "gtest/gtest.h"
+
+#include "indexed-matcher.h"
+#include "model.h"
+#include <fst/vector-fst.h>
+
+using namespace std;
+using namespace fst;
+
+typedef IndexedMatcher<TripoliPdt> Matcher;
+
+// State 0 has the dense labels 0 (twice) and 1 to 99 and the parens 100
+// to 103; state 1 has the sparse labels 1000, 2000, ..., 100000 (the last
+// twice); state 2 has labels 5 and 7.
+static TripoliPdt *FanoutPdt() {
+	VectorFst<TripoliArc> pdt;
+	for (int i = 0; i < 3; ++i)
+		pdt.AddState();
+	pdt.SetStart(0);
+	pdt.SetFinal(2, 0);
+	pdt.AddArc(0, TripoliArc(0, 0, 0, 1));
+	pdt.AddArc(0, TripoliArc(0, 0, 0, 2));
+	for (int label = 1; label < 104; ++label)
+		pdt.AddArc(0, TripoliArc(label, label, 0, 2));
+	for (int label = 1000; label <= 100000; label += 1000)
+		pdt.AddArc(1, TripoliArc(label, label, 0, 2));
+	pdt.AddArc(1, TripoliArc(100000, 100000, 1, 0));
+	pdt.AddArc(2, TripoliArc(5, 5, 0, 2));
+	pdt.AddArc(2, TripoliArc(7, 7, 0, 2));
+	return new TripoliPdt(pdt);
+}
+
+// The labels of the arcs matched by finding label
+static vector<Label> Labels(Matcher *matcher, Label label) {
+	vector<Label> labels;
+	for (matcher->Find(label); !matcher->Done(); matcher->Next())
+		labels.push_back(matcher->Value().ilabel);
+	return labels;
+}
+
+TEST(LabelIndexTest, IndexesBusyStatesDirectlyOrByHash) {
+	unique_ptr<TripoliPdt> pdt(FanoutPdt());
+	LabelIndex index(*pdt, 50);
+	EXPECT_TRUE(index.Indexed(0));
+	EXPECT_TRUE(index.Indexed(1));
+	EXPECT_FALSE(index.Indexed(2));
+	ASSERT_EQ(2u, index.NumIndexed());
+	EXPECT_EQ(LabelIndex::DIRECT, index.Entries()[0].kind);
+	EXPECT_EQ(LabelIndex::HASHED, index.Entries()[1].kind);
+
+	// Every label agrees with a scan of the arcs, including labels not there
+	for (TripoliArc::StateId s = 0; s < 2; ++s) {
+		const TripoliArc *arcs = pdt->Arcs(s);
+		for (Label label = -1; label <= 101000; ++label) {
+			size_t begin, end;
+			ASSERT_TRUE(index.Find(s, label, &begin, &end));
+			size_t count = 0;
+			for (size_t i = 0; i < pdt->NumArcs(s); ++i)
+				count += arcs[i].ilabel == label;
+			ASSERT_EQ(count, end - begin) << "state " << s << " label " << label;
+			for (size_t i = begin; i < end; ++i)
+				EXPECT_EQ(label, arcs[i].ilabel);
+		}
+	}
+	size_t begin = 7, end = 7;
+	EXPECT_FALSE(index.Find(2, 5, &begin, &end));
+	EXPECT_EQ(7u, begin);
+}
+
+TEST(IndexedMatcherTest, MatchesAsASortedMatcher) {
+	unique_ptr<TripoliPdt> pdt(FanoutPdt());
+	LabelIndex index(*pdt, 50);
+	Matcher indexed(*pdt, MATCH_INPUT, &index), sorted(*pdt, MATCH_INPUT);
+	EXPECT_EQ(MATCH_INPUT, indexed.Type(false));
+	for (TripoliArc::StateId s = 0; s < 3; ++s) {
+		indexed.SetState(s);
+		sorted.SetState(s);
+		for (Label label = 1; label <= 100000; label += label < 200 ? 1 : 500) {
+			size_t count = 0;
+			for (size_t i = 0; i < pdt->NumArcs(s); ++i)
+				count += pdt->Arcs(s)[i].ilabel == label;
+			EXPECT_EQ(count, Labels(&indexed, label).size());
+			EXPECT_EQ(Labels(&sorted, label), Labels(&indexed, label));
+		}
+	}
+	indexed.SetState(1);
+	ASSERT_TRUE(indexed.Find(100000));
+	EXPECT_EQ(2, indexed.Value().nextstate);
+	indexed.Next();
+	EXPECT_EQ(0, indexed.Value().nextstate);
+	indexed.Next();
+	EXPECT_TRUE(indexed.Done());
+}
+
+TEST(IndexedMatcherTest, LoopsOnParensAndListsThemForNoLabel) {
+	unique_ptr<TripoliPdt> pdt(FanoutPdt());
+	LabelIndex index(*pdt, 50);
+	Matcher matcher(*pdt, MATCH_INPUT, &index);
+	matcher.AddOpenParen(100);
+	matcher.AddCloseParen(101);
+	matcher.AddOpenParen(103);
+	matcher.AddCloseParen(104);
+	matcher.SetState(0);
+
+	// A paren finds only the loop, which stays in the state
+	ASSERT_TRUE(matcher.Find(100));
+	EXPECT_EQ(kNoLabel, matcher.Value().ilabel);
+	EXPECT_EQ(0, matcher.Value().olabel);
+	EXPECT_EQ(0, matcher.Value().nextstate);
+	matcher.Next();
+	EXPECT_TRUE(matcher.Done());
+
+	// Epsilon finds the loop and then the epsilon arcs
+	EXPECT_EQ(vector<Label>({kNoLabel, 0, 0}), Labels(&matcher, 0));
+
+	// No label finds the epsilon arcs and then the parens, but not label 102
+	EXPECT_EQ(vector<Label>({0, 0, 100, 101, 103}), Labels(&matcher, kNoLabel));
+
+	matcher.SetState(2);
+	EXPECT_TRUE(Labels(&matcher, kNoLabel).empty());
+	EXPECT_TRUE(Labels(&matcher, 6).empty());
+	EXPECT_EQ(vector<Label>({7}), Labels(&matcher, 7));
+
+	// Copies keep the parens
+	unique_ptr<Matcher> copy(matcher.Copy());
+	copy->SetState(0);
+	EXPECT_EQ(vector<Label>({kNoLabel}), Labels(copy.get(), 103));
+}
+
+// Accepts the arcs whose next state is label % 3
+class ModPrefilter : public ArcPrefilter {
+public:
+	ModPrefilter(const TripoliPdt &pdt) : pdt_(pdt), calls(0) {}
+
+	virtual void AcceptArcs(int64_t s, int64_t label, size_t begin, size_t end, vector<uint64_t> *mask) {
+		++calls;
+		mask->assign((end - begin + 63) / 64, 0);
+		for (size_t i = begin; i < end; ++i) {
+			if (pdt_.Arcs(s)[i].nextstate == label % 3)
+				(*mask)[(i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64);
+		}
+	}
+
+	const TripoliPdt &pdt_;
+	int calls;
+};
+
+TEST(IndexedMatcherTest, PrefilterDropsRejectedArcs) {
+	// 20 arcs labelled 4 with next states 0, 1, 2, 0, 1, 2, ...; 3 labelled 5
+	VectorFst<TripoliArc> fst;
+	for (int i = 0; i < 3; ++i)
+		fst.AddState();
+	fst.SetStart(0);
+	for (int i = 0; i < 20; ++i)
+		fst.AddArc(0, TripoliArc(4, 4, 0, i % 3));
+	for (int i = 0; i < 3; ++i)
+		fst.AddArc(0, TripoliArc(5, 5, 0, i));
+	TripoliPdt pdt(fst);
+	ModPrefilter prefilter(pdt);
+	Matcher matcher(pdt, MATCH_INPUT);
+	matcher.SetPrefilter(&prefilter);
+	matcher.SetState(0);
+
+	size_t n = 0;
+	for (matcher.Find(4); !matcher.Done(); matcher.Next(), ++n)
+		EXPECT_EQ(1, matcher.Value().nextstate);
+	EXPECT_EQ(7u, n);
+	EXPECT_EQ(1, prefilter.calls);
+
+	// Short runs are not worth a batch
+	EXPECT_EQ(3u, Labels(&matcher, 5).size());
+	EXPECT_EQ(1, prefilter.calls);
+
+	unique_ptr<Matcher> copy(matcher.Copy());
+	copy->SetState(0);
+	EXPECT_EQ(20u, Labels(copy.get(), 4).size());
+}
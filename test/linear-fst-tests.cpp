@@ -0,0 +1,224 @@
+#include "gtest/gtest.h"
+
+#include "batch.h"
+#include "linear-fst.h"
+#include "synthetic.h"
+#include "test-models.h"
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace fst;
+
+typedef LinearFst<TripoliArc> Linear;
+typedef LinearMatcher<Linear> Matcher;
+
+// The labels of the arcs matched by finding label
+static vector<Label> Labels(Matcher *matcher, Label label) {
+	vector<Label> labels;
+	for (matcher->Find(label); !matcher->Done(); matcher->Next())
+		labels.push_back(matcher->Value().olabel);
+	return labels;
+}
+
+TEST(LinearFstTest, IsAChainOfItsLabels) {
+	Linear fst(vector<Label>({3, 0, 5}));
+	EXPECT_EQ(0, fst.Start());
+	EXPECT_EQ(4, fst.NumStates());
+	EXPECT_EQ(TripoliArc::Weight::One(), fst.Final(3));
+	EXPECT_EQ(TripoliArc::Weight::Zero(), fst.Final(2));
+	EXPECT_EQ(12u, fst.SizeInBytes());
+	EXPECT_EQ(1u, fst.NumInputEpsilons(1));
+	EXPECT_EQ(0u, fst.NumInputEpsilons(2));
+	EXPECT_EQ(0u, fst.NumArcs(3));
+	EXPECT_EQ(kAcceptor | kString | kAcyclic | kTopSorted | kILabelSorted | kEpsilons | kUnweighted,
+			fst.Properties(kAcceptor | kString | kAcyclic | kTopSorted | kILabelSorted | kEpsilons |
+					kUnweighted, false));
+
+	vector<Label> labels;
+	TripoliArc::StateId s = fst.Start();
+	for (StateIterator<Linear> siter(fst); !siter.Done(); siter.Next()) {
+		for (ArcIterator<Linear> aiter(fst, siter.Value()); !aiter.Done(); aiter.Next()) {
+			EXPECT_EQ(s + 1, aiter.Value().nextstate);
+			labels.push_back(aiter.Value().ilabel);
+			s = aiter.Value().nextstate;
+		}
+	}
+	EXPECT_EQ(vector<Label>({3, 0, 5}), labels);
+
+	// The generic iterators, as through an Fst pointer, agree
+	const Fst<TripoliArc> &base = fst;
+	ArcIterator<Fst<TripoliArc> > aiter(base, 2);
+	ASSERT_FALSE(aiter.Done());
+	EXPECT_EQ(5, aiter.Value().olabel);
+	aiter.Next();
+	EXPECT_TRUE(aiter.Done());
+
+	// A view of a buffer, with weights
+	const Label buffer[] = {7, 8};
+	vector<TripoliArc::Weight> weights = {1, 2};
+	Linear view(FlatArray<Label>(buffer, 2), FlatArray<TripoliArc::Weight>(weights), 0.5);
+	EXPECT_EQ(&buffer[0], &view.Labels()[0]);
+	EXPECT_EQ(2, ArcIterator<Linear>(view, 1).Value().weight.Value());
+	EXPECT_EQ(0.5, view.Final(2).Value());
+	EXPECT_TRUE(view.Properties(kWeighted | kNoEpsilons, false) == (kWeighted | kNoEpsilons));
+	unique_ptr<Linear> copy(view.Copy());
+	EXPECT_EQ(3, copy->NumStates());
+}
+
+TEST(LinearMatcherTest, FindsTheOneArcOrLoopsOnParens) {
+	Linear fst(vector<Label>({4, 0, 100}));
+	Matcher matcher(fst, MATCH_OUTPUT);
+	matcher.AddOpenParen(100);
+	matcher.AddCloseParen(101);
+	EXPECT_EQ(MATCH_OUTPUT, matcher.Type(false));
+
+	matcher.SetState(0);
+	EXPECT_EQ(1, matcher.Priority(0));
+	EXPECT_EQ(vector<Label>({4}), Labels(&matcher, 4));
+	EXPECT_TRUE(Labels(&matcher, 5).empty());
+	EXPECT_TRUE(Labels(&matcher, kNoLabel).empty());
+	// Epsilon finds only the loop, which stays in the state
+	ASSERT_TRUE(matcher.Find(0));
+	EXPECT_EQ(0, matcher.Value().ilabel);
+	EXPECT_EQ(kNoLabel, matcher.Value().olabel);
+	EXPECT_EQ(0, matcher.Value().nextstate);
+	matcher.Next();
+	EXPECT_TRUE(matcher.Done());
+	// A paren finds only the loop
+	EXPECT_EQ(vector<Label>({kNoLabel}), Labels(&matcher, 101));
+
+	// Epsilon finds the loop and then the epsilon arc, as does no label
+	matcher.SetState(1);
+	EXPECT_EQ(vector<Label>({kNoLabel, 0}), Labels(&matcher, 0));
+	EXPECT_EQ(vector<Label>({0}), Labels(&matcher, kNoLabel));
+
+	// No label lists a paren arc
+	matcher.SetState(2);
+	EXPECT_EQ(vector<Label>({100}), Labels(&matcher, kNoLabel));
+
+	// The final state has only the loop
+	matcher.SetState(3);
+	EXPECT_EQ(0, matcher.Priority(3));
+	EXPECT_EQ(vector<Label>({kNoLabel}), Labels(&matcher, 0));
+	EXPECT_TRUE(Labels(&matcher, 4).empty());
+
+	// Copies keep the parens
+	unique_ptr<Matcher> copy(matcher.Copy());
+	copy->SetState(0);
+	EXPECT_EQ(vector<Label>({kNoLabel}), Labels(copy.get(), 100));
+}
+
+TEST(LinearFstTest, CompilesLinearTextAndFallsBackOtherwise) {
+	string text = "0 1 4\n1 2 7 1.5\n\n2\n";
+	unique_ptr<Linear> linear(CompileLinearInput(text.data(), text.size(), "input"));
+	ASSERT_TRUE(linear != 0);
+	EXPECT_EQ(3, linear->NumStates());
+	EXPECT_EQ(7, linear->Labels()[1]);
+	EXPECT_EQ(1.5, linear->ArcWeight(1).Value());
+	EXPECT_EQ(TripoliArc::Weight::One(), linear->Final(2));
+	unique_ptr<Fst<TripoliArc> > input(CompileInput(text, "input"));
+	EXPECT_EQ("linear", input->Type());
+
+	// A final weight, and an empty input
+	string final_weight = "0 1 4\n1 2\n";
+	linear.reset(CompileLinearInput(final_weight.data(), final_weight.size(), "input"));
+	ASSERT_TRUE(linear != 0);
+	EXPECT_EQ(2, linear->Final(1).Value());
+	string empty = "0\n";
+	linear.reset(CompileLinearInput(empty.data(), empty.size(), "input"));
+	ASSERT_TRUE(linear != 0);
+	EXPECT_EQ(1, linear->NumStates());
+
+	// Branches, renumbered states, negative labels, no final state and
+	// arcs after the final state are not linear
+	for (string other : {"0 1 4\n0 1 5\n1\n", "0 2 4\n2\n", "0 1 -4\n1\n", "0 1 4\n",
+			"0 1 4\n1\n1 2 5\n", "0 1 4 x\n1\n"}) {
+		EXPECT_TRUE(CompileLinearInput(other.data(), other.size(), "input") == 0) << other;
+	}
+	input.reset(CompileInput("0 1 4\n0 1 5\n1\n", "input"));
+	ASSERT_TRUE(input != 0);
+	EXPECT_EQ("vector", input->Type());
+}
+
+TEST(LinearFstTest, MapsTokensThroughArcLabels) {
+	string filename = "/tmp/tripoli-linear-test-" + to_string(getpid());
+	ofstream(filename.c_str()) << "0 <epsilon>\n1 the\n2 cat\n4 sat\n";
+	TokenLabels labels;
+	ASSERT_TRUE(ReadTokenLabels(filename, &labels));
+	remove(filename.c_str());
+	EXPECT_EQ(4u, labels.size());
+	EXPECT_EQ(4, labels["sat"]);
+
+	istringstream tokens("the cat\n\tsat  the\r\n");
+	unique_ptr<Linear> input(TokensToLinearFst(tokens, labels, "tokens"));
+	ASSERT_TRUE(input != 0);
+	EXPECT_EQ(vector<Label>({1, 2, 4, 1}),
+			vector<Label>(&input->Labels()[0], &input->Labels()[0] + input->Labels().size()));
+	EXPECT_EQ(TripoliArc::Weight::One(), input->Final(4));
+
+	istringstream unknown("the dog");
+	EXPECT_TRUE(TokensToLinearFst(unknown, labels, "tokens") == 0);
+	EXPECT_FALSE(ReadTokenLabels(filename, &labels));
+}
+
+// The composition of text with model as a LinearFst, through
+// TripoliComposeInput, and as a VectorFst with a ParenMatcher, written out
+// as text
+static void ComposeBothWays(const string &text, const TripoliModel &model, string *linear_machine,
+		string *vector_machine) {
+	unique_ptr<Linear> linear(CompileLinearInput(text.data(), text.size(), "input"));
+	ASSERT_TRUE(linear != 0);
+	istringstream strm(text);
+	unique_ptr<VectorFst<TripoliArc> > input(CompileInputFst(strm, "input"));
+	ASSERT_TRUE(input != 0);
+	unique_ptr<ComposeFst<TripoliArc> > by_linear(TripoliComposeInput(*linear, model));
+	unique_ptr<ComposeFst<TripoliArc> > by_vector(
+			TripoliCompose<ParenMatcher<VectorFst<TripoliArc> > >(*input, model));
+	ostringstream x, y;
+	ASSERT_TRUE(WriteOutput(*by_linear, OUTPUT_TEXT, x, "linear"));
+	ASSERT_TRUE(WriteOutput(*by_vector, OUTPUT_TEXT, y, "vector"));
+	*linear_machine = x.str();
+	*vector_machine = y.str();
+}
+
+TEST(LinearFstTest, ComposesAsAVectorFstDoes) {
+	unique_ptr<TripoliModel> small(ReadSmallModel());
+	ASSERT_TRUE(small != 0);
+	for (string text : {"0 1 1\n1 2 2\n2\n", "0 1 2\n1 2 2\n2 3 1\n3\n", "0\n"}) {
+		string linear_machine, vector_machine;
+		ComposeBothWays(text, *small, &linear_machine, &vector_machine);
+		EXPECT_FALSE(linear_machine.empty()) << text;
+		EXPECT_EQ(vector_machine, linear_machine) << text;
+	}
+
+	SyntheticOptions opts;
+	opts.terminals = 20;
+	opts.nonterminals = 8;
+	opts.rules = 60;
+	opts.fanout = 4;
+	SyntheticModel synthetic(opts);
+	unique_ptr<TripoliModel> model(ReadSyntheticModel(synthetic));
+	ASSERT_TRUE(model != 0);
+	for (unsigned seed = 1; seed <= 5; ++seed) {
+		ostringstream text;
+		synthetic.WriteInput(2 * seed, seed, text);
+		string linear_machine, vector_machine;
+		ComposeBothWays(text.str(), *model, &linear_machine, &vector_machine);
+		// Parens, labelled after the terminals, open from the unigram state
+		istringstream lines(linear_machine);
+		bool parens = false;
+		for (TripoliArc::StateId src, dst; lines >> src >> dst;) {
+			Label ilabel, olabel;
+			string weight;
+			lines >> ilabel >> olabel >> weight;
+			parens |= olabel > opts.terminals;
+		}
+		EXPECT_TRUE(parens) << text.str();
+		EXPECT_EQ(vector_machine, linear_machine) << text.str();
+	}
+}
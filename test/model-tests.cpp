@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+
+#include "model.h"
+#include "test-models.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+using namespace fst;
+
+TEST(ModelTest, WriteThenOpenRoundTrips) {
+	unique_ptr<TripoliModel> text(ReadSmallModel());
+	string filename = TempName("model.tpm");
+	ASSERT_TRUE(text->Write(filename));
+	unique_ptr<TripoliModel> mapped(TripoliModel::Open(filename));
+	ASSERT_TRUE(mapped != 0);
+
+	const TripoliPdt &a = text->GetPdt(), &b = mapped->GetPdt();
+	EXPECT_EQ(a.Start(), b.Start());
+	ASSERT_EQ(a.NumStates(), b.NumStates());
+	for (TripoliArc::StateId s = 0; s < a.NumStates(); ++s) {
+		EXPECT_EQ(a.Final(s), b.Final(s));
+		ASSERT_EQ(a.NumArcs(s), b.NumArcs(s));
+		for (size_t i = 0; i < a.NumArcs(s); ++i) {
+			EXPECT_EQ(a.Arcs(s)[i].ilabel, b.Arcs(s)[i].ilabel);
+			EXPECT_EQ(a.Arcs(s)[i].nextstate, b.Arcs(s)[i].nextstate);
+			EXPECT_EQ(a.Arcs(s)[i].rule, b.Arcs(s)[i].rule);
+		}
+		Span<RuleId> x = text->GetPDTInfo().GetContextRuleSet(s);
+		Span<RuleId> y = mapped->GetPDTInfo().GetContextRuleSet(s);
+		EXPECT_EQ(vector<RuleId>(x.begin(), x.end()), vector<RuleId>(y.begin(), y.end()));
+		// every state of the small PDT reaches its final state for free
+		EXPECT_EQ(0, mapped->GetFutureCosts()[s]);
+	}
+	EXPECT_EQ(size_t(a.NumStates()), mapped->GetFutureCosts().size());
+	// no state of the small PDT has enough arcs to be indexed
+	EXPECT_EQ(size_t(a.NumStates()), mapped->GetLabelIndex().States().size());
+	EXPECT_EQ(0u, mapped->GetLabelIndex().NumIndexed());
+	ASSERT_EQ(text->GetPDTInfo().NumBackoffChains(), mapped->GetPDTInfo().NumBackoffChains());
+	for (TripoliArc::StateId s = 0; s < a.NumStates(); ++s)
+		EXPECT_EQ(text->GetPDTInfo().NextBackoffChain(0, s), mapped->GetPDTInfo().NextBackoffChain(0, s));
+
+	const Grammar &g = mapped->GetGrammar();
+	EXPECT_EQ(text->GetGrammar().MaxNonterm(), g.MaxNonterm());
+	for (Symbol term = 1; term <= g.MaxTerm(); ++term) {
+		for (Symbol nonterm = g.MaxPreterm() + 1; nonterm < g.MaxNonterm(); ++nonterm)
+			EXPECT_EQ(text->GetGrammar().SymbolCanReach(nonterm, term), g.SymbolCanReach(nonterm, term));
+		for (RuleId r = 1; r <= 4; ++r)
+			EXPECT_EQ(text->GetGrammar().RuleCanReach(r, term), g.RuleCanReach(r, term));
+	}
+	EXPECT_EQ(g.LabelToSymbol(3), 5);
+	ASSERT_EQ(1u, mapped->GetParens().size());
+	EXPECT_EQ(ParenPair(3, 4), mapped->GetParens()[0]);
+	remove(filename.c_str());
+}
+
+TEST(ModelTest, PdtViewsShareArcs) {
+	unique_ptr<TripoliModel> model(ReadSmallModel());
+	unique_ptr<TripoliPdt> view(model->NewPdtView());
+	EXPECT_NE(&model->GetPdt(), view.get());
+	EXPECT_EQ(model->GetPdt().Start(), view->Start());
+	ASSERT_EQ(model->GetPdt().NumStates(), view->NumStates());
+	for (TripoliArc::StateId s = 0; s < view->NumStates(); ++s)
+		EXPECT_EQ(model->GetPdt().Arcs(s), view->Arcs(s));
+}
+
+// Copies the model file from to to, with the value at index i of section
+// id changed to value.
+template <class T>
+static void CorruptSection(const string &from, const string &to, ModelSection id, size_t i,
+		const T &value) {
+	ifstream in(from.c_str(), ios::binary);
+	string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	const ModelHeader *header = reinterpret_cast<const ModelHeader *>(bytes.data());
+	const ModelSectionEntry *table =
+			reinterpret_cast<const ModelSectionEntry *>(bytes.data() + sizeof(ModelHeader));
+	for (uint32 s = 0; s < header->nsections; ++s) {
+		if (table[s].id == uint32(id)) {
+			ASSERT_LT((i + 1) * sizeof(T), table[s].size + 1);
+			memcpy(&bytes[table[s].offset + i * sizeof(T)], &value, sizeof(T));
+		}
+	}
+	ofstream(to.c_str(), ios::binary) << bytes;
+}
+
+TEST(ModelTest, OpenRejectsSectionsThatDoNotAgree) {
+	unique_ptr<TripoliModel> text(ReadSmallModel());
+	string filename = TempName("model.tpm"), corrupt = TempName("corrupt.tpm");
+	ASSERT_TRUE(text->Write(filename));
+
+	// An arc to a state past the PDT
+	TripoliArc arc = text->GetPdt().AllArcs()[0];
+	arc.nextstate = text->GetPdt().NumStates();
+	CorruptSection(filename, corrupt, MODEL_PDT_ARCS, 0, arc);
+	EXPECT_TRUE(TripoliModel::Open(corrupt) == 0);
+	// A rule past the grammar's
+	CorruptSection(filename, corrupt, MODEL_ARC_RULES, 0, RuleId(5));
+	EXPECT_TRUE(TripoliModel::Open(corrupt) == 0);
+	// PDT and context offsets that go backwards
+	CorruptSection(filename, corrupt, MODEL_PDT_OFFSETS, 1, uint64(5));
+	EXPECT_TRUE(TripoliModel::Open(corrupt) == 0);
+	CorruptSection(filename, corrupt, MODEL_CONTEXT_OFFSETS, 1, uint64(100));
+	EXPECT_TRUE(TripoliModel::Open(corrupt) == 0);
+	// Unigram rules that end past their section
+	size_t nunigram = text->GetPDTInfo().GetIndex().unigram_offsets.size();
+	CorruptSection(filename, corrupt, MODEL_UNIGRAM_OFFSETS, nunigram - 1, uint64(100));
+	EXPECT_TRUE(TripoliModel::Open(corrupt) == 0);
+
+	// The same bytes unchanged still open
+	CorruptSection(filename, corrupt, MODEL_PDT_ARCS, 0, text->GetPdt().AllArcs()[0]);
+	unique_ptr<TripoliModel> same(TripoliModel::Open(corrupt));
+	EXPECT_TRUE(same != 0);
+	remove(filename.c_str());
+	remove(corrupt.c_str());
+}
+
+TEST(ModelTest, OpenRejectsOtherFiles) {
+	string filename = WriteFile(TempName("not-a-model"), "0 1 2 3\n");
+	EXPECT_TRUE(TripoliModel::Open(filename) == 0);
+	EXPECT_TRUE(TripoliModel::Open(TempName("missing")) == 0);
+	remove(filename.c_str());
+}
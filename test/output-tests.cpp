@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+
+#include "output.h"
+#include <limits>
+#include <sstream>
+
+using namespace std;
+using namespace fst;
+
+TEST(OutputTest, ParsesFormats) {
+	OutputFormat format;
+	ASSERT_TRUE(ParseOutputFormat("compact", &format));
+	EXPECT_EQ(OUTPUT_COMPACT, format);
+	ASSERT_TRUE(ParseOutputFormat("text", &format));
+	EXPECT_EQ(OUTPUT_TEXT, format);
+	ASSERT_TRUE(ParseOutputFormat("const", &format));
+	EXPECT_EQ(OUTPUT_CONST, format);
+	EXPECT_FALSE(ParseOutputFormat("vector", &format));
+}
+
+TEST(OutputTest, RuleArcsHaveTheirOwnType) {
+	EXPECT_EQ("rule_" + StdArc::Type(), TripoliArc::Type());
+}
+
+TEST(OutputTest, CompactorKeepsRules) {
+	RuleArcCompactor<TripoliArc> compactor;
+	TripoliArc arc(0, 7, 1.5, 3, -4);
+	TripoliArc expanded = compactor.Expand(2, compactor.Compact(2, arc));
+	EXPECT_EQ(0, expanded.ilabel);
+	EXPECT_EQ(7, expanded.olabel);
+	EXPECT_EQ(1.5, expanded.weight.Value());
+	EXPECT_EQ(3, expanded.nextstate);
+	EXPECT_EQ(-4, expanded.rule);
+
+	// CompactFst stores a final weight as an element with no next state
+	TripoliArc final(kNoLabel, kNoLabel, 0.25, kNoStateId, DUMMY_ARC);
+	expanded = compactor.Expand(2, compactor.Compact(2, final));
+	EXPECT_EQ(kNoLabel, expanded.ilabel);
+	EXPECT_EQ(kNoStateId, expanded.nextstate);
+	EXPECT_EQ(0.25, expanded.weight.Value());
+}
+
+TEST(OutputTest, BufferedWriterFormatsLikeOstream) {
+	ostringstream out;
+	{
+		BufferedWriter writer(&out, 64);  // smaller than what is written
+		for (int i = 0; i < 20; ++i) {
+			writer.WriteInt(-1234567 + i);
+			writer.Put(' ');
+		}
+		writer.WriteInt(numeric_limits<int64_t>::min());
+		writer.Put(' ');
+		writer.WriteFloat(0.1f);
+		writer.Put(' ');
+		writer.WriteFloat(3.0f);
+		writer.Put(' ');
+		writer.Write(string(100, 'x').c_str());
+	}
+	ostringstream expected;
+	for (int i = 0; i < 20; ++i)
+		expected << -1234567 + i << ' ';
+	expected << numeric_limits<int64_t>::min() << ' ' << 0.1f << ' ' << 3.0f << ' ' << string(100, 'x');
+	EXPECT_EQ(expected.str(), out.str());
+}
@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include "test-models.h"
+#include "tripoli.h"
+#include <fst/vector-fst.h>
+
+using namespace std;
+using namespace fst;
+
+typedef RuleArc<StdArc> Arc;
+typedef VectorFst<Arc> Pdt;
+typedef ParenMatcher<Pdt> Matcher;
+typedef TripoliParenFilter<Matcher, Matcher> Filter;
+
+// The small PDT of test-models.h, with a (7, 8) paren pair from the
+// unigram state.
+static void SmallParenPdt(Pdt *pdt, vector<StateInfo> *states) {
+	SmallPdt(pdt, states);
+	pdt->AddArc(2, Arc(7, 7, 0, 2, PORTAL_ARC));
+	pdt->AddArc(2, Arc(8, 8, 0, 3, PORTAL_ARC));
+	pdt->SetFinal(3, 0);
+}
+
+// The input side's loop for a paren on the PDT side
+static Arc Loop() {
+	return Arc(0, kNoLabel, 0, 0);
+}
+
+TEST(ParenFilterTest, KeepsTheStackInTheFilterState) {
+	Pdt pdt, input;
+	vector<StateInfo> states;
+	SmallParenPdt(&pdt, &states);
+	input.AddState();
+	input.SetStart(0);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	vector<pair<Label, Label> > parens = {make_pair(7, 8), make_pair(9, 10)};
+	Filter filter(input, pdt, &info, Span<pair<Label, Label> >(parens.data(), parens.size()));
+
+	Filter::FilterState start = filter.Start();
+	EXPECT_EQ(0, start.GetState2().GetState());
+	filter.SetState(0, 2, start);
+
+	Arc loop = Loop(), close(8, 8, 0, 3, PORTAL_ARC);
+	EXPECT_EQ(Filter::FilterState::NoState(), filter.FilterArc(&loop, &close));
+
+	loop = Loop();
+	Arc open(7, 7, 0, 2, PORTAL_ARC);
+	Filter::FilterState pushed = filter.FilterArc(&loop, &open);
+	ASSERT_NE(Filter::FilterState::NoState(), pushed);
+	EXPECT_NE(0, pushed.GetState2().GetState());
+	EXPECT_EQ(7, loop.ilabel);  // the paren is kept on the input side
+
+	// Open parens make a final state non-final
+	filter.SetState(0, 2, pushed);
+	Arc::Weight final1 = Arc::Weight::One(), final2 = Arc::Weight::One();
+	filter.FilterFinal(&final1, &final2);
+	EXPECT_EQ(Arc::Weight::Zero(), final1);
+
+	loop = Loop();
+	Arc other_close(10, 10, 0, 3, PORTAL_ARC);
+	EXPECT_EQ(Filter::FilterState::NoState(), filter.FilterArc(&loop, &other_close));
+	loop = Loop();
+	close = Arc(8, 8, 0, 3, PORTAL_ARC);
+	EXPECT_EQ(start, filter.FilterArc(&loop, &close));
+
+	// A plain arc keeps the stack, and still goes through the rule filter
+	Arc word(2, 2, 0, 3, 3), term(2, 2, 0, 0);
+	Filter::FilterState f = filter.FilterArc(&term, &word);
+	EXPECT_EQ(pushed.GetState2(), f.GetState2());
+}
+
+TEST(ParenFilterTest, BackoffsFollowPrecomputedChains) {
+	Pdt pdt, input;
+	vector<StateInfo> states;
+	SmallParenPdt(&pdt, &states);
+	input.AddState();
+	input.SetStart(0);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	vector<pair<Label, Label> > parens = {make_pair(7, 8)};
+	Filter filter(input, pdt, &info, Span<pair<Label, Label> >(parens.data(), parens.size()));
+
+	filter.SetState(0, 0, filter.Start());
+	Arc loop = Loop(), backoff(0, 0, 0, 1, LEXICAL_BACKOFF_ARC);
+	Filter::FilterState trigram = filter.FilterArc(&loop, &backoff);
+	EXPECT_EQ(info.NextBackoffChain(0, 0), trigram.GetState1().Chain());
+	filter.SetState(0, 1, trigram);
+	loop = Loop();
+	backoff = Arc(0, 0, 0, 2, LEXICAL_BACKOFF_ARC);
+	Filter::FilterState bigram = filter.FilterArc(&loop, &backoff);
+	ASSERT_NE(kNoBackoffChain, bigram.GetState1().Chain());
+	EXPECT_EQ(info.NextBackoffChain(trigram.GetState1().Chain(), 1), bigram.GetState1().Chain());
+
+	// Rules seen at either state are disallowed at the unigram state
+	filter.SetState(0, 2, bigram);
+	Arc seen(2, 2, 0, 3, 4), unseen(2, 2, 0, 3, 3);
+	loop = Loop();
+	EXPECT_EQ(Filter::FilterState::NoState(), filter.FilterArc(&loop, &seen));
+	loop = Loop();
+	EXPECT_NE(Filter::FilterState::NoState(), filter.FilterArc(&loop, &unseen));
+
+	// Off the chain, as after a dummy arc, the rules are still unioned
+	filter.SetState(0, 0, trigram);
+	loop = Loop();
+	backoff = Arc(0, 0, 0, 1, LEXICAL_BACKOFF_ARC);
+	Filter::FilterState again = filter.FilterArc(&loop, &backoff);
+	EXPECT_EQ(kNoBackoffChain, again.GetState1().Chain());
+	filter.SetState(0, 2, again);
+	loop = Loop();
+	seen = Arc(2, 2, 0, 3, 4);
+	EXPECT_EQ(Filter::FilterState::NoState(), filter.FilterArc(&loop, &seen));
+
+#if TRIPOLI_STATS
+	const ComposeStats &stats = filter.GetTables().stats;
+	EXPECT_EQ(6u, stats.filter_arcs);
+	EXPECT_EQ(3u, stats.lexical_backoffs);
+	EXPECT_EQ(2u, stats.chain_backoffs);
+	EXPECT_EQ(2u, stats.rejected_disallowed);
+	EXPECT_EQ(0u, stats.rejected_reach);
+#endif
+}
+
+TEST(ParenFilterTest, BatchedRuleChecksAgreeWithFilterArc) {
+	Pdt pdt, input;
+	vector<StateInfo> states;
+	SmallParenPdt(&pdt, &states);
+	pdt.AddArc(2, Arc(2, 2, 0, 3, 4));
+	pdt.AddArc(2, Arc(1, 1, 0, 3, 1));
+	pdt.AddArc(2, Arc(1, 1, 0, 3, 2));  // disallowed after backing off from state 1
+	input.AddState();
+	input.SetStart(0);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	TripoliComposeFilter<Matcher, Matcher> filter(input, pdt, &info);
+
+	filter.SetState(0, 1, filter.Start());
+	Arc loop = Loop(), backoff(0, 0, 0, 2, LEXICAL_BACKOFF_ARC);
+	TripoliFilterState<> backed_off = filter.FilterArc(&loop, &backoff);
+	for (Label term = 1; term <= 2; ++term) {
+		for (const TripoliFilterState<> &f : {filter.Start(), backed_off}) {
+			filter.SetState(0, 2, f);
+			vector<uint64_t> mask;
+			filter.AcceptArcs(2, term, 0, pdt.NumArcs(2), &mask);
+			size_t i = 0;
+			for (ArcIterator<Pdt> aiter(pdt, 2); !aiter.Done(); aiter.Next(), ++i) {
+				Arc input_arc(term, term, 0, 0), arc = aiter.Value();
+				bool accepted = filter.FilterArc(&input_arc, &arc) != TripoliFilterState<>::NoState();
+				EXPECT_EQ(accepted, bool((mask[i / 64] >> (i % 64)) & 1)) << "arc " << i << " term " << term;
+			}
+		}
+	}
+}
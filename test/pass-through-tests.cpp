@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+
+#include "pass-through.h"
+#include <fst/vector-fst.h>
+
+using namespace std;
+using namespace fst;
+
+typedef RuleArc<StdArc> Arc;
+typedef VectorFst<Arc> Pdt;
+
+static const StateInfo kTrigram = {TRIGRAM_STATE, -2, -2};
+static const StateInfo kUnigram = {UNIGRAM_STATE, -1, -1};
+static const StateInfo kDummy = {DUMMY_STATE, -1, -1};
+static const StateInfo kPortal = {PORTAL_STATE, -1, -1};
+
+static vector<Arc> Arcs(const Pdt &pdt, Arc::StateId s) {
+	vector<Arc> arcs;
+	for (ArcIterator<Pdt> aiter(pdt, s); !aiter.Done(); aiter.Next())
+		arcs.push_back(aiter.Value());
+	return arcs;
+}
+
+// Start trigram state 0 reads 1 by rule 4 into dummy state 1, which leads
+// on through dummy state 2 to unigram state 3.
+static void ChainPdt(Pdt *pdt, vector<StateInfo> *states) {
+	for (int i = 0; i < 4; ++i)
+		pdt->AddState();
+	pdt->SetStart(0);
+	pdt->AddArc(0, Arc(1, 1, 0.5, 1, 4));
+	pdt->AddArc(0, Arc(0, 0, 0, 3, LEXICAL_BACKOFF_ARC));
+	pdt->AddArc(1, Arc(0, 0, 0.25, 2, DUMMY_ARC));
+	pdt->AddArc(2, Arc(0, 0, 1, 3, PORTAL_ARC));
+	pdt->AddArc(3, Arc(2, 2, 0, 1, 3));
+	pdt->SetFinal(3, 0);
+	*states = {kTrigram, kDummy, kPortal, kUnigram};
+}
+
+TEST(PassThroughTest, BypassesChainsAndRenumbers) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	ChainPdt(&pdt, &states);
+	PassThroughStats stats;
+	BypassPassThroughStates(&pdt, &states, PassThroughOptions(), &stats);
+
+	EXPECT_EQ(2u, stats.states);
+	EXPECT_EQ(2u, stats.arcs);
+	ASSERT_EQ(2, pdt.NumStates());
+	EXPECT_EQ(0, pdt.Start());
+	ASSERT_EQ(2u, states.size());
+	EXPECT_EQ(TRIGRAM_STATE, states[0].tag);
+	EXPECT_EQ(UNIGRAM_STATE, states[1].tag);
+
+	vector<Arc> arcs = Arcs(pdt, 0);
+	ASSERT_EQ(2u, arcs.size());
+	// The arc keeps its labels and rule, and takes on the chain's weights
+	EXPECT_EQ(1, arcs[0].ilabel);
+	EXPECT_EQ(1, arcs[0].olabel);
+	EXPECT_EQ(4, arcs[0].rule);
+	EXPECT_EQ(1, arcs[0].nextstate);
+	EXPECT_FLOAT_EQ(1.75, arcs[0].weight.Value());
+	EXPECT_EQ(LEXICAL_BACKOFF_ARC, arcs[1].rule);
+	EXPECT_EQ(1, arcs[1].nextstate);
+
+	arcs = Arcs(pdt, 1);
+	ASSERT_EQ(1u, arcs.size());
+	EXPECT_EQ(3, arcs[0].rule);
+	EXPECT_EQ(1, arcs[0].nextstate);
+	EXPECT_EQ(Arc::Weight::One(), pdt.Final(1));
+}
+
+TEST(PassThroughTest, KeepsParensFinalsAndFanout) {
+	Pdt pdt;
+	for (int i = 0; i < 6; ++i)
+		pdt.AddState();
+	pdt.SetStart(0);
+	pdt.AddArc(0, Arc(1, 1, 0, 1, 4));
+	pdt.AddArc(0, Arc(2, 2, 0, 2, 4));
+	pdt.AddArc(0, Arc(3, 3, 0, 3, 4));
+	// A portal state whose arc opens a paren
+	pdt.AddArc(1, Arc(7, 7, 0, 5, PORTAL_ARC));
+	// A final dummy state
+	pdt.AddArc(2, Arc(0, 0, 0, 5, DUMMY_ARC));
+	pdt.SetFinal(2, 0);
+	// A dummy state leading two ways
+	pdt.AddArc(3, Arc(0, 0, 0, 4, DUMMY_ARC));
+	pdt.AddArc(3, Arc(0, 0, 0, 5, DUMMY_ARC));
+	pdt.AddArc(4, Arc(1, 1, 0, 5, 2));
+	pdt.SetFinal(5, 0);
+	vector<StateInfo> states = {kTrigram, kPortal, kDummy, kDummy, kUnigram, kUnigram};
+
+	PassThroughStats stats;
+	BypassPassThroughStates(&pdt, &states, PassThroughOptions(), &stats);
+	EXPECT_EQ(0u, stats.states);
+	EXPECT_EQ(6, pdt.NumStates());
+	EXPECT_EQ(6u, states.size());
+
+	PassThroughOptions opts;
+	opts.max_fanout = 2;
+	BypassPassThroughStates(&pdt, &states, opts, &stats);
+	EXPECT_EQ(1u, stats.states);
+	ASSERT_EQ(5, pdt.NumStates());
+	ASSERT_EQ(5u, states.size());
+	EXPECT_EQ(UNIGRAM_STATE, states[3].tag);
+	vector<Arc> arcs = Arcs(pdt, 0);
+	ASSERT_EQ(4u, arcs.size());
+	EXPECT_EQ(3, arcs[2].ilabel);
+	EXPECT_EQ(3, arcs[2].nextstate);
+	EXPECT_EQ(3, arcs[3].ilabel);
+	EXPECT_EQ(4, arcs[3].nextstate);
+}
+
+TEST(PassThroughTest, KeepsCycles) {
+	Pdt pdt;
+	for (int i = 0; i < 4; ++i)
+		pdt.AddState();
+	pdt.SetStart(0);
+	pdt.AddArc(0, Arc(1, 1, 0, 1, 4));
+	pdt.AddArc(1, Arc(0, 0, 1, 2, DUMMY_ARC));
+	pdt.AddArc(2, Arc(0, 0, 2, 1, DUMMY_ARC));
+	pdt.AddArc(3, Arc(0, 0, 0, 2, DUMMY_ARC));
+	vector<StateInfo> states = {kTrigram, kDummy, kDummy, kDummy};
+
+	BypassPassThroughStates(&pdt, &states);
+	// 1 is on the cycle and stays, 2 leads only to it and goes, and 3,
+	// with no arcs into it, goes too
+	ASSERT_EQ(2, pdt.NumStates());
+	EXPECT_EQ(2u, states.size());
+	vector<Arc> arcs = Arcs(pdt, 1);
+	ASSERT_EQ(1u, arcs.size());
+	EXPECT_EQ(1, arcs[0].nextstate);
+	EXPECT_FLOAT_EQ(3, arcs[0].weight.Value());
+	EXPECT_EQ(DUMMY_ARC, arcs[0].rule);
+}
+
+TEST(PassThroughTest, KeepsStateInfoPastThePdt) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	ChainPdt(&pdt, &states);
+	states.push_back(kDummy);
+	BypassPassThroughStates(&pdt, &states);
+	ASSERT_EQ(3u, states.size());
+	EXPECT_EQ(UNIGRAM_STATE, states[1].tag);
+	EXPECT_EQ(DUMMY_STATE, states[2].tag);
+}
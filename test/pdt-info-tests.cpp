@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+
+#include "test-models.h"
+#include "tripoli.h"
+#include <fst/vector-fst.h>
+
+using namespace std;
+using namespace fst;
+
+typedef RuleArc<StdArc> Arc;
+typedef VectorFst<Arc> Pdt;
+
+TEST(PDTInfoTest, ContextRuleSetsAreSortedAndSkipTags) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	Span<RuleId> tri = info.GetContextRuleSet(0);
+	EXPECT_EQ(vector<RuleId>({1, 4}), vector<RuleId>(tri.begin(), tri.end()));
+	Span<RuleId> bi = info.GetContextRuleSet(1);
+	EXPECT_EQ(vector<RuleId>({2}), vector<RuleId>(bi.begin(), bi.end()));
+	EXPECT_TRUE(info.GetContextRuleSet(3).empty());
+	EXPECT_TRUE(info.GetContextRuleSet(100).empty());
+}
+
+TEST(PDTInfoTest, UnigramRuleSetsByLabel) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	Span<RuleId> two = info.GetUnigramRuleSet(2);
+	EXPECT_EQ(vector<RuleId>({1, 3}), vector<RuleId>(two.begin(), two.end()));
+	EXPECT_EQ(1u, info.GetUnigramRuleSet(1).size());
+	EXPECT_TRUE(info.GetUnigramRuleSet(7).empty());
+}
+
+TEST(PDTInfoTest, BackoffChainsFollowTheTopology) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	PDTInfo<Pdt> info(SmallGrammar(), pdt, states);
+	// The empty chain, trigram, trigram then bigram, and bigram
+	EXPECT_EQ(4u, info.NumBackoffChains());
+	BackoffChainId tri = info.NextBackoffChain(0, 0);
+	ASSERT_NE(kNoBackoffChain, tri);
+	Span<RuleId> rules = info.GetBackoffChainRuleSet(tri);
+	EXPECT_EQ(vector<RuleId>({1, 4}), vector<RuleId>(rules.begin(), rules.end()));
+	BackoffChainId tri_bi = info.NextBackoffChain(tri, 1);
+	ASSERT_NE(kNoBackoffChain, tri_bi);
+	rules = info.GetBackoffChainRuleSet(tri_bi);
+	EXPECT_EQ(vector<RuleId>({1, 2, 4}), vector<RuleId>(rules.begin(), rules.end()));
+	BackoffChainId bi = info.NextBackoffChain(0, 1);
+	ASSERT_NE(kNoBackoffChain, bi);
+	rules = info.GetBackoffChainRuleSet(bi);
+	EXPECT_EQ(vector<RuleId>({2}), vector<RuleId>(rules.begin(), rules.end()));
+	// The unigram state does not back off, and a chain only continues
+	// from the state it leads to
+	EXPECT_EQ(kNoBackoffChain, info.NextBackoffChain(tri_bi, 2));
+	EXPECT_EQ(kNoBackoffChain, info.NextBackoffChain(0, 2));
+	EXPECT_EQ(kNoBackoffChain, info.NextBackoffChain(tri, 0));
+	EXPECT_TRUE(info.GetBackoffChainRuleSet(0).empty());
+}
+
+template <class T>
+static vector<T> Elements(const FlatArray<T> &array) {
+	return vector<T>(array.data(), array.data() + array.size());
+}
+
+TEST(PDTInfoTest, ParallelBuildMatchesSerial) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	ThreadPool pool(3);
+	PDTInfo<Pdt> serial(SmallGrammar(), pdt, states);
+	PDTInfo<Pdt> parallel(SmallGrammar(), pdt, states, &pool);
+	const PDTIndex &a = serial.GetIndex(), &b = parallel.GetIndex();
+	EXPECT_EQ(Elements(a.context_rules), Elements(b.context_rules));
+	EXPECT_EQ(Elements(a.context_offsets), Elements(b.context_offsets));
+	EXPECT_EQ(Elements(a.unigram_rules), Elements(b.unigram_rules));
+	EXPECT_EQ(Elements(a.unigram_offsets), Elements(b.unigram_offsets));
+	EXPECT_EQ(Elements(a.arc_rules), Elements(b.arc_rules));
+	EXPECT_EQ(Elements(a.arc_rule_offsets), Elements(b.arc_rule_offsets));
+	EXPECT_EQ(Elements(a.chain_rules), Elements(b.chain_rules));
+	EXPECT_EQ(Elements(a.chain_next), Elements(b.chain_next));
+}
+
+TEST(PDTInfoTest, ParallelBuildReportsFirstBadState) {
+	Pdt pdt;
+	vector<StateInfo> states;
+	SmallPdt(&pdt, &states);
+	StateInfo start = {TRIGRAM_STATE, -2, -2};
+	StateInfo bad = {BIGRAM_STATE, 7, -1};
+	states.push_back(bad);
+	states.push_back(start);
+	ThreadPool pool(4);
+	try {
+		PDTInfo<Pdt> info(SmallGrammar(), pdt, states, &pool);
+		FAIL();
+	} catch (const invalid_argument &e) {
+		EXPECT_EQ(string("invalid StateInfo for bigram state: 4"), e.what());
+	}
+	states[4] = start;
+	try {
+		PDTInfo<Pdt> info(SmallGrammar(), pdt, states, &pool);
+		FAIL();
+	} catch (const invalid_argument &e) {
+		EXPECT_EQ(string("Duplicate start states found: 4"), e.what());
+	}
+}
@@ -0,0 +1,46 @@
+#include "gtest/gtest.h"
+
+#include "rule-set.h"
+
+using namespace std;
+using namespace fst;
+
+TEST(RuleSetTest, EqualSetsShareAHandle) {
+	RuleSetPool pool;
+	vector<RuleId> a = {1, 5, 9};
+	vector<RuleId> b = {1, 5, 9};
+	EXPECT_EQ(pool.Intern(a), pool.Intern(b));
+	EXPECT_EQ(RuleSetPool::kEmpty, pool.Intern(vector<RuleId>()));
+	EXPECT_EQ(2u, pool.NumSets());
+}
+
+TEST(RuleSetTest, ContainsSparseAndDense) {
+	RuleSetPool pool;
+	// Before any other set, the empty set has no sparse storage
+	EXPECT_FALSE(pool.Contains(RuleSetPool::kEmpty, 0));
+	vector<RuleId> sparse = {-3, 2, 4000};
+	vector<RuleId> dense;
+	for (RuleId r = 100; r < 200; r += 2)
+		dense.push_back(r);
+	RuleSetId s = pool.Intern(sparse);
+	RuleSetId d = pool.Intern(dense);
+	EXPECT_TRUE(pool.Contains(s, 4000));
+	EXPECT_TRUE(pool.Contains(s, -3));
+	EXPECT_FALSE(pool.Contains(s, 3));
+	EXPECT_TRUE(pool.Contains(d, 150));
+	EXPECT_FALSE(pool.Contains(d, 151));
+	EXPECT_FALSE(pool.Contains(d, 99));
+	EXPECT_FALSE(pool.Contains(d, 200));
+}
+
+TEST(RuleSetTest, UnionIsInternedAndMemoized) {
+	RuleSetPool pool;
+	vector<RuleId> a = {1, 3};
+	vector<RuleId> b = {2, 3};
+	vector<RuleId> ab = {1, 2, 3};
+	RuleSetId u = pool.Union(pool.Intern(a), pool.Intern(b));
+	EXPECT_EQ(pool.Intern(ab), u);
+	EXPECT_EQ(u, pool.Union(pool.Intern(b), pool.Intern(a)));
+	EXPECT_EQ(1u, pool.NumUnions());
+	EXPECT_EQ(u, pool.Union(u, RuleSetPool::kEmpty));
+}
@@ -0,0 +1,218 @@
+#include "gtest/gtest.h"
+
+#include "session.h"
+#include "synthetic.h"
+#include "test-models.h"
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+
+using namespace std;
+using namespace fst;
+
+// The PDT states of the frontier, in order
+static vector<TripoliArc::StateId> States(const TripoliSession &session) {
+	vector<TripoliArc::StateId> states;
+	for (const FrontierEntry &entry : session.Frontier())
+		states.push_back(entry.state);
+	sort(states.begin(), states.end());
+	return states;
+}
+
+TEST(SessionTest, ExtendsByOneTokenAndRollsBack) {
+	unique_ptr<TripoliModel> model(ReadSmallModel());
+	TripoliSession session(*model);
+	const float kInfinity = numeric_limits<float>::infinity();
+	// The start state backs off to the bigram and unigram states
+	EXPECT_EQ(0u, session.Position());
+	EXPECT_EQ(vector<TripoliArc::StateId>({0, 1, 2}), States(session));
+	EXPECT_EQ(kInfinity, session.FinalCost());
+
+	// Every arc on a leads to the dummy state, and on to the unigram state
+	ASSERT_TRUE(session.Extend(1));
+	EXPECT_EQ(1u, session.Position());
+	EXPECT_EQ(vector<TripoliArc::StateId>({2, 3}), States(session));
+	EXPECT_EQ(0, session.FinalCost());
+
+	// No arc reads label 5
+	EXPECT_FALSE(session.Extend(5));
+	EXPECT_EQ(1u, session.Position());
+	EXPECT_EQ(vector<TripoliArc::StateId>({2, 3}), States(session));
+	EXPECT_FALSE(session.Extend(0));
+
+	ASSERT_TRUE(session.Extend(2));
+	EXPECT_EQ(2u, session.Position());
+	EXPECT_FALSE(session.Rollback(3));
+	ASSERT_TRUE(session.Rollback(1));
+	EXPECT_EQ(vector<TripoliArc::StateId>({2, 3}), States(session));
+	session.Reset();
+	EXPECT_EQ(vector<TripoliArc::StateId>({0, 1, 2}), States(session));
+
+	ASSERT_TRUE(session.Extend(2));
+	EXPECT_EQ(vector<TripoliArc::StateId>({2, 3}), States(session));
+
+	SessionOptions opts;
+	opts.max_active = 1;
+	TripoliSession capped(*model, opts);
+	EXPECT_EQ(vector<TripoliArc::StateId>({0}), States(capped));
+}
+
+TEST(SessionTest, PredictsTheNextTokensOfTheSmallModel) {
+	unique_ptr<TripoliModel> model(ReadSmallModel());
+	TripoliSession session(*model);
+	vector<Prediction> predictions;
+	PredictOptions opts;
+	opts.sum = false;
+	session.Predict(opts, &predictions);
+	ASSERT_EQ(2u, predictions.size());
+	EXPECT_EQ(1, predictions[0].label);
+	EXPECT_EQ(0, predictions[0].cost);
+	EXPECT_EQ(2, predictions[1].label);
+	EXPECT_EQ(0, predictions[1].cost);
+
+	// Three entries read b, and two read a
+	opts.sum = true;
+	opts.k = 1;
+	session.Predict(opts, &predictions);
+	ASSERT_EQ(1u, predictions.size());
+	EXPECT_EQ(2, predictions[0].label);
+	EXPECT_FLOAT_EQ(-log(3.0f), predictions[0].cost);
+	opts.k = 2;
+	session.Predict(opts, &predictions);
+	ASSERT_EQ(2u, predictions.size());
+	EXPECT_EQ(1, predictions[1].label);
+	EXPECT_FLOAT_EQ(-log(2.0f), predictions[1].cost);
+
+	opts.k = 0;
+	session.Predict(opts, &predictions);
+	EXPECT_TRUE(predictions.empty());
+}
+
+TEST(SessionTest, PredictsOverASyntacticBackoff) {
+	// The bigram state also backs off syntactically on b, to the dummy state
+	unique_ptr<TripoliModel> model(ReadSmallModel("1 3 2 0.5 -4\n"));
+	TripoliSession session(*model);
+	vector<Prediction> predictions;
+	PredictOptions opts;
+	opts.k = 2;
+	session.Predict(opts, &predictions);
+	ASSERT_EQ(2u, predictions.size());
+	EXPECT_EQ(2, predictions[0].label);
+	EXPECT_FLOAT_EQ(-log(3.0f + exp(-0.5f)), predictions[0].cost);
+	EXPECT_EQ(1, predictions[1].label);
+	EXPECT_FLOAT_EQ(-log(2.0f), predictions[1].cost);
+
+	// Extend reads b over it too, to an entry of its own
+	ASSERT_TRUE(session.Extend(2));
+	bool backed_off = false;
+	for (const FrontierEntry &entry : session.Frontier())
+		backed_off |= entry.state == 3 && entry.cost == 0.5f;
+	EXPECT_TRUE(backed_off);
+}
+
+TEST(SessionTest, ReadsAnyInputOfASyntheticModel) {
+	SyntheticOptions opts;
+	opts.terminals = 20;
+	opts.nonterminals = 8;
+	opts.rules = 60;
+	opts.fanout = 4;
+	unique_ptr<TripoliModel> model(ReadSyntheticModel(SyntheticModel(opts)));
+	ASSERT_TRUE(model != 0);
+
+	// Parens open from the unigram state before any token
+	TripoliSession session(*model);
+	bool open = false;
+	for (const FrontierEntry &entry : session.Frontier())
+		open |= entry.filter.GetState2().GetState() != 0;
+	EXPECT_TRUE(open);
+
+	mt19937 rng(5);
+	uniform_int_distribution<Label> term(1, 20);
+	vector<Label> input;
+	for (int i = 0; i < 30; ++i) {
+		input.push_back(term(rng));
+		ASSERT_TRUE(session.Extend(input.back())) << "token " << i;
+		EXPECT_LT(session.FinalCost(), numeric_limits<float>::infinity());
+		float best = session.Frontier().front().cost;
+		for (const FrontierEntry &entry : session.Frontier())
+			EXPECT_LE(best, entry.cost);
+	}
+
+	// Rolling back and reading the same tokens again gives the same frontier
+	vector<FrontierEntry> last = session.Frontier();
+	ASSERT_TRUE(session.Rollback(20));
+	for (int i = 20; i < 30; ++i)
+		ASSERT_TRUE(session.Extend(input[i]));
+	ASSERT_EQ(last.size(), session.Frontier().size());
+	for (size_t i = 0; i < last.size(); ++i) {
+		EXPECT_EQ(last[i].state, session.Frontier()[i].state);
+		EXPECT_TRUE(last[i].filter == session.Frontier()[i].filter);
+		EXPECT_EQ(last[i].cost, session.Frontier()[i].cost);
+	}
+
+	// The cheapest predictions are the tokens that extend the prefix, at
+	// the cost of the best entry they reach
+	PredictOptions predict;
+	predict.k = 20;
+	predict.sum = false;
+	for (int i = 0; i < 5; ++i) {
+		vector<Prediction> predictions;
+		session.Predict(predict, &predictions);
+		size_t position = session.Position();
+		map<Label, float> costs;
+		for (Label label = 1; label <= 20; ++label) {
+			if (session.Extend(label)) {
+				costs[label] = session.Frontier().front().cost;
+				ASSERT_TRUE(session.Rollback(position));
+			}
+		}
+		ASSERT_EQ(costs.size(), predictions.size());
+		for (size_t j = 0; j < predictions.size(); ++j) {
+			ASSERT_TRUE(costs.count(predictions[j].label)) << predictions[j].label;
+			EXPECT_FLOAT_EQ(costs[predictions[j].label], predictions[j].cost);
+			if (j > 0) {
+				EXPECT_LE(predictions[j - 1].cost, predictions[j].cost);
+			}
+		}
+
+		// Fewer predictions are the cheapest of them
+		vector<Prediction> top;
+		predict.k = 3;
+		session.Predict(predict, &top);
+		predict.k = 20;
+		ASSERT_EQ(min<size_t>(3, predictions.size()), top.size());
+		for (size_t j = 0; j < top.size(); ++j) {
+			EXPECT_EQ(predictions[j].label, top[j].label);
+			EXPECT_EQ(predictions[j].cost, top[j].cost);
+		}
+		ASSERT_TRUE(session.Extend(predictions[0].label));
+	}
+}
+
+TEST(SessionTest, EndsAsTheCompositionOfThePrefix) {
+	SyntheticOptions opts;
+	opts.terminals = 15;
+	opts.nonterminals = 6;
+	opts.rules = 45;
+	opts.fanout = 3;
+	opts.seed = 7;
+	unique_ptr<TripoliModel> model(ReadSyntheticModel(SyntheticModel(opts)));
+	ASSERT_TRUE(model != 0);
+
+	mt19937 rng(11);
+	uniform_int_distribution<Label> term(1, 15);
+	for (int i = 0; i < 5; ++i) {
+		TripoliSession session(*model);
+		vector<Label> prefix;
+		EXPECT_FLOAT_EQ(ExhaustiveCost(LinearFst<TripoliArc>(vector<Label>(prefix)), *model),
+				session.FinalCost());
+		for (int j = 0; j < 6; ++j) {
+			prefix.push_back(term(rng));
+			ASSERT_TRUE(session.Extend(prefix.back()));
+			EXPECT_FLOAT_EQ(ExhaustiveCost(LinearFst<TripoliArc>(vector<Label>(prefix)), *model),
+					session.FinalCost()) << "prefix " << i << ", token " << j;
+		}
+	}
+}
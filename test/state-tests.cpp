@@ -24,3 +24,7 @@ TEST(StateTest, ReadsBigram) {
 	vector<StateInfo> states = read_states(bigram);
 	EXPECT_EQ(100, states.front().snd);
 }
+
+TEST(StateTest, MissingFileIsAnInvalidArgument) {
+	EXPECT_THROW(read_states(string("/nonexistent/states.txt")), invalid_argument);
+}
@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+
+#include "stats.h"
+#include <sstream>
+
+using namespace std;
+using namespace fst;
+
+TEST(StatsTest, AddsTimesAndKeepsPeakSizes) {
+	StatsReport report;
+	report.AddTime("read_pdt", 0.5);
+	report.AddTime("read_pdt", 0.25);
+	report.AddMemory("pdt_arcs", 100);
+	report.AddMemory("pdt_arcs", 300);
+	report.AddMemory("pdt_arcs", 200);
+	ostringstream out;
+	report.WriteJson(out);
+	string json = out.str();
+	EXPECT_NE(string::npos, json.find("\"read_pdt\": 0.75"));
+	EXPECT_NE(string::npos, json.find("\"pdt_arcs\": 300"));
+	EXPECT_NE(string::npos, json.find("\"peak_rss_bytes\": "));
+}
+
+TEST(StatsTest, TotalsComposeItems) {
+	StatsReport report;
+	ComposeStats a, b;
+	a.filter_arcs = 10;
+	a.set_lookups = 4;
+	a.set_hits = 3;
+	b.filter_arcs = 5;
+	b.set_lookups = 4;
+	b.set_hits = 3;
+	report.AddCompose("a.txt", a, 1);
+	report.AddCompose("dir/\"b\".txt", b, 2);
+	EXPECT_EQ(2u, report.NumItems());
+	EXPECT_EQ(15u, report.Totals().filter_arcs);
+
+	ostringstream out;
+	report.WriteJson(out);
+	string json = out.str();
+	EXPECT_NE(string::npos, json.find("\"items\": 2, \"seconds\": 3"));
+	EXPECT_NE(string::npos, json.find("\"set_hit_rate\": 0.75"));
+	EXPECT_NE(string::npos, json.find("\"union_hit_rate\": 0}"));
+	EXPECT_NE(string::npos, json.find("{\"name\": \"dir/\\\"b\\\".txt\", \"seconds\": 2, \"filter_arcs\": 5"));
+}
+
+TEST(StatsTest, TimerReportsOnlyWithAReport) {
+	StatsReport report;
+	{
+		ScopedTimer timer(&report, "phase");
+		ScopedTimer untimed(0, "other");
+		EXPECT_LE(0, untimed.Seconds());
+	}
+	ostringstream out;
+	report.WriteJson(out);
+	EXPECT_NE(string::npos, out.str().find("\"phase\": "));
+	EXPECT_EQ(string::npos, out.str().find("\"other\""));
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+
+#include "batch.h"
+#include "synthetic.h"
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace fst;
+
+static string TempDir() {
+	string dir = "/tmp/tripoli-synthetic-test-" + to_string(getpid());
+	mkdir(dir.c_str(), 0700);
+	return dir;
+}
+
+static TripoliModel *ReadModel(const string &dir, bool bypass_pass_through) {
+	return TripoliModel::ReadText(dir + "/pdt.txt", dir + "/arc-labels.txt",
+			dir + "/grammar-symbols.txt", dir + "/rules.txt", dir + "/states.txt",
+			dir + "/parens.txt", 0, bypass_pass_through);
+}
+
+static void RemoveModel(const string &dir) {
+	for (const char *name : {"pdt.txt", "arc-labels.txt", "grammar-symbols.txt", "rules.txt",
+			"states.txt", "parens.txt"})
+		remove((dir + "/" + name).c_str());
+	rmdir(dir.c_str());
+}
+
+static SyntheticOptions SmallOptions() {
+	SyntheticOptions opts;
+	opts.terminals = 20;
+	opts.nonterminals = 8;
+	opts.rules = 60;
+	opts.trigram_density = 1.5;
+	opts.fanout = 4;
+	return opts;
+}
+
+TEST(SyntheticTest, SameSeedSameModel) {
+	SyntheticModel a(SmallOptions()), b(SmallOptions());
+	ostringstream pdt_a, pdt_b, input_a, input_b;
+	a.WritePdt(pdt_a);
+	b.WritePdt(pdt_b);
+	EXPECT_EQ(pdt_a.str(), pdt_b.str());
+	a.WriteInput(10, 3, input_a);
+	b.WriteInput(10, 3, input_b);
+	EXPECT_EQ(input_a.str(), input_b.str());
+
+	SyntheticOptions opts = SmallOptions();
+	opts.seed = 2;
+	SyntheticModel c(opts);
+	ostringstream pdt_c;
+	c.WritePdt(pdt_c);
+	EXPECT_NE(pdt_a.str(), pdt_c.str());
+
+	opts.rules = 10;
+	EXPECT_THROW(SyntheticModel d(opts), invalid_argument);
+}
+
+TEST(SyntheticTest, LoadsWithEveryTerminalOnItsOwnRule) {
+	SyntheticModel synthetic(SmallOptions());
+	string dir = TempDir();
+	ASSERT_TRUE(synthetic.Write(dir));
+	unique_ptr<TripoliModel> model(ReadModel(dir, false));
+	unique_ptr<TripoliModel> bypassed(ReadModel(dir, true));
+	RemoveModel(dir);
+	EXPECT_EQ(synthetic.NumStates(), size_t(model->GetPdt().NumStates()));
+	EXPECT_LT(bypassed->GetPdt().NumStates(), model->GetPdt().NumStates());
+
+	const Grammar &grammar = model->GetGrammar();
+	EXPECT_EQ(20, grammar.MaxTerm());
+	EXPECT_EQ(synthetic.NumRules() + 1, size_t(grammar.RuleReach().Cols()));
+	EXPECT_EQ(8u, model->GetParens().size());
+	EXPECT_EQ(grammar.MaxPreterm() + 1, grammar.LabelToSymbol(model->GetParens()[0].first));
+	// so that backing off to the unigram state leaves every terminal a path
+	for (Symbol t = 1; t <= grammar.MaxTerm(); ++t) {
+		EXPECT_TRUE(grammar.RuleCanReach(t, t));
+		Span<RuleId> rules = model->GetPDTInfo().GetUnigramRuleSet(t);
+		EXPECT_EQ(1u, rules.size());
+		EXPECT_EQ(t, rules[0]);
+	}
+
+	stringstream text;
+	synthetic.WriteInput(12, 1, text);
+	unique_ptr<VectorFst<TripoliArc> > input(CompileInputFst(text, "input"));
+	ASSERT_TRUE(input != 0);
+	EXPECT_EQ(13, input->NumStates());
+	for (TripoliArc::StateId s = 0; s < 12; ++s) {
+		ArcIterator<VectorFst<TripoliArc> > aiter(*input, s);
+		EXPECT_TRUE(grammar.IsTerm(aiter.Value().olabel));
+	}
+}
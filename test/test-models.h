@@ -0,0 +1,134 @@
+// test-models.h
+//
+// The models the tests share: the small PDT of pdt-info-tests.cpp, built
+// directly or read as a text model, and synthetic models read from text.
+
+#ifndef TRIPOLI_TEST_MODELS_H__
+#define TRIPOLI_TEST_MODELS_H__
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <fst/vector-fst.h>
+
+#include "a-star.h"
+#include "model.h"
+#include "synthetic.h"
+#include "tripoli.h"
+
+namespace fst {
+
+// A file name of its own for this test process.
+inline std::string TempName(const std::string &name) {
+	return "/tmp/tripoli-test-" + std::to_string(getpid()) + "-" + name;
+}
+
+inline std::string WriteFile(const std::string &filename, const std::string &contents) {
+	std::ofstream(filename.c_str()) << contents;
+	return filename;
+}
+
+// Start trigram state 0 backs off to bigram state 1, which backs off to
+// unigram state 2; 3 is a dummy state.
+template <class Pdt>
+void SmallPdt(Pdt *pdt, std::vector<StateInfo> *states) {
+	typedef typename Pdt::Arc Arc;
+	for (int i = 0; i < 4; ++i)
+		pdt->AddState();
+	pdt->SetStart(0);
+	pdt->AddArc(0, Arc(1, 1, 0, 3, 4));
+	pdt->AddArc(0, Arc(2, 2, 0, 3, 1));
+	pdt->AddArc(0, Arc(2, 2, 0, 3, 4));
+	pdt->AddArc(0, Arc(0, 0, 0, 1, LEXICAL_BACKOFF_ARC));
+	pdt->AddArc(1, Arc(1, 1, 0, 3, 2));
+	pdt->AddArc(1, Arc(0, 0, 0, 2, LEXICAL_BACKOFF_ARC));
+	pdt->AddArc(2, Arc(2, 2, 0, 3, 3));
+	pdt->AddArc(2, Arc(2, 2, 0, 3, 1));
+	pdt->AddArc(2, Arc(1, 1, 0, 3, 2));
+	pdt->AddArc(3, Arc(0, 0, 0, 2, DUMMY_ARC));
+	StateInfo trigram = {TRIGRAM_STATE, -2, -2};
+	StateInfo bigram = {BIGRAM_STATE, 1, -1};
+	StateInfo unigram = {UNIGRAM_STATE, -1, -1};
+	StateInfo dummy = {DUMMY_STATE, -1, -1};
+	*states = {trigram, bigram, unigram, dummy};
+}
+
+// Terminals a and b, preterminals _a and _b, and S and T over them.
+inline Grammar SmallGrammar() {
+	std::vector<Rule> rules = {{1, 5, 3}, {2, 6, 4}, {3, 5, 4}, {4, 6, 3}};
+	return Grammar(2, 4, 6, rules);
+}
+
+// A text model of the PDT text pdt, over the small PDT's states and the
+// small grammar, with a (3, 4) paren pair for S.
+inline TripoliModel *ReadSmallGrammarModel(const std::string &pdt) {
+	std::vector<std::string> files = {
+		WriteFile(TempName("pdt.txt"), pdt),
+		WriteFile(TempName("labels.txt"), "0 <eps>\n1 a\n2 b\n3 +P5\n4 -P5\n"),
+		WriteFile(TempName("symbols.txt"), "1 a\n2 b\n3 _a\n4 _b\n5 S\n6 T\n"),
+		WriteFile(TempName("rules.txt"), "1 5 3\n2 6 4\n3 5 4\n4 6 3\n"),
+		WriteFile(TempName("states.txt"), "0 0 -2 -2\n1 1 1\n2 2\n3 3\n"),
+		WriteFile(TempName("parens.txt"), "3 4\n")};
+	TripoliModel *model = TripoliModel::ReadText(files[0], files[1], files[2], files[3], files[4], files[5]);
+	for (const std::string &filename : files)
+		remove(filename.c_str());
+	return model;
+}
+
+// The small PDT as a text model, final in its dummy state, with arcs1
+// added out of the bigram state.
+inline TripoliModel *ReadSmallModel(const std::string &arcs1 = "") {
+	return ReadSmallGrammarModel(
+			"0 3 1 4\n0 3 2 1\n0 3 2 4\n0 1 0 -3\n"
+			"1 3 1 2\n1 2 0 -3\n" + arcs1 +
+			"2 3 2 3\n2 3 2 1\n2 3 1 2\n"
+			"3 2 0 -1\n3\n");
+}
+
+// synthetic, written out and read back as a text model; 0 if it cannot be
+// written.
+inline TripoliModel *ReadSyntheticModel(const SyntheticModel &synthetic) {
+	std::string dir = TempName("synthetic");
+	mkdir(dir.c_str(), 0700);
+	TripoliModel *model = 0;
+	if (synthetic.Write(dir)) {
+		model = TripoliModel::ReadText(dir + "/pdt.txt", dir + "/arc-labels.txt",
+				dir + "/grammar-symbols.txt", dir + "/rules.txt", dir + "/states.txt",
+				dir + "/parens.txt");
+	}
+	for (const char *name : {"pdt.txt", "arc-labels.txt", "grammar-symbols.txt", "rules.txt",
+			"states.txt", "parens.txt"})
+		remove((dir + "/" + name).c_str());
+	rmdir(dir.c_str());
+	return model;
+}
+
+class ZeroGuide : public AStarGuide {
+public:
+	float FutureCost(TripoliArc::StateId s) { return 0; }
+};
+
+// The cost of the best complete path through the whole composition of
+// input with model, with no guide to prune it; infinity if there is none.
+inline float ExhaustiveCost(const Fst<TripoliArc> &input, const TripoliModel &model) {
+	std::unique_ptr<ComposeFst<TripoliArc> > composed(TripoliComposeInput(input, model));
+	ZeroGuide zero;
+	VectorFst<TripoliArc> path;
+	if (!AStarShortestPath(*composed, model.GetParens(), &zero, &path))
+		return std::numeric_limits<float>::infinity();
+	float cost = 0;
+	TripoliArc::StateId s = path.Start();
+	for (; path.NumArcs(s); s = ArcIterator<VectorFst<TripoliArc> >(path, s).Value().nextstate)
+		cost += ArcIterator<VectorFst<TripoliArc> >(path, s).Value().weight.Value();
+	return cost + path.Final(s).Value();
+}
+
+}  // namespace fst
+
+#endif  // TRIPOLI_TEST_MODELS_H__
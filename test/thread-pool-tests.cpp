@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+
+#include "bounded-queue.h"
+#include "thread-pool.h"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace fst;
+
+TEST(ThreadPoolTest, ParallelForCoversEveryIndexOnce) {
+	for (size_t nthreads : {0, 1, 4}) {
+		ThreadPool pool(nthreads);
+		vector<int> seen(1000);
+		pool.ParallelFor(seen.size(), 16, [&seen](size_t c, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				++seen[i];
+		});
+		EXPECT_EQ(vector<int>(1000, 1), seen);
+	}
+}
+
+TEST(ThreadPoolTest, NestedWorkDoesNotDeadlock) {
+	ThreadPool pool(2);
+	atomic<int> count(0);
+	pool.ParallelFor(8, 8, [&pool, &count](size_t, size_t, size_t) {
+		pool.ParallelFor(8, 8, [&count](size_t, size_t, size_t) { ++count; });
+	});
+	EXPECT_EQ(64, count);
+}
+
+TEST(ThreadPoolTest, RethrowsFromTasks) {
+	ThreadPool pool(3);
+	future<int> result = pool.Async([]() -> int { throw invalid_argument("bad"); });
+	EXPECT_THROW(result.get(), invalid_argument);
+	EXPECT_THROW(pool.ParallelFor(4, 4, [](size_t c, size_t, size_t) {
+		if (c == 2)
+			throw invalid_argument("bad chunk");
+	}), invalid_argument);
+}
+
+TEST(BoundedQueueTest, BlocksProducerAtCapacity) {
+	BoundedQueue<int> queue(2);
+	atomic<int> pushed(0);
+	thread producer([&queue, &pushed]() {
+		for (int i = 0; i < 5; ++i) {
+			queue.Push(i);
+			++pushed;
+		}
+		queue.Close();
+	});
+	while (pushed < 2)
+		this_thread::yield();
+	this_thread::sleep_for(chrono::milliseconds(20));
+	EXPECT_EQ(2, pushed);
+	vector<int> popped;
+	int item;
+	while (queue.Pop(&item))
+		popped.push_back(item);
+	producer.join();
+	EXPECT_EQ(vector<int>({0, 1, 2, 3, 4}), popped);
+}
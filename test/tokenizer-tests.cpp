@@ -0,0 +1,74 @@
+#include "gtest/gtest.h"
+
+#include "tokenizer.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace fst;
+
+static bool Parse(const string &s, int64 *n) {
+	return ParseInt64(s.data(), s.data() + s.size(), n);
+}
+
+TEST(TokenizerTest, ParsesIntegers) {
+	int64 n;
+	EXPECT_TRUE(Parse("0", &n));
+	EXPECT_EQ(0, n);
+	EXPECT_TRUE(Parse("-3", &n));
+	EXPECT_EQ(-3, n);
+	EXPECT_TRUE(Parse("+11296", &n));
+	EXPECT_EQ(11296, n);
+	EXPECT_TRUE(Parse("9223372036854775807", &n));
+	EXPECT_EQ(numeric_limits<int64>::max(), n);
+	EXPECT_TRUE(Parse("-9223372036854775808", &n));
+	EXPECT_EQ(numeric_limits<int64>::min(), n);
+}
+
+TEST(TokenizerTest, RejectsBadIntegers) {
+	int64 n;
+	EXPECT_FALSE(Parse("", &n));
+	EXPECT_FALSE(Parse("-", &n));
+	EXPECT_FALSE(Parse("12a", &n));
+	EXPECT_FALSE(Parse("1.5", &n));
+	EXPECT_FALSE(Parse("9223372036854775808", &n));
+	EXPECT_FALSE(Parse("99999999999999999999", &n));
+}
+
+TEST(TokenizerTest, SplitsLinesAndCountsThem) {
+	string text = "0 1\t2\r\n\n  3  \n4";
+	Tokenizer tok(text.data(), text.size(), "text");
+	vector<Token> col;
+	ASSERT_TRUE(tok.NextLine());
+	ASSERT_EQ(3u, tok.Split(&col));
+	EXPECT_TRUE(col[2] == "2");
+	ASSERT_TRUE(tok.NextLine());
+	EXPECT_EQ(0u, tok.Split(&col));
+	ASSERT_TRUE(tok.NextLine());
+	ASSERT_EQ(1u, tok.Split(&col));
+	EXPECT_EQ("3", col[0].str());
+	ASSERT_TRUE(tok.NextLine());
+	EXPECT_EQ(4u, tok.LineNumber());
+	ASSERT_EQ(1u, tok.Split(&col));
+	EXPECT_TRUE(col[0] == "4");
+	EXPECT_FALSE(tok.NextLine());
+}
+
+TEST(TokenizerTest, ConvertsFields) {
+	string text = "-7 0.25 Infinity x";
+	Tokenizer tok(text.data(), text.size(), "text");
+	vector<Token> col;
+	tok.NextLine();
+	tok.Split(&col);
+	bool err;
+	EXPECT_EQ(-7, tok.ToInt64(col[0], true, &err));
+	EXPECT_FALSE(err);
+	tok.ToInt64(col[0], false, &err);
+	EXPECT_TRUE(err);
+	EXPECT_EQ(0.25f, tok.ToFloat(col[1], &err));
+	EXPECT_FALSE(err);
+	EXPECT_EQ(numeric_limits<float>::infinity(), tok.ToFloat(col[2], &err));
+	EXPECT_FALSE(err);
+	tok.ToFloat(col[3], &err);
+	EXPECT_TRUE(err);
+}